@@ -0,0 +1,1124 @@
+// fastapi-cpp-db-bench: throughput and latency of the database primitives
+// against in-process stand-in servers that speak the real wire protocols,
+// so client-side cost can be measured and compared without a database.
+//
+//   fastapi-cpp-db-bench [--workload NAME]... [--threads N] [--duration S]
+//                        [--pool-size N] [--auth trust|cleartext|md5|scram]
+//                        [--latency-us N] [--statement-cache N]
+//                        [--copy-rows N] [--insert-window-us N]
+//                        [--output FILE] [--list]
+//
+// Each workload also reports wire traffic per operation as seen by the
+// stand-in server (round trips, protocol messages, bytes).
+#include "../include/histogram.hpp"
+#include "../include/mongo_primitives.hpp"
+#include "../include/postgres_connection.hpp"
+#include "../include/postgres_primitives.hpp"
+#include "../include/redis_primitives.hpp"
+#include "fake_mongo.hpp"
+#include "fake_postgres.hpp"
+#include "fake_redis.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::vector<std::string> workloads;
+    int threads = 4;
+    double duration_s = 5.0;
+    int pool_size = 4;
+    FakePostgresServer::Auth auth = FakePostgresServer::Auth::Trust;
+    std::chrono::microseconds latency{0};
+    int statement_cache = 64;
+    int copy_rows = 1000;
+    int insert_window_us = 200;
+    std::string output;
+};
+
+// A started workload: `op` is called concurrently from every client thread.
+class Run {
+public:
+    virtual ~Run() = default;
+    virtual void op(int thread, std::uint64_t iteration) = 0;
+    virtual json report(std::uint64_t ops) const = 0;
+};
+
+struct Workload {
+    std::string name;
+    std::string description;
+    std::function<std::unique_ptr<Run>(const Options&)> start;
+};
+
+std::vector<Workload>& registry() {
+    static std::vector<Workload> workloads;
+    return workloads;
+}
+
+void add(std::string name, std::string description, std::function<std::unique_ptr<Run>(const Options&)> start) {
+    registry().push_back({std::move(name), std::move(description), std::move(start)});
+}
+
+double per_op(std::uint64_t total, std::uint64_t ops) {
+    return ops ? static_cast<double>(total) / static_cast<double>(ops) : 0.0;
+}
+
+// Stand-in server plus PostgresPrimitives pointed at it.
+class PostgresRun : public Run {
+public:
+    explicit PostgresRun(const Options& opts, FakePostgresServer::Handler handler = FakePostgresServer::default_handler(),
+                         const std::function<void(DBConfig&)>& configure = nullptr)
+        : server(std::move(handler), {opts.auth, "bench", "bench"}) {
+        server.set_latency(opts.latency);
+        DBConfig config;
+        config.db_type = DBConfig::PostgreSQL;
+        config.db_host = "127.0.0.1";
+        config.db_port = server.port();
+        config.db_user = "bench";
+        config.db_password = "bench";
+        config.db_name = "bench";
+        config.auto_create_db = false;
+        config.db_pool_size = opts.pool_size;
+        config.db_pool_min_size = opts.pool_size;
+        config.db_pool_warmup_size = opts.pool_size;
+        config.db_statement_cache_size = opts.statement_cache;
+        if (configure)
+            configure(config);
+        PostgresPrimitives::initialize(config);
+        PostgresPrimitives::warmUp(Clock::now() + std::chrono::seconds(10));
+        baseline = snapshot();
+    }
+
+    ~PostgresRun() override { PostgresPrimitives::shutdown(); }
+
+    json report(std::uint64_t ops) const override {
+        Snapshot now = snapshot();
+        return {{"round_trips_per_op", per_op(now.syncs + now.simple - baseline.syncs - baseline.simple, ops)},
+                {"parses_per_op", per_op(now.parses - baseline.parses, ops)},
+                {"bytes_sent_per_op", per_op(now.bytes_in - baseline.bytes_in, ops)},
+                {"bytes_received_per_op", per_op(now.bytes_out - baseline.bytes_out, ops)},
+                {"pool", PostgresPrimitives::getConnectionInfo()["pool"]},
+                {"statement_cache", PostgresPrimitives::getConnectionInfo()["statement_cache"]}};
+    }
+
+protected:
+    struct Snapshot {
+        std::uint64_t syncs, simple, parses, bytes_in, bytes_out;
+    };
+
+    Snapshot snapshot() const {
+        auto& c = server.counters();
+        return {c.syncs.load(), c.simple_queries.load(), c.parses.load(), c.bytes_in.load(), c.bytes_out.load()};
+    }
+
+    mutable FakePostgresServer server;
+    Snapshot baseline{};
+};
+
+void register_postgres_workloads() {
+    add("pg_select", "executeQuery(\"SELECT 1\")", [](const Options& opts) -> std::unique_ptr<Run> {
+        struct Select : PostgresRun {
+            using PostgresRun::PostgresRun;
+            void op(int, std::uint64_t) override {
+                json result = PostgresPrimitives::executeQuery("SELECT 1");
+                if (result["rows"].size() != 1)
+                    throw std::runtime_error("pg_select: unexpected result " + result.dump());
+            }
+        };
+        return std::make_unique<Select>(opts);
+    });
+
+    add("pg_select_param", "executeQuery(\"SELECT $1::int, $2::text\", [i, name])",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            struct SelectParam : PostgresRun {
+                using PostgresRun::PostgresRun;
+                void op(int thread, std::uint64_t i) override {
+                    json result = PostgresPrimitives::executeQuery("SELECT $1::int, $2::text",
+                                                                   json::array({i, "thread" + std::to_string(thread)}));
+                    if (result["rows"][0]["c1"] != std::to_string(i))
+                        throw std::runtime_error("pg_select_param: unexpected result " + result.dump());
+                }
+            };
+            return std::make_unique<SelectParam>(opts);
+        });
+
+    add("pg_select_mixed", "executeQuery over 8 distinct application-sized SELECTs, round robin",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            struct Mixed : PostgresRun {
+                Mixed(const Options& opts) : PostgresRun(opts) {
+                    for (int q = 0; q < 8; ++q)
+                        queries.push_back("SELECT id, name, email, created_at, status FROM users_" + std::to_string(q) +
+                                          " WHERE tenant_id = $1 AND status = $2 ORDER BY created_at DESC LIMIT $3");
+                }
+                void op(int, std::uint64_t i) override {
+                    PostgresPrimitives::executeQuery(queries[i % queries.size()], json::array({i, "active", 20}));
+                }
+                std::vector<std::string> queries;
+            };
+            return std::make_unique<Mixed>(opts);
+        });
+
+    // Five writes per transaction; run with --latency-us to see the RTT saving.
+    auto transaction_batch = [](std::uint64_t i) {
+        std::vector<std::pair<std::string, json>> batch;
+        batch.emplace_back("INSERT INTO orders (id, status) VALUES ($1, $2)", json::array({i, "new"}));
+        for (int line = 0; line < 3; ++line)
+            batch.emplace_back("INSERT INTO order_lines (order_id, line, qty) VALUES ($1, $2, $3)", json::array({i, line, 1}));
+        batch.emplace_back("UPDATE stock SET qty = qty - 3 WHERE sku = $1", json::array({"sku-1"}));
+        return batch;
+    };
+
+    add("pg_transaction", "executeTransaction of 5 statements, pipelined behind one Sync",
+        [transaction_batch](const Options& opts) -> std::unique_ptr<Run> {
+            struct Transaction : PostgresRun {
+                Transaction(const Options& opts, std::function<std::vector<std::pair<std::string, json>>(std::uint64_t)> batch)
+                    : PostgresRun(opts), batch(std::move(batch)) {}
+                void op(int, std::uint64_t i) override { PostgresPrimitives::executeTransaction(batch(i)); }
+                std::function<std::vector<std::pair<std::string, json>>(std::uint64_t)> batch;
+            };
+            return std::make_unique<Transaction>(opts, transaction_batch);
+        });
+
+    add("pg_transaction_sequential", "the pg_transaction batch as one query() per statement (baseline)",
+        [transaction_batch](const Options& opts) -> std::unique_ptr<Run> {
+            struct Sequential : PostgresRun {
+                Sequential(const Options& opts, std::function<std::vector<std::pair<std::string, json>>(std::uint64_t)> batch)
+                    : PostgresRun(opts), batch(std::move(batch)) {
+                    PostgresConnection::Options conn;
+                    conn.port = server.port();
+                    conn.user = conn.password = conn.database = "bench";
+                    for (int t = 0; t < opts.threads; ++t)
+                        connections.push_back(std::make_unique<PostgresConnection>(conn));
+                    baseline = snapshot();
+                }
+                void op(int thread, std::uint64_t i) override {
+                    PostgresConnection& conn = *connections[thread];
+                    conn.query("BEGIN");
+                    for (const auto& [sql, params] : batch(i))
+                        conn.query(sql, params);
+                    conn.query("COMMIT");
+                }
+                std::function<std::vector<std::pair<std::string, json>>(std::uint64_t)> batch;
+                std::vector<std::unique_ptr<PostgresConnection>> connections;
+            };
+            return std::make_unique<Sequential>(opts, transaction_batch);
+        });
+
+    // A 10k-row result read whole versus through a cursor in batches of 1000;
+    // pg_cursor also reports the time until its first batch arrives.
+    auto report_handler = [](const std::string& sql, const FakePostgresServer::Params& params) {
+        if (sql.compare(0, 14, "SELECT * FROM ") != 0)
+            return FakePostgresServer::default_handler()(sql, params);
+        FakePostgresServer::Result result;
+        result.columns = {"id", "customer", "total", "status"};
+        result.types = {23, 25, 1700, 25};
+        for (int i = 0; i < 10000; ++i)
+            result.rows.push_back({std::to_string(i), "customer-" + std::to_string(i % 97), std::to_string(i % 500) + ".25", "paid"});
+        return result;
+    };
+    const std::string report_sql = "SELECT * FROM orders WHERE created_at >= $1";
+
+    add("pg_select_large", "executeQuery of a 10000-row result (materialized at once)",
+        [report_handler, report_sql](const Options& opts) -> std::unique_ptr<Run> {
+            struct Large : PostgresRun {
+                Large(const Options& opts, FakePostgresServer::Handler handler, std::string sql)
+                    : PostgresRun(opts, std::move(handler)), sql(std::move(sql)) {}
+                void op(int, std::uint64_t) override {
+                    if (PostgresPrimitives::executeQuery(sql, json::array({"2024-01-01"}))["rows"].size() != 10000)
+                        throw std::runtime_error("pg_select_large: short result");
+                }
+                std::string sql;
+            };
+            return std::make_unique<Large>(opts, report_handler, report_sql);
+        });
+
+    add("pg_cursor", "the pg_select_large result through openCursor, 1000 rows per batch",
+        [report_handler, report_sql](const Options& opts) -> std::unique_ptr<Run> {
+            struct Cursor : PostgresRun {
+                Cursor(const Options& opts, FakePostgresServer::Handler handler, std::string sql)
+                    : PostgresRun(opts, std::move(handler)), sql(std::move(sql)),
+                      first_batch(static_cast<std::size_t>(opts.threads)) {}
+                void op(int thread, std::uint64_t) override {
+                    auto start = Clock::now();
+                    PostgresCursor cursor = PostgresPrimitives::openCursor(sql, json::array({"2024-01-01"}), 1000);
+                    json rows;
+                    std::size_t total = 0;
+                    for (bool first = true; cursor.next(rows); first = false) {
+                        if (first)
+                            first_batch[static_cast<std::size_t>(thread)].record(static_cast<std::uint64_t>(
+                                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+                        total += rows.size();
+                    }
+                    if (total != 10000)
+                        throw std::runtime_error("pg_cursor: short result");
+                }
+                json report(std::uint64_t ops) const override {
+                    json wire = PostgresRun::report(ops);
+                    Histogram::Snapshot merged;
+                    for (const auto& h : first_batch)
+                        merged.merge(h);
+                    wire["first_batch_us"] = {{"p50", static_cast<double>(merged.percentile(50)) / 1000.0},
+                                              {"p99", static_cast<double>(merged.percentile(99)) / 1000.0}};
+                    return wire;
+                }
+                std::string sql;
+                std::vector<Histogram::Snapshot> first_batch;
+            };
+            return std::make_unique<Cursor>(opts, report_handler, report_sql);
+        });
+
+    // Reads spread over two replicas, one fast (100us) and one slow (1ms),
+    // with the primary at 300us. The report shows where the SELECTs went.
+    struct ReplicaReads : PostgresRun {
+        using Servers = std::vector<std::unique_ptr<FakePostgresServer>>;
+
+        static Servers start_replicas(const Options& opts) {
+            auto handler = [](const std::string& sql, const FakePostgresServer::Params& params) {
+                if (sql.find("pg_is_in_recovery") == std::string::npos)
+                    return FakePostgresServer::default_handler()(sql, params);
+                FakePostgresServer::Result result;
+                result.columns = {"lag_ms"};
+                result.types = {20};
+                result.rows.push_back({std::string("0")});
+                return result;
+            };
+            Servers servers;
+            for (int latency_us : {100, 1000}) {
+                servers.push_back(std::make_unique<FakePostgresServer>(handler, FakePostgresServer::Options{opts.auth, "bench", "bench"}));
+                servers.back()->set_latency(std::chrono::microseconds(latency_us));
+            }
+            return servers;
+        }
+
+        ReplicaReads(const Options& opts, DBConfig::ReplicaSelection selection, Servers servers)
+            : PostgresRun(opts, FakePostgresServer::default_handler(),
+                          [&](DBConfig& config) {
+                              for (const auto& replica : servers)
+                                  config.db_replicas.push_back("127.0.0.1:" + std::to_string(replica->port()));
+                              config.db_replica_selection = selection;
+                          }),
+              replicas(std::move(servers)) {
+            server.set_latency(std::chrono::microseconds(300));
+            for (const auto& replica : replicas)
+                executes_before.push_back(replica->counters().executes.load());
+            primary_before = server.counters().executes.load();
+        }
+
+        void op(int, std::uint64_t i) override {
+            PostgresPrimitives::executeQuery("SELECT $1::int, $2::text", json::array({i, "replica"}));
+        }
+
+        json report(std::uint64_t ops) const override {
+            json wire = PostgresRun::report(ops);
+            json share = {{"primary", per_op(server.counters().executes.load() - primary_before, ops)}};
+            for (std::size_t i = 0; i < replicas.size(); ++i)
+                share["replica" + std::to_string(i + 1)] = per_op(replicas[i]->counters().executes.load() - executes_before[i], ops);
+            wire["executes_per_op"] = share;
+            wire["replicas"] = PostgresPrimitives::getConnectionInfo()["replicas"];
+            return wire;
+        }
+
+        Servers replicas;
+        std::vector<std::uint64_t> executes_before;
+        std::uint64_t primary_before = 0;
+    };
+
+    add("pg_replica_least_outstanding", "executeQuery SELECTs over two replicas, least-outstanding selection",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            return std::make_unique<ReplicaReads>(opts, DBConfig::LeastOutstanding, ReplicaReads::start_replicas(opts));
+        });
+
+    add("pg_replica_latency_weighted", "executeQuery SELECTs over two replicas, latency-weighted selection",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            return std::make_unique<ReplicaReads>(opts, DBConfig::LatencyWeighted, ReplicaReads::start_replicas(opts));
+        });
+
+    // Bulk loading --copy-rows rows per op into a five-column table, as
+    // binary COPY and as the same rows in one pipelined INSERT transaction.
+    auto events_handler = [](const std::string& sql, const FakePostgresServer::Params& params) {
+        if (sql.find("FROM pg_attribute") == std::string::npos)
+            return FakePostgresServer::default_handler()(sql, params);
+        FakePostgresServer::Result result;
+        result.columns = {"relname", "attname", "atttypid"};
+        result.types = {25, 25, 20};
+        for (const auto& [name, oid] : std::vector<std::pair<std::string, int>>{
+                 {"id", 20}, {"name", 25}, {"score", 701}, {"created_at", 1184}, {"payload", 3802}})
+            result.rows.push_back({"events", name, std::to_string(oid)});
+        return result;
+    };
+    auto event_row = [](std::uint64_t id) {
+        return json{{"id", id},
+                    {"name", "event-" + std::to_string(id)},
+                    {"score", static_cast<double>(id % 1000) / 10.0},
+                    {"created_at", "2024-05-01T12:30:00.250Z"},
+                    {"payload", {{"source", "bench"}, {"seq", id}}}};
+    };
+
+    struct BulkLoad : PostgresRun {
+        BulkLoad(const Options& opts, FakePostgresServer::Handler handler) : PostgresRun(opts, std::move(handler)), rows(opts.copy_rows) {}
+        json report(std::uint64_t ops) const override {
+            json wire = PostgresRun::report(ops);
+            wire["rows_per_op"] = rows;
+            wire["bytes_sent_per_row"] = per_op(server.counters().bytes_in.load() - baseline.bytes_in, ops * static_cast<std::uint64_t>(rows));
+            return wire;
+        }
+        int rows;
+    };
+
+    add("pg_copy", "copyRows of --copy-rows generated rows (binary COPY, rows encoded as they stream)",
+        [events_handler, event_row](const Options& opts) -> std::unique_ptr<Run> {
+            struct Copy : BulkLoad {
+                Copy(const Options& opts, FakePostgresServer::Handler handler, std::function<json(std::uint64_t)> make)
+                    : BulkLoad(opts, std::move(handler)), make(std::move(make)) {}
+                void op(int, std::uint64_t) override {
+                    int sent = 0;
+                    json result = PostgresPrimitives::copyRows("events", [&](json& row) {
+                        if (sent == rows)
+                            return false;
+                        row = make(static_cast<std::uint64_t>(sent++));
+                        return true;
+                    });
+                    if (result["rows"] != rows)
+                        throw std::runtime_error("pg_copy: unexpected result " + result.dump());
+                }
+                std::function<json(std::uint64_t)> make;
+            };
+            return std::make_unique<Copy>(opts, events_handler, event_row);
+        });
+
+    add("pg_insert_batch", "the pg_copy rows as one executeTransaction of INSERTs (baseline)",
+        [events_handler, event_row](const Options& opts) -> std::unique_ptr<Run> {
+            struct Insert : BulkLoad {
+                Insert(const Options& opts, FakePostgresServer::Handler handler, std::function<json(std::uint64_t)> make)
+                    : BulkLoad(opts, std::move(handler)), make(std::move(make)) {}
+                void op(int, std::uint64_t) override {
+                    std::vector<std::pair<std::string, json>> batch;
+                    batch.reserve(static_cast<std::size_t>(rows));
+                    for (int i = 0; i < rows; ++i) {
+                        json row = make(static_cast<std::uint64_t>(i));
+                        batch.emplace_back("INSERT INTO events (id, name, score, created_at, payload) VALUES ($1, $2, $3, $4, $5)",
+                                           json::array({row["id"], row["name"], row["score"], row["created_at"], row["payload"]}));
+                    }
+                    PostgresPrimitives::executeTransaction(batch);
+                }
+                std::function<json(std::uint64_t)> make;
+            };
+            return std::make_unique<Insert>(opts, events_handler, event_row);
+        });
+
+    add("pg_select_raw", "PostgresConnection::query on a dedicated connection per thread (no pool)",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            struct Raw : PostgresRun {
+                Raw(const Options& opts) : PostgresRun(opts) {
+                    PostgresConnection::Options conn;
+                    conn.port = server.port();
+                    conn.user = conn.password = conn.database = "bench";
+                    for (int t = 0; t < opts.threads; ++t)
+                        connections.push_back(std::make_unique<PostgresConnection>(conn));
+                    baseline = snapshot();
+                }
+                void op(int thread, std::uint64_t) override { connections[thread]->query("SELECT 1"); }
+                std::vector<std::unique_ptr<PostgresConnection>> connections;
+            };
+            return std::make_unique<Raw>(opts);
+        });
+}
+
+// Stand-in mongod plus MongoPrimitives pointed at it. The server's write
+// batch limit is lowered so insertMany has to split.
+class MongoRun : public Run {
+public:
+    explicit MongoRun(const Options& opts, const std::function<void(DBConfig&)>& configure = nullptr)
+        : server(server_options(opts)) {
+        server.set_latency(opts.latency);
+        DBConfig config;
+        config.db_type = DBConfig::MongoDB;
+        config.db_host = "127.0.0.1";
+        config.db_port = server.port();
+        config.db_name = "bench";
+        if (opts.auth == FakePostgresServer::Auth::Scram)
+            config.db_user = config.db_password = "bench";
+        config.db_pool_size = opts.pool_size;
+        config.db_pool_min_size = opts.pool_size;
+        config.db_pool_warmup_size = opts.pool_size;
+        if (configure)
+            configure(config);
+        MongoPrimitives::initialize(config);
+        MongoPrimitives::warmUp(Clock::now() + std::chrono::seconds(10));
+        baseline = snapshot();
+    }
+
+    ~MongoRun() override { MongoPrimitives::shutdown(); }
+
+    json report(std::uint64_t ops) const override {
+        Snapshot now = snapshot();
+        json info = MongoPrimitives::getConnectionInfo();
+        json wire = {{"round_trips_per_op", per_op(now.messages - baseline.messages, ops)},
+                     {"insert_messages_per_op", per_op(now.inserts - baseline.inserts, ops)},
+                     {"get_mores_per_op", per_op(now.get_mores - baseline.get_mores, ops)},
+                     {"bytes_sent_per_op", per_op(now.bytes_in - baseline.bytes_in, ops)},
+                     {"bytes_received_per_op", per_op(now.bytes_out - baseline.bytes_out, ops)},
+                     {"pool", info["pool"]}};
+        if (info.contains("insert_batching"))
+            wire["insert_batching"] = info["insert_batching"];
+        return wire;
+    }
+
+protected:
+    static constexpr std::size_t write_batch_limit = 1000;
+
+    struct Snapshot {
+        std::uint64_t messages, inserts, get_mores, bytes_in, bytes_out;
+    };
+
+    static FakeMongoServer::Options server_options(const Options& opts) {
+        FakeMongoServer::Options options;
+        options.max_write_batch_size = write_batch_limit;
+        if (opts.auth == FakePostgresServer::Auth::Scram)
+            options.user = options.password = "bench";
+        return options;
+    }
+
+    Snapshot snapshot() const {
+        auto& c = server.counters();
+        return {c.messages.load(), c.inserts.load(), c.get_mores.load(), c.bytes_in.load(), c.bytes_out.load()};
+    }
+
+    static json event(std::uint64_t i) {
+        return {{"seq", i}, {"kind", "click"}, {"score", static_cast<double>(i % 1000) / 10.0}, {"tags", {"a", "b"}}};
+    }
+
+    mutable FakeMongoServer server;
+    Snapshot baseline{};
+};
+
+void register_mongo_workloads() {
+    add("mongo_insert_one", "insertOne(document)", [](const Options& opts) -> std::unique_ptr<Run> {
+        struct InsertOne : MongoRun {
+            using MongoRun::MongoRun;
+            void op(int, std::uint64_t i) override { MongoPrimitives::insertOne("events", event(i)); }
+        };
+        return std::make_unique<InsertOne>(opts);
+    });
+
+    add("mongo_insert_one_grouped", "insertOne(document) with group commit (--insert-window-us)",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            struct InsertGrouped : MongoRun {
+                explicit InsertGrouped(const Options& opts)
+                    : MongoRun(opts, [&](DBConfig& config) { config.db_insert_batch_window_us = opts.insert_window_us; }) {}
+                void op(int, std::uint64_t i) override { MongoPrimitives::insertOne("events", event(i)); }
+            };
+            return std::make_unique<InsertGrouped>(opts);
+        });
+
+    add("mongo_find_one", "find({seq: k}) against 1000 documents", [](const Options& opts) -> std::unique_ptr<Run> {
+        struct FindOne : MongoRun {
+            explicit FindOne(const Options& opts) : MongoRun(opts) {
+                json documents = json::array();
+                for (std::uint64_t i = 0; i < 1000; ++i)
+                    documents.push_back(event(i));
+                server.insert("bench.events", documents);
+            }
+            void op(int, std::uint64_t i) override {
+                json found = MongoPrimitives::find("events", {{"seq", i % 1000}});
+                if (found.size() != 1)
+                    throw std::runtime_error("mongo_find_one: unexpected result " + found.dump());
+            }
+        };
+        return std::make_unique<FindOne>(opts);
+    });
+
+    add("mongo_find_batches", "find({}) of 5000 documents in getMore batches of 500",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            struct FindBatches : MongoRun {
+                explicit FindBatches(const Options& opts) : MongoRun(opts) {
+                    json documents = json::array();
+                    for (std::uint64_t i = 0; i < 5000; ++i)
+                        documents.push_back(event(i));
+                    server.insert("bench.events", documents);
+                }
+                void op(int, std::uint64_t) override {
+                    json found = MongoPrimitives::find("events", json::object(), {{"batchSize", 500}});
+                    if (found.size() != 5000)
+                        throw std::runtime_error("mongo_find_batches: got " + std::to_string(found.size()) + " documents");
+                }
+            };
+            return std::make_unique<FindBatches>(opts);
+        });
+
+    add("mongo_stream_find", "streamFind({}) of the mongo_find_batches documents, BSON written straight to JSON chunks",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            struct StreamFind : MongoRun {
+                explicit StreamFind(const Options& opts) : MongoRun(opts) {
+                    json documents = json::array();
+                    for (std::uint64_t i = 0; i < 5000; ++i)
+                        documents.push_back(event(i));
+                    server.insert("bench.events", documents);
+                }
+                void op(int, std::uint64_t) override {
+                    Response response = MongoPrimitives::streamFind("events", json::object(), {{"batchSize", 500}});
+                    std::size_t bytes = 0, chunk = 0;
+                    response.body_stream([&](const char*, std::size_t size) {
+                        bytes += size;
+                        chunk = std::max(chunk, size);
+                        return true;
+                    });
+                    body_bytes += bytes;
+                    std::size_t seen = largest_chunk.load();
+                    while (chunk > seen && !largest_chunk.compare_exchange_weak(seen, chunk)) {
+                    }
+                }
+                json report(std::uint64_t ops) const override {
+                    json wire = MongoRun::report(ops);
+                    wire["body_bytes_per_op"] = per_op(body_bytes.load(), ops);
+                    wire["largest_chunk_bytes"] = largest_chunk.load();
+                    return wire;
+                }
+                std::atomic<std::uint64_t> body_bytes{0};
+                std::atomic<std::size_t> largest_chunk{0};
+            };
+            return std::make_unique<StreamFind>(opts);
+        });
+
+    add("mongo_insert_many", "insertMany of --copy-rows documents, split at the server's maxWriteBatchSize (1000)",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            struct InsertMany : MongoRun {
+                InsertMany(const Options& opts) : MongoRun(opts), rows(opts.copy_rows) {}
+                void op(int, std::uint64_t i) override {
+                    json documents = json::array();
+                    for (int r = 0; r < rows; ++r)
+                        documents.push_back(event(i * static_cast<std::uint64_t>(rows) + static_cast<std::uint64_t>(r)));
+                    json result = MongoPrimitives::insertMany("events", documents);
+                    if (result["insertedCount"] != rows)
+                        throw std::runtime_error("mongo_insert_many: unexpected result " + result.dump());
+                }
+                int rows;
+            };
+            return std::make_unique<InsertMany>(opts);
+        });
+}
+
+// Stand-in Redis plus RedisPrimitives pointed at it, over multiplexed
+// connections (auto-pipelining) or, for comparison, pooled connections used
+// one command per round trip. With `cluster_nodes`, a stand-in Redis
+// Cluster of that many nodes instead.
+class RedisRun : public Run {
+public:
+    RedisRun(const Options& opts, int pipeline_connections, std::size_t local_cache_bytes = 0, int cluster_nodes = 0) {
+        if (cluster_nodes > 0) {
+            cluster = std::make_unique<FakeRedisCluster>(cluster_nodes);
+            for (int i = 0; i < cluster_nodes; ++i)
+                servers.push_back(&cluster->node(i));
+        } else {
+            server = std::make_unique<FakeRedisServer>();
+            servers.push_back(server.get());
+        }
+        for (FakeRedisServer* s : servers)
+            s->set_latency(opts.latency);
+        for (int i = 0; i < key_count; ++i) {
+            std::string k = key(static_cast<std::uint64_t>(i));
+            std::string value =
+                json{{"id", i}, {"name", "user " + std::to_string(i)}, {"roles", {"reader", "writer"}}, {"score", i * 0.5}}.dump();
+            if (cluster)
+                cluster->set(k, value);
+            else
+                server->set(k, value);
+        }
+        DBConfig config;
+        config.cache_type = DBConfig::Redis;
+        config.cache_host = "127.0.0.1";
+        config.cache_port = servers[0]->port();
+        config.cache_cluster = cluster != nullptr;
+        config.cache_pipeline_connections = pipeline_connections;
+        config.cache_local_max_bytes = local_cache_bytes;
+        config.db_pool_size = opts.pool_size;
+        config.db_pool_min_size = opts.pool_size;
+        config.db_pool_warmup_size = opts.pool_size;
+        RedisPrimitives::initialize(config);
+        RedisPrimitives::warmUp(Clock::now() + std::chrono::seconds(10));
+        baseline = snapshot();
+    }
+
+    ~RedisRun() override { RedisPrimitives::shutdown(); }
+
+    json report(std::uint64_t ops) const override {
+        Snapshot now = snapshot();
+        json info = RedisPrimitives::getConnectionInfo();
+        json wire = {{"round_trips_per_op", per_op(now.round_trips - baseline.round_trips, ops)},
+                     {"commands_per_round_trip", per_op(now.commands - baseline.commands, now.round_trips - baseline.round_trips)},
+                     {"bytes_sent_per_op", per_op(now.bytes_in - baseline.bytes_in, ops)},
+                     {"bytes_received_per_op", per_op(now.bytes_out - baseline.bytes_out, ops)},
+                     {"pool", info["pool"]}};
+        if (info.contains("pipelining"))
+            wire["pipelining"] = info["pipelining"];
+        if (info.contains("local_cache"))
+            wire["local_cache"] = info["local_cache"];
+        if (cluster) {
+            wire["commands_per_node"] = json::array();
+            for (FakeRedisServer* s : servers)
+                wire["commands_per_node"].push_back(s->counters().commands.load());
+            wire["cluster"] = {{"refreshes", info["cluster"]["refreshes"]},
+                               {"moved", info["cluster"]["moved"]},
+                               {"ask", info["cluster"]["ask"]},
+                               {"tryagain", info["cluster"]["tryagain"]}};
+        }
+        return wire;
+    }
+
+protected:
+    static constexpr int key_count = 1000;
+
+    struct Snapshot {
+        std::uint64_t commands, round_trips, bytes_in, bytes_out;
+    };
+
+    Snapshot snapshot() const {
+        Snapshot total{};
+        for (FakeRedisServer* s : servers) {
+            auto& c = s->counters();
+            total.commands += c.commands.load();
+            total.round_trips += c.round_trips.load();
+            total.bytes_in += c.bytes_in.load();
+            total.bytes_out += c.bytes_out.load();
+        }
+        return total;
+    }
+
+    static std::string key(std::uint64_t i) { return "key:" + std::to_string(i % key_count); }
+
+    std::unique_ptr<FakeRedisServer> server;
+    std::unique_ptr<FakeRedisCluster> cluster;
+    std::vector<FakeRedisServer*> servers;
+    Snapshot baseline{};
+};
+
+// Slots migrating between nodes under load: each round migrates one
+// {tag}'s slot, moves its even keys (so MGETs see TRYAGAIN and gets of
+// moved keys see ASK), then hands the slot over (MOVED). Transactions on
+// the odd keys, with an MGET across both, are re-sent whole on MOVED and
+// TRYAGAIN. Every value is checked, and the report fails unless all three
+// redirects were seen.
+class ReshardingRun : public RedisRun {
+public:
+    explicit ReshardingRun(const Options& opts) : RedisRun(opts, 1, 0, 3) {
+        for (int t = 0; t < tags; ++t)
+            for (int k = 0; k < keys_per_tag; ++k)
+                cluster->set(tagged(t, k), value(t, k));
+        mover = std::thread([this] {
+            for (int round = 0; !stopping; ++round) {
+                int t = round % tags;
+                int slot = FakeRedisServer::hash_slot(tagged(t, 0));
+                cluster->migrate_slot(slot, (cluster->owner(slot) + 1) % cluster->size());
+                cluster->migrate_keys(slot, [](const std::string& key) { return key.back() % 2 == 0; });
+                std::this_thread::sleep_for(std::chrono::milliseconds(15));
+                cluster->move_slot(slot, (cluster->owner(slot) + 1) % cluster->size());
+                std::this_thread::sleep_for(std::chrono::milliseconds(15));
+                ++migrations;
+            }
+        });
+    }
+
+    ~ReshardingRun() override {
+        stopping = true;
+        mover.join();
+    }
+
+    void op(int, std::uint64_t i) override {
+        try {
+            read(i);
+        } catch (...) {
+            ++failures;
+            throw;
+        }
+    }
+
+    json report(std::uint64_t ops) const override {
+        json wire = RedisRun::report(ops);
+        wire["migrations"] = migrations.load();
+        wire["failures"] = failures.load();
+        const json& seen = wire["cluster"];
+        if (failures > 0 || (migrations > 0 && (seen["moved"] == 0 || seen["ask"] == 0 || seen["tryagain"] == 0)))
+            throw std::runtime_error("redis_cluster_resharding: redirects not handled: " + wire.dump());
+        return wire;
+    }
+
+private:
+    void read(std::uint64_t i) {
+        int t = static_cast<int>(i / 4 % tags);
+        if (i % 4 == 3) {
+            RedisPipeline tx = RedisPrimitives::transaction();
+            auto odd = tx.get(tagged(t, 1));
+            auto both = tx.command({"MGET", tagged(t, 2), tagged(t, 3)});
+            tx.execute();
+            check(odd.get(), t, 1);
+            if (both.get().elements.size() != 2)
+                throw std::runtime_error("redis_cluster_resharding: bad MGET reply " + both.get().str);
+            check(both.get().elements[0].str, t, 2);
+            check(both.get().elements[1].str, t, 3);
+            return;
+        }
+        if (i % 2 == 0) {
+            int k = static_cast<int>(i / 2 % keys_per_tag);
+            check(RedisPrimitives::get(tagged(t, k)), t, k);
+            return;
+        }
+        std::vector<std::string> keys;
+        for (int k = 0; k < keys_per_tag; ++k)
+            keys.push_back(tagged(t, k));
+        auto values = RedisPrimitives::mget(keys);
+        for (int k = 0; k < keys_per_tag; ++k)
+            check(values[static_cast<std::size_t>(k)], t, k);
+    }
+
+    void check(const std::optional<std::string>& got, int t, int k) {
+        if (got != value(t, k))
+            throw std::runtime_error("redis_cluster_resharding: wrong value for " + tagged(t, k));
+    }
+
+    static std::string tagged(int t, int k) { return "{tag" + std::to_string(t) + "}:" + std::to_string(k); }
+    static std::string value(int t, int k) { return "value " + std::to_string(t) + "/" + std::to_string(k); }
+
+    static constexpr int tags = 8;
+    static constexpr int keys_per_tag = 20;
+    std::atomic<bool> stopping{false};
+    std::atomic<std::uint64_t> migrations{0};
+    std::atomic<std::uint64_t> failures{0};
+    std::thread mover;
+};
+
+void register_redis_workloads() {
+    struct Get : RedisRun {
+        using RedisRun::RedisRun;
+        void op(int, std::uint64_t i) override {
+            if (!RedisPrimitives::get(key(i)))
+                throw std::runtime_error("redis_get: missing " + key(i));
+        }
+    };
+    struct Set : RedisRun {
+        using RedisRun::RedisRun;
+        void op(int thread, std::uint64_t i) override {
+            RedisPrimitives::set("session:" + std::to_string(thread) + ":" + std::to_string(i % 1000), "payload", 60);
+        }
+    };
+    struct GetMany : RedisRun {
+        using RedisRun::RedisRun;
+        void op(int, std::uint64_t i) override {
+            std::vector<std::string> keys;
+            for (std::uint64_t k = 0; k < batch; ++k)
+                keys.push_back(key(i * batch + k));
+            std::size_t found = 0;
+            if (sequential) {
+                for (const auto& k : keys)
+                    found += RedisPrimitives::get(k).has_value();
+            } else {
+                for (const auto& value : RedisPrimitives::mget(keys))
+                    found += value.has_value();
+            }
+            if (found != keys.size())
+                throw std::runtime_error("redis_mget: missing keys");
+        }
+        std::uint64_t batch = 50;
+        bool sequential = false;
+    };
+    struct GetJson : RedisRun {
+        using RedisRun::RedisRun;
+        void op(int, std::uint64_t i) override {
+            std::optional<json> value = RedisPrimitives::getJson(key(i));
+            if (!value || !value->contains("id"))
+                throw std::runtime_error("redis_get_json: missing " + key(i));
+        }
+    };
+    add("redis_get", "get(key) over one auto-pipelined connection", [](const Options& opts) -> std::unique_ptr<Run> {
+        return std::make_unique<Get>(opts, 1);
+    });
+    add("redis_get_pooled", "get(key) over --pool-size pooled connections, one round trip per command (baseline)",
+        [](const Options& opts) -> std::unique_ptr<Run> { return std::make_unique<Get>(opts, 0); });
+    add("redis_set", "set(key, value, ttl) over one auto-pipelined connection", [](const Options& opts) -> std::unique_ptr<Run> {
+        return std::make_unique<Set>(opts, 1);
+    });
+    add("redis_set_pooled", "set(key, value, ttl) over --pool-size pooled connections (baseline)",
+        [](const Options& opts) -> std::unique_ptr<Run> { return std::make_unique<Set>(opts, 0); });
+    add("redis_get_json", "getJson(key), a round trip and a parse per call (baseline)",
+        [](const Options& opts) -> std::unique_ptr<Run> { return std::make_unique<GetJson>(opts, 1); });
+    add("redis_get_json_local", "getJson(key) through a 64 MiB local cache invalidated by client tracking",
+        [](const Options& opts) -> std::unique_ptr<Run> { return std::make_unique<GetJson>(opts, 1, std::size_t(64) << 20); });
+    add("redis_mget", "mget of 50 keys, one command", [](const Options& opts) -> std::unique_ptr<Run> {
+        return std::make_unique<GetMany>(opts, 1);
+    });
+    add("redis_get_sequential", "the same 50 keys as redis_mget with one get(key) after another (baseline)",
+        [](const Options& opts) -> std::unique_ptr<Run> {
+            auto run = std::make_unique<GetMany>(opts, 1);
+            run->sequential = true;
+            return run;
+        });
+    add("redis_get_cluster", "redis_get against a 3-node cluster, each key sent to the node owning its slot",
+        [](const Options& opts) -> std::unique_ptr<Run> { return std::make_unique<Get>(opts, 1, 0, 3); });
+    add("redis_mget_cluster", "redis_mget against a 3-node cluster: one MGET per slot, the nodes asked concurrently",
+        [](const Options& opts) -> std::unique_ptr<Run> { return std::make_unique<GetMany>(opts, 1, 0, 3); });
+    add("redis_cluster_resharding", "get and 20-key mget on a 3-node cluster while slots migrate (MOVED, ASK, TRYAGAIN)",
+        [](const Options& opts) -> std::unique_ptr<Run> { return std::make_unique<ReshardingRun>(opts); });
+}
+
+// Queries the stand-in Postgres received in each 100 ms of a run.
+struct BackendTimeline {
+    static constexpr std::chrono::milliseconds bucket{100};
+
+    Clock::time_point start = Clock::now();
+    std::array<std::atomic<std::uint64_t>, 3000> counts{};
+
+    void record() {
+        auto i = static_cast<std::size_t>((Clock::now() - start) / bucket);
+        if (i < counts.size())
+            counts[i]++;
+    }
+};
+
+// A hot key expiring under load: every client reads one key from the
+// stand-in Redis, cached for a second, and a miss loads it from the
+// stand-in Postgres with a query taking --latency-us (5 ms if unset).
+// Reports the queries Postgres saw per 100 ms, whose peak is the stampede.
+class StampedeRun : public PostgresRun {
+public:
+    StampedeRun(const Options& opts, bool protect) : StampedeRun(opts, protect, std::make_shared<BackendTimeline>()) {}
+
+    ~StampedeRun() override { RedisPrimitives::shutdown(); }
+
+    void op(int, std::uint64_t) override {
+        json value;
+        if (protect) {
+            value = RedisPrimitives::getOrLoadJson(hot_key, load);
+        } else if (std::optional<json> cached = RedisPrimitives::getJson(hot_key)) {
+            value = std::move(*cached);
+        } else {
+            value = load();
+            RedisPrimitives::setJson(hot_key, value, ttl);
+        }
+        if (value["rows"].size() != 1)
+            throw std::runtime_error("cache_stampede: unexpected value " + value.dump());
+    }
+
+    json report(std::uint64_t ops) const override {
+        auto elapsed = Clock::now() - timeline->start;
+        std::size_t buckets = std::min(timeline->counts.size(), static_cast<std::size_t>(elapsed / BackendTimeline::bucket) + 1);
+        json per_bucket = json::array();
+        std::uint64_t total = 0, peak = 0;
+        for (std::size_t i = 0; i < buckets; ++i) {
+            std::uint64_t n = timeline->counts[i].load();
+            per_bucket.push_back(n);
+            total += n;
+            peak = std::max(peak, n);
+        }
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        return {{"backend_queries", total},
+                {"backend_queries_per_op", per_op(total, ops)},
+                {"backend_qps_mean", seconds > 0 ? static_cast<double>(total) / seconds : 0.0},
+                {"backend_qps_peak", peak * 10},
+                {"backend_queries_per_100ms", per_bucket},
+                {"cache_aside", RedisPrimitives::getConnectionInfo()["cache_aside"]}};
+    }
+
+private:
+    static constexpr int ttl = 1;
+    static constexpr const char* hot_key = "report:hot";
+
+    StampedeRun(const Options& opts, bool protect, std::shared_ptr<BackendTimeline> timeline)
+        : PostgresRun(opts,
+                      [timeline](const std::string& sql, const FakePostgresServer::Params& params) {
+                          timeline->record();
+                          return FakePostgresServer::default_handler()(sql, params);
+                      }),
+          protect(protect),
+          timeline(std::move(timeline)) {
+        server.set_latency(opts.latency.count() > 0 ? opts.latency : std::chrono::microseconds(5000));
+        DBConfig config;
+        config.cache_type = DBConfig::Redis;
+        config.cache_host = "127.0.0.1";
+        config.cache_port = redis.port();
+        config.cache_ttl = ttl;
+        RedisPrimitives::initialize(config);
+        RedisPrimitives::warmUp(Clock::now() + std::chrono::seconds(10));
+        this->timeline->start = Clock::now();
+    }
+
+    static json load() { return PostgresPrimitives::executeQuery("SELECT $1::int, $2::text", json::array({42, "report"})); }
+
+    bool protect;
+    std::shared_ptr<BackendTimeline> timeline;
+    FakeRedisServer redis;
+};
+
+void register_cache_workloads() {
+    add("cache_stampede", "getOrLoadJson of one hot key expiring every second (singleflight, XFetch, stale-while-revalidate)",
+        [](const Options& opts) -> std::unique_ptr<Run> { return std::make_unique<StampedeRun>(opts, true); });
+    add("cache_stampede_naive", "the same hot key read with getJson, loaded and set by every caller that misses (baseline)",
+        [](const Options& opts) -> std::unique_ptr<Run> { return std::make_unique<StampedeRun>(opts, false); });
+}
+
+json percentiles_us(const Histogram::Snapshot& h) {
+    auto us = [](std::uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    return json{{"p50", us(h.percentile(50))}, {"p90", us(h.percentile(90))}, {"p99", us(h.percentile(99))},
+                {"p99.9", us(h.percentile(99.9))}, {"max", us(h.max)}, {"mean", h.mean() / 1000.0}};
+}
+
+json run_workload(const Workload& workload, const Options& opts) {
+    std::unique_ptr<Run> run = workload.start(opts);
+    std::vector<Histogram::Snapshot> latencies(static_cast<std::size_t>(opts.threads));
+    std::vector<std::uint64_t> errors(static_cast<std::size_t>(opts.threads), 0);
+    std::vector<std::string> first_error(static_cast<std::size_t>(opts.threads));
+    auto stop = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opts.duration_s));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < opts.threads; ++t) {
+        threads.emplace_back([&, t] {
+            auto index = static_cast<std::size_t>(t);
+            for (std::uint64_t i = 0;; ++i) {
+                auto start = Clock::now();
+                if (start >= stop)
+                    break;
+                try {
+                    run->op(t, i);
+                } catch (const std::exception& e) {
+                    if (errors[index]++ == 0)
+                        first_error[index] = e.what();
+                }
+                latencies[index].record(static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    Histogram::Snapshot total;
+    std::uint64_t error_count = 0;
+    std::string error_sample;
+    for (std::size_t t = 0; t < latencies.size(); ++t) {
+        total.merge(latencies[t]);
+        error_count += errors[t];
+        if (error_sample.empty())
+            error_sample = first_error[t];
+    }
+    json result = {{"workload", workload.name},
+                   {"threads", opts.threads},
+                   {"duration_s", opts.duration_s},
+                   {"ops", total.count},
+                   {"errors", error_count},
+                   {"throughput_ops", static_cast<double>(total.count) / opts.duration_s},
+                   {"latency_us", percentiles_us(total)}};
+    if (!error_sample.empty())
+        result["first_error"] = error_sample;
+    result["wire"] = run->report(total.count);
+    return result;
+}
+
+void usage() {
+    std::cerr << "usage: fastapi-cpp-db-bench [options]\n"
+                 "  --workload NAME   workload to run (repeatable; default: all)\n"
+                 "  --list            list workloads and exit\n"
+                 "  --threads N       client threads (default 4)\n"
+                 "  --duration S      seconds per workload (default 5)\n"
+                 "  --pool-size N     connections per pool (default 4)\n"
+                 "  --auth MODE       trust, cleartext, md5 or scram (default trust; MongoDB: scram or none)\n"
+                 "  --latency-us N    delay the stand-in server adds to every response\n"
+                 "  --statement-cache N  prepared statements per connection (default 64, 0 = off)\n"
+                 "  --copy-rows N     rows per op for pg_copy, pg_insert_batch and mongo_insert_many (default 1000)\n"
+                 "  --insert-window-us N  group commit window for mongo_insert_one_grouped (default 200)\n"
+                 "  --output FILE     write JSON results to FILE instead of stdout\n";
+}
+
+Options parse_args(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::runtime_error("missing value for " + arg);
+            return argv[++i];
+        };
+        if (arg == "--workload")
+            opts.workloads.push_back(value());
+        else if (arg == "--threads")
+            opts.threads = std::max(1, std::stoi(value()));
+        else if (arg == "--duration")
+            opts.duration_s = std::stod(value());
+        else if (arg == "--pool-size")
+            opts.pool_size = std::max(1, std::stoi(value()));
+        else if (arg == "--statement-cache")
+            opts.statement_cache = std::max(0, std::stoi(value()));
+        else if (arg == "--copy-rows")
+            opts.copy_rows = std::max(1, std::stoi(value()));
+        else if (arg == "--insert-window-us")
+            opts.insert_window_us = std::max(1, std::stoi(value()));
+        else if (arg == "--latency-us")
+            opts.latency = std::chrono::microseconds(std::stoll(value()));
+        else if (arg == "--auth") {
+            std::string mode = value();
+            if (mode == "trust")
+                opts.auth = FakePostgresServer::Auth::Trust;
+            else if (mode == "cleartext")
+                opts.auth = FakePostgresServer::Auth::Cleartext;
+            else if (mode == "md5")
+                opts.auth = FakePostgresServer::Auth::Md5;
+            else if (mode == "scram")
+                opts.auth = FakePostgresServer::Auth::Scram;
+            else
+                throw std::runtime_error("unknown auth mode " + mode);
+        } else if (arg == "--output")
+            opts.output = value();
+        else if (arg == "--list") {
+            for (const auto& w : registry())
+                std::cout << w.name << "  " << w.description << "\n";
+            std::exit(0);
+        } else if (arg == "--help" || arg == "-h") {
+            usage();
+            std::exit(0);
+        } else
+            throw std::runtime_error("unknown option " + arg);
+    }
+    return opts;
+}
+
+}
+
+int main(int argc, char** argv) {
+    try {
+        register_postgres_workloads();
+        register_mongo_workloads();
+        register_redis_workloads();
+        register_cache_workloads();
+        Options opts = parse_args(argc, argv);
+
+        json report = json::array();
+        for (const auto& workload : registry()) {
+            if (!opts.workloads.empty() &&
+                std::find(opts.workloads.begin(), opts.workloads.end(), workload.name) == opts.workloads.end())
+                continue;
+            std::cerr << "running " << workload.name << " for " << opts.duration_s << "s\n";
+            report.push_back(run_workload(workload, opts));
+        }
+
+        if (opts.output.empty()) {
+            std::cout << report.dump(2) << std::endl;
+        } else {
+            std::ofstream out(opts.output);
+            out << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "fastapi-cpp-db-bench: " << e.what() << "\n";
+        usage();
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,578 @@
+#pragma once
+// In-process stand-in for a MongoDB server, speaking enough OP_MSG (hello,
+// SCRAM-SHA-256, insert/find/getMore/killCursors/update/delete/aggregate
+// over an in-memory store) to drive MongoConnection offline. Filters match
+// top-level fields by equality or $gt/$gte/$lt/$lte/$ne/$in/$exists.
+// Limits are configurable so benchmarks can exercise batch splitting, and
+// wire counters report messages and bytes per operation.
+#include "fake_server.hpp"
+#include "../include/bson.hpp"
+#include "../include/crypto.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FakeMongoServer {
+public:
+    struct Options {
+        std::size_t max_write_batch_size = 100000;
+        std::size_t max_message_size = 48000000;
+        std::size_t max_bson_object_size = 16 * 1024 * 1024;
+        // Set to require SCRAM-SHA-256 before any other command.
+        std::string user;
+        std::string password;
+    };
+
+    struct Counters {
+        std::atomic<std::uint64_t> connections{0};
+        std::atomic<std::uint64_t> messages{0};
+        std::atomic<std::uint64_t> inserts{0};
+        std::atomic<std::uint64_t> inserted_documents{0};
+        std::atomic<std::uint64_t> finds{0};
+        std::atomic<std::uint64_t> get_mores{0};
+        std::atomic<std::uint64_t> kill_cursors{0};
+        std::atomic<std::uint64_t> bytes_in{0};
+        std::atomic<std::uint64_t> bytes_out{0};
+    };
+
+    FakeMongoServer() : FakeMongoServer(Options()) {}
+
+    explicit FakeMongoServer(Options options)
+        : options_(std::move(options)), server_([this](Socket& socket) { Session(*this, socket).run(); }) {}
+
+    int port() const { return server_.port(); }
+    Counters& counters() { return counters_; }
+
+    // Added before every reply, to model network or server delay.
+    void set_latency(std::chrono::microseconds latency) { latency_us_ = latency.count(); }
+
+    // Direct access to the store, for seeding and checking benchmarks.
+    void insert(const std::string& ns, const json& documents) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& collection = collections_[ns];
+        for (const auto& document : documents) {
+            if (document.contains("_id"))
+                collection.ids.insert(document["_id"].dump());
+            collection.documents.push_back(document);
+        }
+    }
+
+    std::size_t count(const std::string& ns) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = collections_.find(ns);
+        return it == collections_.end() ? 0 : it->second.documents.size();
+    }
+
+    std::size_t open_cursors() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cursors_.size();
+    }
+
+private:
+    struct Collection {
+        std::vector<json> documents;
+        // Serialized _id values, for the duplicate key check.
+        std::set<std::string> ids;
+    };
+
+    struct Cursor {
+        std::string ns;
+        std::vector<json> documents;
+        std::size_t next = 0;
+    };
+
+    struct CommandError {
+        int code;
+        std::string name;
+        std::string message;
+    };
+
+    static bool matches(const json& document, const json& filter) {
+        for (auto it = filter.begin(); it != filter.end(); ++it) {
+            auto field = document.find(it.key());
+            json value = field == document.end() ? json() : *field;
+            const json& expected = it.value();
+            static const char* const operators[] = {"$gt", "$gte", "$lt", "$lte", "$ne", "$in", "$exists"};
+            bool is_operator = expected.is_object() && !expected.empty() &&
+                               std::find_if(std::begin(operators), std::end(operators), [&](const char* op) {
+                                   return expected.begin().key() == op;
+                               }) != std::end(operators);
+            if (!is_operator) {
+                if (value != expected)
+                    return false;
+                continue;
+            }
+            for (auto op = expected.begin(); op != expected.end(); ++op) {
+                const json& arg = op.value();
+                bool present = field != document.end();
+                bool ok = op.key() == "$gt"       ? present && value > arg
+                          : op.key() == "$gte"    ? present && value >= arg
+                          : op.key() == "$lt"     ? present && value < arg
+                          : op.key() == "$lte"    ? present && value <= arg
+                          : op.key() == "$ne"     ? value != arg
+                          : op.key() == "$in"     ? std::find(arg.begin(), arg.end(), value) != arg.end()
+                          : op.key() == "$exists" ? present == arg.get<bool>()
+                                                  : false;
+                if (!ok)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // `order` lists the spec's fields as sent; empty means name order.
+    static void sort(std::vector<json>& documents, const json& spec, const std::vector<std::string>& order = {}) {
+        std::vector<std::string> fields = order;
+        if (fields.empty()) {
+            for (auto it = spec.begin(); it != spec.end(); ++it)
+                fields.push_back(it.key());
+        }
+        std::stable_sort(documents.begin(), documents.end(), [&](const json& a, const json& b) {
+            for (const auto& field : fields) {
+                json x = a.value(field, json()), y = b.value(field, json());
+                if (x == y)
+                    continue;
+                return spec.at(field).get<int>() < 0 ? y < x : x < y;
+            }
+            return false;
+        });
+    }
+
+    static bool apply_update(json& document, const json& update) {
+        json before = document;
+        if (update.empty() || update.begin().key()[0] != '$') {
+            json id = document["_id"];
+            document = update;
+            document["_id"] = id;
+        } else {
+            for (auto op = update.begin(); op != update.end(); ++op) {
+                for (auto field = op.value().begin(); field != op.value().end(); ++field) {
+                    if (op.key() == "$set")
+                        document[field.key()] = field.value();
+                    else if (op.key() == "$unset")
+                        document.erase(field.key());
+                    else if (op.key() == "$inc")
+                        document[field.key()] = document.value(field.key(), 0) + field.value().get<std::int64_t>();
+                    else
+                        throw CommandError{9, "FailedToParse", "Unsupported update operator " + op.key()};
+                }
+            }
+        }
+        return document != before;
+    }
+
+    class Session {
+    public:
+        Session(FakeMongoServer& server, Socket& socket) : server(server), socket(socket) {}
+
+        void run() {
+            server.counters_.connections++;
+            authenticated = server.options_.user.empty();
+            while (true) {
+                std::string message;
+                read_exact(4, message);
+                std::size_t length = static_cast<std::size_t>(Bson::document_size(message.data(), 4));
+                if (length < 21 || length > server.options_.max_message_size)
+                    return;
+                std::string rest;
+                read_exact(length - 4, rest);
+                message += rest;
+                server.counters_.messages++;
+                std::int32_t request = int32_at(message.data() + 4);
+                json body;
+                std::string name;
+                if (int32_at(message.data() + 12) != 2013)
+                    return;
+                parse_sections(message, body, name);
+                json reply;
+                try {
+                    reply = dispatch(name, body);
+                    reply["ok"] = 1.0;
+                } catch (const CommandError& e) {
+                    reply = {{"ok", 0.0}, {"code", e.code}, {"codeName", e.name}, {"errmsg", e.message}};
+                }
+                send_reply(request, reply);
+            }
+        }
+
+    private:
+        static std::int32_t int32_at(const char* p) {
+            std::uint32_t v = 0;
+            for (int i = 3; i >= 0; --i)
+                v = v << 8 | static_cast<unsigned char>(p[i]);
+            return static_cast<std::int32_t>(v);
+        }
+
+        // The command name is the first field of the body as sent, which
+        // the decoded (name-ordered) json no longer shows; nor does it show
+        // the order of a find's sort fields, kept in sort_order.
+        void parse_sections(const std::string& message, json& body, std::string& name) {
+            const char* p = message.data() + 20;
+            const char* end = message.data() + message.size();
+            if (static_cast<std::uint32_t>(int32_at(message.data() + 16)) & 1)
+                end -= 4;
+            while (p < end) {
+                char kind = *p++;
+                std::size_t size = Bson::document_size(p, static_cast<std::size_t>(end - p));
+                if (kind == 0) {
+                    body = Bson::decode(p, size);
+                    name = std::string(p + 5);
+                    sort_order.clear();
+                    if (Bson::Element sort = Bson::find(p, size, "sort"); sort && sort.type == 0x03)
+                        Bson::for_each(sort.value, sort.size, [&](const Bson::Element& e) { sort_order.push_back(e.name); });
+                } else {
+                    const char* q = p + 4;
+                    std::string identifier(q);
+                    q += identifier.size() + 1;
+                    json documents = json::array();
+                    while (q < p + size) {
+                        std::size_t document = Bson::document_size(q, static_cast<std::size_t>(p + size - q));
+                        documents.push_back(Bson::decode(q, document));
+                        q += document;
+                    }
+                    body[identifier] = std::move(documents);
+                }
+                p += size;
+            }
+        }
+
+        json dispatch(const std::string& name, const json& body) {
+            if (name == "hello" || name == "isMaster" || name == "ismaster") {
+                const Options& o = server.options_;
+                return {{"isWritablePrimary", true},
+                        {"ismaster", true},
+                        {"maxBsonObjectSize", o.max_bson_object_size},
+                        {"maxMessageSizeBytes", o.max_message_size},
+                        {"maxWriteBatchSize", o.max_write_batch_size},
+                        {"minWireVersion", 0},
+                        {"maxWireVersion", 17}};
+            }
+            if (name == "ping" || name == "endSessions")
+                return json::object();
+            if (name == "saslStart")
+                return sasl_start(body);
+            if (name == "saslContinue")
+                return sasl_continue(body);
+            if (!authenticated)
+                throw CommandError{13, "Unauthorized", "command " + name + " requires authentication"};
+
+            std::string db = body.value("$db", "test");
+            std::string collection = body[name].is_string() ? body[name].get<std::string>() : "";
+            std::string ns = db + "." + collection;
+            if (name == "insert")
+                return insert(ns, body);
+            if (name == "find") {
+                server.counters_.finds++;
+                std::vector<json> documents = select(ns, body.value("filter", json::object()));
+                if (body.contains("sort"))
+                    FakeMongoServer::sort(documents, body["sort"], sort_order);
+                std::size_t skip = std::min(body.value("skip", std::size_t(0)), documents.size());
+                documents.erase(documents.begin(), documents.begin() + static_cast<std::ptrdiff_t>(skip));
+                std::size_t limit = body.value("limit", std::size_t(0));
+                if (limit > 0 && limit < documents.size())
+                    documents.resize(limit);
+                return open_cursor(ns, std::move(documents), body.value("batchSize", std::size_t(101)));
+            }
+            if (name == "aggregate")
+                return aggregate(ns, body);
+            if (name == "getMore") {
+                server.counters_.get_mores++;
+                return get_more(db + "." + body.value("collection", ""), body["getMore"].get<std::int64_t>(),
+                                body.value("batchSize", std::size_t(0)));
+            }
+            if (name == "killCursors") {
+                server.counters_.kill_cursors++;
+                json killed = json::array();
+                std::lock_guard<std::mutex> lock(server.mutex_);
+                for (const auto& id : body.value("cursors", json::array())) {
+                    if (server.cursors_.erase(id.get<std::int64_t>()))
+                        killed.push_back(id);
+                }
+                return {{"cursorsKilled", killed}};
+            }
+            if (name == "update")
+                return update(ns, body);
+            if (name == "delete")
+                return remove(ns, body);
+            if (name == "createIndexes")
+                return {{"numIndexesBefore", 1}, {"numIndexesAfter", 2}};
+            throw CommandError{59, "CommandNotFound", "no such command: '" + name + "'"};
+        }
+
+        json insert(const std::string& ns, const json& body) {
+            const json& documents = body.value("documents", json::array());
+            if (documents.empty() || documents.size() > server.options_.max_write_batch_size)
+                throw CommandError{16, "InvalidLength",
+                                   "Write batch sizes must be between 1 and " +
+                                       std::to_string(server.options_.max_write_batch_size) + ". Got " +
+                                       std::to_string(documents.size()) + " operations."};
+            server.counters_.inserts++;
+            bool ordered = body.value("ordered", true);
+            json errors = json::array();
+            std::size_t n = 0;
+            std::lock_guard<std::mutex> lock(server.mutex_);
+            auto& collection = server.collections_[ns];
+            for (std::size_t i = 0; i < documents.size(); ++i) {
+                const json& document = documents[i];
+                if (document.contains("_id") && !collection.ids.insert(document["_id"].dump()).second) {
+                    errors.push_back({{"index", i},
+                                      {"code", 11000},
+                                      {"errmsg", "E11000 duplicate key error collection: " + ns + " index: _id_"}});
+                    if (ordered)
+                        break;
+                    continue;
+                }
+                collection.documents.push_back(document);
+                ++n;
+            }
+            server.counters_.inserted_documents += n;
+            json reply = {{"n", n}};
+            if (!errors.empty())
+                reply["writeErrors"] = errors;
+            return reply;
+        }
+
+        std::vector<json> select(const std::string& ns, const json& filter) {
+            std::vector<json> documents;
+            std::lock_guard<std::mutex> lock(server.mutex_);
+            auto it = server.collections_.find(ns);
+            if (it == server.collections_.end())
+                return documents;
+            for (const auto& document : it->second.documents) {
+                if (matches(document, filter))
+                    documents.push_back(document);
+            }
+            return documents;
+        }
+
+        json aggregate(const std::string& ns, const json& body) {
+            std::vector<json> documents;
+            bool first = true;
+            for (const auto& stage : body.value("pipeline", json::array())) {
+                const std::string& op = stage.begin().key();
+                const json& arg = stage.begin().value();
+                if (op == "$match") {
+                    if (first) {
+                        documents = select(ns, arg);
+                    } else {
+                        documents.erase(std::remove_if(documents.begin(), documents.end(),
+                                                       [&](const json& d) { return !matches(d, arg); }),
+                                        documents.end());
+                    }
+                } else {
+                    if (first)
+                        documents = select(ns, json::object());
+                    if (op == "$sort") {
+                        FakeMongoServer::sort(documents, arg);
+                    } else if (op == "$skip") {
+                        std::size_t skip = std::min(arg.get<std::size_t>(), documents.size());
+                        documents.erase(documents.begin(), documents.begin() + static_cast<std::ptrdiff_t>(skip));
+                    } else if (op == "$limit") {
+                        documents.resize(std::min(arg.get<std::size_t>(), documents.size()));
+                    } else if (op == "$count") {
+                        documents = {json{{arg.get<std::string>(), documents.size()}}};
+                    } else {
+                        throw CommandError{40324, "Location40324", "Unrecognized pipeline stage name: '" + op + "'"};
+                    }
+                }
+                first = false;
+            }
+            if (first)
+                documents = select(ns, json::object());
+            const json& cursor = body.value("cursor", json::object());
+            return open_cursor(ns, std::move(documents), cursor.value("batchSize", std::size_t(101)));
+        }
+
+        json open_cursor(const std::string& ns, std::vector<json> documents, std::size_t batch_size) {
+            Cursor cursor{ns, std::move(documents), 0};
+            json batch = take(cursor, batch_size);
+            std::int64_t id = 0;
+            if (cursor.next < cursor.documents.size()) {
+                std::lock_guard<std::mutex> lock(server.mutex_);
+                id = ++server.next_cursor_id_;
+                server.cursors_[id] = std::move(cursor);
+            }
+            return {{"cursor", {{"id", id}, {"ns", ns}, {"firstBatch", std::move(batch)}}}};
+        }
+
+        json get_more(const std::string& ns, std::int64_t id, std::size_t batch_size) {
+            std::lock_guard<std::mutex> lock(server.mutex_);
+            auto it = server.cursors_.find(id);
+            if (it == server.cursors_.end() || it->second.ns != ns)
+                throw CommandError{43, "CursorNotFound", "cursor id " + std::to_string(id) + " not found"};
+            json batch = take(it->second, batch_size);
+            if (it->second.next >= it->second.documents.size()) {
+                server.cursors_.erase(it);
+                id = 0;
+            }
+            return {{"cursor", {{"id", id}, {"ns", ns}, {"nextBatch", std::move(batch)}}}};
+        }
+
+        static json take(Cursor& cursor, std::size_t batch_size) {
+            json batch = json::array();
+            std::size_t end = batch_size == 0 ? cursor.documents.size()
+                                              : std::min(cursor.documents.size(), cursor.next + batch_size);
+            for (; cursor.next < end; ++cursor.next)
+                batch.push_back(std::move(cursor.documents[cursor.next]));
+            return batch;
+        }
+
+        json update(const std::string& ns, const json& body) {
+            std::size_t n = 0, modified = 0;
+            std::lock_guard<std::mutex> lock(server.mutex_);
+            auto& collection = server.collections_[ns];
+            for (const auto& statement : body.value("updates", json::array())) {
+                bool multi = statement.value("multi", false);
+                for (auto& document : collection.documents) {
+                    if (!matches(document, statement.value("q", json::object())))
+                        continue;
+                    ++n;
+                    if (apply_update(document, statement["u"]))
+                        ++modified;
+                    if (!multi)
+                        break;
+                }
+            }
+            return {{"n", n}, {"nModified", modified}};
+        }
+
+        json remove(const std::string& ns, const json& body) {
+            std::size_t n = 0;
+            std::lock_guard<std::mutex> lock(server.mutex_);
+            auto& collection = server.collections_[ns];
+            for (const auto& statement : body.value("deletes", json::array())) {
+                const json& filter = statement.value("q", json::object());
+                bool one = statement.value("limit", 0) == 1;
+                for (auto it = collection.documents.begin(); it != collection.documents.end();) {
+                    if (matches(*it, filter)) {
+                        collection.ids.erase(it->value("_id", json()).dump());
+                        it = collection.documents.erase(it);
+                        ++n;
+                        if (one)
+                            break;
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            return {{"n", n}};
+        }
+
+        static std::string payload(const json& body) {
+            const auto& bytes = body.at("payload").get_binary();
+            return std::string(bytes.begin(), bytes.end());
+        }
+
+        static json binary(const std::string& text) {
+            return json::binary(std::vector<std::uint8_t>(text.begin(), text.end()));
+        }
+
+        static std::string attribute(const std::string& message, char name) {
+            std::string key = std::string(1, name) + "=";
+            std::size_t pos = message.compare(0, 2, key) == 0 ? 0 : message.find("," + key);
+            if (pos == std::string::npos)
+                return "";
+            if (pos > 0)
+                ++pos;
+            std::size_t end = message.find(',', pos);
+            return message.substr(pos + 2, end == std::string::npos ? std::string::npos : end - pos - 2);
+        }
+
+        json sasl_start(const json& body) {
+            if (body.value("mechanism", "") != "SCRAM-SHA-256")
+                throw CommandError{334, "MechanismUnavailable", "Unsupported mechanism"};
+            std::string client_first = payload(body);
+            client_first_bare = client_first.substr(client_first.find(",,") + 2);
+            std::string user = attribute(client_first_bare, 'n');
+            for (auto [escaped, plain] : {std::pair<const char*, char>{"=2C", ','}, {"=3D", '='}}) {
+                for (auto at = user.find(escaped); at != std::string::npos; at = user.find(escaped, at + 1))
+                    user.replace(at, 3, 1, plain);
+            }
+            if (user != server.options_.user)
+                throw CommandError{18, "AuthenticationFailed", "Authentication failed."};
+            nonce = attribute(client_first_bare, 'r') + Crypto::base64_encode(Crypto::random_bytes(18));
+            salt = Crypto::random_bytes(16);
+            server_first = "r=" + nonce + ",s=" + Crypto::base64_encode(salt) + ",i=4096";
+            return {{"conversationId", 1}, {"done", false}, {"payload", binary(server_first)}};
+        }
+
+        json sasl_continue(const json& body) {
+            std::string client_final = payload(body);
+            if (client_final.empty())
+                return {{"conversationId", 1}, {"done", true}, {"payload", binary("")}};
+            std::string without_proof = client_final.substr(0, client_final.find(",p="));
+            std::string proof = Crypto::base64_decode(attribute(client_final, 'p'));
+            std::string salted = Crypto::pbkdf2_hmac_sha256(server.options_.password, salt, 4096);
+            std::string stored_key = Crypto::sha256(Crypto::hmac_sha256(salted, "Client Key"));
+            std::string auth_message = client_first_bare + "," + server_first + "," + without_proof;
+            std::string signature = Crypto::hmac_sha256(stored_key, auth_message);
+            std::string client_key = proof;
+            for (std::size_t i = 0; i < client_key.size() && i < signature.size(); ++i)
+                client_key[i] = static_cast<char>(client_key[i] ^ signature[i]);
+            if (attribute(without_proof, 'r') != nonce || Crypto::sha256(client_key) != stored_key)
+                throw CommandError{18, "AuthenticationFailed", "Authentication failed."};
+            authenticated = true;
+            std::string verifier =
+                "v=" + Crypto::base64_encode(Crypto::hmac_sha256(Crypto::hmac_sha256(salted, "Server Key"), auth_message));
+            return {{"conversationId", 1}, {"done", true}, {"payload", binary(verifier)}};
+        }
+
+        void send_reply(std::int32_t request, const json& reply) {
+            std::string out(16, '\0');
+            auto put = [&](std::size_t at, std::int32_t value) {
+                for (int i = 0; i < 4; ++i)
+                    out[at + i] = static_cast<char>((static_cast<std::uint32_t>(value) >> (8 * i)) & 0xff);
+            };
+            out.append(5, '\0');
+            Bson::encode(reply, out);
+            put(0, static_cast<std::int32_t>(out.size()));
+            put(4, ++next_reply_id);
+            put(8, request);
+            put(12, 2013);
+            if (auto latency = server.latency_us_.load(std::memory_order_relaxed))
+                std::this_thread::sleep_for(std::chrono::microseconds(latency));
+            socket.write_all(out);
+            server.counters_.bytes_out += out.size();
+        }
+
+        void read_exact(std::size_t size, std::string& into) {
+            while (in.size() - in_pos < size) {
+                char buffer[16384];
+                std::size_t got = socket.read_some(buffer, sizeof(buffer));
+                server.counters_.bytes_in += got;
+                in.erase(0, in_pos);
+                in_pos = 0;
+                in.append(buffer, got);
+            }
+            into.assign(in, in_pos, size);
+            in_pos += size;
+        }
+
+        FakeMongoServer& server;
+        Socket& socket;
+        std::string in;
+        std::size_t in_pos = 0;
+        std::vector<std::string> sort_order;
+        std::int32_t next_reply_id = 0;
+        bool authenticated = false;
+        std::string client_first_bare;
+        std::string server_first;
+        std::string nonce;
+        std::string salt;
+    };
+
+    Options options_;
+    Counters counters_;
+    std::atomic<std::int64_t> latency_us_{0};
+    std::mutex mutex_;
+    std::map<std::string, Collection> collections_;
+    std::map<std::int64_t, Cursor> cursors_;
+    std::int64_t next_cursor_id_ = 0;
+    FakeTcpServer server_;
+};
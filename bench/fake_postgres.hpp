@@ -0,0 +1,739 @@
+#pragma once
+// In-process stand-in for a PostgreSQL server, speaking enough of protocol
+// v3 (startup, trust/cleartext/MD5/SCRAM auth, simple and extended query,
+// binary COPY FROM STDIN) to
+// drive PostgresConnection offline. Query results come from a handler, and
+// wire counters let benchmarks report round trips and bytes per query.
+#include "fake_server.hpp"
+#include "../include/crypto.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FakePostgresServer {
+public:
+    using Params = std::vector<std::optional<std::string>>;
+
+    struct Result {
+        std::vector<std::string> columns;
+        std::vector<std::uint32_t> types;
+        std::vector<std::vector<std::optional<std::string>>> rows;
+        // Defaults to "SELECT <row count>".
+        std::string command;
+    };
+
+    // Thrown by handlers to answer with an ErrorResponse.
+    struct Error {
+        std::string sqlstate;
+        std::string message;
+    };
+
+    using Handler = std::function<Result(const std::string& sql, const Params& params)>;
+
+    enum class Auth { Trust, Cleartext, Md5, Scram };
+
+    struct Options {
+        Auth auth = Auth::Trust;
+        std::string user = "bench";
+        std::string password = "bench";
+    };
+
+    struct Counters {
+        std::atomic<std::uint64_t> connections{0};
+        std::atomic<std::uint64_t> parses{0};
+        std::atomic<std::uint64_t> binds{0};
+        std::atomic<std::uint64_t> executes{0};
+        std::atomic<std::uint64_t> syncs{0};
+        std::atomic<std::uint64_t> simple_queries{0};
+        std::atomic<std::uint64_t> copy_rows{0};
+        std::atomic<std::uint64_t> bytes_in{0};
+        std::atomic<std::uint64_t> bytes_out{0};
+    };
+
+    explicit FakePostgresServer(Handler handler = default_handler()) : FakePostgresServer(std::move(handler), Options()) {}
+
+    FakePostgresServer(Handler handler, Options options)
+        : handler_(std::move(handler)), options_(std::move(options)),
+          server_([this](Socket& socket) { Session(*this, socket).run(); }) {}
+
+    int port() const { return server_.port(); }
+    Counters& counters() { return counters_; }
+
+    // Added before every response flush, to model network or server delay.
+    void set_latency(std::chrono::microseconds latency) { latency_us_ = latency.count(); }
+
+    // Receives each row of a binary COPY as raw field bytes; set before
+    // connecting. Without one, rows are only counted.
+    using CopyHandler = std::function<void(const std::string& sql, const Params& fields)>;
+    void set_copy_handler(CopyHandler handler) { copy_handler_ = std::move(handler); }
+
+    // `SELECT` echoes its parameters back as one text row (or returns the
+    // integer 1 without parameters); anything else completes with no rows.
+    static Handler default_handler() {
+        return [](const std::string& sql, const Params& params) {
+            Result result;
+            if (sql.compare(0, 6, "SELECT") != 0 && sql.compare(0, 6, "select") != 0) {
+                auto space = sql.find(' ');
+                result.command = sql.substr(0, space);
+                if (result.command == "INSERT")
+                    result.command += " 0 1";
+                else if (result.command == "UPDATE" || result.command == "DELETE")
+                    result.command += " 1";
+                return result;
+            }
+            if (params.empty()) {
+                result.columns = {"?column?"};
+                result.types = {23};
+                result.rows.push_back({std::string("1")});
+                return result;
+            }
+            std::vector<std::optional<std::string>> row;
+            for (std::size_t i = 0; i < params.size(); ++i) {
+                result.columns.push_back("c" + std::to_string(i + 1));
+                result.types.push_back(25);
+                row.push_back(params[i]);
+            }
+            result.rows.push_back(std::move(row));
+            return result;
+        };
+    }
+
+private:
+    struct Portal {
+        Result result;
+        std::size_t next_row = 0;
+    };
+
+    struct Statement {
+        std::string sql;
+        // Set once described; a later result with other columns is rejected
+        // the way PostgreSQL rejects a cached plan after a schema change.
+        std::optional<std::vector<std::string>> columns;
+    };
+
+    class Session {
+    public:
+        Session(FakePostgresServer& server, Socket& socket) : server(server), socket(socket) {}
+
+        void run() {
+            server.counters_.connections++;
+            if (!handshake())
+                return;
+            while (true) {
+                char type = 0;
+                std::string body;
+                read_message(type, body);
+                Cursor c{body.data(), body.data() + body.size()};
+                switch (type) {
+                case 'P': on_parse(c); break;
+                case 'B': on_bind(c); break;
+                case 'D': on_describe(c); break;
+                case 'E': on_execute(c); break;
+                case 'C': on_close(c); break;
+                case 'S':
+                    server.counters_.syncs++;
+                    failed = false;
+                    portals.erase("");
+                    ready();
+                    flush();
+                    break;
+                case 'H': flush(); break;
+                case 'Q': on_simple_query(c); break;
+                case 'X': return;
+                default: error("08P01", std::string("unsupported message ") + type);
+                }
+            }
+        }
+
+    private:
+        struct Cursor {
+            const char* p;
+            const char* end;
+            std::int32_t int32() {
+                std::uint32_t v = 0;
+                for (int i = 0; i < 4; ++i)
+                    v = v << 8 | static_cast<unsigned char>(*p++);
+                return static_cast<std::int32_t>(v);
+            }
+            std::int16_t int16() {
+                std::uint16_t v = static_cast<std::uint16_t>(static_cast<unsigned char>(p[0]) << 8 | static_cast<unsigned char>(p[1]));
+                p += 2;
+                return static_cast<std::int16_t>(v);
+            }
+            std::string cstring() {
+                std::string s(p);
+                p += s.size() + 1;
+                return s;
+            }
+        };
+
+        bool handshake() {
+            std::string body;
+            while (true) {
+                read_exact(4, body);
+                std::int32_t length = Cursor{body.data(), body.data() + 4}.int32();
+                read_exact(static_cast<std::size_t>(length - 4), body);
+                Cursor c{body.data(), body.data() + body.size()};
+                std::int32_t code = c.int32();
+                if (code == 80877103) {  // SSLRequest: decline
+                    send_raw("N");
+                    continue;
+                }
+                while (c.p < c.end && *c.p) {
+                    std::string key = c.cstring();
+                    std::string value = c.cstring();
+                    if (key == "user")
+                        user = value;
+                }
+                break;
+            }
+            if (!authenticate())
+                return false;
+            parameter_status("server_version", "16.0");
+            parameter_status("client_encoding", "UTF8");
+            begin('K');
+            put_int32(4242);
+            put_int32(2424);
+            end();
+            ready();
+            flush();
+            return true;
+        }
+
+        bool authenticate() {
+            const Options& opts = server.options_;
+            if (opts.auth == Auth::Trust) {
+                auth_ok();
+                return true;
+            }
+            char type;
+            std::string body;
+            if (opts.auth == Auth::Cleartext || opts.auth == Auth::Md5) {
+                std::string salt = Crypto::random_bytes(4);
+                begin('R');
+                put_int32(opts.auth == Auth::Cleartext ? 3 : 5);
+                if (opts.auth == Auth::Md5)
+                    out += salt;
+                end();
+                flush();
+                read_message(type, body);
+                std::string password(body.c_str());
+                std::string expected =
+                    opts.auth == Auth::Cleartext
+                        ? opts.password
+                        : "md5" + Crypto::hex(Crypto::md5(Crypto::hex(Crypto::md5(opts.password + user)) + salt));
+                if (user != opts.user || password != expected)
+                    return auth_failed();
+                auth_ok();
+                return true;
+            }
+
+            begin('R');
+            put_int32(10);
+            put_cstring("SCRAM-SHA-256");
+            out += '\0';
+            end();
+            flush();
+            read_message(type, body);
+            Cursor c{body.data(), body.data() + body.size()};
+            if (c.cstring() != "SCRAM-SHA-256")
+                return auth_failed();
+            std::int32_t length = c.int32();
+            std::string client_first(c.p, static_cast<std::size_t>(length));
+            std::string client_first_bare = client_first.substr(client_first.find(",,") + 2);
+            std::string client_nonce = attribute(client_first_bare, 'r');
+            std::string nonce = client_nonce + Crypto::base64_encode(Crypto::random_bytes(18));
+            std::string salt = Crypto::random_bytes(16);
+            std::string server_first = "r=" + nonce + ",s=" + Crypto::base64_encode(salt) + ",i=4096";
+            begin('R');
+            put_int32(11);
+            out += server_first;
+            end();
+            flush();
+
+            read_message(type, body);
+            std::string client_final = body;
+            std::string without_proof = client_final.substr(0, client_final.find(",p="));
+            std::string proof = Crypto::base64_decode(attribute(client_final, 'p'));
+            std::string salted = Crypto::pbkdf2_hmac_sha256(opts.password, salt, 4096);
+            std::string stored_key = Crypto::sha256(Crypto::hmac_sha256(salted, "Client Key"));
+            std::string auth_message = client_first_bare + "," + server_first + "," + without_proof;
+            std::string signature = Crypto::hmac_sha256(stored_key, auth_message);
+            std::string client_key = proof;
+            for (std::size_t i = 0; i < client_key.size() && i < signature.size(); ++i)
+                client_key[i] = static_cast<char>(client_key[i] ^ signature[i]);
+            if (attribute(without_proof, 'r') != nonce || Crypto::sha256(client_key) != stored_key)
+                return auth_failed();
+            begin('R');
+            put_int32(12);
+            out += "v=" + Crypto::base64_encode(
+                              Crypto::hmac_sha256(Crypto::hmac_sha256(salted, "Server Key"), auth_message));
+            end();
+            auth_ok();
+            return true;
+        }
+
+        static std::string attribute(const std::string& message, char name) {
+            std::string key = std::string(1, name) + "=";
+            std::size_t pos = message.compare(0, 2, key) == 0 ? 0 : message.find("," + key);
+            if (pos == std::string::npos)
+                return "";
+            if (pos > 0)
+                ++pos;
+            std::size_t end = message.find(',', pos);
+            return message.substr(pos + 2, end == std::string::npos ? std::string::npos : end - pos - 2);
+        }
+
+        void auth_ok() {
+            begin('R');
+            put_int32(0);
+            end();
+        }
+
+        bool auth_failed() {
+            error("28P01", "password authentication failed for user \"" + user + "\"");
+            flush();
+            return false;
+        }
+
+        void on_parse(Cursor& c) {
+            server.counters_.parses++;
+            std::string name = c.cstring();
+            std::string sql = c.cstring();
+            if (failed)
+                return;
+            if (!name.empty() && statements.count(name))
+                return error("42P05", "prepared statement \"" + name + "\" already exists");
+            statements[name] = Statement{sql, std::nullopt};
+            begin('1');
+            end();
+        }
+
+        void on_bind(Cursor& c) {
+            server.counters_.binds++;
+            std::string portal = c.cstring();
+            std::string statement = c.cstring();
+            if (failed)
+                return;
+            auto it = statements.find(statement);
+            if (it == statements.end())
+                return error("26000", "prepared statement \"" + statement + "\" does not exist");
+            std::int16_t formats = c.int16();
+            c.p += 2 * formats;
+            Params params(static_cast<std::size_t>(c.int16()));
+            for (auto& param : params) {
+                std::int32_t length = c.int32();
+                if (length >= 0) {
+                    param = std::string(c.p, static_cast<std::size_t>(length));
+                    c.p += length;
+                }
+            }
+            Portal p;
+            if (!run(it->second.sql, params, p.result))
+                return;
+            if (it->second.columns && *it->second.columns != p.result.columns)
+                return error("0A000", "cached plan must not change result type");
+            portals[portal] = std::move(p);
+            begin('2');
+            end();
+        }
+
+        void on_describe(Cursor& c) {
+            char kind = *c.p++;
+            std::string name = c.cstring();
+            if (failed)
+                return;
+            if (kind == 'S') {
+                auto it = statements.find(name);
+                if (it == statements.end())
+                    return error("26000", "prepared statement \"" + name + "\" does not exist");
+                // Describe by running the handler with all-NULL parameters;
+                // transaction control is described without being run.
+                Params params(placeholder_count(it->second.sql));
+                Result result;
+                if (!is_transaction_control(it->second.sql) && !run(it->second.sql, params, result))
+                    return;
+                it->second.columns = result.columns;
+                begin('t');
+                put_int16(static_cast<std::int16_t>(params.size()));
+                for (std::size_t i = 0; i < params.size(); ++i)
+                    put_int32(25);
+                end();
+                row_description(result);
+                return;
+            }
+            auto it = portals.find(name);
+            if (it == portals.end())
+                return error("34000", "portal \"" + name + "\" does not exist");
+            row_description(it->second.result);
+        }
+
+        void on_execute(Cursor& c) {
+            server.counters_.executes++;
+            std::string name = c.cstring();
+            std::int32_t max_rows = c.int32();
+            if (failed)
+                return;
+            auto it = portals.find(name);
+            if (it == portals.end())
+                return error("34000", "portal \"" + name + "\" does not exist");
+            Portal& portal = it->second;
+            std::size_t end_row = portal.result.rows.size();
+            if (max_rows > 0)
+                end_row = std::min(end_row, portal.next_row + static_cast<std::size_t>(max_rows));
+            for (; portal.next_row < end_row; ++portal.next_row)
+                data_row(portal.result.rows[portal.next_row]);
+            if (portal.next_row < portal.result.rows.size()) {
+                begin('s');
+                end();
+            } else {
+                command_complete(portal.result);
+            }
+        }
+
+        void on_close(Cursor& c) {
+            char kind = *c.p++;
+            std::string name = c.cstring();
+            if (failed)
+                return;
+            if (kind == 'S')
+                statements.erase(name);
+            else
+                portals.erase(name);
+            begin('3');
+            end();
+        }
+
+        void on_simple_query(Cursor& c) {
+            server.counters_.simple_queries++;
+            std::string sql = c.cstring();
+            if (first_word(sql) == "COPY" && status != 'E') {
+                on_copy(sql);
+                failed = false;
+                ready();
+                flush();
+                return;
+            }
+            Result result;
+            if (run(sql, {}, result)) {
+                if (!result.columns.empty())
+                    row_description(result);
+                for (const auto& row : result.rows)
+                    data_row(row);
+                command_complete(result);
+            }
+            failed = false;
+            ready();
+            flush();
+        }
+
+        // Accepts only `COPY ... FROM STDIN (FORMAT binary)`, checking the
+        // signature, per-tuple field counts and the trailer as data arrives.
+        void on_copy(const std::string& sql) {
+            std::size_t open = sql.find('(');
+            std::size_t close = sql.find(')', open);
+            if (open == std::string::npos || close == std::string::npos || sql.find("FORMAT binary") == std::string::npos) {
+                error("0A000", "only binary COPY FROM STDIN with a column list is supported");
+                return;
+            }
+            std::int16_t fields = static_cast<std::int16_t>(std::count(sql.begin() + open, sql.begin() + close, ',') + 1);
+            begin('G');
+            out += '\1';
+            put_int16(fields);
+            for (std::int16_t i = 0; i < fields; ++i)
+                put_int16(1);
+            end();
+            flush();
+
+            static const char signature[] = "PGCOPY\n\xff\r\n\0";
+            std::string data;
+            std::size_t pos = 0;
+            bool header = false, trailer = false;
+            std::uint64_t rows = 0;
+            std::string copy_error;
+            Params row;
+            while (true) {
+                char type = 0;
+                std::string body;
+                read_message(type, body);
+                if (type == 'f') {
+                    error("57014", "COPY from stdin failed: " + std::string(body.c_str()));
+                    return;
+                }
+                if (type == 'c')
+                    break;
+                if (type != 'd') {
+                    error("08P01", std::string("unexpected message during COPY ") + type);
+                    return;
+                }
+                if (!copy_error.empty() || trailer)
+                    continue;
+                data.erase(0, pos);
+                pos = 0;
+                data += body;
+                if (!header) {
+                    if (data.size() < 19)
+                        continue;
+                    if (data.compare(0, 11, signature, 11) != 0)
+                        copy_error = "COPY file signature not recognized";
+                    header = true;
+                    pos = 19;
+                }
+                // Consume every complete tuple buffered so far.
+                while (copy_error.empty() && data.size() - pos >= 2) {
+                    Cursor c{data.data() + pos, data.data() + data.size()};
+                    std::int16_t count = c.int16();
+                    if (count == -1) {
+                        trailer = true;
+                        break;
+                    }
+                    if (count != fields) {
+                        copy_error = "row field count is " + std::to_string(count) + ", expected " + std::to_string(fields);
+                        break;
+                    }
+                    row.clear();
+                    bool complete = true;
+                    for (std::int16_t i = 0; i < count && complete; ++i) {
+                        if (c.end - c.p < 4) {
+                            complete = false;
+                            break;
+                        }
+                        std::int32_t length = c.int32();
+                        if (length < 0) {
+                            row.emplace_back();
+                        } else if (c.end - c.p < length) {
+                            complete = false;
+                        } else {
+                            row.emplace_back(std::string(c.p, static_cast<std::size_t>(length)));
+                            c.p += length;
+                        }
+                    }
+                    if (!complete)
+                        break;
+                    pos = static_cast<std::size_t>(c.p - data.data());
+                    ++rows;
+                    if (server.copy_handler_)
+                        server.copy_handler_(sql, row);
+                }
+            }
+            if (copy_error.empty() && !trailer)
+                copy_error = "COPY ended without the file trailer";
+            if (!copy_error.empty()) {
+                error("22P04", copy_error);
+                return;
+            }
+            server.counters_.copy_rows += rows;
+            Result result;
+            result.command = "COPY " + std::to_string(rows);
+            command_complete(result);
+        }
+
+        static std::size_t placeholder_count(const std::string& sql) {
+            std::size_t count = 0;
+            for (std::size_t i = 0; i + 1 < sql.size(); ++i) {
+                if (sql[i] == '$' && std::isdigit(static_cast<unsigned char>(sql[i + 1])))
+                    count = std::max(count, static_cast<std::size_t>(std::atoi(sql.c_str() + i + 1)));
+            }
+            return count;
+        }
+
+        static std::string first_word(const std::string& sql) {
+            std::string word = sql.substr(0, sql.find_first_of(" ;"));
+            std::transform(word.begin(), word.end(), word.begin(), [](unsigned char ch) { return std::toupper(ch); });
+            return word;
+        }
+
+        static bool is_transaction_control(const std::string& sql) {
+            std::string word = first_word(sql);
+            return word == "BEGIN" || word == "START" || word == "COMMIT" || word == "END" || word == "ROLLBACK";
+        }
+
+        // Applies transaction bookkeeping, then asks the handler for a result.
+        bool run(const std::string& sql, const Params& params, Result& result) {
+            std::string word = first_word(sql);
+            if (word == "BEGIN" || word == "START") {
+                status = 'T';
+                result.command = "BEGIN";
+                return true;
+            }
+            if (word == "COMMIT" || word == "END") {
+                result.command = status == 'E' ? "ROLLBACK" : "COMMIT";
+                status = 'I';
+                return true;
+            }
+            if (word == "ROLLBACK") {
+                status = 'I';
+                result.command = "ROLLBACK";
+                return true;
+            }
+            if (status == 'E') {
+                error("25P02", "current transaction is aborted, commands ignored until end of transaction block");
+                return false;
+            }
+            try {
+                result = server.handler_(sql, params);
+            } catch (const Error& e) {
+                error(e.sqlstate, e.message);
+                return false;
+            }
+            return true;
+        }
+
+        void row_description(const Result& result) {
+            if (result.columns.empty()) {
+                begin('n');
+                end();
+                return;
+            }
+            begin('T');
+            put_int16(static_cast<std::int16_t>(result.columns.size()));
+            for (std::size_t i = 0; i < result.columns.size(); ++i) {
+                put_cstring(result.columns[i]);
+                put_int32(0);
+                put_int16(0);
+                put_int32(static_cast<std::int32_t>(i < result.types.size() ? result.types[i] : 25));
+                put_int16(-1);
+                put_int32(-1);
+                put_int16(0);
+            }
+            end();
+        }
+
+        void data_row(const std::vector<std::optional<std::string>>& row) {
+            begin('D');
+            put_int16(static_cast<std::int16_t>(row.size()));
+            for (const auto& value : row) {
+                if (value) {
+                    put_int32(static_cast<std::int32_t>(value->size()));
+                    out += *value;
+                } else {
+                    put_int32(-1);
+                }
+            }
+            end();
+        }
+
+        void command_complete(const Result& result) {
+            begin('C');
+            put_cstring(result.command.empty() ? "SELECT " + std::to_string(result.rows.size()) : result.command);
+            end();
+        }
+
+        void error(const std::string& sqlstate, const std::string& message) {
+            begin('E');
+            out += 'S';
+            put_cstring("ERROR");
+            out += 'C';
+            put_cstring(sqlstate);
+            out += 'M';
+            put_cstring(message);
+            out += '\0';
+            end();
+            failed = true;
+            if (status == 'T')
+                status = 'E';
+        }
+
+        void parameter_status(const std::string& name, const std::string& value) {
+            begin('S');
+            put_cstring(name);
+            put_cstring(value);
+            end();
+        }
+
+        void ready() {
+            begin('Z');
+            out += status;
+            end();
+        }
+
+        void begin(char type) {
+            out += type;
+            start = out.size();
+            out.append(4, '\0');
+        }
+
+        void end() {
+            std::uint32_t length = static_cast<std::uint32_t>(out.size() - start);
+            for (int i = 0; i < 4; ++i)
+                out[start + i] = static_cast<char>((length >> (24 - 8 * i)) & 0xff);
+        }
+
+        void put_int32(std::int32_t value) {
+            for (int shift = 24; shift >= 0; shift -= 8)
+                out += static_cast<char>((static_cast<std::uint32_t>(value) >> shift) & 0xff);
+        }
+
+        void put_int16(std::int16_t value) {
+            out += static_cast<char>((value >> 8) & 0xff);
+            out += static_cast<char>(value & 0xff);
+        }
+
+        void put_cstring(const std::string& value) {
+            out += value;
+            out += '\0';
+        }
+
+        void send_raw(const std::string& data) {
+            socket.write_all(data);
+            server.counters_.bytes_out += data.size();
+        }
+
+        void flush() {
+            if (out.empty())
+                return;
+            if (auto latency = server.latency_us_.load(std::memory_order_relaxed))
+                std::this_thread::sleep_for(std::chrono::microseconds(latency));
+            send_raw(out);
+            out.clear();
+        }
+
+        void read_exact(std::size_t size, std::string& into) {
+            while (in.size() - in_pos < size) {
+                char buffer[16384];
+                std::size_t got = socket.read_some(buffer, sizeof(buffer));
+                server.counters_.bytes_in += got;
+                in.erase(0, in_pos);
+                in_pos = 0;
+                in.append(buffer, got);
+            }
+            into.assign(in, in_pos, size);
+            in_pos += size;
+        }
+
+        void read_message(char& type, std::string& body) {
+            std::string header;
+            read_exact(5, header);
+            type = header[0];
+            std::int32_t length = Cursor{header.data() + 1, header.data() + 5}.int32();
+            read_exact(static_cast<std::size_t>(length - 4), body);
+        }
+
+        FakePostgresServer& server;
+        Socket& socket;
+        std::string user;
+        std::string in;
+        std::size_t in_pos = 0;
+        std::string out;
+        std::size_t start = 0;
+        std::map<std::string, Statement> statements;
+        std::map<std::string, Portal> portals;
+        char status = 'I';
+        bool failed = false;
+    };
+
+    Handler handler_;
+    CopyHandler copy_handler_;
+    Options options_;
+    Counters counters_;
+    std::atomic<std::int64_t> latency_us_{0};
+    FakeTcpServer server_;
+};
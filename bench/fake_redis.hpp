@@ -0,0 +1,712 @@
+#pragma once
+// In-process stand-in for a Redis server, speaking RESP2 and RESP3 (HELLO,
+// AUTH, SELECT, MULTI/EXEC, CLIENT TRACKING ... BCAST and the string
+// commands RedisPrimitives uses) over an in-memory keyspace; FakeRedisCluster
+// joins several into a Redis Cluster. Like Redis it
+// executes every complete command in what it has read before replying, so
+// pipelined commands share one write; the configured latency is added once
+// per such batch, modelling a network round trip. Counters report commands
+// and round trips per operation.
+#include "fake_server.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class FakeRedisServer {
+public:
+    struct Options {
+        // Set to require AUTH (or HELLO ... AUTH) before any other command.
+        std::string password;
+        // false answers HELLO with an unknown command error, as Redis 5 does.
+        bool resp3 = true;
+    };
+
+    struct Counters {
+        std::atomic<std::uint64_t> connections{0};
+        std::atomic<std::uint64_t> commands{0};
+        std::atomic<std::uint64_t> round_trips{0};
+        std::atomic<std::uint64_t> bytes_in{0};
+        std::atomic<std::uint64_t> bytes_out{0};
+    };
+
+    FakeRedisServer() : FakeRedisServer(Options()) {}
+
+    explicit FakeRedisServer(Options options)
+        : options_(std::move(options)), server_([this](Socket& socket) { Session(*this, socket).run(); }) {}
+
+    int port() const { return server_.port(); }
+    Counters& counters() { return counters_; }
+
+    // Added before every batch of replies, to model network or server delay.
+    void set_latency(std::chrono::microseconds latency) { latency_us_ = latency.count(); }
+
+    // Direct access to the keyspace of database `db`, for seeding and checks.
+    void set(const std::string& key, const std::string& value, int db = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        databases_[db][key] = Entry{value, {}};
+    }
+
+    std::size_t size(int db = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return databases_[db].size();
+    }
+
+    // The keys `match` accepts, with their values but not their TTLs.
+    std::vector<std::pair<std::string, std::string>> copy(const std::function<bool(const std::string&)>& match, int db = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::pair<std::string, std::string>> copied;
+        for (const auto& entry : databases_[db]) {
+            if (match(entry.first))
+                copied.emplace_back(entry.first, entry.second.value);
+        }
+        return copied;
+    }
+
+    // Removes and returns the keys `match` accepts, without their TTLs.
+    std::vector<std::pair<std::string, std::string>> take(const std::function<bool(const std::string&)>& match, int db = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::pair<std::string, std::string>> taken;
+        Keyspace& keys = databases_[db];
+        for (auto it = keys.begin(); it != keys.end();) {
+            if (!match(it->first)) {
+                ++it;
+                continue;
+            }
+            taken.emplace_back(it->first, std::move(it->second.value));
+            it = keys.erase(it);
+        }
+        return taken;
+    }
+
+    // Cluster key slot: CRC16 (XMODEM) of the key or its {hash tag}, mod 16384.
+    static int hash_slot(const std::string& key) {
+        std::size_t begin = 0, end = key.size();
+        auto open = key.find('{');
+        if (open != std::string::npos) {
+            auto close = key.find('}', open + 1);
+            if (close != std::string::npos && close > open + 1) {
+                begin = open + 1;
+                end = close;
+            }
+        }
+        std::uint16_t crc = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+            crc ^= static_cast<std::uint16_t>(static_cast<unsigned char>(key[i]) << 8);
+            for (int bit = 0; bit < 8; ++bit)
+                crc = static_cast<std::uint16_t>(crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1);
+        }
+        return crc & 16383;
+    }
+
+    enum Presence { NoKeys, SomeKeys, AllKeys };
+    // For a cluster node: given the slot of a command's keys, whether ASKING
+    // preceded it and how many of the keys this node holds, the error to
+    // answer instead (MOVED, ASK, TRYAGAIN), or "" to run it.
+    using Router = std::function<std::string(int slot, bool asking, Presence present)>;
+
+    // Makes this a cluster node; `slots` encodes the CLUSTER SLOTS reply.
+    // Call before connecting.
+    void join_cluster(Router route, std::function<std::string()> slots) {
+        route_ = std::move(route);
+        slots_reply_ = std::move(slots);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::string value;
+        // Default-constructed for keys without a TTL.
+        Clock::time_point expires;
+    };
+
+    using Keyspace = std::unordered_map<std::string, Entry>;
+
+    class Session {
+    public:
+        Session(FakeRedisServer& server, Socket& socket) : server(server), socket(socket) {}
+
+        ~Session() {
+            std::lock_guard<std::mutex> lock(server.trackers_mutex_);
+            server.trackers_.erase(std::remove(server.trackers_.begin(), server.trackers_.end(), this), server.trackers_.end());
+        }
+
+        void run() {
+            server.counters_.connections++;
+            authenticated = server.options_.password.empty();
+            std::vector<std::string> args;
+            while (true) {
+                char buffer[16384];
+                std::size_t got = socket.read_some(buffer, sizeof(buffer));
+                server.counters_.bytes_in += got;
+                in.append(buffer, got);
+                std::string out;
+                while (parse(args)) {
+                    server.counters_.commands++;
+                    if (!execute(args, out))
+                        return;
+                }
+                in.erase(0, in_pos);
+                in_pos = 0;
+                if (!changed.empty() || flushed)
+                    server.invalidate(changed, flushed);
+                changed.clear();
+                flushed = false;
+                if (out.empty())
+                    continue;
+                if (auto latency = server.latency_us_.load(std::memory_order_relaxed))
+                    std::this_thread::sleep_for(std::chrono::microseconds(latency));
+                std::lock_guard<std::mutex> lock(write_mutex);
+                socket.write_all(out);
+                server.counters_.round_trips++;
+                server.counters_.bytes_out += out.size();
+            }
+        }
+
+        // Sends a tracking session an invalidation push for the keys it
+        // watches; a nil key list stands for a flush.
+        void push_invalidation(const std::vector<std::string>& keys, bool flush) {
+            std::vector<const std::string*> watched;
+            for (const auto& key : keys) {
+                bool match = prefixes.empty();
+                for (const auto& prefix : prefixes)
+                    match = match || key.compare(0, prefix.size(), prefix) == 0;
+                if (match)
+                    watched.push_back(&key);
+            }
+            if (!flush && watched.empty())
+                return;
+            std::string push = ">2\r\n";
+            bulk(push, "invalidate");
+            if (flush) {
+                push += "_\r\n";
+            } else {
+                push += "*" + std::to_string(watched.size()) + "\r\n";
+                for (const std::string* key : watched)
+                    bulk(push, *key);
+            }
+            std::lock_guard<std::mutex> lock(write_mutex);
+            try {
+                socket.write_all(push);
+            } catch (const std::exception&) {
+                // The session is going away; its own thread cleans up.
+            }
+        }
+
+    private:
+        // One complete command from `in`, or false (consuming nothing) if it
+        // has not all arrived yet.
+        bool parse(std::vector<std::string>& args) {
+            std::size_t pos = in_pos;
+            auto number = [&](char prefix, long long& value) {
+                if (pos >= in.size())
+                    return false;
+                if (in[pos] != prefix)
+                    throw std::runtime_error("Expected a RESP array of bulk strings");
+                std::size_t end = in.find("\r\n", pos);
+                if (end == std::string::npos)
+                    return false;
+                value = std::stoll(in.substr(pos + 1, end - pos - 1));
+                pos = end + 2;
+                return true;
+            };
+            long long count = 0;
+            if (!number('*', count))
+                return false;
+            args.clear();
+            for (long long i = 0; i < count; ++i) {
+                long long length = 0;
+                if (!number('$', length) || in.size() - pos < static_cast<std::size_t>(length) + 2)
+                    return false;
+                args.push_back(in.substr(pos, static_cast<std::size_t>(length)));
+                pos += static_cast<std::size_t>(length) + 2;
+            }
+            in_pos = pos;
+            return true;
+        }
+
+        // Appends the reply to `out`; false closes the connection (QUIT).
+        bool execute(std::vector<std::string>& args, std::string& out) {
+            if (args.empty())
+                return error(out, "ERR empty command");
+            std::string name = args[0];
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+            if (name == "QUIT") {
+                simple(out, "OK");
+                socket.write_all(out);
+                return false;
+            }
+            if (name == "HELLO")
+                return hello(args, out);
+            if (name == "AUTH") {
+                if (args.size() < 2 || args.back() != server.options_.password)
+                    return error(out, "WRONGPASS invalid username-password pair or user is disabled.");
+                authenticated = true;
+                return simple(out, "OK");
+            }
+            if (!authenticated)
+                return error(out, "NOAUTH Authentication required.");
+            if (name == "ASKING") {
+                asking = true;
+                return simple(out, "OK");
+            }
+            if (name == "CLUSTER") {
+                if (!server.slots_reply_)
+                    return error(out, "ERR This instance has cluster support disabled");
+                if (args.size() == 2 && upper(args[1]) == "SLOTS") {
+                    out += server.slots_reply_();
+                    return true;
+                }
+                return error(out, "ERR unknown subcommand");
+            }
+            if (name == "MULTI") {
+                if (in_multi)
+                    return error(out, "ERR MULTI calls can not be nested");
+                in_multi = true;
+                queue_failed = false;
+                queued.clear();
+                return simple(out, "OK");
+            }
+            if (name == "EXEC" || name == "DISCARD") {
+                if (!in_multi)
+                    return error(out, "ERR " + name + " without MULTI");
+                in_multi = false;
+                if (name == "DISCARD")
+                    return simple(out, "OK");
+                if (queue_failed)
+                    return error(out, "EXECABORT Transaction discarded because of previous errors.");
+                out += "*" + std::to_string(queued.size()) + "\r\n";
+                replaying = true;
+                for (auto& command : queued)
+                    execute(command, out);
+                replaying = false;
+                return true;
+            }
+            if (in_multi) {
+                // Only the commands this server knows are accepted; anything
+                // else fails the transaction, as a syntax error does in Redis.
+                static const char* known[] = {"GET", "SET", "DEL", "UNLINK", "EXISTS", "EXPIRE", "PEXPIRE", "TTL", "PTTL", "INCR", "MGET", "MSET"};
+                if (std::find(std::begin(known), std::end(known), name) == std::end(known)) {
+                    queue_failed = true;
+                    return error(out, "ERR unknown command '" + args[0] + "', with args beginning with: ");
+                }
+                if (redirected(name, args, out)) {
+                    queue_failed = true;
+                    return true;
+                }
+                queued.push_back(args);
+                return simple(out, "QUEUED");
+            }
+            if (redirected(name, args, out))
+                return true;
+            if (name == "PING")
+                return args.size() > 1 ? bulk(out, args[1]) : simple(out, "PONG");
+            if (name == "ECHO" && args.size() == 2)
+                return bulk(out, args[1]);
+            if (name == "SELECT" && args.size() == 2) {
+                db = std::stoi(args[1]);
+                return simple(out, "OK");
+            }
+            if (name == "CLIENT" && args.size() >= 3 && upper(args[1]) == "TRACKING") {
+                if (upper(args[2]) != "ON")
+                    return simple(out, "OK");
+                if (protocol != 3)
+                    return error(out, "ERR Client tracking without REDIRECT needs RESP3");
+                for (std::size_t i = 3; i < args.size(); ++i) {
+                    if (upper(args[i]) == "PREFIX" && i + 1 < args.size())
+                        prefixes.push_back(args[++i]);
+                }
+                std::lock_guard<std::mutex> lock(server.trackers_mutex_);
+                server.trackers_.push_back(this);
+                return simple(out, "OK");
+            }
+            if (name == "CLIENT")
+                return simple(out, "OK");
+
+            std::lock_guard<std::mutex> lock(server.mutex_);
+            Keyspace& keys = server.databases_[db];
+            auto now = Clock::now();
+            auto live = [&](const std::string& key) -> Entry* {
+                auto it = keys.find(key);
+                if (it == keys.end())
+                    return nullptr;
+                if (it->second.expires != Clock::time_point() && it->second.expires <= now) {
+                    keys.erase(it);
+                    return nullptr;
+                }
+                return &it->second;
+            };
+            if (name == "GET" && args.size() == 2) {
+                Entry* entry = live(args[1]);
+                return entry ? bulk(out, entry->value) : null(out);
+            }
+            if (name == "SET" && args.size() >= 3) {
+                Clock::time_point expires;
+                bool nx = false, xx = false;
+                for (std::size_t i = 3; i < args.size(); ++i) {
+                    std::string option = args[i];
+                    std::transform(option.begin(), option.end(), option.begin(), [](unsigned char c) { return std::toupper(c); });
+                    if ((option == "EX" || option == "PX") && i + 1 < args.size()) {
+                        long long amount = std::stoll(args[++i]);
+                        if (amount <= 0)
+                            return error(out, "ERR invalid expire time in 'set' command");
+                        expires = now + (option == "EX" ? std::chrono::milliseconds(amount * 1000) : std::chrono::milliseconds(amount));
+                    } else if (option == "NX") {
+                        nx = true;
+                    } else if (option == "XX") {
+                        xx = true;
+                    } else {
+                        return error(out, "ERR syntax error");
+                    }
+                }
+                bool present = live(args[1]) != nullptr;
+                if ((nx && present) || (xx && !present))
+                    return null(out);
+                keys[args[1]] = Entry{args[2], expires};
+                changed.push_back(args[1]);
+                return simple(out, "OK");
+            }
+            if ((name == "DEL" || name == "UNLINK" || name == "EXISTS") && args.size() >= 2) {
+                long long n = 0;
+                for (std::size_t i = 1; i < args.size(); ++i) {
+                    if (live(args[i])) {
+                        ++n;
+                        if (name != "EXISTS") {
+                            keys.erase(args[i]);
+                            changed.push_back(args[i]);
+                        }
+                    }
+                }
+                return integer(out, n);
+            }
+            if ((name == "EXPIRE" || name == "PEXPIRE") && args.size() == 3) {
+                Entry* entry = live(args[1]);
+                if (!entry)
+                    return integer(out, 0);
+                long long amount = std::stoll(args[2]);
+                entry->expires = now + (name == "EXPIRE" ? std::chrono::milliseconds(amount * 1000) : std::chrono::milliseconds(amount));
+                changed.push_back(args[1]);
+                return integer(out, 1);
+            }
+            if ((name == "TTL" || name == "PTTL") && args.size() == 2) {
+                Entry* entry = live(args[1]);
+                if (!entry)
+                    return integer(out, -2);
+                if (entry->expires == Clock::time_point())
+                    return integer(out, -1);
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(entry->expires - now).count();
+                return integer(out, name == "TTL" ? left / 1000 : left);
+            }
+            if (name == "INCR" && args.size() == 2) {
+                Entry* entry = live(args[1]);
+                long long value = entry ? std::stoll(entry->value) + 1 : 1;
+                if (entry)
+                    entry->value = std::to_string(value);
+                else
+                    keys[args[1]] = Entry{std::to_string(value), {}};
+                changed.push_back(args[1]);
+                return integer(out, value);
+            }
+            if (name == "MGET" && args.size() >= 2) {
+                out += "*" + std::to_string(args.size() - 1) + "\r\n";
+                for (std::size_t i = 1; i < args.size(); ++i) {
+                    Entry* entry = live(args[i]);
+                    entry ? bulk(out, entry->value) : null(out);
+                }
+                return true;
+            }
+            if (name == "MSET" && args.size() >= 3 && args.size() % 2 == 1) {
+                for (std::size_t i = 1; i < args.size(); i += 2) {
+                    keys[args[i]] = Entry{args[i + 1], {}};
+                    changed.push_back(args[i]);
+                }
+                return simple(out, "OK");
+            }
+            if (name == "DBSIZE")
+                return integer(out, static_cast<long long>(keys.size()));
+            if (name == "FLUSHDB") {
+                keys.clear();
+                flushed = true;
+                return simple(out, "OK");
+            }
+            return error(out, "ERR unknown command '" + args[0] + "', with args beginning with: ");
+        }
+
+        // On a cluster node, appends the error replacing a command on keys
+        // of another slot, or of several.
+        bool redirected(const std::string& name, const std::vector<std::string>& args, std::string& out) {
+            bool was_asking = asking;
+            asking = false;
+            if (!server.route_ || replaying || args.size() < 2)
+                return false;
+            std::vector<const std::string*> keys;
+            static const char* single[] = {"GET", "SET", "EXPIRE", "PEXPIRE", "TTL", "PTTL", "INCR"};
+            if (name == "MSET") {
+                for (std::size_t i = 1; i < args.size(); i += 2)
+                    keys.push_back(&args[i]);
+            } else if (name == "MGET" || name == "DEL" || name == "UNLINK" || name == "EXISTS") {
+                for (std::size_t i = 1; i < args.size(); ++i)
+                    keys.push_back(&args[i]);
+            } else if (std::find(std::begin(single), std::end(single), name) != std::end(single)) {
+                keys.push_back(&args[1]);
+            } else {
+                return false;
+            }
+            int slot = hash_slot(*keys[0]);
+            for (const std::string* key : keys) {
+                if (hash_slot(*key) != slot)
+                    return error(out, "CROSSSLOT Keys in request don't hash to the same slot");
+            }
+            std::size_t present = 0;
+            {
+                std::lock_guard<std::mutex> lock(server.mutex_);
+                Keyspace& keyspace = server.databases_[db];
+                for (const std::string* key : keys)
+                    present += keyspace.count(*key);
+            }
+            std::string redirect =
+                server.route_(slot, was_asking, present == 0 ? NoKeys : present == keys.size() ? AllKeys : SomeKeys);
+            if (redirect.empty())
+                return false;
+            return error(out, redirect);
+        }
+
+        bool hello(const std::vector<std::string>& args, std::string& out) {
+            if (!server.options_.resp3)
+                return error(out, "ERR unknown command 'HELLO', with args beginning with: ");
+            int version = args.size() > 1 ? std::stoi(args[1]) : protocol;
+            if (version != 2 && version != 3)
+                return error(out, "NOPROTO unsupported protocol version");
+            for (std::size_t i = 2; i < args.size(); ++i) {
+                std::string option = args[i];
+                std::transform(option.begin(), option.end(), option.begin(), [](unsigned char c) { return std::toupper(c); });
+                if (option == "AUTH" && i + 2 < args.size()) {
+                    if (args[i + 2] != server.options_.password)
+                        return error(out, "WRONGPASS invalid username-password pair or user is disabled.");
+                    authenticated = true;
+                    i += 2;
+                } else if (option == "SETNAME" && i + 1 < args.size()) {
+                    ++i;
+                }
+            }
+            if (!authenticated)
+                return error(out, "NOAUTH HELLO must be called with the client already authenticated");
+            protocol = version;
+            out += protocol == 3 ? "%3\r\n" : "*6\r\n";
+            bulk(out, "server");
+            bulk(out, "redis");
+            bulk(out, "version");
+            bulk(out, "7.2.0");
+            bulk(out, "proto");
+            return integer(out, protocol);
+        }
+
+        static std::string upper(std::string text) {
+            std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::toupper(c); });
+            return text;
+        }
+
+        bool simple(std::string& out, const std::string& text) {
+            out += "+" + text + "\r\n";
+            return true;
+        }
+        bool error(std::string& out, const std::string& text) {
+            out += "-" + text + "\r\n";
+            return true;
+        }
+        bool integer(std::string& out, long long value) {
+            out += ":" + std::to_string(value) + "\r\n";
+            return true;
+        }
+        bool bulk(std::string& out, const std::string& value) {
+            out += "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+            return true;
+        }
+        bool null(std::string& out) {
+            out += protocol == 3 ? "_\r\n" : "$-1\r\n";
+            return true;
+        }
+
+        FakeRedisServer& server;
+        Socket& socket;
+        std::string in;
+        std::size_t in_pos = 0;
+        int protocol = 2;
+        int db = 0;
+        bool authenticated = false;
+        bool in_multi = false;
+        bool queue_failed = false;
+        // Running the commands of EXEC, which were routed when queued.
+        bool replaying = false;
+        bool asking = false;
+        std::vector<std::vector<std::string>> queued;
+        // Keys written by the current batch, announced to tracking sessions.
+        std::vector<std::string> changed;
+        bool flushed = false;
+        std::vector<std::string> prefixes;
+        std::mutex write_mutex;
+    };
+
+    void invalidate(const std::vector<std::string>& keys, bool flush) {
+        std::lock_guard<std::mutex> lock(trackers_mutex_);
+        for (Session* session : trackers_)
+            session->push_invalidation(keys, flush);
+    }
+
+    Options options_;
+    Counters counters_;
+    std::atomic<std::int64_t> latency_us_{0};
+    std::mutex mutex_;
+    std::map<int, Keyspace> databases_;
+    std::mutex trackers_mutex_;
+    std::vector<Session*> trackers_;
+    Router route_;
+    std::function<std::string()> slots_reply_;
+    FakeTcpServer server_;
+};
+
+// A Redis Cluster of FakeRedisServers on 127.0.0.1, the slots split evenly
+// between them. Nodes answer MOVED for slots they do not own, and a slot
+// can be resharded live: migrate_slot() has its owner answer ASK for keys
+// it no longer holds (TRYAGAIN when it holds some of a command's keys),
+// served by the importing node after ASKING, and move_slot() completes the
+// move.
+class FakeRedisCluster {
+public:
+    static constexpr int slot_count = 16384;
+
+    explicit FakeRedisCluster(int nodes, FakeRedisServer::Options options = FakeRedisServer::Options())
+        : owners_(slot_count), importing_(slot_count, -1) {
+        for (int i = 0; i < nodes; ++i)
+            servers_.push_back(std::make_unique<FakeRedisServer>(options));
+        for (int slot = 0; slot < slot_count; ++slot)
+            owners_[slot] = static_cast<int>(static_cast<long long>(slot) * nodes / slot_count);
+        for (int i = 0; i < nodes; ++i) {
+            servers_[i]->join_cluster(
+                [this, i](int slot, bool asking, FakeRedisServer::Presence present) { return route(i, slot, asking, present); },
+                [this] { return slots_reply(); });
+        }
+    }
+
+    int size() const { return static_cast<int>(servers_.size()); }
+    FakeRedisServer& node(int i) { return *servers_[i]; }
+    // "127.0.0.1:port" of every node, as seeds.
+    std::vector<std::string> addresses() const {
+        std::vector<std::string> out;
+        for (const auto& server : servers_)
+            out.push_back("127.0.0.1:" + std::to_string(server->port()));
+        return out;
+    }
+
+    int owner(int slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return owners_[slot];
+    }
+
+    void set_latency(std::chrono::microseconds latency) {
+        for (auto& server : servers_)
+            server->set_latency(latency);
+    }
+
+    // Seeds `key` on the node owning its slot.
+    void set(const std::string& key, const std::string& value) { servers_[owner(FakeRedisServer::hash_slot(key))]->set(key, value); }
+
+    // Starts moving `slot` to node `to`; keys stay where they are until
+    // migrate_keys() or move_slot() moves them.
+    void migrate_slot(int slot, int to) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        importing_[slot] = to;
+    }
+
+    // Moves the keys of a migrating `slot` that `match` accepts to the
+    // importing node, as MIGRATE does: each key is on one node or the other.
+    void migrate_keys(int slot, const std::function<bool(const std::string&)>& match) {
+        int from, to;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            from = owners_[slot];
+            to = importing_[slot];
+        }
+        if (to < 0)
+            return;
+        auto in_slot = [&](const std::string& key) { return FakeRedisServer::hash_slot(key) == slot && match(key); };
+        // Copied before they are removed, so a reader never finds them on neither node.
+        for (auto& entry : servers_[from]->copy(in_slot))
+            servers_[to]->set(entry.first, entry.second);
+        servers_[from]->take(in_slot);
+    }
+
+    // Hands `slot`, with its remaining keys, to node `to`.
+    void move_slot(int slot, int to) {
+        int from = owner(slot);
+        auto in_slot = [slot](const std::string& key) { return FakeRedisServer::hash_slot(key) == slot; };
+        for (auto& entry : servers_[from]->copy(in_slot))
+            servers_[to]->set(entry.first, entry.second);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            owners_[slot] = to;
+            importing_[slot] = -1;
+        }
+        servers_[from]->take(in_slot);
+    }
+
+private:
+    std::string address(int node) const { return "127.0.0.1:" + std::to_string(servers_[node]->port()); }
+
+    std::string route(int node, int slot, bool asking, FakeRedisServer::Presence present) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int owner = owners_[slot];
+        int importing = importing_[slot];
+        std::string where = std::to_string(slot) + " ";
+        if (node == owner) {
+            if (importing < 0 || present == FakeRedisServer::AllKeys)
+                return "";
+            if (present == FakeRedisServer::SomeKeys)
+                return "TRYAGAIN Multiple keys request during rehashing of slot";
+            return "ASK " + where + address(importing);
+        }
+        if (node == importing && asking)
+            return "";
+        return "MOVED " + where + address(owner);
+    }
+
+    // One entry per run of slots with the same owner.
+    std::string slots_reply() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::string> ranges;
+        for (int start = 0; start < slot_count;) {
+            int end = start;
+            while (end + 1 < slot_count && owners_[end + 1] == owners_[start])
+                ++end;
+            std::string host = "127.0.0.1";
+            std::string id = "node-" + std::to_string(owners_[start]);
+            ranges.push_back("*3\r\n:" + std::to_string(start) + "\r\n:" + std::to_string(end) + "\r\n*3\r\n$" +
+                             std::to_string(host.size()) + "\r\n" + host + "\r\n:" +
+                             std::to_string(servers_[owners_[start]]->port()) + "\r\n$" + std::to_string(id.size()) +
+                             "\r\n" + id + "\r\n");
+            start = end + 1;
+        }
+        std::string out = "*" + std::to_string(ranges.size()) + "\r\n";
+        for (const auto& range : ranges)
+            out += range;
+        return out;
+    }
+
+    std::mutex mutex_;
+    std::vector<int> owners_;
+    std::vector<int> importing_;
+    // Last, so the servers stop before the tables their sessions consult go.
+    std::vector<std::unique_ptr<FakeRedisServer>> servers_;
+};
@@ -0,0 +1,98 @@
+#pragma once
+// Loopback TCP server for the database benchmarks: accepts connections on
+// an ephemeral port and runs `session` for each one on its own thread.
+#include "../include/socket.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class FakeTcpServer {
+public:
+    using Session = std::function<void(Socket&)>;
+
+    explicit FakeTcpServer(Session session) : session_(std::move(session)) {
+        listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd_ < 0)
+            throw SocketError("socket() failed");
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t len = sizeof(addr);
+        if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listen_fd_, 128) != 0 ||
+            getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+            ::close(listen_fd_);
+            throw SocketError("cannot listen on loopback");
+        }
+        port_ = ntohs(addr.sin_port);
+        acceptor_ = std::thread([this] { accept_loop(); });
+    }
+
+    ~FakeTcpServer() {
+        stopping_ = true;
+        acceptor_.join();
+        ::close(listen_fd_);
+        std::vector<std::thread> sessions;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int fd : fds_) {
+                if (fd >= 0)
+                    ::shutdown(fd, SHUT_RDWR);
+            }
+            sessions.swap(sessions_);
+        }
+        for (auto& t : sessions)
+            t.join();
+    }
+
+    FakeTcpServer(const FakeTcpServer&) = delete;
+    FakeTcpServer& operator=(const FakeTcpServer&) = delete;
+
+    int port() const { return port_; }
+
+private:
+    void accept_loop() {
+        while (!stopping_) {
+            pollfd pfd{listen_fd_, POLLIN, 0};
+            if (::poll(&pfd, 1, 50) <= 0)
+                continue;
+            int fd = ::accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0)
+                continue;
+            std::lock_guard<std::mutex> lock(mutex_);
+            fds_.push_back(fd);
+            sessions_.emplace_back([this, fd] {
+                Socket socket(fd);
+                socket.set_timeout(std::chrono::hours(24));
+                try {
+                    session_(socket);
+                } catch (const std::exception&) {
+                    // Client went away or spoke garbage; just drop the session.
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto& open : fds_) {
+                    if (open == fd)
+                        open = -1;
+                }
+            });
+        }
+    }
+
+    Session session_;
+    int listen_fd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> stopping_{false};
+    std::thread acceptor_;
+    std::mutex mutex_;
+    std::vector<int> fds_;
+    std::vector<std::thread> sessions_;
+};
@@ -0,0 +1,330 @@
+// fastapi-cpp-bench: multi-threaded HTTP load generator for comparing
+// framework versions on loopback.
+//
+// Closed-loop mode (default) keeps one request in flight per thread.
+// Open-loop mode (--rate) issues requests on a fixed schedule and measures
+// latency from each request's intended start time, so a stalled server is
+// charged for the requests it delayed (coordinated-omission correction).
+// --in-process drives the example routes through TestClient instead of
+// sockets, isolating framework cost from the kernel's TCP stack.
+#include "../include/server.hpp"
+#include "../include/test_client.hpp"
+#include "../include/macros.hpp"
+#include "../include/validation.hpp"
+#include "../include/histogram.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifndef FASTAPI_CPP_BENCH_SCENARIO_DIR
+#define FASTAPI_CPP_BENCH_SCENARIO_DIR "bench/scenarios"
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 18080;
+    bool serve = true;
+    bool in_process = false;
+    int threads = 4;
+    double duration_s = 10.0;
+    double warmup_s = 1.0;
+    double rate = 0.0;
+    double expected_interval_us = 0.0;
+    std::vector<std::string> scenarios;
+    std::string output;
+};
+
+struct Scenario {
+    std::string name;
+    std::vector<httplib::Request> requests;
+    std::vector<TestClient::Headers> headers;
+};
+
+struct ThreadResult {
+    Histogram::Snapshot latency;
+    Histogram::Snapshot service_time;
+    std::uint64_t requests = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t non_2xx = 0;
+};
+
+// The example application's routes, served in-process unless --url is given.
+struct UserModel : public Validatable {
+    std::string name;
+    int age;
+    MODEL(UserModel, name, age);
+};
+
+Response get_hello() {
+    return Response(json{{"message", "Hello from FastAPI-C++!"}, {"version", "1.0.0"}});
+}
+
+Response get_user(int user_id) {
+    return Response(json{{"id", user_id},
+                         {"name", "User " + std::to_string(user_id)},
+                         {"message", "This is a sample user"}});
+}
+
+Response create_user(UserModel user) {
+    return Response(json{{"id", 123}, {"name", user.name}, {"age", user.age}, {"message", "User created successfully"}});
+}
+
+// Intentionally leaked: the detached server thread uses it until exit.
+Router& example_app() {
+    static Router& app = *[] {
+        Router& app = *new Router();
+        APP_GET("/", get_hello);
+        APP_GET("/users/{id}", get_user, Path<int>);
+        APP_POST("/users", create_user, Body<UserModel>);
+        return &app;
+    }();
+    return app;
+}
+
+void start_example_server(const std::string& host, int port) {
+    Router& app = example_app();
+    std::thread([&app, host, port] { FastApiCpp::run(app, host, port); }).detach();
+
+    httplib::Client probe(host, port);
+    for (int i = 0; i < 100; ++i) {
+        if (probe.Get("/"))
+            return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    throw std::runtime_error("in-process server did not start");
+}
+
+Scenario load_scenario(const std::string& name_or_path) {
+    std::ifstream in(name_or_path);
+    if (!in)
+        in.open(std::string(FASTAPI_CPP_BENCH_SCENARIO_DIR) + "/" + name_or_path + ".json");
+    if (!in)
+        throw std::runtime_error("scenario not found: " + name_or_path);
+
+    json doc = json::parse(in);
+    Scenario scenario;
+    scenario.name = doc.value("name", name_or_path);
+    for (const auto& r : doc.at("requests")) {
+        httplib::Request req;
+        req.method = r.value("method", "GET");
+        req.path = r.at("path").get<std::string>();
+        TestClient::Headers headers;
+        if (r.contains("headers")) {
+            for (const auto& h : r["headers"].items()) {
+                req.set_header(h.key(), h.value().get<std::string>());
+                headers[h.key()] = h.value().get<std::string>();
+            }
+        }
+        if (r.contains("body"))
+            req.body = r["body"].is_string() ? r["body"].get<std::string>() : r["body"].dump();
+        scenario.requests.push_back(std::move(req));
+        scenario.headers.push_back(std::move(headers));
+    }
+    if (scenario.requests.empty())
+        throw std::runtime_error("scenario has no requests: " + name_or_path);
+    return scenario;
+}
+
+void run_worker(const Options& opts, const Scenario& scenario, int thread_index, Clock::time_point start,
+                Clock::time_point measure_from, Clock::time_point stop, ThreadResult& result) {
+    httplib::Client client(opts.host, opts.port);
+    client.set_keep_alive(true);
+    client.set_tcp_nodelay(true);
+    TestClient in_process(example_app());
+
+    const bool open_loop = opts.rate > 0.0;
+    const auto interval = open_loop ? std::chrono::nanoseconds(static_cast<std::int64_t>(1e9 * opts.threads / opts.rate))
+                                    : std::chrono::nanoseconds(0);
+    const auto expected_interval_ns = static_cast<std::uint64_t>(opts.expected_interval_us * 1000.0);
+    // Stagger threads so the aggregate schedule is evenly spaced.
+    auto intended = start + interval * thread_index / (open_loop ? opts.threads : 1);
+    std::size_t next = static_cast<std::size_t>(thread_index);
+
+    while (true) {
+        if (open_loop) {
+            if (intended >= stop || Clock::now() >= stop)
+                break;
+            if (Clock::now() < intended)
+                std::this_thread::sleep_until(intended);
+        }
+        auto sent = Clock::now();
+        if (!open_loop) {
+            if (sent >= stop)
+                break;
+            intended = sent;
+        }
+
+        std::size_t index = next++ % scenario.requests.size();
+        const auto& req = scenario.requests[index];
+        int status = 0;
+        if (opts.in_process) {
+            status = in_process.request(req.method, req.path, req.body, scenario.headers[index]).status;
+        } else if (auto res = client.send(req)) {
+            status = res->status;
+        }
+        auto done = Clock::now();
+
+        if (intended >= measure_from) {
+            ++result.requests;
+            if (status == 0)
+                ++result.errors;
+            else if (status < 200 || status >= 300)
+                ++result.non_2xx;
+            auto latency = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(done - intended).count());
+            auto service = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(done - sent).count());
+            result.latency.record(latency);
+            result.service_time.record(service);
+            // HdrHistogram-style back-fill for closed-loop runs: a response slower
+            // than the expected interval hid the requests that would have been sent.
+            if (!open_loop && expected_interval_ns > 0) {
+                for (std::uint64_t missing = latency > expected_interval_ns ? latency - expected_interval_ns : 0;
+                     missing >= expected_interval_ns; missing -= expected_interval_ns)
+                    result.latency.record(missing);
+            }
+        }
+        if (open_loop)
+            intended += interval;
+    }
+}
+
+json percentiles_us(const Histogram::Snapshot& h) {
+    auto us = [](std::uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    return json{{"p50", us(h.percentile(50))},   {"p90", us(h.percentile(90))},
+                {"p99", us(h.percentile(99))},   {"p99.9", us(h.percentile(99.9))},
+                {"p99.99", us(h.percentile(99.99))}, {"max", us(h.max)},
+                {"mean", h.mean() / 1000.0}};
+}
+
+json run_scenario(const Options& opts, const Scenario& scenario) {
+    std::vector<ThreadResult> results(static_cast<std::size_t>(opts.threads));
+    std::vector<std::thread> workers;
+    auto start = Clock::now() + std::chrono::milliseconds(50);
+    auto measure_from = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opts.warmup_s));
+    auto stop = measure_from + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opts.duration_s));
+
+    for (int t = 0; t < opts.threads; ++t)
+        workers.emplace_back(run_worker, std::cref(opts), std::cref(scenario), t, start, measure_from, stop,
+                             std::ref(results[static_cast<std::size_t>(t)]));
+    for (auto& w : workers)
+        w.join();
+
+    ThreadResult total;
+    for (const auto& r : results) {
+        total.latency.merge(r.latency);
+        total.service_time.merge(r.service_time);
+        total.requests += r.requests;
+        total.errors += r.errors;
+        total.non_2xx += r.non_2xx;
+    }
+
+    return json{{"scenario", scenario.name},
+                {"mode", opts.rate > 0.0 ? "open-loop" : "closed-loop"},
+                {"transport", opts.in_process ? "in-process" : "tcp"},
+                {"threads", opts.threads},
+                {"target_rate_rps", opts.rate},
+                {"duration_s", opts.duration_s},
+                {"requests", total.requests},
+                {"errors", total.errors},
+                {"non_2xx", total.non_2xx},
+                {"throughput_rps", static_cast<double>(total.requests) / opts.duration_s},
+                {"latency_us", percentiles_us(total.latency)},
+                {"service_time_us", percentiles_us(total.service_time)}};
+}
+
+void usage() {
+    std::cerr << "usage: fastapi-cpp-bench [options]\n"
+                 "  --scenario NAME|PATH   scenario to run (repeatable; default: all bundled)\n"
+                 "  --url HOST:PORT        target an external server instead of the in-process example\n"
+                 "  --port N               port for the in-process server (default 18080)\n"
+                 "  --in-process           call the example routes through TestClient, no sockets\n"
+                 "  --threads N            client threads / connections (default 4)\n"
+                 "  --duration S           measured seconds per scenario (default 10)\n"
+                 "  --warmup S             unmeasured warm-up seconds (default 1)\n"
+                 "  --rate R               open-loop mode at R requests/s in total\n"
+                 "  --expected-interval-us N  closed-loop coordinated-omission correction\n"
+                 "  --output FILE          write JSON results to FILE instead of stdout\n";
+}
+
+Options parse_args(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::runtime_error("missing value for " + arg);
+            return argv[++i];
+        };
+        if (arg == "--scenario")
+            opts.scenarios.push_back(value());
+        else if (arg == "--url") {
+            std::string url = value();
+            auto colon = url.rfind(':');
+            if (colon == std::string::npos)
+                throw std::runtime_error("--url expects HOST:PORT");
+            opts.host = url.substr(0, colon);
+            opts.port = std::stoi(url.substr(colon + 1));
+            opts.serve = false;
+        } else if (arg == "--in-process") {
+            opts.in_process = true;
+            opts.serve = false;
+        } else if (arg == "--port")
+            opts.port = std::stoi(value());
+        else if (arg == "--threads")
+            opts.threads = std::max(1, std::stoi(value()));
+        else if (arg == "--duration")
+            opts.duration_s = std::stod(value());
+        else if (arg == "--warmup")
+            opts.warmup_s = std::stod(value());
+        else if (arg == "--rate")
+            opts.rate = std::stod(value());
+        else if (arg == "--expected-interval-us")
+            opts.expected_interval_us = std::stod(value());
+        else if (arg == "--output")
+            opts.output = value();
+        else if (arg == "--help" || arg == "-h") {
+            usage();
+            std::exit(0);
+        } else
+            throw std::runtime_error("unknown option " + arg);
+    }
+    if (opts.scenarios.empty())
+        opts.scenarios = {"static_get", "path_param", "json_post"};
+    return opts;
+}
+
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options opts = parse_args(argc, argv);
+        if (opts.serve)
+            start_example_server(opts.host, opts.port);
+
+        json report = json::array();
+        for (const auto& name : opts.scenarios) {
+            Scenario scenario = load_scenario(name);
+            std::cerr << "running " << scenario.name << " for " << opts.duration_s << "s\n";
+            report.push_back(run_scenario(opts, scenario));
+        }
+
+        if (opts.output.empty()) {
+            std::cout << report.dump(2) << std::endl;
+        } else {
+            std::ofstream out(opts.output);
+            out << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "fastapi-cpp-bench: " << e.what() << "\n";
+        usage();
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,768 @@
+// fastapi-cpp-microbench: component benchmarks for the framework's hot
+// primitives, reported as JSON so results can be tracked across releases.
+//
+//   fastapi-cpp-microbench [--filter SUBSTR] [--min-time-ms N] [--samples N]
+//                          [--output FILE] [--compare BASELINE.json] [--threshold PCT]
+//
+// With --compare, every benchmark slower than the baseline by more than the
+// threshold (default 10%) is reported and the exit status is 2.
+//
+// Heap allocations are counted through a replacement operator new and
+// reported per op. The alloc/ benchmarks carry a budget of bytes per op;
+// exceeding it makes the exit status 3.
+//
+// The check/ entries are pass/fail behaviour checks run once before the
+// benchmarks, e.g. of ConnectionPool; any failure makes the exit status 4.
+#include "../include/binding.hpp"
+#include "../include/connection_pool.hpp"
+#include "../include/json_codec.hpp"
+#include "../include/params.hpp"
+#include "../include/router.hpp"
+#include "../include/test_client.hpp"
+#include "../include/validation.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Allocations made on this thread while `active`; benchmark bodies pause
+// counting around their own setup with Uncounted.
+struct AllocationCounter {
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+    bool active = false;
+};
+
+thread_local AllocationCounter allocation_counter;
+
+class Uncounted {
+public:
+    Uncounted() : was_active_(allocation_counter.active) { allocation_counter.active = false; }
+    ~Uncounted() { allocation_counter.active = was_active_; }
+
+private:
+    bool was_active_;
+};
+
+void* counted_alloc(std::size_t size) {
+    if (allocation_counter.active) {
+        ++allocation_counter.allocations;
+        allocation_counter.bytes += size;
+    }
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+}
+
+void* operator new(std::size_t size) { return counted_alloc(size); }
+void* operator new[](std::size_t size) { return counted_alloc(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+template <typename T>
+inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+struct Benchmark {
+    std::string name;
+    std::function<void(std::uint64_t iterations)> body;
+    // Extra fields for the report, e.g. sizes.
+    json info;
+    // Heap bytes allowed per op; negative for no budget.
+    double max_alloc_bytes_per_op = -1;
+};
+
+std::vector<Benchmark>& registry() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+void add(std::string name, std::function<void(std::uint64_t)> body, json info = json::object()) {
+    registry().push_back({std::move(name), std::move(body), std::move(info)});
+}
+
+void add_with_budget(std::string name, std::function<void(std::uint64_t)> body, double max_alloc_bytes_per_op) {
+    registry().push_back({std::move(name), std::move(body), json::object(), max_alloc_bytes_per_op});
+}
+
+// Returns an empty string on success, otherwise what went wrong.
+struct Check {
+    std::string name;
+    std::function<std::string()> run;
+};
+
+std::vector<Check>& checks() {
+    static std::vector<Check> registered;
+    return registered;
+}
+
+void add_check(std::string name, std::function<std::string()> run) {
+    checks().push_back({std::move(name), std::move(run)});
+}
+
+struct Options {
+    std::string filter;
+    std::string output;
+    std::string compare;
+    double threshold_pct = 10.0;
+    double min_time_ms = 50.0;
+    int samples = 7;
+};
+
+double time_ns(const Benchmark& b, std::uint64_t iterations) {
+    auto start = Clock::now();
+    b.body(iterations);
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+json run_benchmark(const Benchmark& b, const Options& opts) {
+    std::uint64_t iterations = 1;
+    const double target_ns = opts.min_time_ms * 1e6;
+    while (true) {
+        double elapsed = time_ns(b, iterations);
+        if (elapsed >= target_ns || iterations >= (std::uint64_t(1) << 40))
+            break;
+        double scale = elapsed > 0 ? std::min(10.0, 1.2 * target_ns / elapsed) : 10.0;
+        iterations = std::max(iterations + 1, static_cast<std::uint64_t>(static_cast<double>(iterations) * scale));
+    }
+
+    std::vector<double> per_op;
+    allocation_counter = AllocationCounter{0, 0, true};
+    for (int s = 0; s < opts.samples; ++s)
+        per_op.push_back(time_ns(b, iterations) / static_cast<double>(iterations));
+    AllocationCounter allocated = allocation_counter;
+    allocation_counter = AllocationCounter{};
+    std::sort(per_op.begin(), per_op.end());
+    double ops = static_cast<double>(iterations) * static_cast<double>(opts.samples);
+
+    double mean = 0;
+    for (double v : per_op)
+        mean += v;
+    mean /= static_cast<double>(per_op.size());
+    double variance = 0;
+    for (double v : per_op)
+        variance += (v - mean) * (v - mean);
+
+    json result = {{"name", b.name},
+                   {"iterations", iterations},
+                   {"samples", per_op.size()},
+                   {"ns_per_op", per_op[per_op.size() / 2]},
+                   {"min_ns_per_op", per_op.front()},
+                   {"max_ns_per_op", per_op.back()},
+                   {"stddev_ns", std::sqrt(variance / static_cast<double>(per_op.size()))},
+                   {"allocs_per_op", static_cast<double>(allocated.allocations) / ops},
+                   {"alloc_bytes_per_op", static_cast<double>(allocated.bytes) / ops}};
+    if (b.max_alloc_bytes_per_op >= 0)
+        result["max_alloc_bytes_per_op"] = b.max_alloc_bytes_per_op;
+    result.update(b.info);
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Router
+
+Response ok_handler(Request&, const Router::Values&) {
+    return Response("ok");
+}
+
+std::unique_ptr<Router> make_router(std::size_t route_count) {
+    auto router = std::make_unique<Router>();
+    for (std::size_t i = 0; i + 1 < route_count; ++i)
+        router->add_route("GET", "/r" + std::to_string(i) + "/items/{id}", ok_handler);
+    router->add_route("GET", "/users/{id}/posts/{post}", ok_handler);
+    return router;
+}
+
+void register_router_benchmarks() {
+    for (std::size_t count : {1, 10, 100, 1000}) {
+        std::shared_ptr<Router> router = make_router(count);
+        add("router/handle_request/last_of_" + std::to_string(count), [router](std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i) {
+                Response res = router->handle_request("GET", "/users/42/posts/7");
+                do_not_optimize(res);
+            }
+        });
+        add("router/match_miss/" + std::to_string(count), [router](std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i) {
+                Response res = router->handle_request("GET", "/missing/route/here");
+                do_not_optimize(res);
+            }
+        });
+    }
+}
+
+// ---------------------------------------------------------------------------
+// parse_param
+
+template <typename T>
+void add_parse_param(const std::string& type_name, const std::string& input) {
+    add("parse_param/" + type_name, [input](std::uint64_t n) {
+        for (std::uint64_t i = 0; i < n; ++i) {
+            auto value = parse_param<T>(input);
+            do_not_optimize(value);
+        }
+    });
+}
+
+void register_param_benchmarks() {
+    add_parse_param<int>("int", "123456");
+    add_parse_param<float>("float", "3.14159");
+    add_parse_param<double>("double", "2.718281828459045");
+    add_parse_param<std::string>("string", "some-user-name");
+    add_parse_param<bool>("bool", "true");
+    add_parse_param<std::optional<int>>("optional_int", "123456");
+    add_parse_param<std::optional<float>>("optional_float", "3.14159");
+    add_parse_param<std::optional<double>>("optional_double", "2.718281828459045");
+    add_parse_param<std::optional<std::string>>("optional_string", "some-user-name");
+    add_parse_param<std::optional<bool>>("optional_bool", "true");
+}
+
+// ---------------------------------------------------------------------------
+// make_handler dispatch
+
+struct UserModel : public Validatable {
+    std::string name;
+    int age;
+    MODEL(UserModel, name, age);
+};
+
+Response user_by_id(int id) {
+    return Response(std::to_string(id));
+}
+
+Response no_args() {
+    return Response("ok");
+}
+
+Response create_user(UserModel user) {
+    return Response(user.name);
+}
+
+void register_dispatch_benchmarks() {
+    add("dispatch/direct_call", [](std::uint64_t n) {
+        Response (*volatile fn)(int) = user_by_id;
+        for (std::uint64_t i = 0; i < n; ++i) {
+            Response res = fn(42);
+            do_not_optimize(res);
+        }
+    });
+    add("dispatch/make_handler_no_params", [](std::uint64_t n) {
+        Router::Handler handler = make_handler<>(no_args);
+        Request req("GET", "/");
+        Router::Values values;
+        for (std::uint64_t i = 0; i < n; ++i) {
+            Response res = handler(req, values);
+            do_not_optimize(res);
+        }
+    });
+    add("dispatch/make_handler_path_int", [](std::uint64_t n) {
+        Router::Handler handler = make_handler<Path<int>>(user_by_id);
+        Request req("GET", "/users/42");
+        Router::Values values{"42"};
+        for (std::uint64_t i = 0; i < n; ++i) {
+            Response res = handler(req, values);
+            do_not_optimize(res);
+        }
+    });
+    add("dispatch/make_handler_body_model", [](std::uint64_t n) {
+        Router::Handler handler = make_handler<Body<UserModel>>(create_user);
+        Request req("POST", "/users", json{{"name", "John Doe"}, {"age", 30}});
+        Router::Values values;
+        for (std::uint64_t i = 0; i < n; ++i) {
+            Response res = handler(req, values);
+            do_not_optimize(res);
+        }
+    });
+}
+
+// ---------------------------------------------------------------------------
+// JSON payload corpus
+
+json make_user(int i) {
+    return json{{"id", i},
+                {"name", "User " + std::to_string(i)},
+                {"email", "user" + std::to_string(i) + "@example.com"},
+                {"active", i % 2 == 0},
+                {"score", i * 1.5},
+                {"tags", {"alpha", "beta", "gamma"}}};
+}
+
+std::vector<std::pair<std::string, json>> payload_corpus() {
+    json medium = json::array();
+    for (int i = 0; i < 100; ++i)
+        medium.push_back(make_user(i));
+    json large = json::array();
+    for (int i = 0; i < 10000; ++i)
+        large.push_back(make_user(i));
+    json numbers = json::array();
+    for (int i = 0; i < 10000; ++i)
+        numbers.push_back(i * 0.25);
+    return {{"small", make_user(1)},
+            {"medium_100_objects", medium},
+            {"large_10k_objects", large},
+            {"numbers_10k", numbers},
+            {"string_64k", std::string(65536, 'x')}};
+}
+
+// A 1 MB body must reach the handler without being copied: dispatching
+// it may allocate for the route and the response, never for the body.
+// Handlers park the body in `sink`, because destroying a json DOM
+// allocates a work stack in proportion to its elements; the next
+// iteration clears it uncounted.
+void register_allocation_benchmarks() {
+    const double budget = 4096;
+    auto sink = std::make_shared<json>();
+    auto dispatch = [sink](std::shared_ptr<Router> router, std::shared_ptr<const json> body) {
+        return [router, body, sink](std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i) {
+                std::optional<json> copy;
+                {
+                    Uncounted setup;
+                    *sink = nullptr;
+                    copy = *body;
+                }
+                Response res = router->handle_request("POST", "/upload", std::move(copy));
+                do_not_optimize(res);
+            }
+        };
+    };
+
+    auto json_router = std::make_shared<Router>();
+    json_router->add_route("POST", "/upload", make_handler<Body<json>>([sink](json body) {
+        Response res(std::to_string(body.size()));
+        *sink = std::move(body);
+        return res;
+    }));
+    json rows = json::array();
+    std::size_t size = 2;
+    while (size < (std::size_t(1) << 20)) {
+        rows.push_back(make_user(static_cast<int>(rows.size())));
+        size += rows.back().dump().size() + 1;
+    }
+    add_with_budget("alloc/dispatch_body_json_1mb", dispatch(json_router, std::make_shared<const json>(std::move(rows))), budget);
+
+    auto string_router = std::make_shared<Router>();
+    string_router->add_route("POST", "/upload", make_handler<Body<std::string>>([sink](std::string body) {
+        Response res(std::to_string(body.size()));
+        *sink = std::move(body);
+        return res;
+    }));
+    add_with_budget("alloc/dispatch_body_string_1mb",
+                    dispatch(string_router, std::make_shared<const json>(std::string(std::size_t(1) << 20, 'x'))), budget);
+}
+
+// ---------------------------------------------------------------------------
+// ConnectionPool behaviour
+
+struct PooledThing {
+    int id;
+    explicit PooledThing(int id) : id(id) {}
+};
+
+using ThingPool = ConnectionPool<PooledThing>;
+
+ThingPool::Options pool_options(int min_size, int max_size) {
+    ThingPool::Options options;
+    options.min_size = min_size;
+    options.max_size = max_size;
+    options.acquire_timeout = std::chrono::milliseconds(50);
+    options.idle_timeout = std::chrono::milliseconds(0);
+    options.health_check_interval = std::chrono::milliseconds(60000);
+    return options;
+}
+
+std::shared_ptr<std::atomic<int>> counter() { return std::make_shared<std::atomic<int>>(0); }
+
+ThingPool::Factory thing_factory(std::shared_ptr<std::atomic<int>> created) {
+    return [created] { return std::make_shared<PooledThing>(++*created); };
+}
+
+// Polls `done` for up to `limit`.
+bool eventually(const std::function<bool()>& done, std::chrono::milliseconds limit = std::chrono::milliseconds(3000)) {
+    auto deadline = Clock::now() + limit;
+    while (!done()) {
+        if (Clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+void register_pool_checks() {
+    add_check("check/pool/acquire_timeout", [] {
+        ThingPool pool(thing_factory(counter()), {}, pool_options(0, 1));
+        auto held = pool.lease();
+        auto start = Clock::now();
+        try {
+            auto second = pool.lease();
+            return std::string("second lease of a one-connection pool succeeded");
+        } catch (const ConnectionPoolTimeout&) {
+        }
+        if (Clock::now() - start < std::chrono::milliseconds(40))
+            return std::string("timed out before acquire_timeout");
+        if (pool.stats().timeouts != 1)
+            return "timeouts is " + std::to_string(pool.stats().timeouts);
+        return std::string();
+    });
+
+    add_check("check/pool/broken_discarded", [] {
+        auto created = counter();
+        ThingPool pool(thing_factory(created), {}, pool_options(0, 1));
+        int first;
+        {
+            auto lease = pool.lease();
+            first = lease->id;
+            lease.mark_broken();
+        }
+        if (pool.open_connections() != 0 || pool.stats().destroys != 1)
+            return std::string("broken connection was not closed");
+        if (pool.lease()->id == first)
+            return std::string("broken connection was handed out again");
+        return std::string();
+    });
+
+    add_check("check/pool/idle_reaped_to_min_size", [] {
+        auto options = pool_options(1, 4);
+        options.idle_timeout = std::chrono::milliseconds(30);
+        ThingPool pool(thing_factory(counter()), {}, options);
+        {
+            std::vector<ThingPool::Lease> leases;
+            for (int i = 0; i < 4; ++i)
+                leases.push_back(pool.lease());
+        }
+        if (!eventually([&] { return pool.open_connections() == 1; }))
+            return "open is " + std::to_string(pool.open_connections()) + ", expected 1";
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        if (pool.open_connections() != 1)
+            return "reaped below min_size: open is " + std::to_string(pool.open_connections());
+        return std::string();
+    });
+
+    add_check("check/pool/waiter_woken_on_release", [] {
+        auto options = pool_options(0, 1);
+        options.acquire_timeout = std::chrono::milliseconds(5000);
+        ThingPool pool(thing_factory(counter()), {}, options);
+        auto held = pool.lease();
+        std::atomic<bool> acquired{false};
+        Clock::duration waited{};
+        std::thread waiter([&] {
+            auto start = Clock::now();
+            auto lease = pool.lease();
+            waited = Clock::now() - start;
+            acquired = true;
+        });
+        if (!eventually([&] { return pool.stats().waiting == 1; })) {
+            held.reset();
+            waiter.join();
+            return std::string("waiter never parked");
+        }
+        held.reset();
+        waiter.join();
+        if (!acquired || waited > std::chrono::milliseconds(1000))
+            return "waiter took " +
+                   std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(waited).count()) + " ms";
+        return std::string();
+    });
+
+    // A failed health check closes the connection and the sweep reopens one
+    // to keep min_size; leases keep being served throughout, never opening
+    // more than max_size.
+    add_check("check/pool/health_check_replaces_failed", [] {
+        auto created = counter();
+        auto options = pool_options(2, 2);
+        options.health_check_interval = std::chrono::milliseconds(20);
+        std::atomic<int> checks{0};
+        // Connections parked in a thread cache are not checked, so fail
+        // whichever idle one the sweep reaches first.
+        ThingPool pool(thing_factory(created), [&checks](PooledThing&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            return checks++ > 0;
+        }, options);
+        if (!pool.warm_up(2, Clock::now() + std::chrono::seconds(2)))
+            return std::string("pool did not warm up");
+        std::atomic<bool> stop{false};
+        std::atomic<int> served{0};
+        std::string failure;
+        std::thread client([&] {
+            try {
+                // Two leases at once, so the second comes off the idle stack.
+                while (!stop) {
+                    auto a = pool.lease_for(std::chrono::milliseconds(1000));
+                    auto b = pool.lease_for(std::chrono::milliseconds(1000));
+                    ++served;
+                    b.reset();
+                    a.reset();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            } catch (const std::exception& e) {
+                failure = e.what();
+            }
+        });
+        bool replaced = eventually([&] { return pool.stats().health_check_failures >= 1 && pool.open_connections() == 2; });
+        bool checked = eventually([&] { return checks.load() >= 10; });
+        stop = true;
+        client.join();
+        if (!failure.empty())
+            return "lease failed during sweeps: " + failure;
+        if (!replaced)
+            return std::string("unhealthy connection was not replaced");
+        if (!checked || served.load() == 0)
+            return std::string("sweeps or leases stalled");
+        if (created->load() != 3)
+            return "opened " + std::to_string(created->load()) + " connections, expected 3";
+        return std::string();
+    });
+}
+
+void register_json_benchmarks() {
+    for (auto& entry : payload_corpus()) {
+        std::string text = entry.second.dump();
+        add("json/parse/" + entry.first, [text](std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i) {
+                json j = json::parse(text);
+                do_not_optimize(j);
+            }
+        });
+        auto response = std::make_shared<Response>(entry.second);
+        add("response/dump/" + entry.first, [response](std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i) {
+                std::string body = response->dump();
+                do_not_optimize(body);
+            }
+        });
+    }
+}
+
+// Cached value encodings (RedisPrimitives::setJson/getJson), with the bytes
+// each one stores.
+void register_codec_benchmarks() {
+    JsonCodec::Options text, msgpack, compressed;
+    text.format = JsonCodec::Text;
+    msgpack.compress_threshold = 0;
+    const std::pair<const char*, JsonCodec::Options> codecs[] = {{"text", text}, {"msgpack", msgpack}, {"msgpack_lz4", compressed}};
+    for (auto& entry : payload_corpus()) {
+        for (const auto& codec : codecs) {
+            std::string stored = JsonCodec::encode(entry.second, codec.second);
+            json info = {{"stored_bytes", stored.size()}};
+            std::string suffix = std::string(codec.first) + "/" + entry.first;
+            json value = entry.second;
+            JsonCodec::Options options = codec.second;
+            add("codec/encode/" + suffix, [value, options](std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    std::string data = JsonCodec::encode(value, options);
+                    do_not_optimize(data);
+                }
+            }, info);
+            add("codec/decode/" + suffix, [stored](std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    json j = JsonCodec::decode(stored);
+                    do_not_optimize(j);
+                }
+            }, info);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Request / Response construction
+
+void register_construction_benchmarks() {
+    add("request/construct_no_body", [](std::uint64_t n) {
+        std::string method = "GET", path = "/users/42";
+        for (std::uint64_t i = 0; i < n; ++i) {
+            Request req(method, path);
+            do_not_optimize(req);
+        }
+    });
+    add("request/construct_moved_body", [](std::uint64_t n) {
+        std::string method = "POST", path = "/users";
+        for (std::uint64_t i = 0; i < n; ++i) {
+            std::optional<json> body = json{{"name", "John"}, {"age", 30}};
+            Request req(method, path, std::move(body));
+            do_not_optimize(req);
+        }
+    });
+    add("response/construct_text", [](std::uint64_t n) {
+        for (std::uint64_t i = 0; i < n; ++i) {
+            Response res("Hello, world", "text/plain");
+            do_not_optimize(res);
+        }
+    });
+    add("pipeline/test_client_post_model", [](std::uint64_t n) {
+        Router app;
+        app.add_route("POST", "/users", make_handler<Body<UserModel>>(create_user));
+        TestClient client(app);
+        std::string body = json{{"name", "John Doe"}, {"age", 30}}.dump();
+        for (std::uint64_t i = 0; i < n; ++i) {
+            auto res = client.request("POST", "/users", body);
+            do_not_optimize(res);
+        }
+    });
+    add("response/construct_json", [](std::uint64_t n) {
+        for (std::uint64_t i = 0; i < n; ++i) {
+            Response res(json{{"message", "Hello"}, {"version", "1.0.0"}});
+            do_not_optimize(res);
+        }
+    });
+}
+
+// ---------------------------------------------------------------------------
+
+Options parse_args(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::runtime_error("missing value for " + arg);
+            return argv[++i];
+        };
+        if (arg == "--filter")
+            opts.filter = value();
+        else if (arg == "--output")
+            opts.output = value();
+        else if (arg == "--compare")
+            opts.compare = value();
+        else if (arg == "--threshold")
+            opts.threshold_pct = std::stod(value());
+        else if (arg == "--min-time-ms")
+            opts.min_time_ms = std::stod(value());
+        else if (arg == "--samples")
+            opts.samples = std::max(1, std::stoi(value()));
+        else
+            throw std::runtime_error("unknown option " + arg);
+    }
+    return opts;
+}
+
+// Returns the number of regressions beyond the threshold.
+int compare_with_baseline(const json& results, const std::string& path, double threshold_pct) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("cannot open baseline " + path);
+    json baseline = json::parse(in);
+
+    std::map<std::string, double> previous;
+    for (const auto& b : baseline.at("benchmarks"))
+        previous[b.at("name").get<std::string>()] = b.at("ns_per_op").get<double>();
+
+    int regressions = 0;
+    for (const auto& b : results.at("benchmarks")) {
+        auto it = previous.find(b.at("name").get<std::string>());
+        if (it == previous.end() || it->second <= 0)
+            continue;
+        double now = b.at("ns_per_op").get<double>();
+        double change = (now - it->second) / it->second * 100.0;
+        const char* verdict = change > threshold_pct ? "REGRESSION" : (change < -threshold_pct ? "improved" : "ok");
+        if (change > threshold_pct)
+            ++regressions;
+        std::fprintf(stderr, "%-48s %12.1f -> %12.1f ns/op  %+7.1f%%  %s\n", it->first.c_str(), it->second, now,
+                     change, verdict);
+    }
+    return regressions;
+}
+
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options opts = parse_args(argc, argv);
+        register_router_benchmarks();
+        register_param_benchmarks();
+        register_dispatch_benchmarks();
+        register_json_benchmarks();
+        register_codec_benchmarks();
+        register_construction_benchmarks();
+        register_allocation_benchmarks();
+        register_pool_checks();
+
+        json results = {{"suite", "fastapi-cpp-microbench"}, {"checks", json::array()}, {"benchmarks", json::array()}};
+        int failed_checks = 0;
+        for (const auto& c : checks()) {
+            if (!opts.filter.empty() && c.name.find(opts.filter) == std::string::npos)
+                continue;
+            std::string failure;
+            try {
+                failure = c.run();
+            } catch (const std::exception& e) {
+                failure = std::string("threw: ") + e.what();
+            }
+            std::fprintf(stderr, "%-48s %s%s\n", c.name.c_str(), failure.empty() ? "ok" : "FAILED: ", failure.c_str());
+            if (!failure.empty())
+                ++failed_checks;
+            results["checks"].push_back({{"name", c.name}, {"passed", failure.empty()}, {"failure", failure}});
+        }
+
+        int over_budget = 0;
+        for (const auto& b : registry()) {
+            if (!opts.filter.empty() && b.name.find(opts.filter) == std::string::npos)
+                continue;
+            json r = run_benchmark(b, opts);
+            std::fprintf(stderr, "%-48s %12.1f ns/op", b.name.c_str(), r["ns_per_op"].get<double>());
+            if (r.contains("stored_bytes"))
+                std::fprintf(stderr, " %10zu bytes", r["stored_bytes"].get<std::size_t>());
+            if (b.max_alloc_bytes_per_op >= 0 && r["alloc_bytes_per_op"].get<double>() > b.max_alloc_bytes_per_op) {
+                std::fprintf(stderr, "  OVER BUDGET: %.0f bytes/op allocated, %.0f allowed",
+                             r["alloc_bytes_per_op"].get<double>(), b.max_alloc_bytes_per_op);
+                ++over_budget;
+            }
+            std::fprintf(stderr, "\n");
+            results["benchmarks"].push_back(std::move(r));
+        }
+
+        if (opts.output.empty()) {
+            std::cout << results.dump(2) << std::endl;
+        } else {
+            std::ofstream out(opts.output);
+            out << results.dump(2) << std::endl;
+        }
+
+        if (!opts.compare.empty()) {
+            int regressions = compare_with_baseline(results, opts.compare, opts.threshold_pct);
+            if (regressions > 0) {
+                std::fprintf(stderr, "%d benchmark(s) regressed by more than %.1f%%\n", regressions, opts.threshold_pct);
+                return 2;
+            }
+        }
+        if (over_budget > 0) {
+            std::fprintf(stderr, "%d benchmark(s) allocated more than their budget\n", over_budget);
+            return 3;
+        }
+        if (failed_checks > 0) {
+            std::fprintf(stderr, "%d check(s) failed\n", failed_checks);
+            return 4;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "fastapi-cpp-microbench: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -1,10 +1,21 @@
 #pragma once
+#include <tuple>
+#include <type_traits>
 #include "params.hpp"
 #include "router.hpp"
 #include "request.hpp"
+#include "timing.hpp"
 
 template <typename Param>
-auto resolve_arg(const Request &req, const Router::Values &values, size_t index)
+struct is_body_param : std::false_type {};
+
+template <typename T>
+struct is_body_param<Body<T>> : std::true_type {};
+
+// With a single Body<T> parameter the request body is consumed: it is moved
+// into the argument instead of being copied out of the Request.
+template <typename Param, bool OwnsBody>
+auto resolve_arg(Request &req, const Router::Values &values, size_t index)
 {
     using T = typename Param::type;
 
@@ -16,20 +27,33 @@ auto resolve_arg(const Request &req, const Router::Values &values, size_t index)
     {
         if (!req.json_body)
             throw std::runtime_error("Missing JSON body");
-        return req.json_body->get<T>();
+        if constexpr (OwnsBody && std::is_same_v<T, json>)
+            return json(std::move(*req.json_body));
+        else if constexpr (OwnsBody && std::is_same_v<T, std::string>)
+            return std::move(req.json_body->template get_ref<std::string &>());
+        else
+            return req.json_body->template get<T>();
     }
 }
 
 template <typename Func, typename... Params, std::size_t... I>
-Response call_with_params(Func f, const Request &req, const Router::Values &values, std::index_sequence<I...>)
+Response call_with_params(const Func &f, Request &req, const Router::Values &values, std::index_sequence<I...>)
 {
-    return f(resolve_arg<Params>(req, values, I)...);
+    [[maybe_unused]] constexpr bool owns_body = (0 + ... + (is_body_param<Params>::value ? 1 : 0)) == 1;
+#if FASTAPI_CPP_ENABLE_TIMING
+    std::tuple<decltype(resolve_arg<Params, owns_body>(req, values, I))...> args{
+        resolve_arg<Params, owns_body>(req, values, I)...};
+    FASTAPI_TIMING_MARK(Bind);
+    return std::apply(f, std::move(args));
+#else
+    return f(resolve_arg<Params, owns_body>(req, values, I)...);
+#endif
 }
 
 template <typename... Params, typename Func>
 Router::Handler make_handler(Func f)
 {
-    return [f](const Request &req, const Router::Values &values) -> Response
+    return [f](Request &req, const Router::Values &values) -> Response
     {
         try
         {
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// BSON for the MongoDB client, built on nlohmann's to_bson/from_bson.
+// BSON types nlohmann has no counterpart for are carried in json as MongoDB
+// Extended JSON wrappers and converted at the byte level on the way in and
+// out:
+//   ObjectId     {"$oid": "<24 hex digits>"}
+//   UTC datetime {"$date": <milliseconds since the epoch>}
+//   Timestamp    {"$timestamp": {"t": <seconds>, "i": <increment>}}
+//   Decimal128   {"$numberDecimal": "<decimal string>"}
+//   Regex        {"$regularExpression": {"pattern": "...", "options": "..."}}
+//   MinKey/MaxKey {"$minKey": 1} / {"$maxKey": 1}
+// Encoding also accepts {"$numberLong": "<digits>"} for an explicit int64.
+//
+// json objects keep their fields in name order, so they are encoded that
+// way. Where order matters, as in a compound sort or index key, pass the
+// fields as {"$ordered": [["b", 1], ["a", -1]]}, which encodes a document
+// with the fields in array order. Decoding returns a plain object.
+class Bson {
+public:
+    // `document` must be a json object. Throws std::invalid_argument otherwise.
+    static std::string encode(const json& document);
+    // Appends the encoding to `out`.
+    static void encode(const json& document, std::string& out);
+    // As above, but writes `first_key` ahead of the other fields, which are in
+    // name order. MongoDB takes the command name from the first field.
+    static void encode(const json& document, std::string& out, const std::string& first_key);
+    // Throws std::runtime_error on malformed or unsupported input.
+    static json decode(const char* data, std::size_t size);
+
+    // Length prefix of the document at `data`; 0 if fewer than 4 bytes are available.
+    static std::size_t document_size(const char* data, std::size_t available);
+
+    // One field of an encoded document, read in place. `value` points into
+    // the document and is `size` bytes long.
+    struct Element {
+        char type = 0;
+        const char* name = nullptr;
+        const char* value = nullptr;
+        std::size_t size = 0;
+        explicit operator bool() const { return value != nullptr; }
+    };
+    // Calls `fn` for each field of the document at `data`, in order.
+    static void for_each(const char* data, std::size_t size, const std::function<void(const Element&)>& fn);
+    // The first field called `name`; a false Element if there is none.
+    static Element find(const char* data, std::size_t size, const char* name);
+    // Value of an int32, int64 or double element. Throws std::runtime_error otherwise.
+    static double number(const Element& element);
+    static std::int64_t integer(const Element& element);
+    // Value of a string element.
+    static std::string string(const Element& element);
+
+    // Appends the document at `data` as JSON text, straight from the bytes
+    // and in field order, with the same Extended JSON wrappers as decode().
+    static void write_json(const char* data, std::size_t size, std::string& out);
+
+    // A new ObjectId wrapper: timestamp, per-process random value and counter.
+    static json object_id();
+};
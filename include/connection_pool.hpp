@@ -1,21 +1,730 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <memory>
-#include <queue>
 #include <mutex>
-#include <condition_variable>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "db_config.hpp"
+#include "histogram.hpp"
+#include "nlohmann/json.hpp"
+
+class ConnectionPoolTimeout : public std::runtime_error {
+public:
+    ConnectionPoolTimeout() : std::runtime_error("Timed out waiting for a pooled connection") {}
+};
 
-template<typename ConnectionType>
+inline std::atomic<std::uint64_t>& connection_pool_next_id() {
+    static std::atomic<std::uint64_t> id{1};
+    return id;
+}
+
+// Fixed-capacity pool of up to `max_size` connections.
+//
+// Fast path: a connection released by a thread is parked in that thread's
+// private cache and handed back to it on the next acquire without touching
+// shared state. Otherwise idle connections sit on a lock-free (tagged index)
+// stack. Only a caller that finds the pool exhausted takes the mutex to wait.
+// Idle eviction, topping up to `min_size` and health checks run on a
+// background thread, never on the request path.
+template <typename ConnectionType>
 class ConnectionPool {
 public:
-    ConnectionPool(int size);
-    std::shared_ptr<ConnectionType> acquire();
-    void release(std::shared_ptr<ConnectionType> conn);
-    bool isHealthy();
-    void shutdown();
+    using Connection = std::shared_ptr<ConnectionType>;
+    using Factory = std::function<Connection()>;
+    using HealthCheck = std::function<bool(ConnectionType&)>;
+
+    struct Options {
+        int min_size = 1;
+        int max_size = 10;
+        std::chrono::milliseconds acquire_timeout{5000};
+        std::chrono::milliseconds idle_timeout{60000};
+        std::chrono::milliseconds health_check_interval{30000};
+        // Open connections the pool needs before ready() first reports true.
+        int warmup_size = 1;
+    };
+
+    struct Stats {
+        int min_size = 0;
+        int max_size = 0;
+        int open = 0;
+        int in_use = 0;
+        int idle = 0;
+        int waiting = 0;
+        std::uint64_t acquires = 0;
+        std::uint64_t cache_hits = 0;
+        std::uint64_t timeouts = 0;
+        std::uint64_t creates = 0;
+        std::uint64_t create_failures = 0;
+        std::uint64_t destroys = 0;
+        std::uint64_t health_check_failures = 0;
+        Histogram::Snapshot acquire_wait_ns;
+
+        nlohmann::json to_json() const {
+            auto us = [](std::uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+            return {{"min_size", min_size},
+                    {"max_size", max_size},
+                    {"open", open},
+                    {"in_use", in_use},
+                    {"idle", idle},
+                    {"waiting", waiting},
+                    {"utilization", max_size ? static_cast<double>(in_use) / max_size : 0.0},
+                    {"acquires", acquires},
+                    {"thread_cache_hits", cache_hits},
+                    {"timeouts", timeouts},
+                    {"creates", creates},
+                    {"create_failures", create_failures},
+                    {"destroys", destroys},
+                    {"health_check_failures", health_check_failures},
+                    {"acquire_wait_us",
+                     {{"p50", us(acquire_wait_ns.percentile(50))},
+                      {"p90", us(acquire_wait_ns.percentile(90))},
+                      {"p99", us(acquire_wait_ns.percentile(99))},
+                      {"max", us(acquire_wait_ns.max)},
+                      {"mean", acquire_wait_ns.mean() / 1000.0}}}};
+        }
+    };
+
+    static Options options_from(const DBConfig& config) {
+        Options options;
+        options.max_size = std::max(1, config.db_pool_size);
+        options.min_size = std::clamp(config.db_pool_min_size, 0, options.max_size);
+        options.acquire_timeout = std::chrono::milliseconds(config.db_pool_acquire_timeout_ms);
+        options.idle_timeout = std::chrono::milliseconds(config.db_pool_idle_timeout_ms);
+        options.health_check_interval = std::chrono::milliseconds(config.db_pool_health_check_interval_ms);
+        options.warmup_size = std::clamp(config.db_pool_warmup_size, 0, options.max_size);
+        return options;
+    }
+
+    // Returns its connection to the pool when destroyed.
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(ConnectionPool* pool, std::uint32_t slot, Connection conn)
+            : pool(pool), slot(slot), conn(std::move(conn)) {}
+        Lease(Lease&& other) noexcept { *this = std::move(other); }
+        Lease& operator=(Lease&& other) noexcept {
+            if (this != &other) {
+                reset();
+                pool = other.pool;
+                slot = other.slot;
+                conn = std::move(other.conn);
+                broken = other.broken;
+                other.pool = nullptr;
+            }
+            return *this;
+        }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease() { reset(); }
+
+        ConnectionType* operator->() const { return conn.get(); }
+        ConnectionType& operator*() const { return *conn; }
+        const Connection& get() const { return conn; }
+        explicit operator bool() const { return pool != nullptr; }
+
+        // The connection is closed instead of being reused.
+        void mark_broken() { broken = true; }
+
+        void reset() {
+            if (pool) {
+                pool->release_slot(slot, broken);
+                pool = nullptr;
+                conn.reset();
+            }
+        }
+
+    private:
+        ConnectionPool* pool = nullptr;
+        std::uint32_t slot = 0;
+        Connection conn;
+        bool broken = false;
+    };
+
+    ConnectionPool(int size) : ConnectionPool(default_factory(), {}, sized_options(size)) {}
+
+    ConnectionPool(const DBConfig& config, Factory factory, HealthCheck health_check = {})
+        : ConnectionPool(std::move(factory), std::move(health_check), options_from(config)) {}
+
+    ConnectionPool(Factory factory, HealthCheck health_check, Options options)
+        : factory(std::move(factory)),
+          health_check(std::move(health_check)),
+          options(options),
+          pool_size(std::max(1, options.max_size)),
+          id(connection_pool_next_id().fetch_add(1, std::memory_order_relaxed)),
+          slots(new Slot[static_cast<std::size_t>(std::max(1, options.max_size))]) {
+        for (std::uint32_t i = static_cast<std::uint32_t>(pool_size); i-- > 0;)
+            empty.push(slots.get(), i);
+        maintenance = std::thread([this] { maintenance_loop(); });
+    }
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    ~ConnectionPool() { shutdown(); }
+
+    // Blocks up to the configured acquire timeout; throws ConnectionPoolTimeout.
+    Lease lease() { return lease_for(options.acquire_timeout); }
+
+    Lease lease_for(std::chrono::milliseconds timeout) {
+        std::uint32_t slot;
+        if (!acquire_slot(timeout, slot))
+            throw ConnectionPoolTimeout();
+        return Lease(this, slot, slots[slot].conn);
+    }
+
+    std::shared_ptr<ConnectionType> acquire() {
+        std::uint32_t slot;
+        if (!acquire_slot(options.acquire_timeout, slot))
+            throw ConnectionPoolTimeout();
+        return slots[slot].conn;
+    }
+
+    void release(std::shared_ptr<ConnectionType> conn) {
+        if (!conn)
+            return;
+        for (std::uint32_t i = 0; i < static_cast<std::uint32_t>(pool_size); ++i) {
+            if (slots[i].raw.load(std::memory_order_relaxed) == conn.get()) {
+                conn.reset();
+                release_slot(i, false);
+                return;
+            }
+        }
+    }
+
+    // Opens connections on parallel threads until `count` are open, waiting
+    // at most until `deadline`. Connections still being opened when the
+    // deadline passes keep going and join the pool when they are ready.
+    bool warm_up(int count, std::chrono::steady_clock::time_point deadline) {
+        count = std::min(count, pool_size);
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopped.load(std::memory_order_acquire))
+            return false;
+        for (int i = open.load(std::memory_order_relaxed) + warming; i < count; ++i) {
+            ++warming;
+            warmers.emplace_back([this] { warm_one(); });
+        }
+        warm_cv.wait_until(lock, deadline, [&] {
+            return stopped.load(std::memory_order_acquire) || warming == 0 ||
+                   open.load(std::memory_order_relaxed) >= count;
+        });
+        return open.load(std::memory_order_relaxed) >= count;
+    }
+
+    // Warms up to the configured `warmup_size`.
+    bool warm_up(std::chrono::steady_clock::time_point deadline) {
+        if (warm_up(options.warmup_size, deadline))
+            warmed.store(true, std::memory_order_release);
+        return ready();
+    }
+
+    // Healthy and warmed up. The warm-up half is latched, so idle eviction
+    // below `warmup_size` later does not take the pool out of rotation.
+    bool ready() {
+        if (!warmed.load(std::memory_order_acquire) &&
+            open.load(std::memory_order_relaxed) >= std::min(options.warmup_size, pool_size))
+            warmed.store(true, std::memory_order_release);
+        return warmed.load(std::memory_order_acquire) && isHealthy();
+    }
+
+    bool isHealthy() {
+        return !stopped.load(std::memory_order_acquire) && last_sweep_healthy.load(std::memory_order_relaxed);
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopped.exchange(true))
+                return;
+        }
+        cv.notify_all();
+        warm_cv.notify_all();
+        maintenance_cv.notify_all();
+        if (maintenance.joinable())
+            maintenance.join();
+        for (auto& warmer : warmers)
+            warmer.join();
+        steal_cached(std::chrono::steady_clock::time_point::max());
+        std::uint32_t slot;
+        while (idle.pop(slots.get(), slot))
+            destroy(slot);
+    }
+
+    int size() const { return pool_size; }
+    int open_connections() const { return open.load(std::memory_order_relaxed); }
+    int in_use_connections() const { return in_use.load(std::memory_order_relaxed); }
+
+    // Counters are read without stopping the pool, so a snapshot taken under
+    // load may be off by the few operations in flight.
+    Stats stats() {
+        Stats s;
+        s.min_size = options.min_size;
+        s.max_size = pool_size;
+        s.open = open.load(std::memory_order_relaxed);
+        s.in_use = in_use.load(std::memory_order_relaxed);
+        s.idle = std::max(0, s.open - s.in_use);
+        s.waiting = waiters.load(std::memory_order_relaxed);
+        s.timeouts = timeouts.load(std::memory_order_relaxed);
+        s.creates = creates.load(std::memory_order_relaxed);
+        s.create_failures = create_failures.load(std::memory_order_relaxed);
+        s.destroys = destroys.load(std::memory_order_relaxed);
+        s.health_check_failures = health_check_failures.load(std::memory_order_relaxed);
+        acquire_wait.snapshot_into(s.acquire_wait_ns);
+        {
+            std::lock_guard<std::mutex> lock(caches_mutex);
+            for (const auto& cache : caches)
+                s.cache_hits += cache->hits.load(std::memory_order_relaxed);
+        }
+        // Thread-cache hits never wait; they are counted per thread to keep
+        // the fast path off shared cache lines and folded in as zero waits.
+        s.acquire_wait_ns.record(0, s.cache_hits);
+        s.acquires = s.acquire_wait_ns.count;
+        return s;
+    }
 
 private:
-    std::queue<std::shared_ptr<ConnectionType>> available;
+    static constexpr std::uint32_t no_slot = 0xffffffffu;
+    using Clock = std::chrono::steady_clock;
+
+    // Where a slot is, as far as the sweep is concerned. Idle, Checking and
+    // Dead slots sit on the idle stack; Detached ones were popped while the
+    // sweep had them claimed and are its to requeue.
+    enum SlotState : std::uint8_t { Taken, Idle, Checking, Detached, Dead };
+
+    struct Slot {
+        Connection conn;
+        std::atomic<std::uint8_t> state{Taken};
+        std::atomic<ConnectionType*> raw{nullptr};
+        std::atomic<std::uint32_t> next{0};
+        std::atomic<std::int64_t> last_used{0};
+        std::atomic<std::int64_t> last_checked{0};
+    };
+
+    // Treiber stack of slot indices; the head carries a version tag in its
+    // upper half so a concurrent pop/push of the same slot cannot ABA.
+    class SlotStack {
+    public:
+        void push(Slot* slots, std::uint32_t slot) {
+            std::uint64_t old = head.load(std::memory_order_relaxed);
+            std::uint64_t desired;
+            do {
+                slots[slot].next.store(static_cast<std::uint32_t>(old), std::memory_order_relaxed);
+                desired = (((old >> 32) + 1) << 32) | (slot + 1);
+            } while (!head.compare_exchange_weak(old, desired, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        bool pop(Slot* slots, std::uint32_t& slot) {
+            std::uint64_t old = head.load(std::memory_order_acquire);
+            while (static_cast<std::uint32_t>(old) != 0) {
+                std::uint32_t top = static_cast<std::uint32_t>(old) - 1;
+                std::uint64_t next = slots[top].next.load(std::memory_order_relaxed);
+                std::uint64_t desired = (((old >> 32) + 1) << 32) | next;
+                if (head.compare_exchange_weak(old, desired, std::memory_order_acquire, std::memory_order_acquire)) {
+                    slot = top;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool empty() const { return static_cast<std::uint32_t>(head.load(std::memory_order_acquire)) == 0; }
+
+    private:
+        std::atomic<std::uint64_t> head{0};
+    };
+
+    struct alignas(64) ThreadCache {
+        std::atomic<std::uint32_t> slot{no_slot};
+        std::atomic<std::uint64_t> hits{0};
+    };
+
+    static Factory default_factory() {
+        if constexpr (std::is_default_constructible_v<ConnectionType>)
+            return [] { return std::make_shared<ConnectionType>(); };
+        else
+            return {};
+    }
+
+    static Options sized_options(int size) {
+        Options options;
+        options.max_size = std::max(1, size);
+        options.min_size = std::min(options.min_size, options.max_size);
+        return options;
+    }
+
+    static std::int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // Each thread remembers its cache in up to `cache_ways` pools, indexed by
+    // pool id. Ids are handed out in sequence and never reused, so threads
+    // alternating between a primary, its replicas or cluster nodes each keep
+    // their own entry, and an entry left by a destroyed pool never matches.
+    static constexpr std::size_t cache_ways = 16;
+
+    ThreadCache& local_cache() {
+        struct Entry {
+            std::uint64_t pool = 0;
+            ThreadCache* cache = nullptr;
+        };
+        thread_local Entry entries[cache_ways];
+        Entry& entry = entries[id % cache_ways];
+        if (entry.pool == id)
+            return *entry.cache;
+
+        std::lock_guard<std::mutex> lock(caches_mutex);
+        ThreadCache*& cache = cache_by_thread[std::this_thread::get_id()];
+        if (!cache) {
+            caches.push_back(std::make_unique<ThreadCache>());
+            cache = caches.back().get();
+        }
+        entry.pool = id;
+        entry.cache = cache;
+        return *cache;
+    }
+
+    void push_idle(std::uint32_t slot) {
+        slots[slot].state.store(Idle, std::memory_order_release);
+        idle.push(slots.get(), slot);
+    }
+
+    // Pops an idle connection, stepping over slots the sweep has claimed.
+    bool pop_idle(std::uint32_t& slot) {
+        while (idle.pop(slots.get(), slot)) {
+            std::atomic<std::uint8_t>& state = slots[slot].state;
+            std::uint8_t current = state.load(std::memory_order_acquire);
+            while (true) {
+                if (current == Idle) {
+                    if (state.compare_exchange_weak(current, Taken, std::memory_order_acq_rel))
+                        return true;
+                } else if (current == Checking) {
+                    if (state.compare_exchange_weak(current, Detached, std::memory_order_acq_rel))
+                        break;
+                } else {
+                    // Closed by the sweep while on the stack.
+                    state.store(Taken, std::memory_order_relaxed);
+                    empty.push(slots.get(), slot);
+                    break;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool try_take(std::uint32_t& slot) {
+        if (pop_idle(slot))
+            return true;
+        if (empty.pop(slots.get(), slot)) {
+            try {
+                create(slot);
+            } catch (...) {
+                empty.push(slots.get(), slot);
+                throw;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool acquire_slot(std::chrono::milliseconds timeout, std::uint32_t& slot) {
+        if (stopped.load(std::memory_order_acquire))
+            throw std::runtime_error("Connection pool is shut down");
+
+        ThreadCache& cache = local_cache();
+        slot = cache.slot.exchange(no_slot, std::memory_order_acquire);
+        if (slot != no_slot) {
+            cache.hits.store(cache.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else {
+            auto start = Clock::now();
+            if (!try_take(slot)) {
+                waiters.fetch_add(1);
+                bool acquired;
+                try {
+                    acquired = wait_for_slot(start + timeout, slot);
+                } catch (...) {
+                    waiters.fetch_sub(1);
+                    throw;
+                }
+                waiters.fetch_sub(1);
+                if (!acquired) {
+                    timeouts.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            acquire_wait.record(static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+        }
+        in_use.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Slow path: the pool is at max_size with nothing idle.
+    bool wait_for_slot(Clock::time_point deadline, std::uint32_t& slot) {
+        while (true) {
+            if (stopped.load(std::memory_order_acquire))
+                throw std::runtime_error("Connection pool is shut down");
+            // Connections parked in other threads' caches are fair game once
+            // somebody is waiting; releasers see `waiters` and skip the cache.
+            steal_cached(Clock::time_point::max());
+            if (try_take(slot))
+                return true;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!idle.empty() || !empty.empty() || stopped.load(std::memory_order_acquire))
+                continue;
+            if (cv.wait_until(lock, deadline) == std::cv_status::timeout) {
+                lock.unlock();
+                return try_take(slot);
+            }
+        }
+    }
+
+    void release_slot(std::uint32_t slot, bool broken) {
+        in_use.fetch_sub(1, std::memory_order_relaxed);
+        if (broken || stopped.load(std::memory_order_acquire)) {
+            destroy(slot);
+            empty.push(slots.get(), slot);
+            notify_waiters();
+            return;
+        }
+
+        slots[slot].last_used.store(now_ns(), std::memory_order_relaxed);
+        if (waiters.load() == 0) {
+            ThreadCache& cache = local_cache();
+            std::uint32_t previous = cache.slot.exchange(slot);
+            if (previous != no_slot)
+                push_idle(previous);
+            // A waiter may have arrived after the check above; hand the
+            // connection over rather than leaving it parked here.
+            if (waiters.load() == 0)
+                return;
+            slot = cache.slot.exchange(no_slot);
+            if (slot == no_slot)
+                return;
+        }
+        push_idle(slot);
+        notify_waiters();
+    }
+
+    void notify_waiters() {
+        if (waiters.load() == 0)
+            return;
+        { std::lock_guard<std::mutex> lock(mutex); }
+        cv.notify_one();
+    }
+
+    void create(std::uint32_t slot) {
+        if (!factory)
+            throw std::runtime_error("Connection pool has no connection factory");
+        Connection conn;
+        try {
+            conn = factory();
+        } catch (...) {
+            create_failures.fetch_add(1, std::memory_order_relaxed);
+            throw;
+        }
+        if (!conn) {
+            create_failures.fetch_add(1, std::memory_order_relaxed);
+            throw std::runtime_error("Connection factory returned no connection");
+        }
+        Slot& s = slots[slot];
+        s.raw.store(conn.get(), std::memory_order_relaxed);
+        s.conn = std::move(conn);
+        s.last_used.store(now_ns(), std::memory_order_relaxed);
+        s.last_checked.store(now_ns(), std::memory_order_relaxed);
+        open.fetch_add(1, std::memory_order_relaxed);
+        creates.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void destroy(std::uint32_t slot) {
+        Slot& s = slots[slot];
+        if (!s.conn)
+            return;
+        s.raw.store(nullptr, std::memory_order_relaxed);
+        s.conn.reset();
+        open.fetch_sub(1, std::memory_order_relaxed);
+        destroys.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void warm_one() {
+        std::uint32_t slot;
+        if (!stopped.load(std::memory_order_acquire) && empty.pop(slots.get(), slot)) {
+            try {
+                create(slot);
+                push_idle(slot);
+            } catch (...) {
+                empty.push(slots.get(), slot);
+            }
+            notify_waiters();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        --warming;
+        warm_cv.notify_all();
+    }
+
+    // Moves cached connections last used before `cutoff` to the idle stack.
+    void steal_cached(Clock::time_point cutoff) {
+        std::int64_t cutoff_ns = cutoff == Clock::time_point::max()
+                                     ? INT64_MAX
+                                     : std::chrono::duration_cast<std::chrono::nanoseconds>(cutoff.time_since_epoch()).count();
+        std::lock_guard<std::mutex> lock(caches_mutex);
+        for (auto& cache : caches) {
+            std::uint32_t slot = cache->slot.load(std::memory_order_relaxed);
+            if (slot == no_slot || slots[slot].last_used.load(std::memory_order_relaxed) > cutoff_ns)
+                continue;
+            if (cache->slot.compare_exchange_strong(slot, no_slot))
+                push_idle(slot);
+        }
+    }
+
+    void maintenance_loop() {
+        // A zero interval disables its task rather than making the loop spin.
+        std::chrono::milliseconds tick(1000);
+        for (auto interval : {options.idle_timeout, options.health_check_interval}) {
+            if (interval > std::chrono::milliseconds(0))
+                tick = std::min(tick, interval);
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopped.load(std::memory_order_acquire)) {
+            lock.unlock();
+            sweep();
+            lock.lock();
+            maintenance_cv.wait_for(lock, tick, [this] { return stopped.load(std::memory_order_acquire); });
+        }
+    }
+
+    // Health checks and closes claim one idle connection at a time in place
+    // (Idle -> Checking), so the idle stack is never drained: acquirers that
+    // pop a claimed slot leave it to finish_check() and take the next one.
+    void sweep() {
+        const std::int64_t now = now_ns();
+        const std::int64_t idle_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(options.idle_timeout).count();
+        const std::int64_t check_ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(options.health_check_interval).count();
+        auto expired = [&](const Slot& entry) {
+            return idle_ns > 0 && now - entry.last_used.load(std::memory_order_relaxed) > idle_ns &&
+                   open.load(std::memory_order_relaxed) > options.min_size;
+        };
+        auto check_due = [&](const Slot& entry) {
+            return health_check && now - entry.last_checked.load(std::memory_order_relaxed) >= check_ns;
+        };
+
+        // Connections parked in a thread cache for a whole health-check
+        // interval belong to idle or exited threads; reclaim them.
+        steal_cached(Clock::now() - options.health_check_interval);
+
+        bool healthy = true;
+        for (std::uint32_t slot = 0; slot < static_cast<std::uint32_t>(pool_size); ++slot) {
+            if (stopped.load(std::memory_order_acquire))
+                break;
+            Slot& entry = slots[slot];
+            std::uint8_t state = Idle;
+            if (entry.state.load(std::memory_order_acquire) != Idle || !(expired(entry) || check_due(entry)) ||
+                !entry.state.compare_exchange_strong(state, Checking, std::memory_order_acq_rel))
+                continue;
+
+            bool close = expired(entry);
+            if (!close) {
+                entry.last_checked.store(now, std::memory_order_relaxed);
+                try {
+                    close = !health_check(*entry.conn);
+                } catch (...) {
+                    close = true;
+                }
+                if (close) {
+                    healthy = false;
+                    health_check_failures.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (close)
+                destroy(slot);
+            finish_check(slot, close ? Dead : Idle);
+            notify_waiters();
+        }
+
+        // Top up to min_size, first reopening slots closed above that are
+        // still on the idle stack.
+        for (std::uint32_t slot = 0; slot < static_cast<std::uint32_t>(pool_size) && healthy; ++slot) {
+            if (stopped.load(std::memory_order_acquire) || open.load(std::memory_order_relaxed) >= options.min_size)
+                break;
+            std::uint8_t state = Dead;
+            if (!slots[slot].state.compare_exchange_strong(state, Checking, std::memory_order_acq_rel))
+                continue;
+            try {
+                create(slot);
+                finish_check(slot, Idle);
+            } catch (...) {
+                finish_check(slot, Dead);
+                healthy = false;
+            }
+        }
+        std::uint32_t slot;
+        while (healthy && !stopped.load(std::memory_order_acquire) &&
+               open.load(std::memory_order_relaxed) < options.min_size && empty.pop(slots.get(), slot)) {
+            try {
+                create(slot);
+                push_idle(slot);
+            } catch (...) {
+                empty.push(slots.get(), slot);
+                healthy = false;
+            }
+        }
+        notify_waiters();
+        last_sweep_healthy.store(healthy, std::memory_order_relaxed);
+    }
+
+    // Ends a sweep's claim on `slot` with `outcome` (Idle, or Dead once its
+    // connection is closed). If an acquirer popped the slot meanwhile it is
+    // off the idle stack, so it goes back on the stack `outcome` calls for.
+    void finish_check(std::uint32_t slot, std::uint8_t outcome) {
+        std::uint8_t state = Checking;
+        if (slots[slot].state.compare_exchange_strong(state, outcome, std::memory_order_acq_rel))
+            return;
+        if (outcome == Idle) {
+            push_idle(slot);
+        } else {
+            slots[slot].state.store(Taken, std::memory_order_relaxed);
+            empty.push(slots.get(), slot);
+        }
+    }
+
+    Factory factory;
+    HealthCheck health_check;
+    Options options;
+    int pool_size;
+    std::uint64_t id;
+    std::unique_ptr<Slot[]> slots;
+    SlotStack idle;
+    SlotStack empty;
+    std::atomic<int> open{0};
+    std::atomic<int> in_use{0};
+    std::atomic<int> waiters{0};
+    std::atomic<bool> stopped{false};
+    std::atomic<bool> last_sweep_healthy{true};
+    std::atomic<bool> warmed{false};
+    std::atomic<std::uint64_t> timeouts{0};
+    std::atomic<std::uint64_t> creates{0};
+    std::atomic<std::uint64_t> create_failures{0};
+    std::atomic<std::uint64_t> destroys{0};
+    std::atomic<std::uint64_t> health_check_failures{0};
+    Histogram acquire_wait;
     std::mutex mutex;
+    // Acquirers wait on cv and the maintenance thread on its own condvar, so
+    // notify_one() always reaches an acquirer.
     std::condition_variable cv;
-    int pool_size;
+    std::condition_variable warm_cv;
+    std::condition_variable maintenance_cv;
+    int warming = 0;
+    std::vector<std::thread> warmers;
+    std::mutex caches_mutex;
+    std::vector<std::unique_ptr<ThreadCache>> caches;
+    std::unordered_map<std::thread::id, ThreadCache*> cache_by_thread;
+    std::thread maintenance;
 };
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Hashes and encodings needed by the database wire protocols (PostgreSQL
+// MD5 and SCRAM-SHA-256 authentication). Inputs and outputs are raw bytes
+// held in std::string.
+class Crypto {
+public:
+    static std::string md5(const std::string& data);
+    static std::string sha256(const std::string& data);
+    static std::string hmac_sha256(const std::string& key, const std::string& data);
+    static std::string pbkdf2_hmac_sha256(const std::string& password, const std::string& salt, int iterations);
+
+    static std::string hex(const std::string& bytes);
+    static std::string base64_encode(const std::string& bytes);
+    // Throws std::runtime_error on malformed input.
+    static std::string base64_decode(const std::string& text);
+
+    // From the OS CSPRNG, fit for SCRAM nonces; throws std::runtime_error
+    // if the OS cannot supply them.
+    static std::string random_bytes(std::size_t count);
+};
@@ -1,17 +1,45 @@
 #pragma once
+#include <cstddef>
 #include <string>
+#include <vector>
 
 struct DBConfig {
     enum DBType { PostgreSQL, MongoDB, None };
     enum CacheType { Redis, CacheNone };
+    enum CacheEncoding { CacheMessagePack, CacheJsonText };
+    enum ReplicaSelection { LeastOutstanding, LatencyWeighted };
     DBType db_type = None;
     std::string db_host;
-    int db_port;
+    int db_port = 0;
     std::string db_name;
     std::string db_user;
     std::string db_password;
     std::string db_connection_string;
     int db_pool_size = 10;
+    int db_pool_min_size = 1;
+    int db_pool_acquire_timeout_ms = 5000;
+    int db_pool_idle_timeout_ms = 60000;
+    int db_pool_health_check_interval_ms = 30000;
+    int db_pool_warmup_size = 1;
+    int db_connect_timeout_ms = 5000;
+    int db_query_timeout_ms = 30000;
+    int db_statement_cache_size = 64;
+    int startup_timeout_ms = 10000;
+    // Read replicas as "host" or "host:port" (default port: db_port). Read-only
+    // queries are spread across them; writes and transactions stay on db_host.
+    std::vector<std::string> db_replicas;
+    ReplicaSelection db_replica_selection = LeastOutstanding;
+    // A replica is taken out of rotation for db_replica_eject_ms after this
+    // many consecutive failures, or while its replay lag exceeds the limit.
+    int db_replica_error_threshold = 3;
+    int db_replica_max_lag_ms = 10000;
+    int db_replica_eject_ms = 30000;
+    // Group commit for MongoPrimitives::insertOne: once every pooled
+    // connection has an insert for a collection in flight, further calls wait
+    // up to the window and go out together, up to
+    // db_insert_batch_max_documents at a time. 0 sends every call on its own.
+    int db_insert_batch_window_us = 0;
+    int db_insert_batch_max_documents = 256;
     bool auto_create_db = true;
     CacheType cache_type = CacheNone;
     std::string cache_host;
@@ -19,4 +47,37 @@ struct DBConfig {
     std::string cache_password;
     int cache_db = 0;
     int cache_ttl = 3600;
+    // RedisPrimitives::getOrLoadJson keeps values this many seconds beyond
+    // their TTL, served stale while one request per process reloads them.
+    // XFetch reloads early with a probability that grows as expiry nears and
+    // with the time loads take; cache_xfetch_beta scales it (above 1 reloads
+    // sooner, 0 disables it).
+    int cache_stale_ttl = 60;
+    double cache_xfetch_beta = 1.0;
+    // RedisPrimitives commands from concurrent callers share this many
+    // connections and are written together (auto-pipelining). 0 leases a
+    // pooled connection for each command instead, one round trip apiece.
+    int cache_pipeline_connections = 1;
+    // Redis Cluster: keys are spread over its masters by hash slot (see
+    // RedisCluster), found through these seed nodes as "host" or "host:port"
+    // (default port: cache_port), or through cache_host when empty. cache_db
+    // is ignored, as cluster nodes only have database 0.
+    bool cache_cluster = false;
+    std::vector<std::string> cache_cluster_nodes;
+    // In-process L1 in front of RedisPrimitives::getJson and mgetJson, holding
+    // decoded values up to this many bytes (0 disables it). Entries live at
+    // most cache_local_ttl_ms; with cache_local_tracking, writes to their keys
+    // from any client evict them as soon as Redis reports them (RESP3 client
+    // tracking, Redis 6+), optionally only for keys with the given prefixes.
+    std::size_t cache_local_max_bytes = 0;
+    int cache_local_ttl_ms = 60000;
+    bool cache_local_tracking = true;
+    std::vector<std::string> cache_local_tracking_prefixes;
+    // How RedisPrimitives::setJson stores values (see JsonCodec). Values in
+    // either encoding are read back, but versions before MessagePack support
+    // only read text: keep CacheJsonText while they share the keyspace.
+    // MessagePack of at least cache_compress_threshold_bytes is LZ4-compressed
+    // (0 disables compression).
+    CacheEncoding cache_value_encoding = CacheMessagePack;
+    std::size_t cache_compress_threshold_bytes = 1024;
 };
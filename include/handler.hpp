@@ -0,0 +1,174 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "request.hpp"
+#include "response.hpp"
+
+// Type-erased route handler with small-buffer inline storage.
+// Callables of up to `capacity` bytes are stored inline, so unlike
+// std::function building or copying the handler does not allocate; larger
+// ones are boxed on the heap when the handler is built, never per request.
+// Dispatch is a single indirect call: straight to a free function, or
+// through a trampoline specialised for the stored callable type.
+class InlineHandler {
+public:
+    using Values = std::vector<std::string>;
+    using FreeFunction = Response (*)(Request&, const Values&);
+    static constexpr std::size_t capacity = 6 * sizeof(void*);
+
+    InlineHandler() noexcept = default;
+
+    InlineHandler(FreeFunction fn) noexcept : fn_(fn) {}
+
+    template <typename F,
+              typename D = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<D, InlineHandler> &&
+                                          !std::is_same_v<D, FreeFunction>>>
+    InlineHandler(F&& f) {
+        emplace(std::forward<F>(f));
+    }
+
+    InlineHandler(const InlineHandler& other) { copy_from(other); }
+    InlineHandler(InlineHandler&& other) noexcept { move_from(other); }
+
+    InlineHandler& operator=(const InlineHandler& other) {
+        if (this != &other) {
+            reset();
+            copy_from(other);
+        }
+        return *this;
+    }
+
+    InlineHandler& operator=(InlineHandler&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    ~InlineHandler() { reset(); }
+
+    // Throws std::bad_function_call when empty.
+    Response operator()(Request& req, const Values& values) const {
+        if (fn_)
+            return fn_(req, values);
+        if (!invoke_)
+            throw std::bad_function_call();
+        return invoke_(storage_, req, values);
+    }
+
+    explicit operator bool() const noexcept { return fn_ || invoke_; }
+
+private:
+    enum class Op { Copy, Move, Destroy };
+    using Invoke = Response (*)(const void*, Request&, const Values&);
+    using Manage = void (*)(Op, void* dst, void* src);
+
+    template <typename D>
+    static Response invoke(const void* storage, Request& req, const Values& values) {
+        return (*static_cast<const D*>(storage))(req, values);
+    }
+
+    template <typename D>
+    static constexpr bool fits_inline = sizeof(D) <= capacity && alignof(D) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<D>;
+
+    template <typename D>
+    static Response invoke_boxed(const void* storage, Request& req, const Values& values) {
+        return (**static_cast<D* const*>(storage))(req, values);
+    }
+
+    // The storage holds a D*; moving it moves the pointer.
+    template <typename D>
+    static void manage_boxed(Op op, void* dst, void* src) {
+        switch (op) {
+        case Op::Copy:
+            *static_cast<D**>(dst) = new D(**static_cast<D* const*>(src));
+            break;
+        case Op::Move:
+            *static_cast<D**>(dst) = *static_cast<D**>(src);
+            *static_cast<D**>(src) = nullptr;
+            break;
+        case Op::Destroy:
+            delete *static_cast<D**>(dst);
+            break;
+        }
+    }
+
+    template <typename D>
+    static void manage(Op op, void* dst, void* src) {
+        switch (op) {
+        case Op::Copy:
+            ::new (dst) D(*static_cast<const D*>(src));
+            break;
+        case Op::Move:
+            ::new (dst) D(std::move(*static_cast<D*>(src)));
+            static_cast<D*>(src)->~D();
+            break;
+        case Op::Destroy:
+            static_cast<D*>(dst)->~D();
+            break;
+        }
+    }
+
+    template <typename F>
+    void emplace(F&& f) {
+        using D = std::decay_t<F>;
+        static_assert(std::is_copy_constructible_v<D>, "handler callable must be copyable");
+        if constexpr (!fits_inline<D>) {
+            ::new (static_cast<void*>(storage_)) D*(new D(std::forward<F>(f)));
+            invoke_ = &invoke_boxed<D>;
+            manage_ = &manage_boxed<D>;
+        } else {
+            ::new (static_cast<void*>(storage_)) D(std::forward<F>(f));
+            invoke_ = &invoke<D>;
+            if constexpr (std::is_trivially_copyable_v<D> && std::is_trivially_destructible_v<D>)
+                manage_ = nullptr;
+            else
+                manage_ = &manage<D>;
+        }
+    }
+
+    void copy_from(const InlineHandler& other) {
+        if (other.manage_)
+            other.manage_(Op::Copy, storage_, const_cast<unsigned char*>(other.storage_));
+        else
+            std::memcpy(storage_, other.storage_, capacity);
+        fn_ = other.fn_;
+        invoke_ = other.invoke_;
+        manage_ = other.manage_;
+    }
+
+    void move_from(InlineHandler& other) noexcept {
+        if (other.manage_)
+            other.manage_(Op::Move, storage_, other.storage_);
+        else
+            std::memcpy(storage_, other.storage_, capacity);
+        fn_ = other.fn_;
+        invoke_ = other.invoke_;
+        manage_ = other.manage_;
+        other.fn_ = nullptr;
+        other.invoke_ = nullptr;
+        other.manage_ = nullptr;
+    }
+
+    void reset() noexcept {
+        if (manage_)
+            manage_(Op::Destroy, storage_, nullptr);
+        fn_ = nullptr;
+        invoke_ = nullptr;
+        manage_ = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[capacity] = {};
+    FreeFunction fn_ = nullptr;
+    Invoke invoke_ = nullptr;
+    Manage manage_ = nullptr;
+};
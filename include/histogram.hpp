@@ -0,0 +1,136 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// HDR-style log-linear histogram: every power of two is split into
+// 2^sub_bucket_bits linear sub-buckets, giving ~12% relative precision over
+// the full range with a fixed, small number of buckets. Recording is a
+// handful of relaxed atomic adds and never takes a lock.
+class Histogram {
+public:
+    static constexpr int sub_bucket_bits = 3;
+    static constexpr std::uint64_t sub_bucket_count = std::uint64_t(1) << sub_bucket_bits;
+    static constexpr int max_bits = 40;
+    static constexpr std::size_t bucket_count =
+        (max_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+    static std::size_t bucket_index(std::uint64_t value) noexcept {
+        if (value < 2 * sub_bucket_count)
+            return static_cast<std::size_t>(value);
+        int msb = most_significant_bit(value);
+        if (msb >= max_bits)
+            return bucket_count - 1;
+        int shift = msb - sub_bucket_bits;
+        std::uint64_t offset = (value >> shift) & (sub_bucket_count - 1);
+        return static_cast<std::size_t>((shift + 1) * sub_bucket_count + offset);
+    }
+
+    // Largest value that maps to `index`.
+    static std::uint64_t bucket_upper_bound(std::size_t index) noexcept {
+        if (index < 2 * sub_bucket_count)
+            return index;
+        std::size_t shift = index / sub_bucket_count - 1;
+        std::uint64_t offset = index % sub_bucket_count;
+        std::uint64_t lower = (sub_bucket_count + offset) << shift;
+        return lower + (std::uint64_t(1) << shift) - 1;
+    }
+
+    void record(std::uint64_t value) noexcept {
+        buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        std::uint64_t prev = max_.load(std::memory_order_relaxed);
+        while (value > prev && !max_.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::uint64_t count() const noexcept { return count_.load(std::memory_order_relaxed); }
+
+    struct Snapshot {
+        std::vector<std::uint64_t> buckets = std::vector<std::uint64_t>(bucket_count, 0);
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+        std::uint64_t max = 0;
+
+        void record(std::uint64_t value, std::uint64_t times = 1) {
+            buckets[bucket_index(value)] += times;
+            count += times;
+            sum += value * times;
+            if (value > max)
+                max = value;
+        }
+
+        void merge(const Snapshot& other) {
+            for (std::size_t i = 0; i < bucket_count; ++i)
+                buckets[i] += other.buckets[i];
+            count += other.count;
+            sum += other.sum;
+            if (other.max > max)
+                max = other.max;
+        }
+
+        // Number of recorded values that are <= `bound`; exact when `bound`
+        // is a power of two minus one.
+        std::uint64_t count_at_or_below(std::uint64_t bound) const {
+            std::uint64_t total = 0;
+            for (std::size_t i = 0; i < bucket_count && bucket_upper_bound(i) <= bound; ++i)
+                total += buckets[i];
+            return total;
+        }
+
+        std::uint64_t percentile(double q) const {
+            if (count == 0)
+                return 0;
+            auto rank = static_cast<std::uint64_t>(q / 100.0 * static_cast<double>(count) + 0.5);
+            if (rank == 0)
+                rank = 1;
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < bucket_count; ++i) {
+                seen += buckets[i];
+                if (seen >= rank)
+                    return bucket_upper_bound(i) < max ? bucket_upper_bound(i) : max;
+            }
+            return max;
+        }
+
+        double mean() const { return count ? static_cast<double>(sum) / static_cast<double>(count) : 0.0; }
+    };
+
+    void snapshot_into(Snapshot& out) const {
+        for (std::size_t i = 0; i < bucket_count; ++i)
+            out.buckets[i] += buckets_[i].load(std::memory_order_relaxed);
+        out.count += count_.load(std::memory_order_relaxed);
+        out.sum += sum_.load(std::memory_order_relaxed);
+        std::uint64_t m = max_.load(std::memory_order_relaxed);
+        if (m > out.max)
+            out.max = m;
+    }
+
+    Snapshot snapshot() const {
+        Snapshot out;
+        snapshot_into(out);
+        return out;
+    }
+
+private:
+    static int most_significant_bit(std::uint64_t value) noexcept {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<int>(index);
+#else
+        return 63 - __builtin_clzll(value);
+#endif
+    }
+
+    std::array<std::atomic<std::uint64_t>, bucket_count> buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
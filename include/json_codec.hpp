@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "db_config.hpp"
+#include "nlohmann/json.hpp"
+
+// How RedisPrimitives stores JSON values. Binary encodings start with a
+// two-byte header, 0xC1 and then the format, so they can be told apart from
+// JSON text (which never starts with 0xC1) written by older versions or
+// with the Text format; decode() reads all of them.
+//
+//   0xC1 'm' <MessagePack>
+//   0xC1 'z' <uint32 LE MessagePack size> <LZ4 block of the MessagePack>
+class JsonCodec {
+public:
+    enum Format { Text, MessagePack };
+
+    struct Options {
+        Format format = MessagePack;
+        // MessagePack at least this long is LZ4-compressed, if that makes it
+        // smaller. 0 never compresses.
+        std::size_t compress_threshold = 1024;
+
+        static Options from(const DBConfig& config);
+    };
+
+    static std::string encode(const nlohmann::json& value, const Options& options);
+    // Throws nlohmann::json::exception (text) or std::runtime_error on corrupt data.
+    static nlohmann::json decode(const std::string& data);
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+
+// Sharded, size-bounded in-process cache of decoded JSON values, each with
+// its own TTL. Admission and eviction follow W-TinyLFU: new entries enter a
+// small LRU window, and an entry leaving the window only displaces the main
+// region's eviction candidate if a count-min sketch of recent accesses says
+// it is wanted more often. Keys read once pass through without flushing the
+// hot set, as they would under plain LRU. The main region is a segmented
+// LRU: entries hit again while on probation move to the protected segment.
+class LocalCache {
+public:
+    using Value = std::shared_ptr<const nlohmann::json>;
+
+    // `max_bytes` bounds the estimated size of keys and values together.
+    // 0 shards picks a count from the hardware concurrency.
+    explicit LocalCache(std::size_t max_bytes, std::size_t shards = 0);
+    ~LocalCache();
+    LocalCache(const LocalCache&) = delete;
+    LocalCache& operator=(const LocalCache&) = delete;
+
+    // Null on a miss, including an expired entry.
+    Value get(const std::string& key);
+    // Read it before fetching the value to cache and pass it to put(), so a
+    // value fetched before a concurrent invalidation of the same key is not
+    // cached after it. Invalidations of other keys do not affect it.
+    std::uint64_t epoch(const std::string& key) const;
+    // Returns false if `key` was invalidated (or the cache cleared) since
+    // `epoch`, or the admission policy turned the value away.
+    bool put(const std::string& key, Value value, std::chrono::milliseconds ttl, std::uint64_t epoch);
+    void invalidate(const std::string& key);
+    void clear();
+
+    // hits, misses, hit_ratio, entries, bytes, max_bytes, evictions,
+    // rejections, expirations and invalidations, summed over the shards.
+    nlohmann::json stats() const;
+
+    // Rough heap footprint of a decoded value, as charged against max_bytes.
+    static std::size_t estimate_size(const nlohmann::json& value);
+
+private:
+    struct Shard;
+
+    Shard& shard_for(std::uint64_t hash) const;
+
+    std::size_t max_bytes_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
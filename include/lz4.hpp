@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// LZ4 block format (no frame), compatible with LZ4_compress_default and
+// LZ4_decompress_safe. The compressor is a single-pass greedy matcher that
+// favours speed over ratio, which is what cache values want.
+class Lz4 {
+public:
+    static std::string compress(const char* data, std::size_t size);
+    static std::string compress(const std::string& data) { return compress(data.data(), data.size()); }
+    // `original_size` must be the exact decompressed size, as stored by the
+    // caller. Throws std::runtime_error on malformed input.
+    static std::string decompress(const char* data, std::size_t size, std::size_t original_size);
+};
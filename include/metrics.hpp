@@ -0,0 +1,86 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "histogram.hpp"
+#include "timing.hpp"
+
+// Per-route request metrics exported in Prometheus text format.
+// Each recording thread owns a shard of cache-line aligned counters, so the
+// request path only does relaxed atomic adds on memory no other thread
+// writes; shards are merged when the exposition is rendered.
+class Metrics {
+public:
+    static constexpr std::size_t unmatched_route = static_cast<std::size_t>(-1);
+    static constexpr std::size_t routes_per_chunk = 8;
+    static constexpr std::size_t max_chunks = 512;
+
+    explicit Metrics(std::string path = "/metrics");
+    ~Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    const std::string& path() const { return path_; }
+
+    // Routes are labelled by method and template path, never by raw path.
+    void set_route_label(std::size_t route, const std::string& method, const std::string& template_path);
+
+    void record(std::size_t route, int status, std::size_t request_bytes,
+                std::size_t response_bytes, std::uint64_t latency_ns);
+
+    // Feeds one request's phase breakdown into the per-phase histograms.
+    void record_phases(const RequestTiming& timing);
+
+    // Appends samples from outside the request path, such as backend cache
+    // counters, to every exposition. Collectors write complete families.
+    void add_collector(std::function<void(std::ostream&)> collector);
+
+    std::string render() const;
+
+private:
+    struct alignas(64) RouteStats {
+        Histogram latency_ns;
+        Histogram response_bytes;
+        std::array<std::atomic<std::uint64_t>, 6> status_classes{};
+        std::atomic<std::uint64_t> request_bytes{0};
+    };
+
+    struct RouteChunk {
+        RouteStats routes[routes_per_chunk];
+    };
+
+    struct PhaseStats {
+        Histogram phases[RequestTiming::PhaseCount];
+    };
+
+    struct alignas(64) Shard {
+        std::array<std::atomic<RouteChunk*>, max_chunks> chunks{};
+        std::atomic<PhaseStats*> phases{nullptr};
+        ~Shard();
+        RouteStats* stats_for(std::size_t slot);
+    };
+
+    struct RouteLabel {
+        std::string method;
+        std::string template_path;
+    };
+
+    Shard& local_shard();
+
+    std::string path_;
+    std::uint64_t id_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::unordered_map<std::thread::id, Shard*> shard_by_thread_;
+    std::vector<RouteLabel> labels_;
+    std::vector<std::function<void(std::ostream&)>> collectors_;
+};
@@ -0,0 +1,140 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bson.hpp"
+#include "db_config.hpp"
+#include "socket.hpp"
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// A command reply with ok: 0. The connection that raised it is still usable;
+// transport failures throw SocketError instead.
+class MongoError : public std::runtime_error {
+public:
+    MongoError(int code, std::string code_name, const std::string& message)
+        : std::runtime_error(message), code_(code), code_name_(std::move(code_name)) {}
+    int code() const { return code_; }
+    const std::string& code_name() const { return code_name_; }
+
+private:
+    int code_;
+    std::string code_name_;
+};
+
+// One MongoDB session speaking OP_MSG directly (no driver), for servers 3.6
+// and later. Supports unauthenticated and SCRAM-SHA-256 sessions. Documents
+// are converted with Bson, so ObjectIds, dates and decimals travel as
+// Extended JSON wrappers.
+// Not thread-safe; share connections through ConnectionPool.
+class MongoConnection {
+public:
+    struct Options {
+        std::string host = "127.0.0.1";
+        int port = 27017;
+        std::string user;
+        std::string password;
+        std::string auth_database = "admin";
+        std::chrono::milliseconds connect_timeout{5000};
+        std::chrono::milliseconds io_timeout{30000};
+
+        static Options from(const DBConfig& config);
+    };
+
+    explicit MongoConnection(const Options& options);
+    MongoConnection(const MongoConnection&) = delete;
+    MongoConnection& operator=(const MongoConnection&) = delete;
+
+    // Runs `command` against `db` and returns the reply. `name` is the
+    // command's own key in `command` ("find", "insert", ...), which goes out
+    // first. Throws MongoError when the reply has ok: 0.
+    json command(const std::string& db, const std::string& name, const json& command);
+
+    // Runs a write command (insert, update or delete) with `documents` sent
+    // as the `identifier` document sequence ("documents", "updates" or
+    // "deletes"), split into as many messages as maxWriteBatchSize and
+    // maxMessageSizeBytes require. Unordered writes pipeline every message
+    // before reading the replies; ordered ones stop at the first message
+    // with a write error. Returns the merged {"n", "nModified", "upserted",
+    // "writeErrors"}, with indexes relative to `documents`.
+    json write(const std::string& db, const std::string& name, const json& command, const std::string& identifier,
+               const json& documents);
+
+    // Runs a find or aggregate and leaves its cursor open for fetch(). Each
+    // getMore is sent before the previous batch is handed out, so the server
+    // works while the caller consumes. The connection runs nothing else until
+    // fetch() returns false or close_cursor() is called.
+    void open_cursor(const std::string& db, const std::string& name, const json& command, std::size_t batch_size);
+    // Replaces `documents` with the next batch; false once the cursor is exhausted.
+    bool fetch(json& documents);
+    // As above, but hands each document of the batch to `each` as raw BSON,
+    // valid only during the call, without decoding it.
+    bool fetch(const std::function<void(const char*, std::size_t)>& each);
+    // Abandons an open cursor, killing it on the server.
+    void close_cursor();
+    bool cursor_open() const { return cursor_open_; }
+
+    bool ping();
+
+    // Set once a transport or protocol error leaves the session in an unknown state.
+    bool is_broken() const { return broken_; }
+
+    // Limits from the server's hello reply.
+    std::size_t max_write_batch_size() const { return max_write_batch_size_; }
+    std::size_t max_message_size() const { return max_message_size_; }
+    std::size_t max_bson_object_size() const { return max_bson_object_size_; }
+
+    // Wire traffic counters, for benchmarks and statistics.
+    std::uint64_t bytes_sent() const { return bytes_sent_; }
+    std::uint64_t bytes_received() const { return bytes_received_; }
+    std::uint64_t round_trips() const { return round_trips_; }
+
+private:
+    // Documents [begin, end) of `documents` sent as a kind-1 section.
+    struct Sequence {
+        const std::string* identifier = nullptr;
+        const std::vector<std::string>* documents = nullptr;
+        std::size_t begin = 0;
+        std::size_t end = 0;
+    };
+
+    std::int32_t send(const std::string& db, const std::string& name, const json& command, const Sequence& sequence);
+    json receive(std::int32_t request_id);
+    // The reply body undecoded; error replies still throw MongoError.
+    std::string receive_raw(std::int32_t request_id);
+    void handshake(const Options& options);
+    void authenticate(const Options& options);
+    void take_batch(const char* field);
+    void check_no_cursor() const;
+
+    void flush();
+    void ensure_buffered(std::size_t size);
+    [[noreturn]] void fail(const std::string& what);
+
+    Socket socket_;
+    std::string out_;
+    std::string in_;
+    std::size_t in_pos_ = 0;
+    std::int32_t next_request_id_ = 1;
+    std::size_t max_write_batch_size_ = 100000;
+    std::size_t max_message_size_ = 48000000;
+    std::size_t max_bson_object_size_ = 16 * 1024 * 1024;
+    std::string cursor_db_;
+    std::string cursor_collection_;
+    std::int64_t cursor_id_ = 0;
+    std::int32_t cursor_batch_size_ = 0;
+    // Last cursor reply, kept as BSON; cursor_batch_ points into it.
+    std::string cursor_reply_;
+    Bson::Element cursor_batch_;
+    // Request id of a getMore sent ahead of the caller; 0 when none.
+    std::int32_t get_more_request_ = 0;
+    bool cursor_open_ = false;
+    bool broken_ = false;
+    std::uint64_t bytes_sent_ = 0;
+    std::uint64_t bytes_received_ = 0;
+    std::uint64_t round_trips_ = 0;
+};
@@ -1,23 +1,81 @@
 #pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
 #include "db_config.hpp"
+#include "response.hpp"
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
 
+// Documents of one find or aggregate, pulled batch by batch with getMore
+// over a pooled connection that the cursor holds until it is exhausted or
+// destroyed. Only the current batch is held in memory.
+class MongoCursor {
+public:
+    MongoCursor(MongoCursor&&) noexcept;
+    MongoCursor& operator=(MongoCursor&&) noexcept;
+    ~MongoCursor();
+
+    // Replaces `documents` with the next batch; false once the cursor is exhausted.
+    bool next(json& documents);
+    // Hands each document of the next batch to `each` as raw BSON, valid only
+    // during the call; Bson::write_json turns it into text without a DOM.
+    bool next(const std::function<void(const char* data, std::size_t size)>& each);
+
+private:
+    friend class MongoPrimitives;
+    struct State;
+    explicit MongoCursor(std::unique_ptr<State> state);
+    std::unique_ptr<State> state;
+};
+
 class MongoPrimitives {
 public:
     static bool initialize(const DBConfig& config);
     static bool ensureDatabase(const std::string& dbName);
     static void shutdown();
+    // `options` fields (sort, projection, limit, skip, batchSize, ...) are
+    // passed through to the find command; every batch is collected with getMore.
+    // json objects keep keys in name order, so give a compound sort or hint as
+    // [[field, direction], ...] to keep its precedence.
     static json find(const std::string& collection, const json& filter, const json& options = {});
+    // Documents without an _id get a new ObjectId. Throws MongoError on a write error.
+    // With DBConfig::db_insert_batch_window_us set, concurrent calls for one
+    // collection share a single insert; each still gets its own result or error.
     static json insertOne(const std::string& collection, const json& document);
+    // Ordered; split into as many messages as the server's batch and message
+    // size limits require. Write errors are returned in "writeErrors".
     static json insertMany(const std::string& collection, const json& documents);
     static json updateOne(const std::string& collection, const json& filter, const json& update);
     static json updateMany(const std::string& collection, const json& filter, const json& update);
     static json deleteOne(const std::string& collection, const json& filter);
     static json deleteMany(const std::string& collection, const json& filter);
+    // A compound $sort stage needs its fields as {"$ordered": [...]} (see bson.hpp).
     static json aggregate(const std::string& collection, const json& pipeline);
+    // Cursor versions of find and aggregate. `options` is as for find(); its
+    // batchSize defaults to 1000.
+    static MongoCursor findCursor(const std::string& collection, const json& filter, const json& options = {});
+    static MongoCursor aggregateCursor(const std::string& collection, const json& pipeline, std::size_t batch_size = 1000);
+    // Streams the documents as a chunked response, one chunk per batch: a
+    // JSON array, or one object per line for "application/x-ndjson".
+    // Documents go from BSON to JSON text directly. The first batch is
+    // fetched before returning, so query errors still surface as
+    // exceptions; a later failure truncates the response.
+    static Response streamFind(const std::string& collection, const json& filter, const json& options = {},
+                               const std::string& content_type = "application/json");
+    static Response streamAggregate(const std::string& collection, const json& pipeline, std::size_t batch_size = 1000,
+                                    const std::string& content_type = "application/json");
+    // `keys` as [[field, direction], ...] keeps the field order; an object's
+    // fields are taken in name order, which only suits single-field indexes.
     static bool createIndex(const std::string& collection, const json& keys);
     static json getConnectionInfo();
     static bool isConnected();
+    // Opens `db_pool_warmup_size` connections in parallel, waiting until `deadline`.
+    static bool warmUp(std::chrono::steady_clock::time_point deadline);
+    static bool isReady();
+
+private:
+    static MongoCursor openCursor(const std::string& name, const json& command, std::size_t batch_size);
 };
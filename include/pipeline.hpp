@@ -0,0 +1,23 @@
+#pragma once
+#include <chrono>
+#include <map>
+#include <string>
+#include "request.hpp"
+#include "router.hpp"
+
+// Serialized result of running a request through the framework pipeline.
+struct PipelineResult {
+    int status = 200;
+    std::string content_type;
+    std::map<std::string, std::string> headers;
+    std::string body;
+    // Set instead of `body` for streamed responses; metrics for the request
+    // are recorded once the stream has been written.
+    Response::BodyStream stream;
+};
+
+// The request path shared by FastApiCpp::run and TestClient: parse the JSON
+// body, dispatch through Router::handle_request, serialize the Response and
+// record metrics. `req` carries method, path, headers and query parameters.
+PipelineResult run_pipeline(const Router& app, Request&& req, const std::string& body,
+                            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now());
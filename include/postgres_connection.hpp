@@ -0,0 +1,239 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "db_config.hpp"
+#include "socket.hpp"
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// An ErrorResponse from the server. The connection that raised it is still
+// usable; transport failures throw SocketError instead.
+class PostgresError : public std::runtime_error {
+public:
+    PostgresError(std::string sqlstate, const std::string& message)
+        : std::runtime_error(message), sqlstate_(std::move(sqlstate)) {}
+    const std::string& sqlstate() const { return sqlstate_; }
+
+private:
+    std::string sqlstate_;
+};
+
+// One PostgreSQL session speaking frontend/backend protocol v3 directly
+// (no libpq). Supports trust, cleartext, MD5 and SCRAM-SHA-256 auth and the
+// extended query protocol with text-format parameters and results.
+// Not thread-safe; share connections through ConnectionPool.
+//
+// Statements run through query() are prepared server-side and kept in a
+// per-connection LRU, so a repeated SQL string sends only Bind/Execute.
+class PostgresConnection {
+public:
+    // Shared by every connection of a pool to report one hit rate.
+    struct StatementCacheStats {
+        std::atomic<std::uint64_t> hits{0};
+        std::atomic<std::uint64_t> misses{0};
+        std::atomic<std::uint64_t> evictions{0};
+        std::atomic<std::uint64_t> invalidations{0};
+
+        json to_json() const {
+            std::uint64_t h = hits.load(std::memory_order_relaxed);
+            std::uint64_t m = misses.load(std::memory_order_relaxed);
+            return {{"hits", h},
+                    {"misses", m},
+                    {"hit_rate", h + m ? static_cast<double>(h) / static_cast<double>(h + m) : 0.0},
+                    {"evictions", evictions.load(std::memory_order_relaxed)},
+                    {"invalidations", invalidations.load(std::memory_order_relaxed)}};
+        }
+    };
+
+    struct Options {
+        std::string host = "127.0.0.1";
+        int port = 5432;
+        std::string user;
+        std::string password;
+        std::string database;
+        std::chrono::milliseconds connect_timeout{5000};
+        std::chrono::milliseconds io_timeout{30000};
+        // Prepared statements kept per connection; 0 sends Parse every time.
+        std::size_t statement_cache_size = 64;
+        std::shared_ptr<StatementCacheStats> statement_stats;
+
+        static Options from(const DBConfig& config);
+    };
+
+    explicit PostgresConnection(const Options& options);
+    ~PostgresConnection();
+    PostgresConnection(const PostgresConnection&) = delete;
+    PostgresConnection& operator=(const PostgresConnection&) = delete;
+
+    // Runs one statement with `$n` placeholders bound from `params` (a json
+    // array, a single scalar, or null for none). Returns
+    // {"command": tag, "rows_affected": n, "rows": [{column: value}, ...]}.
+    json query(const std::string& sql, const json& params = nullptr);
+
+    // Runs `statements` as one transaction in a single round trip: BEGIN,
+    // every statement and COMMIT go out as one pipeline behind one Sync, and
+    // results come back in order. On the first error the server skips the
+    // rest, the transaction is rolled back and the error is rethrown; a
+    // cached plan invalidated by a schema change is re-prepared and the
+    // transaction retried once.
+    json transaction(const std::vector<std::pair<std::string, json>>& statements);
+
+    // Bulk-loads rows with COPY ... FROM STDIN (FORMAT binary). `next_row`
+    // fills in one row (an object keyed by column, or a positional array) and
+    // returns false at the end. Rows are encoded straight into fixed-size
+    // CopyData chunks, so memory stays flat however many rows are sent.
+    // An empty `columns` means every column of `table`, which is resolved
+    // like a regclass literal: `events`, `app.events` or `"MixedCase"`. Returns
+    // {"command", "rows", "bytes", "seconds", "rows_per_second"}.
+    using RowSource = std::function<bool(json& row)>;
+    json copy_in(const std::string& table, std::vector<std::string> columns, const RowSource& next_row);
+    static constexpr std::size_t copy_chunk_size = 64 * 1024;
+
+    // Runs `sql` in a portal whose rows are then pulled with fetch(), at most
+    // `batch_size` per round trip, so a large result is never held at once.
+    // Each batch is requested before the previous one is handed out, so the
+    // server works while the caller consumes. The connection runs nothing
+    // else until fetch() returns false or close_cursor() is called.
+    void open_cursor(const std::string& sql, const json& params, std::size_t batch_size);
+    // Replaces `rows` with the next batch; false once the result is exhausted.
+    bool fetch(json& rows);
+    // Abandons an open cursor, discarding rows still in flight.
+    void close_cursor();
+    bool cursor_open() const { return cursor_open_; }
+
+    // Round trip with an empty Sync; false if the session is unusable.
+    bool ping();
+
+    // Set once a transport or protocol error leaves the session in an unknown state.
+    bool is_broken() const { return broken_; }
+    // Transaction status from the last ReadyForQuery: 'I' idle, 'T' in a block, 'E' failed block.
+    char transaction_status() const { return transaction_status_; }
+    std::string server_parameter(const std::string& name) const;
+    const StatementCacheStats& statement_cache_stats() const { return *statement_stats_; }
+    std::size_t cached_statements() const { return statements_.size(); }
+
+    // Wire traffic counters, for benchmarks and statistics.
+    std::uint64_t bytes_sent() const { return bytes_sent_; }
+    std::uint64_t bytes_received() const { return bytes_received_; }
+    std::uint64_t round_trips() const { return round_trips_; }
+
+    // Text encoding of a json parameter; returns false for SQL NULL.
+    static bool encode_param(const json& value, std::string& out);
+    // Decodes a text-format column value by type OID. NUMERIC values too
+    // precise for a double come back as strings.
+    static json decode_value(std::uint32_t type_oid, const char* data, std::size_t size);
+
+private:
+    struct Message {
+        char type = 0;
+        const char* data = nullptr;
+        std::size_t size = 0;
+    };
+
+    struct Column {
+        std::string name;
+        std::uint32_t type_oid = 0;
+    };
+
+    struct Statement {
+        std::string sql;
+        std::string name;
+        std::vector<Column> columns;
+    };
+
+    // One statement written into the current pipeline, awaiting its results.
+    struct Pending {
+        Statement* statement = nullptr;
+        bool prepared_now = false;
+        // The statement evicted to make room for this one, closed just
+        // before its Parse.
+        std::string evicted;
+    };
+
+    json run_query(const std::string& sql, const json& params, bool retry);
+    json run_transaction(const std::vector<std::pair<std::string, json>>& statements, bool retry);
+    Pending write_statement(const std::string& sql, const json& params, std::int32_t max_rows = 0);
+    json read_statement(const Pending& pending, std::string& error_state, std::string& error_message);
+    // Drops a cached statement that failed; true if the failure was an
+    // invalidated plan worth retrying.
+    bool settle_failure(const Pending& pending, const std::string& error_state);
+    // Undoes the cache changes of statements the server skipped after an error.
+    void settle_skipped(const Pending& pending);
+    void write_pending_closes();
+    Statement* lookup_statement(const std::string& sql);
+    Statement& add_statement(const std::string& sql, std::string& evicted);
+    void forget_statement(const std::string& sql);
+
+    void startup(const Options& options);
+    void authenticate_sasl(const Message& request, const Options& options);
+
+    // Outgoing messages accumulate in out_ until flush().
+    void begin_message(char type);
+    void end_message();
+    void put_int16(std::int16_t value);
+    void put_int32(std::int32_t value);
+    void put_cstring(const std::string& value);
+    void write_parse(const std::string& statement, const std::string& sql);
+    void write_bind(const std::string& portal, const std::string& statement, const json& params);
+    void write_describe(char kind, const std::string& name);
+    void write_execute(const std::string& portal, std::int32_t max_rows);
+    void write_sync();
+    void write_flush();
+    void write_copy_chunk(std::string& chunk);
+    void write_close(char kind, const std::string& name);
+    void flush();
+
+    Message next_message();
+    // Consumes one statement's responses up to CommandComplete (or an error).
+    json read_result(std::string& error_state, std::string& error_message);
+    void read_until_ready();
+    void ensure_buffered(std::size_t size);
+    void check_no_cursor() const;
+    [[noreturn]] void fail(const std::string& what);
+
+    Socket socket_;
+    std::string out_;
+    std::size_t message_start_ = 0;
+    std::string in_;
+    std::size_t in_pos_ = 0;
+    std::map<std::string, std::string> parameters_;
+    std::vector<Column> columns_;
+    // Most recently used first; the map's keys view the list's sql strings.
+    std::list<Statement> statement_lru_;
+    // Evicted entries stay alive until the pipeline that may reference them is read.
+    std::list<Statement> retired_statements_;
+    std::unordered_map<std::string_view, std::list<Statement>::iterator> statements_;
+    std::vector<std::string> pending_closes_;
+    // Quoted name, column names and type OIDs per COPY target, looked up
+    // once per table; dropped when a COPY into the table fails.
+    struct CopyTable {
+        std::string name;
+        std::vector<std::pair<std::string, std::uint32_t>> columns;
+    };
+    std::map<std::string, CopyTable> copy_tables_;
+    std::size_t statement_cache_size_ = 0;
+    std::uint64_t next_statement_id_ = 0;
+    std::shared_ptr<StatementCacheStats> statement_stats_;
+    Pending cursor_;
+    std::int32_t cursor_batch_size_ = 0;
+    bool cursor_open_ = false;
+    // Set by read_result when the portal stopped at its row limit.
+    bool portal_suspended_ = false;
+    int pending_syncs_ = 0;
+    char transaction_status_ = 'I';
+    bool broken_ = false;
+    std::uint64_t bytes_sent_ = 0;
+    std::uint64_t bytes_received_ = 0;
+    std::uint64_t round_trips_ = 0;
+};
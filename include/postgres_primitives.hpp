@@ -1,16 +1,77 @@
 #pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 #include "db_config.hpp"
+#include "response.hpp"
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
 
+// Rows of one query, pulled in batches over a pooled connection that the
+// cursor holds until it is exhausted or destroyed.
+class PostgresCursor {
+public:
+    PostgresCursor(PostgresCursor&&) noexcept;
+    PostgresCursor& operator=(PostgresCursor&&) noexcept;
+    ~PostgresCursor();
+
+    // Replaces `rows` with the next batch; false once the result is exhausted.
+    bool next(json& rows);
+
+private:
+    friend class PostgresPrimitives;
+    struct State;
+    explicit PostgresCursor(std::unique_ptr<State> state);
+    std::unique_ptr<State> state;
+};
+
 class PostgresPrimitives {
 public:
     static bool initialize(const DBConfig& config);
     static bool ensureDatabase(const std::string& dbName);
     static void shutdown();
+    // Read-only statements (SELECT, SHOW, VALUES, TABLE, side-effect-free WITH)
+    // go to a replica when `db_replicas` is set, falling back to the primary
+    // if none is available; everything else runs on the primary.
     static json executeQuery(const std::string& sql, const json& params = {});
+    // Always on the primary, e.g. for reads that must see a write just made
+    // or SELECTs that call functions with side effects.
+    static json executeOnPrimary(const std::string& sql, const json& params = {});
     static json executeTransaction(const std::vector<std::pair<std::string, json>>& queries);
+    // Runs `sql` through a portal and fetches at most `batch_size` rows per
+    // round trip, for results too large to materialize.
+    static PostgresCursor openCursor(const std::string& sql, const json& params = {}, std::size_t batch_size = 1000);
+    // Streams the rows of `sql` as a chunked response, one chunk per batch:
+    // a JSON array, or one object per line for "application/x-ndjson". The
+    // first batch is fetched before returning, so query errors still surface
+    // as exceptions; a later failure truncates the response.
+    static Response streamQuery(const std::string& sql, const json& params = {}, std::size_t batch_size = 1000,
+                                const std::string& content_type = "application/json");
+    // Bulk-loads rows with binary COPY, streaming them in fixed-size chunks.
+    // Rows are objects keyed by column or positional arrays; an empty
+    // `columns` means every column of `table`. Returns the row count, bytes
+    // sent and rows_per_second.
+    static json copyRows(const std::string& table, const json& rows, const std::vector<std::string>& columns = {});
+    static json copyRows(const std::string& table, const std::function<bool(json& row)>& next_row,
+                         const std::vector<std::string>& columns = {});
+    // Same for MODEL structs; each is converted to JSON only as it is sent.
+    template <typename Model>
+    static json copyModels(const std::string& table, const std::vector<Model>& models,
+                           const std::vector<std::string>& columns = {}) {
+        std::size_t next = 0;
+        return copyRows(table, [&](json& row) {
+            if (next == models.size())
+                return false;
+            row = models[next++];
+            return true;
+        }, columns);
+    }
     static json getConnectionInfo();
     static bool isConnected();
+    // Opens `db_pool_warmup_size` connections in parallel, waiting until `deadline`.
+    static bool warmUp(std::chrono::steady_clock::time_point deadline);
+    static bool isReady();
 };
@@ -0,0 +1,104 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "db_config.hpp"
+#include "redis_connection.hpp"
+#include "redis_node.hpp"
+#include "nlohmann/json.hpp"
+
+// Client side of Redis Cluster. A key belongs to one of 16384 hash slots,
+// the CRC16 of the key or of its {hash tag}, and each slot to one master,
+// as listed by CLUSTER SLOTS. Commands go straight to the node owning their
+// key's slot, each node with connections of its own (a RedisNode).
+//
+// The slot map is loaded on first use. A MOVED reply points its slot at the
+// new owner at once and has the whole map reloaded by the next caller; an
+// ASK reply, for a slot being migrated, retries that one command on the
+// importing node after ASKING without touching the map. TRYAGAIN is retried
+// after a short pause. A command gives up after max_redirects hops and
+// returns the last error reply.
+class RedisCluster {
+public:
+    static constexpr int slot_count = 16384;
+    static constexpr int max_redirects = 5;
+    // Called, once, for every node the client learns about.
+    using NodeListener = std::function<void(const RedisConnection::Options&)>;
+
+    // `seeds` as "host" or "host:port" (default port: cache_port), tried in
+    // order for CLUSTER SLOTS; empty uses cache_host.
+    RedisCluster(const DBConfig& config, const std::vector<std::string>& seeds, NodeListener on_node = {});
+    ~RedisCluster();
+    RedisCluster(const RedisCluster&) = delete;
+    RedisCluster& operator=(const RedisCluster&) = delete;
+
+    // CRC16 (XMODEM) of the key, or of the part between the first '{' and
+    // the next '}' if that is not empty, modulo 16384. Keys sharing a hash
+    // tag, like "{user:1}:name" and "{user:1}:email", share a slot.
+    static int hash_slot(const std::string& key);
+    // The slot of the key in args[1]; -1 for a command without one.
+    static int command_slot(const std::vector<std::string>& args);
+
+    // Routed by command_slot; keyless commands go to any node. Throws
+    // RedisError on an error reply.
+    RedisReply call(const std::vector<std::string>& args);
+    // Each command routed on its own. Those for the same node share one
+    // write and the nodes are asked concurrently, so this takes one round
+    // trip however many nodes are involved. Error replies are returned in
+    // place, in the order of `commands`.
+    std::vector<RedisReply> call_many(const std::vector<std::vector<std::string>>& commands);
+    // Back to back on the node owning `slot`, as MULTI/EXEC needs. After a
+    // MOVED reply to any of them, the whole batch is sent to the new owner.
+    std::vector<RedisReply> call_slot(int slot, const std::vector<std::vector<std::string>>& commands);
+    // On every master, e.g. FLUSHDB; throws the first error.
+    void call_all(const std::vector<std::string>& args);
+
+    // Reloads the slot map from the first node that answers, known nodes
+    // before seeds. Throws the last error if none does.
+    void refresh();
+
+    bool warm_up(std::chrono::steady_clock::time_point deadline);
+    bool connected();
+    bool ready();
+    // Per node: address, slots owned and RedisNode::stats(); plus refreshes
+    // and the redirects seen.
+    nlohmann::json stats();
+
+private:
+    RedisNode& node_for(int slot);
+    RedisNode& node_at(const std::string& host, int port);
+    std::vector<RedisNode*> masters();
+    void refresh_if_needed();
+    void load_slots();
+
+    DBConfig config_;
+    RedisConnection::Options base_;
+    std::vector<std::pair<std::string, int>> seeds_;
+    NodeListener on_node_;
+
+    // Guards nodes_ and announced_; nodes live as long as the client.
+    std::mutex nodes_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<RedisNode>> nodes_;
+    // Masters passed to on_node_ so far.
+    std::unordered_set<RedisNode*> announced_;
+    std::array<std::atomic<RedisNode*>, slot_count> slots_;
+
+    std::mutex refresh_mutex_;
+    std::atomic<bool> loaded_{false};
+    std::atomic<bool> stale_{true};
+    std::chrono::steady_clock::time_point next_refresh_;
+
+    std::atomic<std::uint64_t> refreshes_{0};
+    std::atomic<std::uint64_t> moved_{0};
+    std::atomic<std::uint64_t> asked_{0};
+    std::atomic<std::uint64_t> retried_{0};
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "db_config.hpp"
+#include "socket.hpp"
+
+// An error reply ("ERR ...", "WRONGTYPE ..."). The connection that raised it
+// is still usable; transport failures throw SocketError instead.
+class RedisError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+    // The error code: the first word of the message, e.g. "WRONGTYPE".
+    std::string code() const;
+};
+
+// One reply, RESP2 or RESP3. Verbatim strings arrive as String; maps hold
+// their keys and values alternately in `elements`.
+struct RedisReply {
+    enum Type { Nil, String, Status, Integer, Double, Boolean, BigNumber, Array, Map, Set, Push, Error };
+
+    Type type = Nil;
+    std::string str;
+    std::int64_t integer = 0;
+    double number = 0.0;
+    std::vector<RedisReply> elements;
+
+    bool is_nil() const { return type == Nil; }
+    bool is_error() const { return type == Error; }
+    bool is_ok() const { return type == Status && str == "OK"; }
+};
+
+// One Redis session speaking RESP directly (no hiredis). The handshake asks
+// for RESP3 with HELLO and falls back to RESP2 plus AUTH on servers older
+// than 6. Not thread-safe for commands; RedisMultiplexer shares one between
+// threads through the write()/read_reply() pair, which may run concurrently
+// with each other.
+class RedisConnection {
+public:
+    struct Options {
+        std::string host = "127.0.0.1";
+        int port = 6379;
+        std::string user;
+        std::string password;
+        int database = 0;
+        // 3 tries HELLO 3 first; 2 skips it.
+        int protocol = 3;
+        std::chrono::milliseconds connect_timeout{5000};
+        std::chrono::milliseconds io_timeout{30000};
+
+        static Options from(const DBConfig& config);
+    };
+
+    explicit RedisConnection(const Options& options);
+    RedisConnection(const RedisConnection&) = delete;
+    RedisConnection& operator=(const RedisConnection&) = delete;
+
+    // Sends one command and waits for its reply. Throws RedisError on an error reply.
+    RedisReply command(const std::vector<std::string>& args);
+    // Sends every command in one write, then reads their replies in order.
+    // Error replies come back as Error elements rather than being thrown.
+    std::vector<RedisReply> pipeline(const std::vector<std::vector<std::string>>& commands);
+
+    // Appends `args` to `out` as a RESP array of bulk strings.
+    static void encode(const std::vector<std::string>& args, std::string& out);
+    // Writes already encoded commands.
+    void write(const std::string& data);
+    // The next reply, with error replies returned rather than thrown.
+    // Out-of-band RESP3 pushes are skipped.
+    RedisReply read_reply();
+    // The next reply or out-of-band push, such as a client tracking invalidation.
+    RedisReply read_message();
+    // Waits up to `timeout` for a reply or push to start arriving.
+    bool wait_readable(std::chrono::milliseconds timeout);
+
+    bool ping();
+    // Shuts the socket down, waking a read or write blocked in another
+    // thread. The connection is broken afterwards.
+    void abort();
+
+    // Set once a transport or protocol error leaves the session in an unknown state.
+    bool is_broken() const { return broken_; }
+    // 2 or 3, as negotiated.
+    int protocol() const { return protocol_; }
+
+    // Wire traffic counters; writes are counted as round trips.
+    std::uint64_t bytes_sent() const { return bytes_sent_; }
+    std::uint64_t bytes_received() const { return bytes_received_; }
+    std::uint64_t round_trips() const { return round_trips_; }
+
+private:
+    void handshake(const Options& options);
+    RedisReply parse(int depth);
+    std::string read_line();
+    std::string read_bytes(std::size_t size);
+    void fill(std::size_t wanted);
+    [[noreturn]] void fail(const std::string& what);
+
+    Socket socket_;
+    std::string in_;
+    std::size_t in_pos_ = 0;
+    int protocol_ = 2;
+    std::atomic<bool> broken_{false};
+    std::atomic<std::uint64_t> bytes_sent_{0};
+    std::atomic<std::uint64_t> bytes_received_{0};
+    std::atomic<std::uint64_t> round_trips_{0};
+};
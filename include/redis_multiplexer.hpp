@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "redis_connection.hpp"
+#include "nlohmann/json.hpp"
+
+// One RedisConnection shared by any number of threads, with automatic
+// pipelining. Each call appends its command to a common output buffer.
+// While fewer than two writes are awaiting replies, a caller that finds no
+// write in progress sends everything buffered so far in one write;
+// otherwise its command waits and goes out with the next write, issued as
+// soon as a reply frees a slot. A caller that finds no read in progress
+// reads replies in order, handing each to its caller, until its own
+// arrives, then passes the role on. Concurrent callers thus share writes
+// and round trips with no I/O thread of their own, and a lone caller pays
+// one write and one read as before.
+//
+// The connection is opened on first use and reopened after a transport
+// error; the commands in flight at the time fail with that error.
+class RedisMultiplexer {
+    struct Waiter;
+
+public:
+    using Factory = std::function<std::unique_ptr<RedisConnection>()>;
+
+    explicit RedisMultiplexer(Factory factory);
+    RedisMultiplexer(const RedisMultiplexer&) = delete;
+    RedisMultiplexer& operator=(const RedisMultiplexer&) = delete;
+
+    // Throws RedisError on an error reply.
+    RedisReply call(const std::vector<std::string>& args);
+    // Queues `commands` back to back, so nothing from other callers lands
+    // between them (as MULTI/EXEC needs), and returns their replies in
+    // order. Error replies are returned as Error elements, not thrown.
+    std::vector<RedisReply> call_many(const std::vector<std::vector<std::string>>& commands);
+
+    // A call_many() split in two, so one caller can have commands in flight
+    // on several multiplexers at once: send() queues them (writing them
+    // straight away when it can) and wait() returns their replies. A ticket
+    // dropped before wait() waits when destroyed, as its replies still have
+    // to be read off the connection.
+    class Ticket {
+    public:
+        Ticket(Ticket&& other) noexcept;
+        Ticket& operator=(Ticket&&) = delete;
+        ~Ticket();
+
+        // Once per ticket.
+        std::vector<RedisReply> wait();
+
+    private:
+        friend class RedisMultiplexer;
+        Ticket(RedisMultiplexer* owner, std::unique_ptr<Waiter> waiter);
+
+        RedisMultiplexer* owner_;
+        std::unique_ptr<Waiter> waiter_;
+    };
+
+    Ticket send(const std::vector<std::vector<std::string>>& commands);
+
+    // Connects if needed and round-trips a PING.
+    bool ping();
+    bool connected() const;
+
+    // calls, writes, commands_per_write, connects and the protocol in use.
+    nlohmann::json stats() const;
+
+private:
+    struct Waiter {
+        std::vector<RedisReply> replies;
+        std::size_t expected = 1;
+        std::exception_ptr error;
+        bool done = false;
+        // Its last command ended a write, which is answered with its last reply.
+        bool ends_write = false;
+        // Its caller is blocked on `cv`, rather than busy elsewhere between
+        // send() and wait().
+        bool parked = false;
+        std::condition_variable cv;
+    };
+
+    void submit(Waiter& me, const std::vector<std::vector<std::string>>& commands);
+    void enqueue(Waiter& me, const std::vector<std::vector<std::string>>& commands);
+    void finish(Waiter& me);
+    void connect_if_needed();
+    void write_pending(std::unique_lock<std::mutex>& lock);
+    void read_until_done(Waiter& me, std::unique_lock<std::mutex>& lock);
+    void fail_all(const std::shared_ptr<RedisConnection>& conn, std::exception_ptr error);
+
+    Factory factory_;
+    mutable std::mutex mutex_;
+    std::shared_ptr<RedisConnection> conn_;
+    // Encoded commands not yet written; their waiters are already queued.
+    std::string out_;
+    // Callers awaiting replies, in the order their commands were buffered.
+    std::deque<Waiter*> waiting_;
+    bool writing_ = false;
+    bool reading_ = false;
+    int writes_in_flight_ = 0;
+
+    std::atomic<std::uint64_t> calls_{0};
+    std::atomic<std::uint64_t> writes_{0};
+    std::atomic<std::uint64_t> connects_{0};
+};
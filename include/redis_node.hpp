@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "db_config.hpp"
+#include "redis_connection.hpp"
+#include "nlohmann/json.hpp"
+
+template <typename ConnectionType>
+class ConnectionPool;
+class RedisMultiplexer;
+
+// The connections to one Redis server: DBConfig::cache_pipeline_connections
+// multiplexed ones (see RedisMultiplexer), or a pool leased one command at a
+// time when that is 0.
+class RedisNode {
+public:
+    RedisNode(const RedisConnection::Options& options, const DBConfig& config);
+    ~RedisNode();
+    RedisNode(const RedisNode&) = delete;
+    RedisNode& operator=(const RedisNode&) = delete;
+
+    // Throws RedisError on an error reply.
+    RedisReply call(const std::vector<std::string>& args);
+    // Back to back on one connection, in one write. Error replies are
+    // returned in place rather than thrown.
+    std::vector<RedisReply> call_many(const std::vector<std::vector<std::string>>& commands);
+
+    // call_many() split in two, so one caller can have commands out to
+    // several nodes at once: send() writes them and wait() reads their
+    // replies. A ticket dropped before wait() disposes of them itself.
+    class Ticket {
+    public:
+        Ticket(Ticket&& other) noexcept;
+        Ticket& operator=(Ticket&&) = delete;
+        ~Ticket();
+
+        // Once per ticket.
+        std::vector<RedisReply> wait();
+
+    private:
+        friend class RedisNode;
+        struct State;
+        explicit Ticket(std::unique_ptr<State> state);
+
+        std::unique_ptr<State> state_;
+    };
+
+    Ticket send(const std::vector<std::vector<std::string>>& commands);
+
+    // Opens every multiplexed connection, or `db_pool_warmup_size` pooled
+    // ones in parallel by `deadline`.
+    bool warm_up(std::chrono::steady_clock::time_point deadline);
+    bool connected() const;
+    // Once warm, as long as the pool is healthy or a multiplexed connection
+    // is up (see ConnectionPool::ready()).
+    bool ready();
+
+    const RedisConnection::Options& options() const { return options_; }
+    std::string address() const { return options_.host + ":" + std::to_string(options_.port); }
+    // "pool", and "pipelining" per multiplexed connection.
+    nlohmann::json stats() const;
+
+private:
+    RedisConnection::Options options_;
+    std::unique_ptr<ConnectionPool<RedisConnection>> pool_;
+    std::vector<std::unique_ptr<RedisMultiplexer>> multiplexers_;
+    std::atomic<std::size_t> next_{0};
+    // Multiplexed connections only; the pool latches its own.
+    std::atomic<bool> warmed_{false};
+};
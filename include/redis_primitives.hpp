@@ -1,9 +1,106 @@
 #pragma once
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <ostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 #include "db_config.hpp"
+#include "redis_connection.hpp"
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
 
+// The outcome of one command queued on a RedisPipeline, available once the
+// pipeline has executed. get() rethrows the command's error, e.g. a
+// RedisError for WRONGTYPE, without affecting the other commands.
+template <typename T>
+class RedisResult {
+public:
+    const T& get() const {
+        if (slot_->error)
+            std::rethrow_exception(slot_->error);
+        if (!slot_->value)
+            throw std::logic_error("Redis pipeline has not been executed");
+        return *slot_->value;
+    }
+
+    bool ready() const { return slot_->value || slot_->error; }
+
+private:
+    friend class RedisPipeline;
+
+    struct Slot {
+        std::optional<T> value;
+        std::exception_ptr error;
+    };
+
+    RedisResult() : slot_(std::make_shared<Slot>()) {}
+
+    std::shared_ptr<Slot> slot_;
+};
+
+// Commands queued here go out in one write when execute() runs, on a single
+// connection, and each hands back a typed RedisResult. From
+// RedisPrimitives::transaction() they are wrapped in MULTI/EXEC as well, so
+// they apply atomically; with DBConfig::cache_cluster their keys must then
+// share a hash slot, or execute() throws CROSSSLOT. Pipelined commands on
+// a cluster go out in one write per node.
+class RedisPipeline {
+public:
+    RedisResult<bool> set(const std::string& key, const std::string& value, int ttl = -1);
+    RedisResult<std::optional<std::string>> get(const std::string& key);
+    RedisResult<bool> del(const std::string& key);
+    RedisResult<bool> exists(const std::string& key);
+    RedisResult<bool> expire(const std::string& key, int ttl);
+    RedisResult<std::int64_t> incr(const std::string& key);
+    RedisResult<bool> setJson(const std::string& key, const json& value, int ttl = -1);
+    RedisResult<std::optional<json>> getJson(const std::string& key);
+    // Any other command, with its raw reply.
+    RedisResult<RedisReply> command(std::vector<std::string> args);
+
+    std::size_t size() const { return commands_.size(); }
+
+    // Runs every queued command; a pipeline executes once. Error replies
+    // land in their own results. A transport error, or a transaction the
+    // server refuses (EXECABORT), throws and fails every result with it.
+    void execute();
+
+private:
+    friend class RedisPrimitives;
+
+    explicit RedisPipeline(bool transaction) : transaction_(transaction) {}
+
+    template <typename T>
+    RedisResult<T> add(std::vector<std::string> args, std::function<T(RedisReply&)> convert);
+
+    // Fills in the result of the command at the same index.
+    struct Pending {
+        std::function<void(RedisReply&)> deliver;
+        std::function<void(std::exception_ptr)> fail;
+    };
+
+    bool transaction_;
+    bool executed_ = false;
+    std::vector<std::vector<std::string>> commands_;
+    std::vector<Pending> pending_;
+    // Keys written by typed commands, dropped from the local cache after execute().
+    std::vector<std::string> written_;
+};
+
+// Commands go over DBConfig::cache_pipeline_connections multiplexed
+// connections, so concurrent callers share round trips (see
+// RedisMultiplexer), or over pooled connections one at a time when that is
+// 0. With DBConfig::cache_cluster there are such connections to every
+// master of a Redis Cluster, each key going to the one that owns it (see
+// RedisCluster). Error replies throw RedisError. With
+// DBConfig::cache_local_max_bytes set, getJson and mgetJson are served from
+// an in-process LocalCache first.
 class RedisPrimitives {
 public:
     static bool initialize(const DBConfig& config);
@@ -12,9 +109,35 @@ public:
     static std::optional<std::string> get(const std::string& key);
     static bool del(const std::string& key);
     static bool exists(const std::string& key);
+    // Stored as DBConfig::cache_value_encoding (see JsonCodec); read it back
+    // with getJson rather than get.
     static bool setJson(const std::string& key, const json& value, int ttl = -1);
     static std::optional<json> getJson(const std::string& key);
+    // Cache-aside with stampede protection: the value cached under `key`, or
+    // what `loader` returns, cached for `ttl` seconds (DBConfig::cache_ttl
+    // when not positive). Loads are coalesced per key within the process,
+    // may start early (XFetch, DBConfig::cache_xfetch_beta), and past expiry
+    // the stale value is served while one caller reloads it
+    // (DBConfig::cache_stale_ttl). The key holds the value with its timing;
+    // read it through this call only. Loader exceptions propagate.
+    static json getOrLoadJson(const std::string& key, const std::function<json()>& loader, int ttl = -1);
+    // Multi-key forms, in one round trip. Results follow the order of `keys`;
+    // with clustering the keys are split per hash slot and the commands for
+    // all slots still go out together, to all their nodes at once.
+    static std::vector<std::optional<std::string>> mget(const std::vector<std::string>& keys);
+    static std::vector<std::optional<json>> mgetJson(const std::vector<std::string>& keys);
+    // MSET, or one pipelined SET ... EX per entry when `ttl` is positive.
+    static bool mset(const std::vector<std::pair<std::string, std::string>>& entries, int ttl = -1);
+    static RedisPipeline pipeline();
+    static RedisPipeline transaction();
     static bool expire(const std::string& key, int ttl);
     static bool flushDb();
+    static json getConnectionInfo();
+    // Local cache hits, misses, evictions and bytes in Prometheus text
+    // format, when DBConfig::cache_local_max_bytes is set.
+    static void writeMetrics(std::ostream& out);
     static bool isConnected();
+    // Opens `db_pool_warmup_size` connections in parallel, waiting until `deadline`.
+    static bool warmUp(std::chrono::steady_clock::time_point deadline);
+    static bool isReady();
 };
@@ -6,19 +6,39 @@
 
 using json = nlohmann::json;
 
+// Orders names ignoring ASCII case, as HTTP compares header names.
+struct CaseInsensitiveLess {
+    bool operator()(const std::string& a, const std::string& b) const;
+};
+
 struct Request {
+    using Headers = std::multimap<std::string, std::string, CaseInsensitiveLess>;
+    using Params = std::multimap<std::string, std::string>;
+
+    // Non-owning view of the server's own request, valid while it is being
+    // dispatched. `header` returns the first value of a header, or null.
+    struct Transport {
+        const void* request = nullptr;
+        const std::string* (*header)(const void* request, const std::string& name) = nullptr;
+        const Params* query_params = nullptr;
+    };
+
     std::string method;
     std::string path;
-    std::map<std::string, std::string> headers;
-    std::map<std::string, std::string> query_params;
+    // Filled by TestClient or by hand. FastApiCpp::run leaves them empty and
+    // sets `transport` instead, so serving a request copies neither; the
+    // getters below look in both.
+    Headers headers;
+    Params query_params;
+    Transport transport;
     std::map<std::string, std::string> path_params;
     std::optional<json> json_body;
     std::string raw_body;
 
     // Constructor
-    Request(const std::string& method, const std::string& path, const std::optional<json>& body = std::nullopt);
+    Request(const std::string& method, const std::string& path, std::optional<json>&& body = std::nullopt);
 
-    // Helper methods
+    // Helper methods; the first value when a name repeats.
     std::string get_header(const std::string& name) const;
     std::string get_query_param(const std::string& name) const;
     std::string get_path_param(const std::string& name) const;
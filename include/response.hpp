@@ -1,25 +1,38 @@
 #pragma once
 #include <string>
 #include <optional>
+#include <functional>
 #include <map>
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
 
 struct Response {
+    // A streamed body is produced by calling the stream once; it hands each
+    // piece to `write`, which returns false once the client has gone away.
+    // Bodies are sent with chunked transfer encoding as they are written.
+    using BodyWriter = std::function<bool(const char* data, std::size_t size)>;
+    using BodyStream = std::function<void(const BodyWriter& write)>;
+
     int status_code;
     std::map<std::string, std::string> headers;
     std::string content_type;
     std::string raw_body;
     std::optional<json> json_body;
+    BodyStream body_stream;
 
     // Constructors
     Response(const std::string& body, const std::string& type = "text/plain", int status = 200);
+    Response(std::string&& body, const std::string& type = "text/plain", int status = 200);
     Response(const char* body, const std::string& type = "text/plain", int status = 200);
     Response(const json& j, const std::string& type = "application/json", int status = 200);
+    Response(json&& j, const std::string& type = "application/json", int status = 200);
+
+    static Response stream(BodyStream body, const std::string& type = "application/octet-stream", int status = 200);
 
     // Methods
-    std::string dump() const;
+    std::string dump() const&;
+    std::string dump() &&;
     void set_header(const std::string& name, const std::string& value);
     std::string get_header(const std::string& name) const;
 };
@@ -1,17 +1,36 @@
 #pragma once
+#include <memory>
 #include <string>
 #include <vector>
-#include <functional>
+#include "handler.hpp"
+#include "metrics.hpp"
+#include "timing.hpp"
 #include "request.hpp"
 #include "response.hpp"
 
 class Router {
 public:
-    using Values = std::vector<std::string>;
-    using Handler = std::function<Response(const Request&, const Values&)>;
+    using Values = InlineHandler::Values;
+    using Handler = InlineHandler;
+    static constexpr size_t npos = Metrics::unmatched_route;
     void add_route(const std::string& method, const std::string& template_path, Handler handler);
-    Response handle_request(const std::string& method, const std::string& path, const std::optional<json>& body = std::nullopt) const;
+    // `matched_route`, if given, receives the index of the dispatched route or npos.
+    Response handle_request(const std::string& method, const std::string& path, std::optional<json>&& body = std::nullopt,
+                            size_t* matched_route = nullptr) const;
+    Response handle_request(Request&& req, size_t* matched_route = nullptr) const;
     size_t get_route_count() const { return routes.size(); }
+
+    // Opt-in Prometheus metrics, served by a GET route at `path`.
+    void enable_metrics(const std::string& path = "/metrics");
+    Metrics* metrics() const { return metrics_.get(); }
+
+    // GET route reporting Startup readiness: 200 once every configured backend
+    // is warm (or straight away without a DBConfig), 503 until then.
+    void enable_health(const std::string& path = "/health");
+
+    // Emit a Server-Timing header; needs a build with FASTAPI_CPP_ENABLE_TIMING.
+    void enable_server_timing(bool enabled = true) { server_timing_ = enabled; }
+    bool server_timing() const { return server_timing_; }
 private:
     struct Route {
         std::string method;
@@ -19,5 +38,7 @@ private:
         Handler handler;
     };
     std::vector<Route> routes;
+    std::unique_ptr<Metrics> metrics_;
+    bool server_timing_ = false;
     bool match_and_extract(const std::string& tpl, const std::string& path, Values& out_params) const;
 };
@@ -1,6 +1,10 @@
 #pragma once
+#include <chrono>
+#include <iostream>
 #include "httplib.hpp"
+#include "pipeline.hpp"
 #include "router.hpp"
+#include "startup.hpp"
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
@@ -8,27 +12,58 @@ using json = nlohmann::json;
 class FastApiCpp
 {
 public:
+    // Warms the configured backends (bounded by `startup_timeout_ms`) before
+    // the listening socket is opened.
+    static void run(Router &app, const std::string &host, int port, const DBConfig &config)
+    {
+        if (!Startup::initialize(config))
+            std::cout << "Serving before every backend is warm; health checks report 503 until they are" << std::endl;
+        run(app, host, port);
+    }
+
     static void run(Router &app, const std::string &host, int port)
     {
         httplib::Server svr;
+        // Headers and body go out in separate writes; without this Nagle's
+        // algorithm holds the body back until the client's delayed ACK.
+        svr.set_tcp_nodelay(true);
         auto handle_request = [&](const httplib::Request &req, httplib::Response &res)
         {
-            std::optional<json> parsed;
-            if (!req.body.empty())
+#if FASTAPI_CPP_ENABLE_TIMING
+            RequestTiming::begin(req.start_time_).mark(RequestTiming::Read);
+#endif
+            auto start = std::chrono::steady_clock::now();
+            Request app_req{req.method, req.path};
+            app_req.transport.request = &req;
+            app_req.transport.header = [](const void *source, const std::string &name) -> const std::string *
             {
-                try
-                {
-                    parsed = json::parse(req.body);
-                }
-                catch (...)
-                {
-                    res.status = 400;
-                    res.set_content("{\"error\":\"Invalid JSON\"}", "application/json");
-                    return;
-                }
+                const auto &headers = static_cast<const httplib::Request *>(source)->headers;
+                auto it = headers.find(name);
+                return it != headers.end() ? &it->second : nullptr;
+            };
+            app_req.transport.query_params = &req.params;
+
+            PipelineResult result = run_pipeline(app, std::move(app_req), req.body, start);
+            // The handler's status and headers go out as TestClient reports them.
+            res.status = result.status;
+            for (auto &header : result.headers)
+                res.set_header(header.first, header.second);
+            if (result.stream)
+            {
+                // An error part-way through drops the connection without the
+                // terminating chunk, so the client sees a truncated body.
+                res.set_chunked_content_provider(result.content_type, [stream = std::move(result.stream)](size_t, httplib::DataSink &sink)
+                                                 {
+                    try {
+                        stream([&sink](const char *data, size_t size) { return size == 0 || sink.write(data, size); });
+                    } catch (...) {
+                        return false;
+                    }
+                    sink.done();
+                    return true; });
+                return;
             }
-            Response app_res = app.handle_request(req.method, req.path, parsed);
-            res.set_content(app_res.dump(), app_res.content_type);
+            res.set_content(std::move(result.body), result.content_type);
         };
 
         svr.Get(R"(.*)", handle_request);
@@ -38,6 +73,19 @@ public:
         svr.Delete(R"(.*)", handle_request);
         svr.Options(R"(.*)", handle_request);
 
+#if FASTAPI_CPP_ENABLE_TIMING
+        // The logger runs on the connection thread once the response is written.
+        svr.set_logger([&app](const httplib::Request &, const httplib::Response &)
+                       {
+            RequestTiming *timing = RequestTiming::current();
+            if (!timing)
+                return;
+            timing->mark(RequestTiming::Write);
+            if (Metrics *metrics = app.metrics())
+                metrics->record_phases(*timing);
+            RequestTiming::end(); });
+#endif
+
         std::cout << "Server running at http://" << host << ":" << port << "\n";
         svr.listen(host, port);
     }
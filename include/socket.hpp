@@ -0,0 +1,52 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+class SocketError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Non-blocking TCP stream used by the database clients. Every call waits in
+// poll() against a deadline rather than blocking in the kernel, so a dead
+// peer surfaces as a SocketError instead of a hung request thread.
+class Socket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Socket() = default;
+    // Takes ownership of an already connected descriptor.
+    explicit Socket(int fd);
+    ~Socket();
+    Socket(Socket&& other) noexcept;
+    Socket& operator=(Socket&& other) noexcept;
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    static Socket connect(const std::string& host, int port, std::chrono::milliseconds timeout);
+
+    void set_timeout(std::chrono::milliseconds timeout) { timeout_ = timeout; }
+    std::chrono::milliseconds timeout() const { return timeout_; }
+
+    void write_all(const char* data, std::size_t size);
+    void write_all(const std::string& data) { write_all(data.data(), data.size()); }
+    // Returns at least one byte; throws on timeout or when the peer closed.
+    std::size_t read_some(char* buffer, std::size_t size);
+    // Waits up to `timeout` for data to become readable.
+    bool wait_readable(std::chrono::milliseconds timeout);
+
+    bool is_open() const { return fd_ >= 0; }
+    int fd() const { return fd_; }
+    void close();
+    // Shuts both directions down without releasing the descriptor, waking a
+    // read or write blocked on it in another thread.
+    void shutdown();
+
+private:
+    bool wait(short events, Clock::time_point deadline);
+
+    int fd_ = -1;
+    std::chrono::milliseconds timeout_{30000};
+};
@@ -0,0 +1,23 @@
+#pragma once
+#include <ostream>
+#include "db_config.hpp"
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// Brings up every backend named in the config in parallel and warms its pool
+// before the server accepts traffic. Readiness is reported by Router::enable_health.
+class Startup {
+public:
+    // Blocks until all configured backends are warm or `startup_timeout_ms`
+    // elapses; returns whether they all made it.
+    static bool initialize(const DBConfig& config);
+    static void shutdown();
+    // True when initialize() was never called, since then there is nothing
+    // to wait for; false once shut down.
+    static bool isReady();
+    // {"status": "ready" | "starting" | "stopped", "backends": {name: {"ready"}}}.
+    static json status();
+    // Prometheus samples from the configured backends; see Metrics::add_collector.
+    static void writeMetrics(std::ostream& out);
+};
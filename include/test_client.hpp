@@ -0,0 +1,40 @@
+#pragma once
+#include <map>
+#include <string>
+#include "pipeline.hpp"
+#include "router.hpp"
+
+// Drives a Router in-process through the same pipeline as FastApiCpp::run,
+// without sockets. Stateless, so one client can be shared by many threads.
+class TestClient {
+public:
+    using Headers = std::map<std::string, std::string>;
+
+    struct Result {
+        int status = 0;
+        Headers headers;
+        std::string content_type;
+        std::string body;
+        // Pieces a streamed response was written in; 0 for a plain body.
+        std::size_t chunks = 0;
+
+        json json_body() const { return json::parse(body); }
+        std::string get_header(const std::string& name) const;
+    };
+
+    explicit TestClient(const Router& app) : app(app) {}
+
+    // `path` may carry a query string, which is decoded into Request::query_params.
+    Result request(const std::string& method, const std::string& path, const std::string& body = "",
+                   const Headers& headers = {}) const;
+
+    Result get(const std::string& path, const Headers& headers = {}) const { return request("GET", path, "", headers); }
+    Result post(const std::string& path, const json& body, const Headers& headers = {}) const;
+    Result put(const std::string& path, const json& body, const Headers& headers = {}) const;
+    Result patch(const std::string& path, const json& body, const Headers& headers = {}) const;
+    Result del(const std::string& path, const Headers& headers = {}) const { return request("DELETE", path, "", headers); }
+    Result options(const std::string& path, const Headers& headers = {}) const { return request("OPTIONS", path, "", headers); }
+
+private:
+    const Router& app;
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Per-request phase timing. Compiled in only when FASTAPI_CPP_ENABLE_TIMING
+// is defined to 1 (CMake option of the same name); otherwise every
+// FASTAPI_TIMING_MARK expands to nothing.
+#ifndef FASTAPI_CPP_ENABLE_TIMING
+#define FASTAPI_CPP_ENABLE_TIMING 0
+#endif
+
+struct RequestTiming {
+    enum Phase : unsigned { Read, Parse, Match, Bind, Handler, Dump, Write, PhaseCount };
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr const char* phase_name(unsigned phase) {
+        constexpr const char* names[PhaseCount] = {"read", "parse", "match", "bind", "handler", "dump", "write"};
+        return names[phase];
+    }
+
+    std::array<std::uint64_t, PhaseCount> phase_ns{};
+    Clock::time_point last;
+
+    // Attributes the time since the previous mark to `phase`.
+    void mark(Phase phase) {
+        auto now = Clock::now();
+        phase_ns[phase] += static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count());
+        last = now;
+    }
+
+    // Value for a Server-Timing header; durations are in milliseconds.
+    std::string server_timing_header() const {
+        std::string out;
+        char buf[48];
+        for (unsigned p = 0; p < PhaseCount; ++p) {
+            if (p == Write)
+                continue;
+            std::snprintf(buf, sizeof(buf), "%s%s;dur=%.3f", out.empty() ? "" : ", ", phase_name(p),
+                          static_cast<double>(phase_ns[p]) / 1e6);
+            out += buf;
+        }
+        return out;
+    }
+
+    // The timing of the request being served on this thread, if any.
+    static RequestTiming*& current() {
+        thread_local RequestTiming* active = nullptr;
+        return active;
+    }
+
+    static RequestTiming& begin(Clock::time_point start) {
+        thread_local RequestTiming instance;
+        instance.phase_ns.fill(0);
+        instance.last = start;
+        current() = &instance;
+        return instance;
+    }
+
+    static void end() { current() = nullptr; }
+};
+
+#if FASTAPI_CPP_ENABLE_TIMING
+#define FASTAPI_TIMING_MARK(phase)                              \
+    do {                                                        \
+        if (RequestTiming* timing_ = RequestTiming::current())  \
+            timing_->mark(RequestTiming::phase);                \
+    } while (0)
+#else
+#define FASTAPI_TIMING_MARK(phase) \
+    do {                           \
+    } while (0)
+#endif
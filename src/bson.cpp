@@ -0,0 +1,780 @@
+#include "../include/bson.hpp"
+#include "../include/crypto.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+struct Reader {
+    const char* p;
+    const char* end;
+
+    void need(std::size_t n) const {
+        if (static_cast<std::size_t>(end - p) < n)
+            throw std::runtime_error("Truncated BSON document");
+    }
+    std::uint32_t uint32() {
+        need(4);
+        std::uint32_t v = 0;
+        for (int i = 3; i >= 0; --i)
+            v = v << 8 | static_cast<unsigned char>(p[i]);
+        p += 4;
+        return v;
+    }
+    std::int32_t int32() { return static_cast<std::int32_t>(uint32()); }
+    std::uint64_t uint64() {
+        std::uint64_t low = uint32();
+        return static_cast<std::uint64_t>(uint32()) << 32 | low;
+    }
+    std::string cstring() {
+        const char* start = skip_cstring();
+        return std::string(start, p - 1);
+    }
+    // Steps over a C string, returning where it started.
+    const char* skip_cstring() {
+        const char* nul = static_cast<const char*>(std::memchr(p, 0, static_cast<std::size_t>(end - p)));
+        if (!nul)
+            throw std::runtime_error("Unterminated BSON string");
+        const char* start = p;
+        p = nul + 1;
+        return start;
+    }
+};
+
+void put_uint32(std::string& out, std::uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+
+void put_uint64(std::string& out, std::uint64_t v) {
+    put_uint32(out, static_cast<std::uint32_t>(v));
+    put_uint32(out, static_cast<std::uint32_t>(v >> 32));
+}
+
+void put_header(std::string& out, char type, const std::string& name) {
+    out += type;
+    out += name;
+    out += '\0';
+}
+
+std::size_t begin_document(std::string& out) {
+    std::size_t at = out.size();
+    out.append(4, '\0');
+    return at;
+}
+
+void end_document(std::string& out, std::size_t at) {
+    out += '\0';
+    std::uint32_t size = static_cast<std::uint32_t>(out.size() - at);
+    for (int i = 0; i < 4; ++i)
+        out[at + i] = static_cast<char>((size >> (8 * i)) & 0xff);
+}
+
+void put_string(std::string& out, const std::string& name, const std::string& value) {
+    put_header(out, 0x02, name);
+    put_uint32(out, static_cast<std::uint32_t>(value.size() + 1));
+    out += value;
+    out += '\0';
+}
+
+// Size in bytes of an element value of `type` starting at r.p.
+std::size_t value_size(char type, Reader r) {
+    switch (static_cast<unsigned char>(type)) {
+    case 0x01:
+    case 0x09:
+    case 0x11:
+    case 0x12:
+        return 8;
+    case 0x02:
+    case 0x0D:
+    case 0x0E:
+        return 4 + static_cast<std::size_t>(r.uint32());
+    case 0x03:
+    case 0x04:
+    case 0x0F:
+        return static_cast<std::size_t>(r.uint32());
+    case 0x05:
+        return 5 + static_cast<std::size_t>(r.uint32());
+    case 0x06:
+    case 0x0A:
+    case 0x7F:
+    case 0xFF:
+        return 0;
+    case 0x07:
+        return 12;
+    case 0x08:
+        return 1;
+    case 0x10:
+        return 4;
+    case 0x13:
+        return 16;
+    case 0x0B: {
+        const char* start = r.p;
+        r.cstring();
+        r.cstring();
+        return static_cast<std::size_t>(r.p - start);
+    }
+    case 0x0C:
+        return 4 + static_cast<std::size_t>(r.uint32()) + 12;
+    default:
+        throw std::runtime_error("Unknown BSON element type " + std::to_string(static_cast<unsigned char>(type)));
+    }
+}
+
+int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Decimal128 coefficients (up to 113 bits) as four 32-bit limbs, most
+// significant first.
+using Limbs = std::array<std::uint32_t, 4>;
+
+std::uint32_t divide_by_10(Limbs& v) {
+    std::uint64_t remainder = 0;
+    for (auto& limb : v) {
+        std::uint64_t current = remainder << 32 | limb;
+        limb = static_cast<std::uint32_t>(current / 10);
+        remainder = current % 10;
+    }
+    return static_cast<std::uint32_t>(remainder);
+}
+
+void multiply_add(Limbs& v, std::uint32_t factor, std::uint32_t addend) {
+    std::uint64_t carry = addend;
+    for (int i = 3; i >= 0; --i) {
+        std::uint64_t current = static_cast<std::uint64_t>(v[i]) * factor + carry;
+        v[i] = static_cast<std::uint32_t>(current);
+        carry = current >> 32;
+    }
+}
+
+const int decimal_exponent_bias = 6176;
+
+std::string decimal128_to_string(std::uint64_t high, std::uint64_t low) {
+    bool negative = high >> 63;
+    std::uint32_t combination = static_cast<std::uint32_t>(high >> 58) & 0x1f;
+    if (combination == 0x1f)
+        return "NaN";
+    if (combination == 0x1e)
+        return negative ? "-Infinity" : "Infinity";
+
+    int biased;
+    Limbs coefficient{};
+    if (((high >> 61) & 3) == 3) {
+        // Non-canonical: the coefficient would exceed 10^34, so it reads as zero.
+        biased = static_cast<int>((high >> 47) & 0x3fff);
+    } else {
+        biased = static_cast<int>((high >> 49) & 0x3fff);
+        std::uint64_t coefficient_high = high & 0x1ffffffffffffULL;
+        coefficient = {static_cast<std::uint32_t>(coefficient_high >> 32), static_cast<std::uint32_t>(coefficient_high),
+                       static_cast<std::uint32_t>(low >> 32), static_cast<std::uint32_t>(low)};
+    }
+    int exponent = biased - decimal_exponent_bias;
+
+    std::string digits;
+    while (coefficient != Limbs{})
+        digits.insert(digits.begin(), static_cast<char>('0' + divide_by_10(coefficient)));
+    if (digits.empty())
+        digits = "0";
+
+    std::string text = negative ? "-" : "";
+    int adjusted = exponent + static_cast<int>(digits.size()) - 1;
+    if (exponent <= 0 && adjusted >= -6) {
+        if (exponent == 0)
+            return text + digits;
+        int point = static_cast<int>(digits.size()) + exponent;
+        if (point > 0)
+            return text + digits.substr(0, static_cast<std::size_t>(point)) + "." + digits.substr(static_cast<std::size_t>(point));
+        return text + "0." + std::string(static_cast<std::size_t>(-point), '0') + digits;
+    }
+    text += digits[0];
+    if (digits.size() > 1)
+        text += "." + digits.substr(1);
+    return text + "E" + (adjusted >= 0 ? "+" : "") + std::to_string(adjusted);
+}
+
+void string_to_decimal128(const std::string& text, std::uint64_t& high, std::uint64_t& low) {
+    std::string s = text;
+    bool negative = false;
+    if (!s.empty() && (s[0] == '-' || s[0] == '+')) {
+        negative = s[0] == '-';
+        s.erase(0, 1);
+    }
+    std::uint64_t sign = negative ? 1ULL << 63 : 0;
+    low = 0;
+    if (s == "NaN") {
+        high = 0x7c00000000000000ULL;
+        return;
+    }
+    if (s == "Infinity" || s == "Inf") {
+        high = 0x7800000000000000ULL | sign;
+        return;
+    }
+
+    std::string digits;
+    int exponent = 0;
+    bool seen_point = false;
+    std::size_t i = 0;
+    for (; i < s.size(); ++i) {
+        char c = s[i];
+        if (c >= '0' && c <= '9') {
+            digits += c;
+            if (seen_point)
+                --exponent;
+        } else if (c == '.' && !seen_point) {
+            seen_point = true;
+        } else {
+            break;
+        }
+    }
+    if (i < s.size()) {
+        if ((s[i] != 'e' && s[i] != 'E') || i + 1 == s.size())
+            throw std::invalid_argument("Invalid $numberDecimal: " + text);
+        std::size_t used = 0;
+        exponent += std::stoi(s.substr(i + 1), &used);
+        if (i + 1 + used != s.size())
+            throw std::invalid_argument("Invalid $numberDecimal: " + text);
+    }
+    if (digits.empty())
+        throw std::invalid_argument("Invalid $numberDecimal: " + text);
+    digits.erase(0, std::min(digits.find_first_not_of('0'), digits.size() - 1));
+    while (digits.size() > 34 && digits.back() == '0') {
+        digits.pop_back();
+        ++exponent;
+    }
+    while (exponent > 6111 && digits.size() < 34 && digits != "0") {
+        digits += '0';
+        --exponent;
+    }
+    if (digits.size() > 34 || exponent > 6111 || exponent < -decimal_exponent_bias)
+        throw std::invalid_argument("$numberDecimal out of range: " + text);
+
+    Limbs coefficient{};
+    for (char c : digits)
+        multiply_add(coefficient, 10, static_cast<std::uint32_t>(c - '0'));
+    std::uint64_t biased = static_cast<std::uint64_t>(exponent + decimal_exponent_bias);
+    high = sign | biased << 49 | (static_cast<std::uint64_t>(coefficient[0]) << 32 | coefficient[1]);
+    low = static_cast<std::uint64_t>(coefficient[2]) << 32 | coefficient[3];
+}
+
+// Rewrites the document at `in` into `out`, replacing the BSON types
+// nlohmann cannot read with their Extended JSON wrappers.
+void to_portable(Reader& in, std::string& out) {
+    const char* start = in.p;
+    std::uint32_t size = in.uint32();
+    if (size < 5 || size > static_cast<std::size_t>(in.end - start))
+        throw std::runtime_error("Invalid BSON document length");
+    Reader body{in.p, start + size};
+    std::size_t at = begin_document(out);
+    while (true) {
+        body.need(1);
+        char type = *body.p++;
+        if (type == 0)
+            break;
+        std::string name = body.cstring();
+        switch (static_cast<unsigned char>(type)) {
+        case 0x03:
+        case 0x04:
+            put_header(out, type, name);
+            to_portable(body, out);
+            break;
+        case 0x07: {
+            body.need(12);
+            put_header(out, 0x03, name);
+            std::size_t wrapper = begin_document(out);
+            put_string(out, "$oid", Crypto::hex(std::string(body.p, 12)));
+            end_document(out, wrapper);
+            body.p += 12;
+            break;
+        }
+        case 0x09: {
+            put_header(out, 0x03, name);
+            std::size_t wrapper = begin_document(out);
+            put_header(out, 0x12, "$date");
+            put_uint64(out, body.uint64());
+            end_document(out, wrapper);
+            break;
+        }
+        case 0x11: {
+            std::uint64_t value = body.uint64();
+            put_header(out, 0x03, name);
+            std::size_t wrapper = begin_document(out);
+            put_header(out, 0x03, "$timestamp");
+            std::size_t inner = begin_document(out);
+            put_header(out, 0x12, "t");
+            put_uint64(out, value >> 32);
+            put_header(out, 0x12, "i");
+            put_uint64(out, value & 0xffffffffu);
+            end_document(out, inner);
+            end_document(out, wrapper);
+            break;
+        }
+        case 0x13: {
+            std::uint64_t low = body.uint64();
+            std::uint64_t high = body.uint64();
+            put_header(out, 0x03, name);
+            std::size_t wrapper = begin_document(out);
+            put_string(out, "$numberDecimal", decimal128_to_string(high, low));
+            end_document(out, wrapper);
+            break;
+        }
+        case 0x0B: {
+            std::string pattern = body.cstring();
+            std::string options = body.cstring();
+            put_header(out, 0x03, name);
+            std::size_t wrapper = begin_document(out);
+            put_header(out, 0x03, "$regularExpression");
+            std::size_t inner = begin_document(out);
+            put_string(out, "pattern", pattern);
+            put_string(out, "options", options);
+            end_document(out, inner);
+            end_document(out, wrapper);
+            break;
+        }
+        case 0x7F:
+        case 0xFF: {
+            put_header(out, 0x03, name);
+            std::size_t wrapper = begin_document(out);
+            put_header(out, 0x10, type == 0x7F ? "$maxKey" : "$minKey");
+            put_uint32(out, 1);
+            end_document(out, wrapper);
+            break;
+        }
+        case 0x06:
+            put_header(out, 0x0A, name);
+            break;
+        case 0x0E: {
+            std::size_t value = value_size(type, body);
+            body.need(value);
+            put_header(out, 0x02, name);
+            out.append(body.p, value);
+            body.p += value;
+            break;
+        }
+        case 0x0C:
+        case 0x0D:
+        case 0x0F:
+            throw std::runtime_error("Unsupported BSON element type " + std::to_string(static_cast<unsigned char>(type)) +
+                                     " in field " + name);
+        default: {
+            std::size_t value = value_size(type, body);
+            body.need(value);
+            put_header(out, type, name);
+            out.append(body.p, value);
+            body.p += value;
+        }
+        }
+    }
+    end_document(out, at);
+    in.p = start + size;
+}
+
+double to_double(std::uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void write_string(std::string& out, const char* data, std::size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    out += '"';
+    for (std::size_t i = 0; i < size; ++i) {
+        char c = data[i];
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                out += "\\u00";
+                out += digits[(c >> 4) & 0xf];
+                out += digits[c & 0xf];
+            } else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+}
+
+// JSON text for the document at `in`, in the shape decode() followed by
+// dump() gives (except that fields keep their BSON order).
+void write_document(Reader& in, std::string& out, bool array) {
+    const char* start = in.p;
+    std::uint32_t size = in.uint32();
+    if (size < 5 || size > static_cast<std::size_t>(in.end - start))
+        throw std::runtime_error("Invalid BSON document length");
+    Reader body{in.p, start + size};
+    out += array ? '[' : '{';
+    bool first = true;
+    while (true) {
+        body.need(1);
+        char type = *body.p++;
+        if (type == 0)
+            break;
+        const char* name = body.skip_cstring();
+        if (!first)
+            out += ',';
+        first = false;
+        if (!array) {
+            write_string(out, name, static_cast<std::size_t>(body.p - name - 1));
+            out += ':';
+        }
+        switch (static_cast<unsigned char>(type)) {
+        case 0x01: {
+            double value = to_double(body.uint64());
+            out += json(value).dump();
+            break;
+        }
+        case 0x02:
+        case 0x0E: {
+            std::uint32_t length = body.uint32();
+            body.need(length);
+            if (length == 0)
+                throw std::runtime_error("Invalid BSON string length");
+            write_string(out, body.p, length - 1);
+            body.p += length;
+            break;
+        }
+        case 0x03:
+        case 0x04:
+            write_document(body, out, type == 0x04);
+            break;
+        case 0x05: {
+            std::uint32_t length = body.uint32();
+            body.need(1 + static_cast<std::size_t>(length));
+            auto subtype = static_cast<unsigned char>(*body.p++);
+            out += "{\"bytes\":[";
+            for (std::uint32_t i = 0; i < length; ++i) {
+                if (i)
+                    out += ',';
+                out += std::to_string(static_cast<unsigned char>(body.p[i]));
+            }
+            out += "],\"subtype\":" + std::to_string(subtype) + "}";
+            body.p += length;
+            break;
+        }
+        case 0x06:
+        case 0x0A:
+            out += "null";
+            break;
+        case 0x07:
+            body.need(12);
+            out += "{\"$oid\":\"" + Crypto::hex(std::string(body.p, 12)) + "\"}";
+            body.p += 12;
+            break;
+        case 0x08:
+            body.need(1);
+            out += *body.p++ ? "true" : "false";
+            break;
+        case 0x09:
+            out += "{\"$date\":" + std::to_string(static_cast<std::int64_t>(body.uint64())) + "}";
+            break;
+        case 0x0B: {
+            const char* pattern = body.skip_cstring();
+            const char* options = body.skip_cstring();
+            out += "{\"$regularExpression\":{\"pattern\":";
+            write_string(out, pattern, static_cast<std::size_t>(options - pattern - 1));
+            out += ",\"options\":";
+            write_string(out, options, static_cast<std::size_t>(body.p - options - 1));
+            out += "}}";
+            break;
+        }
+        case 0x10:
+            out += std::to_string(body.int32());
+            break;
+        case 0x11: {
+            std::uint64_t value = body.uint64();
+            out += "{\"$timestamp\":{\"t\":" + std::to_string(value >> 32) + ",\"i\":" +
+                   std::to_string(value & 0xffffffffu) + "}}";
+            break;
+        }
+        case 0x12:
+            out += std::to_string(static_cast<std::int64_t>(body.uint64()));
+            break;
+        case 0x13: {
+            std::uint64_t low = body.uint64();
+            std::uint64_t high = body.uint64();
+            out += "{\"$numberDecimal\":\"" + decimal128_to_string(high, low) + "\"}";
+            break;
+        }
+        case 0x7F:
+            out += "{\"$maxKey\":1}";
+            break;
+        case 0xFF:
+            out += "{\"$minKey\":1}";
+            break;
+        default:
+            throw std::runtime_error("Unsupported BSON element type " + std::to_string(static_cast<unsigned char>(type)) +
+                                     " in field " + name);
+        }
+    }
+    out += array ? ']' : '}';
+    in.p = start + size;
+}
+
+std::int64_t integer_value(const json& value) {
+    if (value.is_number_integer())
+        return value.get<std::int64_t>();
+    if (value.is_number_float())
+        return static_cast<std::int64_t>(value.get<double>());
+    if (value.is_string())
+        return std::stoll(value.get<std::string>());
+    if (value.is_object() && value.contains("$numberLong"))
+        return std::stoll(value["$numberLong"].get<std::string>());
+    throw std::invalid_argument("Expected an integer in Extended JSON, got " + value.dump());
+}
+
+void encode_value(const std::string& name, const json& value, std::string& out);
+
+// Writes the native element for an Extended JSON wrapper; false if
+// `wrapper` is an ordinary document.
+bool put_native(std::string& out, const std::string& name, const json& wrapper) {
+    const std::string& key = wrapper.begin().key();
+    const json& value = wrapper.begin().value();
+    if (key == "$oid" && value.is_string() && value.get_ref<const std::string&>().size() == 24) {
+        const std::string& hex = value.get_ref<const std::string&>();
+        std::string bytes;
+        for (std::size_t i = 0; i < 24; i += 2) {
+            int high = hex_digit(hex[i]), low = hex_digit(hex[i + 1]);
+            if (high < 0 || low < 0)
+                return false;
+            bytes += static_cast<char>(high << 4 | low);
+        }
+        put_header(out, 0x07, name);
+        out += bytes;
+    } else if (key == "$date") {
+        put_header(out, 0x09, name);
+        put_uint64(out, static_cast<std::uint64_t>(integer_value(value)));
+    } else if (key == "$numberLong" && value.is_string()) {
+        put_header(out, 0x12, name);
+        put_uint64(out, static_cast<std::uint64_t>(std::stoll(value.get<std::string>())));
+    } else if (key == "$numberDecimal" && value.is_string()) {
+        std::uint64_t high, low;
+        string_to_decimal128(value.get<std::string>(), high, low);
+        put_header(out, 0x13, name);
+        put_uint64(out, low);
+        put_uint64(out, high);
+    } else if (key == "$timestamp" && value.is_object()) {
+        put_header(out, 0x11, name);
+        put_uint64(out, static_cast<std::uint64_t>(integer_value(value.at("t"))) << 32 |
+                            (static_cast<std::uint64_t>(integer_value(value.at("i"))) & 0xffffffffu));
+    } else if (key == "$regularExpression" && value.is_object()) {
+        put_header(out, 0x0B, name);
+        out += value.at("pattern").get<std::string>();
+        out += '\0';
+        out += value.value("options", "");
+        out += '\0';
+    } else if (key == "$minKey" || key == "$maxKey") {
+        put_header(out, key == "$minKey" ? static_cast<char>(0xFF) : static_cast<char>(0x7F), name);
+    } else if (key == "$ordered" && value.is_array()) {
+        put_header(out, 0x03, name);
+        std::size_t at = begin_document(out);
+        for (const auto& field : value) {
+            if (!field.is_array() || field.size() != 2 || !field[0].is_string())
+                throw std::invalid_argument("$ordered expects [name, value] pairs, got " + field.dump());
+            encode_value(field[0].get_ref<const std::string&>(), field[1], out);
+        }
+        end_document(out, at);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool is_wrapper(const json& value) {
+    if (!value.is_object() || value.size() != 1)
+        return false;
+    const std::string& key = value.begin().key();
+    return key == "$oid" || key == "$date" || key == "$numberLong" || key == "$numberDecimal" || key == "$timestamp" ||
+           key == "$regularExpression" || key == "$minKey" || key == "$maxKey" || key == "$ordered";
+}
+
+bool has_wrappers(const json& value) {
+    if (is_wrapper(value))
+        return true;
+    if (value.is_structured()) {
+        for (const auto& child : value) {
+            if (has_wrappers(child))
+                return true;
+        }
+    }
+    return false;
+}
+
+void encode_with_wrappers(const json& document, std::string& out);
+
+void encode_value(const std::string& name, const json& value, std::string& out) {
+    if (is_wrapper(value) && put_native(out, name, value))
+        return;
+    if (!has_wrappers(value)) {
+        // Plain values go through nlohmann as a one-field document, minus its framing.
+        std::string single;
+        json::to_bson(json{{name, value}}, single);
+        out.append(single, 4, single.size() - 5);
+    } else if (value.is_object()) {
+        put_header(out, 0x03, name);
+        encode_with_wrappers(value, out);
+    } else {
+        put_header(out, 0x04, name);
+        std::size_t at = begin_document(out);
+        std::size_t index = 0;
+        for (const auto& element : value)
+            encode_value(std::to_string(index++), element, out);
+        end_document(out, at);
+    }
+}
+
+void encode_with_wrappers(const json& document, std::string& out) {
+    std::size_t at = begin_document(out);
+    for (auto it = document.begin(); it != document.end(); ++it)
+        encode_value(it.key(), it.value(), out);
+    end_document(out, at);
+}
+
+}
+
+std::string Bson::encode(const json& document) {
+    std::string out;
+    encode(document, out);
+    return out;
+}
+
+void Bson::encode(const json& document, std::string& out) {
+    if (!document.is_object())
+        throw std::invalid_argument("BSON documents must be JSON objects");
+    if (!has_wrappers(document)) {
+        json::to_bson(document, out);
+        return;
+    }
+    encode_with_wrappers(document, out);
+}
+
+void Bson::encode(const json& document, std::string& out, const std::string& first_key) {
+    if (!document.is_object())
+        throw std::invalid_argument("BSON documents must be JSON objects");
+    auto first = document.find(first_key);
+    if (first == document.end() || first == document.begin()) {
+        encode(document, out);
+        return;
+    }
+    std::size_t at = begin_document(out);
+    encode_value(first_key, *first, out);
+    for (auto it = document.begin(); it != document.end(); ++it) {
+        if (it != first)
+            encode_value(it.key(), it.value(), out);
+    }
+    end_document(out, at);
+}
+
+json Bson::decode(const char* data, std::size_t size) {
+    Reader in{data, data + size};
+    std::string portable;
+    portable.reserve(size + 64);
+    to_portable(in, portable);
+    return json::from_bson(portable);
+}
+
+void Bson::for_each(const char* data, std::size_t size, const std::function<void(const Element&)>& fn) {
+    Reader in{data, data + size};
+    std::uint32_t length = in.uint32();
+    if (length < 5 || length > size)
+        throw std::runtime_error("Invalid BSON document length");
+    Reader body{in.p, data + length};
+    while (true) {
+        body.need(1);
+        char type = *body.p++;
+        if (type == 0)
+            return;
+        Element element;
+        element.type = type;
+        element.name = body.skip_cstring();
+        element.size = value_size(type, body);
+        body.need(element.size);
+        element.value = body.p;
+        body.p += element.size;
+        fn(element);
+    }
+}
+
+Bson::Element Bson::find(const char* data, std::size_t size, const char* name) {
+    Element found;
+    for_each(data, size, [&](const Element& element) {
+        if (!found && std::strcmp(element.name, name) == 0)
+            found = element;
+    });
+    return found;
+}
+
+double Bson::number(const Element& element) {
+    Reader r{element.value, element.value + element.size};
+    switch (element.type) {
+    case 0x01:
+        return to_double(r.uint64());
+    case 0x10:
+        return r.int32();
+    case 0x12:
+        return static_cast<double>(static_cast<std::int64_t>(r.uint64()));
+    default:
+        throw std::runtime_error(std::string("BSON field ") + (element.name ? element.name : "") + " is not a number");
+    }
+}
+
+std::int64_t Bson::integer(const Element& element) {
+    if (element.type == 0x12) {
+        Reader r{element.value, element.value + element.size};
+        return static_cast<std::int64_t>(r.uint64());
+    }
+    return static_cast<std::int64_t>(number(element));
+}
+
+std::string Bson::string(const Element& element) {
+    if (element.type != 0x02 || element.size < 5)
+        throw std::runtime_error(std::string("BSON field ") + (element.name ? element.name : "") + " is not a string");
+    return std::string(element.value + 4, element.size - 5);
+}
+
+void Bson::write_json(const char* data, std::size_t size, std::string& out) {
+    Reader in{data, data + size};
+    write_document(in, out, false);
+}
+
+std::size_t Bson::document_size(const char* data, std::size_t available) {
+    if (available < 4)
+        return 0;
+    return Reader{data, data + 4}.uint32();
+}
+
+json Bson::object_id() {
+    static const std::string process = Crypto::random_bytes(5);
+    static std::atomic<std::uint32_t> counter{[] {
+        std::string seed = Crypto::random_bytes(3);
+        return static_cast<std::uint32_t>(static_cast<unsigned char>(seed[0]) << 16 |
+                                          static_cast<unsigned char>(seed[1]) << 8 | static_cast<unsigned char>(seed[2]));
+    }()};
+    auto seconds = static_cast<std::uint32_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    std::uint32_t count = counter.fetch_add(1, std::memory_order_relaxed);
+    std::string bytes;
+    for (int shift = 24; shift >= 0; shift -= 8)
+        bytes += static_cast<char>((seconds >> shift) & 0xff);
+    bytes += process;
+    for (int shift = 16; shift >= 0; shift -= 8)
+        bytes += static_cast<char>((count >> shift) & 0xff);
+    return {{"$oid", Crypto::hex(bytes)}};
+}
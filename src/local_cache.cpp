@@ -0,0 +1,357 @@
+#include "../include/local_cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// List and index nodes plus the shared_ptr control block of one entry.
+const std::size_t entry_overhead = 160;
+// Smallest shard worth having; fewer, larger shards beat many that each
+// hold a handful of entries.
+const std::size_t min_shard_bytes = 256 * 1024;
+// Recently invalidated keys remembered per shard for put() to check.
+const std::size_t max_tombstones = 256;
+
+std::uint64_t mix(std::uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+std::size_t round_up_pow2(std::size_t n) {
+    std::size_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+// Count-min sketch of access frequency, four rows of counters saturating at
+// 15. Every counter is halved once `sample_size` increments have been
+// recorded, so the estimate follows recent popularity.
+class FrequencySketch {
+public:
+    explicit FrequencySketch(std::size_t width)
+        : width_(round_up_pow2(std::max<std::size_t>(width, 64))), table_(width_ * rows, 0), sample_size_(width_ * 10) {}
+
+    void increment(std::uint64_t hash) {
+        bool added = false;
+        for (std::size_t row = 0; row < rows; ++row) {
+            std::uint8_t& counter = table_[slot(hash, row)];
+            if (counter < 15) {
+                ++counter;
+                added = true;
+            }
+        }
+        if (added && ++additions_ >= sample_size_)
+            age();
+    }
+
+    int frequency(std::uint64_t hash) const {
+        int estimate = 15;
+        for (std::size_t row = 0; row < rows; ++row)
+            estimate = std::min<int>(estimate, table_[slot(hash, row)]);
+        return estimate;
+    }
+
+private:
+    static constexpr std::size_t rows = 4;
+
+    std::size_t slot(std::uint64_t hash, std::size_t row) const {
+        static const std::uint64_t seeds[rows] = {0x97cb3127ULL, 0xab5d7c1fULL, 0x5e6f8d2bULL, 0xc3a5c85cULL};
+        return row * width_ + (mix(hash + seeds[row]) & (width_ - 1));
+    }
+
+    void age() {
+        for (auto& counter : table_)
+            counter >>= 1;
+        additions_ /= 2;
+    }
+
+    std::size_t width_;
+    std::vector<std::uint8_t> table_;
+    std::size_t sample_size_;
+    std::size_t additions_ = 0;
+};
+
+}  // namespace
+
+struct LocalCache::Shard {
+    enum Region { Window, Probation, Protected };
+
+    struct Entry {
+        std::string key;
+        Value value;
+        std::size_t size;
+        std::uint64_t hash;
+        Clock::time_point expires;
+        Region region;
+    };
+
+    using List = std::list<Entry>;
+
+    explicit Shard(std::size_t capacity)
+        : capacity(capacity),
+          window_capacity(capacity / 100),
+          main_capacity(capacity - window_capacity),
+          protected_capacity(main_capacity * 4 / 5),
+          sketch(capacity / 512) {}
+
+    List& list(Region region) { return region == Window ? window : region == Probation ? probation : protected_; }
+
+    std::size_t& bytes(Region region) {
+        return region == Window ? window_bytes : region == Probation ? probation_bytes : protected_bytes;
+    }
+
+    std::size_t main_bytes() const { return probation_bytes + protected_bytes; }
+
+    void move(List::iterator entry, Region to) {
+        bytes(entry->region) -= entry->size;
+        list(to).splice(list(to).begin(), list(entry->region), entry);
+        entry->region = to;
+        bytes(to) += entry->size;
+    }
+
+    void remove(List::iterator entry) {
+        bytes(entry->region) -= entry->size;
+        index.erase(std::string_view(entry->key));
+        list(entry->region).erase(entry);
+    }
+
+    // A hit: recency within the window and the protected segment, promotion
+    // out of probation.
+    void touch(List::iterator entry) {
+        if (entry->region != Probation) {
+            move(entry, entry->region);
+            return;
+        }
+        move(entry, Protected);
+        while (protected_bytes > protected_capacity && protected_.size() > 1)
+            move(std::prev(protected_.end()), Probation);
+    }
+
+    // Moves window overflow into the main region, each entry there only at
+    // the expense of colder ones.
+    void evict(Clock::time_point now) {
+        while (window_bytes > window_capacity && !window.empty()) {
+            List::iterator candidate = std::prev(window.end());
+            move(candidate, Probation);
+            while (main_bytes() > main_capacity) {
+                List::iterator victim = std::prev(probation.end());
+                if (victim == candidate)
+                    victim = protected_.empty() ? candidate : std::prev(protected_.end());
+                if (victim == candidate) {
+                    remove(candidate);
+                    ++rejections;
+                    break;
+                }
+                if (victim->expires <= now) {
+                    remove(victim);
+                    ++expirations;
+                } else if (sketch.frequency(candidate->hash) > sketch.frequency(victim->hash)) {
+                    remove(victim);
+                    ++evictions;
+                } else {
+                    remove(candidate);
+                    ++rejections;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Records that `key` was invalidated at the current epoch. Only the
+    // latest max_tombstones are kept; `floor` rises past the ones dropped,
+    // so a put() begun before them is refused rather than trusted.
+    void tombstone(const std::string& key) {
+        std::uint64_t at = epoch.fetch_add(1, std::memory_order_release) + 1;
+        tombstones[key] = at;
+        tombstone_order.emplace_back(key, at);
+        if (tombstone_order.size() <= max_tombstones)
+            return;
+        auto& oldest = tombstone_order.front();
+        auto found = tombstones.find(oldest.first);
+        if (found != tombstones.end() && found->second == oldest.second)
+            tombstones.erase(found);
+        floor = std::max(floor, oldest.second);
+        tombstone_order.pop_front();
+    }
+
+    // Whether `key` may have been invalidated since `since`.
+    bool invalidated_since(const std::string& key, std::uint64_t since) const {
+        if (since < floor)
+            return true;
+        auto found = tombstones.find(key);
+        return found != tombstones.end() && found->second > since;
+    }
+
+    mutable std::mutex mutex;
+    // Bumped by every invalidation; epoch() hands it out without the lock.
+    std::atomic<std::uint64_t> epoch{0};
+    std::unordered_map<std::string, std::uint64_t> tombstones;
+    std::deque<std::pair<std::string, std::uint64_t>> tombstone_order;
+    std::uint64_t floor = 0;
+    std::unordered_map<std::string_view, List::iterator> index;
+    List window, probation, protected_;
+    const std::size_t capacity;
+    const std::size_t window_capacity;
+    const std::size_t main_capacity;
+    const std::size_t protected_capacity;
+    std::size_t window_bytes = 0, probation_bytes = 0, protected_bytes = 0;
+    FrequencySketch sketch;
+    std::uint64_t hits = 0, misses = 0, evictions = 0, rejections = 0, expirations = 0, invalidations = 0;
+};
+
+LocalCache::LocalCache(std::size_t max_bytes, std::size_t shards) : max_bytes_(max_bytes) {
+    if (shards == 0)
+        shards = std::max(1u, std::thread::hardware_concurrency()) * 4;
+    shards = std::min(shards, std::max<std::size_t>(1, max_bytes / min_shard_bytes));
+    // A power of two, rounded down so no shard drops below the minimum.
+    std::size_t count = round_up_pow2(shards);
+    if (count > shards)
+        count /= 2;
+    for (std::size_t i = 0; i < count; ++i)
+        shards_.push_back(std::make_unique<Shard>(max_bytes / count));
+}
+
+LocalCache::~LocalCache() = default;
+
+LocalCache::Shard& LocalCache::shard_for(std::uint64_t hash) const {
+    return *shards_[(mix(hash) >> 32) & (shards_.size() - 1)];
+}
+
+LocalCache::Value LocalCache::get(const std::string& key) {
+    std::uint64_t hash = std::hash<std::string>()(key);
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sketch.increment(hash);
+    auto found = shard.index.find(std::string_view(key));
+    if (found == shard.index.end()) {
+        ++shard.misses;
+        return nullptr;
+    }
+    Shard::List::iterator entry = found->second;
+    if (entry->expires <= Clock::now()) {
+        shard.remove(entry);
+        ++shard.expirations;
+        ++shard.misses;
+        return nullptr;
+    }
+    shard.touch(entry);
+    ++shard.hits;
+    return entry->value;
+}
+
+std::uint64_t LocalCache::epoch(const std::string& key) const {
+    return shard_for(std::hash<std::string>()(key)).epoch.load(std::memory_order_acquire);
+}
+
+bool LocalCache::put(const std::string& key, Value value, std::chrono::milliseconds ttl, std::uint64_t epoch) {
+    std::uint64_t hash = std::hash<std::string>()(key);
+    Shard& shard = shard_for(hash);
+    std::size_t size = key.size() + estimate_size(*value) + entry_overhead;
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.invalidated_since(key, epoch))
+        return false;
+    auto found = shard.index.find(std::string_view(key));
+    if (found != shard.index.end())
+        shard.remove(found->second);
+    if (size > shard.capacity) {
+        ++shard.rejections;
+        return false;
+    }
+    shard.window.push_front(Shard::Entry{key, std::move(value), size, hash, now + ttl, Shard::Window});
+    shard.window_bytes += size;
+    shard.index.emplace(std::string_view(shard.window.front().key), shard.window.begin());
+    shard.evict(now);
+    return shard.index.count(std::string_view(key)) > 0;
+}
+
+void LocalCache::invalidate(const std::string& key) {
+    Shard& shard = shard_for(std::hash<std::string>()(key));
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.tombstone(key);
+    auto found = shard.index.find(std::string_view(key));
+    if (found == shard.index.end())
+        return;
+    shard.remove(found->second);
+    ++shard.invalidations;
+}
+
+void LocalCache::clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->floor = shard->epoch.fetch_add(1, std::memory_order_release) + 1;
+        shard->tombstones.clear();
+        shard->tombstone_order.clear();
+        shard->invalidations += shard->index.size();
+        shard->index.clear();
+        shard->window.clear();
+        shard->probation.clear();
+        shard->protected_.clear();
+        shard->window_bytes = shard->probation_bytes = shard->protected_bytes = 0;
+    }
+}
+
+nlohmann::json LocalCache::stats() const {
+    std::uint64_t hits = 0, misses = 0, evictions = 0, rejections = 0, expirations = 0, invalidations = 0;
+    std::size_t entries = 0, bytes = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        hits += shard->hits;
+        misses += shard->misses;
+        evictions += shard->evictions;
+        rejections += shard->rejections;
+        expirations += shard->expirations;
+        invalidations += shard->invalidations;
+        entries += shard->index.size();
+        bytes += shard->window_bytes + shard->main_bytes();
+    }
+    std::uint64_t lookups = hits + misses;
+    return {{"hits", hits},
+            {"misses", misses},
+            {"hit_ratio", lookups ? static_cast<double>(hits) / static_cast<double>(lookups) : 0.0},
+            {"entries", entries},
+            {"bytes", bytes},
+            {"max_bytes", max_bytes_},
+            {"shards", shards_.size()},
+            {"evictions", evictions},
+            {"rejections", rejections},
+            {"expirations", expirations},
+            {"invalidations", invalidations}};
+}
+
+std::size_t LocalCache::estimate_size(const nlohmann::json& value) {
+    std::size_t size = sizeof(nlohmann::json);
+    switch (value.type()) {
+    case nlohmann::json::value_t::object:
+        // std::map nodes: links, the key string and the value.
+        for (auto it = value.begin(); it != value.end(); ++it)
+            size += 32 + sizeof(std::string) + it.key().size() + estimate_size(it.value());
+        break;
+    case nlohmann::json::value_t::array:
+        size += sizeof(std::vector<nlohmann::json>);
+        for (const auto& element : value)
+            size += estimate_size(element);
+        break;
+    case nlohmann::json::value_t::string:
+        size += sizeof(std::string) + value.get_ref<const std::string&>().size();
+        break;
+    default:
+        break;
+    }
+    return size;
+}
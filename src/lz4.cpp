@@ -0,0 +1,146 @@
+#include "../include/lz4.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const std::size_t min_match = 4;
+// The format requires the last 5 bytes to be literals and the last match
+// to start at least 12 bytes before the end.
+const std::size_t last_literals = 5;
+const std::size_t match_find_limit = 12;
+const std::size_t max_offset = 65535;
+const int hash_bits = 16;
+
+std::uint32_t read32(const char* p) {
+    std::uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+std::uint32_t hash(std::uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - hash_bits);
+}
+
+void write_length(std::string& out, std::size_t length) {
+    while (length >= 255) {
+        out += static_cast<char>(255);
+        length -= 255;
+    }
+    out += static_cast<char>(length);
+}
+
+void write_sequence(std::string& out, const char* literals, std::size_t literal_count, std::size_t offset, std::size_t match_length) {
+    std::size_t match_code = match_length - min_match;
+    unsigned token = (literal_count >= 15 ? 15u : static_cast<unsigned>(literal_count)) << 4;
+    token |= match_code >= 15 ? 15u : static_cast<unsigned>(match_code);
+    out += static_cast<char>(token);
+    if (literal_count >= 15)
+        write_length(out, literal_count - 15);
+    out.append(literals, literal_count);
+    out += static_cast<char>(offset & 0xff);
+    out += static_cast<char>(offset >> 8);
+    if (match_code >= 15)
+        write_length(out, match_code - 15);
+}
+
+void write_last_literals(std::string& out, const char* literals, std::size_t literal_count) {
+    out += static_cast<char>((literal_count >= 15 ? 15u : static_cast<unsigned>(literal_count)) << 4);
+    if (literal_count >= 15)
+        write_length(out, literal_count - 15);
+    out.append(literals, literal_count);
+}
+
+}  // namespace
+
+std::string Lz4::compress(const char* data, std::size_t size) {
+    std::string out;
+    out.reserve(size + size / 255 + 16);
+    if (size < match_find_limit + 1) {
+        write_last_literals(out, data, size);
+        return out;
+    }
+    // Position + 1 of the last occurrence of each hashed 4-byte sequence; 0 is empty.
+    std::vector<std::uint32_t> table(std::size_t(1) << hash_bits, 0);
+    const std::size_t match_limit = size - last_literals;
+    const std::size_t find_limit = size - match_find_limit;
+    std::size_t anchor = 0;
+    std::size_t pos = 0;
+    // Steps grow through long runs without a match, so incompressible data
+    // is skipped over quickly.
+    std::size_t misses = 0;
+    while (pos < find_limit) {
+        std::uint32_t sequence = read32(data + pos);
+        std::uint32_t& slot = table[hash(sequence)];
+        std::size_t candidate = slot;
+        slot = static_cast<std::uint32_t>(pos + 1);
+        if (candidate == 0 || pos - (candidate - 1) > max_offset || read32(data + candidate - 1) != sequence) {
+            pos += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+        std::size_t match = candidate - 1;
+        std::size_t length = min_match;
+        while (pos + length < match_limit && data[match + length] == data[pos + length])
+            ++length;
+        write_sequence(out, data + anchor, pos - anchor, pos - match, length);
+        pos += length;
+        anchor = pos;
+    }
+    write_last_literals(out, data + anchor, size - anchor);
+    return out;
+}
+
+std::string Lz4::decompress(const char* data, std::size_t size, std::size_t original_size) {
+    std::string out(original_size, '\0');
+    std::size_t in = 0, written = 0;
+    auto length = [&](std::size_t base) {
+        if (base != 15)
+            return base;
+        unsigned char byte;
+        do {
+            if (in >= size)
+                throw std::runtime_error("Truncated LZ4 block");
+            byte = static_cast<unsigned char>(data[in++]);
+            base += byte;
+        } while (byte == 255);
+        return base;
+    };
+    while (in < size) {
+        unsigned token = static_cast<unsigned char>(data[in++]);
+        std::size_t literal_count = length(token >> 4);
+        if (literal_count > size - in || literal_count > original_size - written)
+            throw std::runtime_error("LZ4 literals overrun the block");
+        std::memcpy(&out[written], data + in, literal_count);
+        in += literal_count;
+        written += literal_count;
+        if (in == size)
+            break;
+        if (size - in < 2)
+            throw std::runtime_error("Truncated LZ4 block");
+        std::size_t offset = static_cast<unsigned char>(data[in]) | (static_cast<std::size_t>(static_cast<unsigned char>(data[in + 1])) << 8);
+        in += 2;
+        if (offset == 0 || offset > written)
+            throw std::runtime_error("Invalid LZ4 match offset");
+        std::size_t match_length = length(token & 15) + min_match;
+        if (match_length > original_size - written)
+            throw std::runtime_error("LZ4 match overruns the output");
+        // A match may overlap its own output, repeating the last `offset`
+        // bytes. Copy one period, then keep doubling what has been copied.
+        char* dest = &out[written];
+        std::size_t copied = std::min(offset, match_length);
+        std::memcpy(dest, dest - offset, copied);
+        while (copied < match_length) {
+            std::size_t chunk = std::min(copied, match_length - copied);
+            std::memcpy(dest + copied, dest, chunk);
+            copied += chunk;
+        }
+        written += match_length;
+    }
+    if (written != original_size)
+        throw std::runtime_error("LZ4 block shorter than its declared size");
+    return out;
+}
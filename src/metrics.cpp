@@ -0,0 +1,214 @@
+#include "../include/metrics.hpp"
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+std::atomic<std::uint64_t> next_metrics_id{1};
+
+struct ShardCache {
+    std::uint64_t owner = 0;
+    void* shard = nullptr;
+};
+
+thread_local ShardCache shard_cache;
+
+std::string escape_label(const std::string& value) {
+    std::string out;
+    out.reserve(value.size());
+    for (char c : value) {
+        if (c == '\\' || c == '"')
+            out += '\\';
+        if (c == '\n') {
+            out += "\\n";
+            continue;
+        }
+        out += c;
+    }
+    return out;
+}
+
+std::string format_double(double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.12g", value);
+    return buf;
+}
+
+void write_histogram(std::ostringstream& out, const std::string& name, const std::string& labels,
+                     const Histogram::Snapshot& snap, int first_bit, int last_bit, int step, double scale) {
+    for (int bit = first_bit; bit <= last_bit; bit += step) {
+        std::uint64_t bound = (std::uint64_t(1) << bit) - 1;
+        out << name << "_bucket{" << labels << ",le=\"" << format_double(bound * scale) << "\"} "
+            << snap.count_at_or_below(bound) << "\n";
+    }
+    out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << snap.count << "\n";
+    out << name << "_sum{" << labels << "} " << format_double(snap.sum * scale) << "\n";
+    out << name << "_count{" << labels << "} " << snap.count << "\n";
+}
+
+const char* const status_class_names[] = {"other", "1xx", "2xx", "3xx", "4xx", "5xx"};
+
+}
+
+Metrics::Shard::~Shard() {
+    for (auto& chunk : chunks)
+        delete chunk.load(std::memory_order_relaxed);
+    delete phases.load(std::memory_order_relaxed);
+}
+
+Metrics::RouteStats* Metrics::Shard::stats_for(std::size_t slot) {
+    std::size_t index = slot / routes_per_chunk;
+    if (index >= max_chunks)
+        return nullptr;
+    RouteChunk* chunk = chunks[index].load(std::memory_order_acquire);
+    if (!chunk) {
+        chunk = new RouteChunk();
+        chunks[index].store(chunk, std::memory_order_release);
+    }
+    return &chunk->routes[slot % routes_per_chunk];
+}
+
+Metrics::Metrics(std::string path)
+    : path_(std::move(path)), id_(next_metrics_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+Metrics::~Metrics() = default;
+
+void Metrics::set_route_label(std::size_t route, const std::string& method, const std::string& template_path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (labels_.size() <= route)
+        labels_.resize(route + 1);
+    labels_[route] = {method, template_path};
+}
+
+Metrics::Shard& Metrics::local_shard() {
+    if (shard_cache.owner == id_)
+        return *static_cast<Shard*>(shard_cache.shard);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Shard*& shard = shard_by_thread_[std::this_thread::get_id()];
+    if (!shard) {
+        shards_.push_back(std::make_unique<Shard>());
+        shard = shards_.back().get();
+    }
+    shard_cache.owner = id_;
+    shard_cache.shard = shard;
+    return *shard;
+}
+
+void Metrics::record(std::size_t route, int status, std::size_t request_bytes,
+                     std::size_t response_bytes, std::uint64_t latency_ns) {
+    std::size_t slot = route == unmatched_route ? 0 : route + 1;
+    RouteStats* stats = local_shard().stats_for(slot);
+    if (!stats)
+        return;
+    std::size_t status_class = (status >= 100 && status < 600) ? static_cast<std::size_t>(status / 100) : 0;
+    stats->status_classes[status_class].fetch_add(1, std::memory_order_relaxed);
+    stats->request_bytes.fetch_add(request_bytes, std::memory_order_relaxed);
+    stats->response_bytes.record(response_bytes);
+    stats->latency_ns.record(latency_ns);
+}
+
+void Metrics::record_phases(const RequestTiming& timing) {
+    Shard& shard = local_shard();
+    PhaseStats* stats = shard.phases.load(std::memory_order_acquire);
+    if (!stats) {
+        stats = new PhaseStats();
+        shard.phases.store(stats, std::memory_order_release);
+    }
+    for (unsigned p = 0; p < RequestTiming::PhaseCount; ++p)
+        stats->phases[p].record(timing.phase_ns[p]);
+}
+
+void Metrics::add_collector(std::function<void(std::ostream&)> collector) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    collectors_.push_back(std::move(collector));
+}
+
+std::string Metrics::render() const {
+    struct Merged {
+        std::string labels;
+        Histogram::Snapshot latency;
+        Histogram::Snapshot response_bytes;
+        std::array<std::uint64_t, 6> status_classes{};
+        std::uint64_t request_bytes = 0;
+    };
+
+    std::vector<Merged> merged;
+    std::vector<Histogram::Snapshot> phases(RequestTiming::PhaseCount);
+    std::vector<std::function<void(std::ostream&)>> collectors;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        collectors = collectors_;
+        merged.resize(labels_.size() + 1);
+        merged[0].labels = "method=\"\",route=\"unmatched\"";
+        for (std::size_t i = 0; i < labels_.size(); ++i)
+            merged[i + 1].labels = "method=\"" + escape_label(labels_[i].method) + "\",route=\"" +
+                                   escape_label(labels_[i].template_path) + "\"";
+
+        for (const auto& shard : shards_) {
+            for (std::size_t slot = 0; slot < merged.size(); ++slot) {
+                std::size_t index = slot / routes_per_chunk;
+                if (index >= max_chunks)
+                    break;
+                RouteChunk* chunk = shard->chunks[index].load(std::memory_order_acquire);
+                if (!chunk)
+                    continue;
+                const RouteStats& stats = chunk->routes[slot % routes_per_chunk];
+                Merged& m = merged[slot];
+                stats.latency_ns.snapshot_into(m.latency);
+                stats.response_bytes.snapshot_into(m.response_bytes);
+                for (std::size_t c = 0; c < m.status_classes.size(); ++c)
+                    m.status_classes[c] += stats.status_classes[c].load(std::memory_order_relaxed);
+                m.request_bytes += stats.request_bytes.load(std::memory_order_relaxed);
+            }
+            if (PhaseStats* stats = shard->phases.load(std::memory_order_acquire)) {
+                for (unsigned p = 0; p < RequestTiming::PhaseCount; ++p)
+                    stats->phases[p].snapshot_into(phases[p]);
+            }
+        }
+    }
+
+    std::ostringstream out;
+    out << "# HELP fastapi_http_requests_total Requests handled, by route template and status class.\n"
+        << "# TYPE fastapi_http_requests_total counter\n";
+    for (const auto& m : merged) {
+        for (std::size_t c = 0; c < m.status_classes.size(); ++c) {
+            if (m.status_classes[c])
+                out << "fastapi_http_requests_total{" << m.labels << ",code=\"" << status_class_names[c]
+                    << "\"} " << m.status_classes[c] << "\n";
+        }
+    }
+
+    out << "# HELP fastapi_http_request_duration_seconds Time from request parse to serialized response.\n"
+        << "# TYPE fastapi_http_request_duration_seconds histogram\n";
+    for (const auto& m : merged) {
+        if (m.latency.count)
+            write_histogram(out, "fastapi_http_request_duration_seconds", m.labels, m.latency, 10, 34, 2, 1e-9);
+    }
+
+    out << "# HELP fastapi_http_request_body_bytes_total Request body bytes received.\n"
+        << "# TYPE fastapi_http_request_body_bytes_total counter\n";
+    for (const auto& m : merged) {
+        if (m.latency.count)
+            out << "fastapi_http_request_body_bytes_total{" << m.labels << "} " << m.request_bytes << "\n";
+    }
+
+    out << "# HELP fastapi_http_response_body_bytes Response body size.\n"
+        << "# TYPE fastapi_http_response_body_bytes histogram\n";
+    for (const auto& m : merged) {
+        if (m.response_bytes.count)
+            write_histogram(out, "fastapi_http_response_body_bytes", m.labels, m.response_bytes, 6, 24, 2, 1.0);
+    }
+
+    if (phases[0].count) {
+        out << "# HELP fastapi_http_phase_duration_seconds Time spent in each request processing phase.\n"
+            << "# TYPE fastapi_http_phase_duration_seconds histogram\n";
+        for (unsigned p = 0; p < RequestTiming::PhaseCount; ++p)
+            write_histogram(out, "fastapi_http_phase_duration_seconds",
+                            std::string("phase=\"") + RequestTiming::phase_name(p) + "\"", phases[p], 6, 34, 2, 1e-9);
+    }
+
+    for (const auto& collector : collectors)
+        collector(out);
+    return out.str();
+}
@@ -0,0 +1,500 @@
+#include "../include/mongo_connection.hpp"
+#include "../include/bson.hpp"
+#include "../include/crypto.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+
+namespace {
+
+const std::int32_t op_msg = 2013;
+const std::uint32_t checksum_present = 1;
+
+#if defined(_WIN32)
+const char* const os_type = "Windows";
+#elif defined(__APPLE__)
+const char* const os_type = "Darwin";
+#else
+const char* const os_type = "Linux";
+#endif
+
+void put_int32(std::string& out, std::int32_t value) {
+    auto v = static_cast<std::uint32_t>(value);
+    for (int i = 0; i < 4; ++i)
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+
+void patch_int32(std::string& out, std::size_t at, std::size_t value) {
+    auto v = static_cast<std::uint32_t>(value);
+    for (int i = 0; i < 4; ++i)
+        out[at + i] = static_cast<char>((v >> (8 * i)) & 0xff);
+}
+
+std::int32_t get_int32(const char* p) {
+    std::uint32_t v = 0;
+    for (int i = 3; i >= 0; --i)
+        v = v << 8 | static_cast<unsigned char>(p[i]);
+    return static_cast<std::int32_t>(v);
+}
+
+// Cursor ids must be BSON int64 even when they would fit in an int32.
+json int64_value(std::int64_t value) {
+    return {{"$numberLong", std::to_string(value)}};
+}
+
+std::string scram_attribute(const std::string& message, char name) {
+    std::size_t pos = 0;
+    while (pos < message.size()) {
+        std::size_t comma = message.find(',', pos);
+        if (comma == std::string::npos)
+            comma = message.size();
+        if (comma - pos >= 2 && message[pos] == name && message[pos + 1] == '=')
+            return message.substr(pos + 2, comma - pos - 2);
+        pos = comma + 1;
+    }
+    throw std::runtime_error(std::string("SCRAM message is missing attribute ") + name);
+}
+
+std::string xor_bytes(const std::string& a, const std::string& b) {
+    std::string out = a;
+    for (std::size_t i = 0; i < out.size() && i < b.size(); ++i)
+        out[i] = static_cast<char>(out[i] ^ b[i]);
+    return out;
+}
+
+std::string scram_username(const std::string& user) {
+    std::string escaped;
+    for (char c : user) {
+        if (c == '=')
+            escaped += "=3D";
+        else if (c == ',')
+            escaped += "=2C";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+json binary_payload(const std::string& bytes) {
+    return json::binary(std::vector<std::uint8_t>(bytes.begin(), bytes.end()));
+}
+
+std::string payload_text(const json& reply) {
+    const json& payload = reply.at("payload");
+    if (payload.is_binary())
+        return std::string(payload.get_binary().begin(), payload.get_binary().end());
+    return payload.get<std::string>();
+}
+
+}
+
+MongoConnection::Options MongoConnection::Options::from(const DBConfig& config) {
+    Options options;
+    options.host = config.db_host.empty() ? "127.0.0.1" : config.db_host;
+    options.port = config.db_port > 0 ? config.db_port : 27017;
+    options.user = config.db_user;
+    options.password = config.db_password;
+    options.connect_timeout = std::chrono::milliseconds(config.db_connect_timeout_ms);
+    options.io_timeout = std::chrono::milliseconds(config.db_query_timeout_ms);
+    return options;
+}
+
+MongoConnection::MongoConnection(const Options& options) {
+    socket_ = Socket::connect(options.host, options.port, options.connect_timeout);
+    socket_.set_timeout(options.io_timeout);
+    try {
+        handshake(options);
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+}
+
+void MongoConnection::handshake(const Options& options) {
+    json hello = {{"hello", 1},
+                  {"client", {{"driver", {{"name", "fastapi-cpp"}, {"version", "1.0.0"}}}, {"os", {{"type", os_type}}}}}};
+    json reply = command("admin", "hello", hello);
+    auto limit = [&](const char* field, std::size_t fallback) {
+        const json& value = reply.contains(field) ? reply[field] : json();
+        return value.is_number() && value.get<double>() > 0 ? value.get<std::size_t>() : fallback;
+    };
+    max_write_batch_size_ = limit("maxWriteBatchSize", max_write_batch_size_);
+    max_message_size_ = limit("maxMessageSizeBytes", max_message_size_);
+    max_bson_object_size_ = limit("maxBsonObjectSize", max_bson_object_size_);
+    if (!options.user.empty())
+        authenticate(options);
+}
+
+// SCRAM-SHA-256 over saslStart/saslContinue. Unlike SCRAM-SHA-1 the
+// password is used as given, with no MongoDB-specific digest.
+void MongoConnection::authenticate(const Options& options) {
+    std::string client_nonce = Crypto::base64_encode(Crypto::random_bytes(24));
+    std::string client_first_bare = "n=" + scram_username(options.user) + ",r=" + client_nonce;
+    json reply = command(options.auth_database, "saslStart",
+                         {{"saslStart", 1},
+                          {"mechanism", "SCRAM-SHA-256"},
+                          {"payload", binary_payload("n,," + client_first_bare)},
+                          {"autoAuthorize", 1},
+                          {"options", {{"skipEmptyExchange", true}}}});
+    json conversation = reply.at("conversationId");
+    std::string server_first = payload_text(reply);
+    std::string nonce = scram_attribute(server_first, 'r');
+    if (nonce.compare(0, client_nonce.size(), client_nonce) != 0)
+        fail("SCRAM server nonce does not extend the client nonce");
+    std::string salt = Crypto::base64_decode(scram_attribute(server_first, 's'));
+    int iterations = std::atoi(scram_attribute(server_first, 'i').c_str());
+
+    std::string salted = Crypto::pbkdf2_hmac_sha256(options.password, salt, iterations);
+    std::string client_key = Crypto::hmac_sha256(salted, "Client Key");
+    std::string stored_key = Crypto::sha256(client_key);
+    std::string final_without_proof = "c=biws,r=" + nonce;
+    std::string auth_message = client_first_bare + "," + server_first + "," + final_without_proof;
+    std::string proof = xor_bytes(client_key, Crypto::hmac_sha256(stored_key, auth_message));
+
+    reply = command(options.auth_database, "saslContinue",
+                    {{"saslContinue", 1},
+                     {"conversationId", conversation},
+                     {"payload", binary_payload(final_without_proof + ",p=" + Crypto::base64_encode(proof))}});
+    std::string expected = Crypto::hmac_sha256(Crypto::hmac_sha256(salted, "Server Key"), auth_message);
+    if (Crypto::base64_decode(scram_attribute(payload_text(reply), 'v')) != expected)
+        fail("SCRAM server signature mismatch");
+    // Servers that ignore skipEmptyExchange want one more, empty, step.
+    if (!reply.value("done", false)) {
+        reply = command(options.auth_database, "saslContinue",
+                        {{"saslContinue", 1}, {"conversationId", conversation}, {"payload", binary_payload("")}});
+        if (!reply.value("done", false))
+            fail("SCRAM conversation did not complete");
+    }
+}
+
+json MongoConnection::command(const std::string& db, const std::string& name, const json& command) {
+    check_no_cursor();
+    std::int32_t request = send(db, name, command, Sequence{});
+    flush();
+    return receive(request);
+}
+
+json MongoConnection::write(const std::string& db, const std::string& name, const json& command,
+                            const std::string& identifier, const json& documents) {
+    check_no_cursor();
+    std::vector<std::string> encoded;
+    encoded.reserve(documents.size());
+    for (const auto& document : documents) {
+        std::string bytes;
+        Bson::encode(document, bytes);
+        if (bytes.size() > max_bson_object_size_)
+            throw std::invalid_argument("Document " + std::to_string(encoded.size()) + " is " +
+                                        std::to_string(bytes.size()) + " bytes, over maxBsonObjectSize");
+        encoded.push_back(std::move(bytes));
+    }
+
+    // Everything in a message but the sequence's documents: header, flag
+    // bits, the command section and the sequence's own framing.
+    json body = command;
+    body["$db"] = db;
+    std::string probe;
+    Bson::encode(body, probe, name);
+    std::size_t overhead = 16 + 4 + 1 + probe.size() + 1 + 4 + identifier.size() + 1;
+
+    std::vector<std::pair<std::size_t, std::size_t>> batches;
+    for (std::size_t i = 0; i < encoded.size();) {
+        std::size_t begin = i, size = overhead;
+        while (i < encoded.size() && i - begin < max_write_batch_size_ &&
+               (i == begin || size + encoded[i].size() <= max_message_size_))
+            size += encoded[i++].size();
+        batches.emplace_back(begin, i);
+    }
+
+    json merged = {{"n", 0}, {"nModified", 0}, {"upserted", json::array()}, {"writeErrors", json::array()}};
+    auto merge = [&](const json& reply, std::size_t offset) {
+        merged["n"] = merged["n"].get<std::int64_t>() + reply.value("n", std::int64_t(0));
+        merged["nModified"] = merged["nModified"].get<std::int64_t>() + reply.value("nModified", std::int64_t(0));
+        for (const char* list : {"upserted", "writeErrors"}) {
+            if (!reply.contains(list))
+                continue;
+            for (json entry : reply[list]) {
+                entry["index"] = entry.value("index", std::size_t(0)) + offset;
+                merged[list].push_back(std::move(entry));
+            }
+        }
+        if (reply.contains("writeConcernError"))
+            merged["writeConcernError"] = reply["writeConcernError"];
+    };
+    auto send_batch = [&](const std::pair<std::size_t, std::size_t>& batch) {
+        return send(db, name, command, Sequence{&identifier, &encoded, batch.first, batch.second});
+    };
+
+    if (command.value("ordered", true)) {
+        for (const auto& batch : batches) {
+            std::int32_t request = send_batch(batch);
+            flush();
+            merge(receive(request), batch.first);
+            if (!merged["writeErrors"].empty())
+                break;
+        }
+        return merged;
+    }
+
+    std::vector<std::int32_t> requests;
+    for (const auto& batch : batches)
+        requests.push_back(send_batch(batch));
+    flush();
+    // Every reply is read before rethrowing, so the session stays in step.
+    std::exception_ptr error;
+    for (std::size_t i = 0; i < requests.size(); ++i) {
+        try {
+            merge(receive(requests[i]), batches[i].first);
+        } catch (const MongoError&) {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
+    return merged;
+}
+
+void MongoConnection::open_cursor(const std::string& db, const std::string& name, const json& command,
+                                  std::size_t batch_size) {
+    check_no_cursor();
+    std::int32_t request = send(db, name, command, Sequence{});
+    flush();
+    cursor_reply_ = receive_raw(request);
+    take_batch("firstBatch");
+    Bson::Element cursor = Bson::find(cursor_reply_.data(), cursor_reply_.size(), "cursor");
+    Bson::Element ns = Bson::find(cursor.value, cursor.size, "ns");
+    std::string full_name = ns ? Bson::string(ns) : "";
+    cursor_db_ = db;
+    cursor_collection_ = full_name.substr(full_name.find('.') + 1);
+    cursor_batch_size_ = static_cast<std::int32_t>(batch_size);
+    cursor_open_ = true;
+}
+
+void MongoConnection::take_batch(const char* field) {
+    Bson::Element cursor = Bson::find(cursor_reply_.data(), cursor_reply_.size(), "cursor");
+    if (cursor.type != 0x03)
+        fail("Cursor reply without a cursor document");
+    Bson::Element id = Bson::find(cursor.value, cursor.size, "id");
+    cursor_id_ = id ? Bson::integer(id) : 0;
+    cursor_batch_ = Bson::find(cursor.value, cursor.size, field);
+    if (cursor_batch_ && cursor_batch_.type != 0x04)
+        fail(std::string("Cursor ") + field + " is not an array");
+}
+
+bool MongoConnection::fetch(json& documents) {
+    documents = json::array();
+    return fetch([&](const char* data, std::size_t size) { documents.push_back(Bson::decode(data, size)); });
+}
+
+bool MongoConnection::fetch(const std::function<void(const char*, std::size_t)>& each) {
+    if (!cursor_open_)
+        return false;
+    if (get_more_request_) {
+        std::int32_t request = get_more_request_;
+        get_more_request_ = 0;
+        try {
+            cursor_reply_ = receive_raw(request);
+            take_batch("nextBatch");
+        } catch (...) {
+            cursor_open_ = false;
+            cursor_id_ = 0;
+            cursor_batch_ = Bson::Element();
+            throw;
+        }
+    }
+    if (cursor_id_ == 0) {
+        cursor_open_ = false;
+    } else {
+        json get_more = {{"getMore", int64_value(cursor_id_)}, {"collection", cursor_collection_}};
+        if (cursor_batch_size_ > 0)
+            get_more["batchSize"] = cursor_batch_size_;
+        get_more_request_ = send(cursor_db_, "getMore", get_more, Sequence{});
+        flush();
+    }
+    // The getMore reply lands in in_, not cursor_reply_, so the batch stays
+    // valid while the caller walks it.
+    Bson::Element batch = cursor_batch_;
+    cursor_batch_ = Bson::Element();
+    if (batch) {
+        Bson::for_each(batch.value, batch.size, [&](const Bson::Element& document) {
+            if (document.type != 0x03)
+                throw std::runtime_error("Cursor batch holds a non-document value");
+            each(document.value, document.size);
+        });
+    }
+    return true;
+}
+
+void MongoConnection::close_cursor() {
+    if (!cursor_open_)
+        return;
+    cursor_open_ = false;
+    if (get_more_request_) {
+        std::int32_t request = get_more_request_;
+        get_more_request_ = 0;
+        try {
+            cursor_reply_ = receive_raw(request);
+            take_batch("nextBatch");
+        } catch (const MongoError&) {
+            cursor_id_ = 0;
+        }
+    }
+    if (cursor_id_ != 0) {
+        try {
+            command(cursor_db_, "killCursors",
+                    {{"killCursors", cursor_collection_}, {"cursors", json::array({int64_value(cursor_id_)})}});
+        } catch (const MongoError&) {
+            // The server reaps cursors it cannot kill now on its own timeout.
+        }
+    }
+    cursor_id_ = 0;
+    cursor_batch_ = Bson::Element();
+    cursor_reply_ = std::string();
+}
+
+bool MongoConnection::ping() {
+    if (broken_)
+        return false;
+    try {
+        command("admin", "ping", {{"ping", 1}});
+        return true;
+    } catch (...) {
+        broken_ = true;
+        return false;
+    }
+}
+
+std::int32_t MongoConnection::send(const std::string& db, const std::string& name, const json& command,
+                                   const Sequence& sequence) {
+    std::int32_t request = next_request_id_;
+    next_request_id_ = next_request_id_ == INT32_MAX ? 1 : next_request_id_ + 1;
+    json body = command;
+    body["$db"] = db;
+
+    std::size_t start = out_.size();
+    put_int32(out_, 0);
+    put_int32(out_, request);
+    put_int32(out_, 0);
+    put_int32(out_, op_msg);
+    put_int32(out_, 0);
+    out_ += '\0';
+    Bson::encode(body, out_, name);
+    if (sequence.identifier) {
+        out_ += '\1';
+        std::size_t section = out_.size();
+        put_int32(out_, 0);
+        out_ += *sequence.identifier;
+        out_ += '\0';
+        for (std::size_t i = sequence.begin; i < sequence.end; ++i)
+            out_ += (*sequence.documents)[i];
+        patch_int32(out_, section, out_.size() - section);
+    }
+    patch_int32(out_, start, out_.size() - start);
+    return request;
+}
+
+json MongoConnection::receive(std::int32_t request_id) {
+    std::string body = receive_raw(request_id);
+    return Bson::decode(body.data(), body.size());
+}
+
+std::string MongoConnection::receive_raw(std::int32_t request_id) {
+    ensure_buffered(16);
+    std::int32_t length = get_int32(in_.data() + in_pos_);
+    if (length < 21 || static_cast<std::size_t>(length) > max_message_size_ + 16 * 1024 * 1024)
+        fail("Invalid OP_MSG length " + std::to_string(length));
+    ensure_buffered(static_cast<std::size_t>(length));
+    const char* p = in_.data() + in_pos_;
+    if (get_int32(p + 12) != op_msg)
+        fail("Server replied with opcode " + std::to_string(get_int32(p + 12)) + "; OP_MSG needs MongoDB 3.6 or later");
+    if (get_int32(p + 8) != request_id)
+        fail("Reply to an unexpected request");
+    auto flags = static_cast<std::uint32_t>(get_int32(p + 16));
+    const char* end = p + length - (flags & checksum_present ? 4 : 0);
+
+    std::string reply;
+    bool found = false;
+    try {
+        for (const char* q = p + 20; q < end;) {
+            char kind = *q++;
+            std::size_t size = Bson::document_size(q, static_cast<std::size_t>(end - q));
+            if (size < 5 || size > static_cast<std::size_t>(end - q))
+                fail("Invalid OP_MSG section");
+            if (kind == 0) {
+                reply.assign(q, size);
+                found = true;
+            } else if (kind != 1) {
+                fail("Unknown OP_MSG section kind " + std::to_string(kind));
+            }
+            q += size;
+        }
+    } catch (const std::exception& e) {
+        fail(e.what());
+    }
+    in_pos_ += static_cast<std::size_t>(length);
+    if (!found)
+        fail("OP_MSG reply without a body");
+
+    bool ok = false;
+    try {
+        Bson::Element field = Bson::find(reply.data(), reply.size(), "ok");
+        ok = field && Bson::number(field) == 1.0;
+    } catch (const std::runtime_error&) {
+    }
+    if (!ok) {
+        json error;
+        try {
+            error = Bson::decode(reply.data(), reply.size());
+        } catch (const std::exception& e) {
+            fail(e.what());
+        }
+        throw MongoError(error.value("code", 0), error.value("codeName", ""), error.value("errmsg", "MongoDB command failed"));
+    }
+    return reply;
+}
+
+void MongoConnection::check_no_cursor() const {
+    if (cursor_open_)
+        throw std::logic_error("A cursor is open on this connection; fetch or close it first");
+}
+
+void MongoConnection::flush() {
+    if (out_.empty())
+        return;
+    try {
+        socket_.write_all(out_);
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+    bytes_sent_ += out_.size();
+    ++round_trips_;
+    out_.clear();
+}
+
+void MongoConnection::ensure_buffered(std::size_t size) {
+    constexpr std::size_t chunk = 64 * 1024;
+    while (in_.size() - in_pos_ < size) {
+        if (in_pos_ > 0) {
+            in_.erase(0, in_pos_);
+            in_pos_ = 0;
+        }
+        std::size_t old_size = in_.size();
+        in_.resize(old_size + std::max(chunk, size - old_size));
+        std::size_t got = 0;
+        try {
+            got = socket_.read_some(&in_[old_size], in_.size() - old_size);
+        } catch (...) {
+            in_.resize(old_size);
+            broken_ = true;
+            throw;
+        }
+        in_.resize(old_size + got);
+        bytes_received_ += got;
+    }
+}
+
+void MongoConnection::fail(const std::string& what) {
+    broken_ = true;
+    throw std::runtime_error(what);
+}
@@ -1,69 +1,506 @@
 #include "../include/mongo_primitives.hpp"
+#include "../include/bson.hpp"
+#include "../include/connection_pool.hpp"
+#include "../include/histogram.hpp"
+#include "../include/mongo_connection.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using Pool = ConnectionPool<MongoConnection>;
+
+std::unique_ptr<Pool> pool;
+DBConfig active_config;
+
+Pool::Lease checkout() {
+    if (!pool)
+        throw std::runtime_error("MongoDB primitives are not initialized");
+    return pool->lease();
+}
+
+// Runs `fn` on a pooled connection; a session left in an unknown state by a
+// transport or protocol error is closed instead of going back to the pool.
+template <typename Fn>
+json with_connection(Fn&& fn) {
+    Pool::Lease conn = checkout();
+    try {
+        return fn(*conn);
+    } catch (...) {
+        if (conn->is_broken())
+            conn.mark_broken();
+        throw;
+    }
+}
+
+const std::string& database() {
+    static const std::string fallback = "test";
+    return active_config.db_name.empty() ? fallback : active_config.db_name;
+}
+
+json object_or_empty(const json& value) {
+    return value.is_null() ? json::object() : value;
+}
+
+MongoError write_error(const json& error) {
+    return MongoError(error.value("code", 0), error.value("codeName", ""), error.value("errmsg", "MongoDB write failed"));
+}
+
+// Runs a find or aggregate and collects every batch of its cursor.
+json drain(MongoConnection& conn, const std::string& name, const json& command, std::size_t batch_size) {
+    conn.open_cursor(database(), name, command, batch_size);
+    json documents = json::array();
+    json batch;
+    try {
+        while (conn.fetch(batch)) {
+            for (auto& document : batch)
+                documents.push_back(std::move(document));
+        }
+    } catch (...) {
+        try {
+            conn.close_cursor();
+        } catch (...) {
+        }
+        throw;
+    }
+    return documents;
+}
+
+// Key specifications given as [[field, value], ...] keep that order; json
+// objects would encode in name order.
+json key_spec(const json& keys) {
+    return keys.is_array() ? json{{"$ordered", keys}} : keys;
+}
+
+json find_command(const std::string& collection, const json& filter, const json& options) {
+    json command = {{"find", collection}, {"filter", object_or_empty(filter)}};
+    if (options.is_object()) {
+        for (auto it = options.begin(); it != options.end(); ++it)
+            command[it.key()] = it.key() == "sort" || it.key() == "hint" ? key_spec(it.value()) : it.value();
+    }
+    return command;
+}
+
+json aggregate_command(const std::string& collection, const json& pipeline, std::size_t batch_size) {
+    if (!pipeline.is_array())
+        throw std::invalid_argument("aggregate expects a JSON array of stages");
+    json cursor = json::object();
+    if (batch_size > 0)
+        cursor["batchSize"] = batch_size;
+    return {{"aggregate", collection}, {"pipeline", pipeline}, {"cursor", std::move(cursor)}};
+}
+
+// JSON text for the documents of one batch, written straight from BSON.
+struct JsonChunk {
+    bool ndjson = false;
+    bool first = true;
+    std::string text;
+
+    void add(const char* data, std::size_t size) {
+        if (!ndjson && !first)
+            text += ',';
+        Bson::write_json(data, size, text);
+        if (ndjson)
+            text += '\n';
+        first = false;
+    }
+};
+
+// Writes every document of `cursor`, one chunk per batch; see streamFind.
+Response stream_cursor(MongoCursor cursor, const std::string& content_type) {
+    auto shared = std::make_shared<MongoCursor>(std::move(cursor));
+    auto chunk = std::make_shared<JsonChunk>();
+    chunk->ndjson = content_type == "application/x-ndjson";
+    if (!chunk->ndjson)
+        chunk->text = "[";
+    auto add = [chunk](const char* data, std::size_t size) { chunk->add(data, size); };
+    bool more = shared->next(add);
+    return Response::stream([shared, chunk, add, more](const Response::BodyWriter& write) {
+        bool has_more = more;
+        while (has_more) {
+            if (!write(chunk->text.data(), chunk->text.size()))
+                return;
+            chunk->text.clear();
+            has_more = shared->next(add);
+        }
+        if (!chunk->ndjson)
+            chunk->text += ']';
+        if (!chunk->text.empty())
+            write(chunk->text.data(), chunk->text.size());
+    }, content_type);
+}
+
+json single_write(const std::string& name, const std::string& collection, const std::string& identifier,
+                  const json& statement) {
+    json result = with_connection([&](MongoConnection& conn) {
+        return conn.write(database(), name, {{name, collection}}, identifier, json::array({statement}));
+    });
+    if (!result["writeErrors"].empty())
+        throw write_error(result["writeErrors"][0]);
+    return result;
+}
+
+// Group commit for insertOne. The first caller to find no open group for a
+// collection leads it: while the collection already has a group in flight on
+// every pooled connection it waits, up to the window, for more callers to
+// join; then it sends every member as one unordered insert and hands each
+// member its own outcome. Light load therefore adds no delay, and load
+// beyond the pool fills batches instead of queueing for connections.
+struct GroupedInsert {
+    explicit GroupedInsert(json document) : document(std::move(document)) {}
+
+    json document;
+    bool done = false;
+    std::exception_ptr error;
+};
+
+struct InsertGroup {
+    std::vector<GroupedInsert*> members;
+};
+
+struct InsertQueue {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::shared_ptr<InsertGroup> open;
+    int in_flight = 0;
+};
+
+struct InsertBatchStats {
+    std::atomic<std::uint64_t> groups{0};
+    std::atomic<std::uint64_t> documents{0};
+    std::atomic<std::uint64_t> filled{0};
+    std::atomic<std::uint64_t> write_errors{0};
+    Histogram fill;
+    Histogram wait_ns;
+
+    json to_json() const {
+        Histogram::Snapshot f, w;
+        fill.snapshot_into(f);
+        wait_ns.snapshot_into(w);
+        std::uint64_t g = groups.load(std::memory_order_relaxed);
+        auto us = [](std::uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+        return {{"window_us", active_config.db_insert_batch_window_us},
+                {"max_documents", active_config.db_insert_batch_max_documents},
+                {"batches", g},
+                {"documents", documents.load(std::memory_order_relaxed)},
+                {"full_batches", filled.load(std::memory_order_relaxed)},
+                {"write_errors", write_errors.load(std::memory_order_relaxed)},
+                {"fill", {{"mean", f.mean()}, {"p50", f.percentile(50)}, {"p99", f.percentile(99)}, {"max", f.max}}},
+                {"wait_us", {{"p50", us(w.percentile(50))}, {"p99", us(w.percentile(99))}, {"max", us(w.max)}}}};
+    }
+};
+
+std::mutex insert_queues_mutex;
+std::unordered_map<std::string, std::unique_ptr<InsertQueue>> insert_queues;
+std::unique_ptr<InsertBatchStats> insert_stats;
+
+InsertQueue& insert_queue(const std::string& collection) {
+    std::lock_guard<std::mutex> lock(insert_queues_mutex);
+    auto& queue = insert_queues[collection];
+    if (!queue)
+        queue = std::make_unique<InsertQueue>();
+    return *queue;
+}
+
+void send_group(const std::string& collection, InsertGroup& group) {
+    json documents = json::array();
+    for (GroupedInsert* member : group.members)
+        documents.push_back(member->document);
+    try {
+        json result = with_connection([&](MongoConnection& conn) {
+            return conn.write(database(), "insert", {{"insert", collection}, {"ordered", false}}, "documents", documents);
+        });
+        for (const auto& error : result["writeErrors"]) {
+            std::size_t index = error.value("index", std::size_t(0));
+            if (index < group.members.size())
+                group.members[index]->error = std::make_exception_ptr(write_error(error));
+        }
+        insert_stats->write_errors.fetch_add(result["writeErrors"].size(), std::memory_order_relaxed);
+    } catch (...) {
+        for (GroupedInsert* member : group.members)
+            member->error = std::current_exception();
+    }
+}
+
+void grouped_insert(const std::string& collection, GroupedInsert& mine) {
+    auto started = std::chrono::steady_clock::now();
+    auto max_documents = static_cast<std::size_t>(std::max(1, active_config.db_insert_batch_max_documents));
+    InsertQueue& queue = insert_queue(collection);
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    bool leader = !queue.open;
+    if (leader)
+        queue.open = std::make_shared<InsertGroup>();
+    std::shared_ptr<InsertGroup> group = queue.open;
+    group->members.push_back(&mine);
+    if (group->members.size() >= max_documents) {
+        queue.open.reset();
+        queue.cv.notify_all();
+    }
+    if (!leader) {
+        queue.cv.wait(lock, [&] { return mine.done; });
+        return;
+    }
+
+    auto deadline = started + std::chrono::microseconds(active_config.db_insert_batch_window_us);
+    queue.cv.wait_until(lock, deadline, [&] { return queue.open != group || queue.in_flight < pool->size(); });
+    if (queue.open == group)
+        queue.open.reset();
+    else
+        insert_stats->filled.fetch_add(1, std::memory_order_relaxed);
+    ++queue.in_flight;
+    lock.unlock();
+
+    insert_stats->groups.fetch_add(1, std::memory_order_relaxed);
+    insert_stats->documents.fetch_add(group->members.size(), std::memory_order_relaxed);
+    insert_stats->fill.record(group->members.size());
+    insert_stats->wait_ns.record(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count()));
+    send_group(collection, *group);
+
+    lock.lock();
+    --queue.in_flight;
+    for (GroupedInsert* member : group->members)
+        member->done = true;
+    queue.cv.notify_all();
+}
+
+std::string index_name(const json& keys) {
+    std::string name;
+    auto add = [&](const std::string& field, const json& value) {
+        if (!name.empty())
+            name += '_';
+        name += field + '_' + (value.is_string() ? value.get<std::string>() : value.dump());
+    };
+    if (keys.is_array()) {
+        for (const auto& pair : keys) {
+            if (!pair.is_array() || pair.size() != 2 || !pair[0].is_string())
+                throw std::invalid_argument("createIndex expects [field, direction] pairs, got " + pair.dump());
+            add(pair[0].get<std::string>(), pair[1]);
+        }
+    } else {
+        for (auto it = keys.begin(); it != keys.end(); ++it)
+            add(it.key(), it.value());
+    }
+    return name;
+}
+
+}
 
 bool MongoPrimitives::initialize(const DBConfig& config) {
+    active_config = config;
+    insert_stats = std::make_unique<InsertBatchStats>();
+    auto options = MongoConnection::Options::from(config);
+    pool = std::make_unique<Pool>(
+        config, [options] { return std::make_shared<MongoConnection>(options); },
+        [](MongoConnection& conn) { return conn.ping(); });
     std::cout << "MongoDB primitives initialized" << std::endl;
     return true;
 }
 
+// MongoDB creates a database on its first write; this only checks that the
+// server answers for it.
 bool MongoPrimitives::ensureDatabase(const std::string& dbName) {
-    std::cout << "Ensuring MongoDB database: " << dbName << std::endl;
-    return true;
+    try {
+        with_connection([&](MongoConnection& conn) { return conn.command(dbName, "ping", {{"ping", 1}}); });
+        return true;
+    } catch (const std::exception& e) {
+        std::cout << "Could not reach MongoDB database " << dbName << ": " << e.what() << std::endl;
+        return false;
+    }
 }
 
 void MongoPrimitives::shutdown() {
+    pool.reset();
     std::cout << "MongoDB primitives shutdown" << std::endl;
 }
 
 json MongoPrimitives::find(const std::string& collection, const json& filter, const json& options) {
-    std::cout << "MongoDB find in collection: " << collection << std::endl;
-    return json::object();
+    json command = find_command(collection, filter, options);
+    std::size_t batch_size = command.value("batchSize", std::size_t(0));
+    return with_connection([&](MongoConnection& conn) { return drain(conn, "find", command, batch_size); });
 }
 
 json MongoPrimitives::insertOne(const std::string& collection, const json& document) {
-    std::cout << "MongoDB insertOne in collection: " << collection << std::endl;
-    return json::object();
+    if (!document.is_object())
+        throw std::invalid_argument("insertOne expects a JSON object");
+    json stored = document;
+    if (!stored.contains("_id"))
+        stored["_id"] = Bson::object_id();
+    if (active_config.db_insert_batch_window_us <= 0) {
+        single_write("insert", collection, "documents", stored);
+        return {{"acknowledged", true}, {"insertedId", stored["_id"]}};
+    }
+    GroupedInsert mine(std::move(stored));
+    grouped_insert(collection, mine);
+    if (mine.error)
+        std::rethrow_exception(mine.error);
+    return {{"acknowledged", true}, {"insertedId", mine.document["_id"]}};
 }
 
 json MongoPrimitives::insertMany(const std::string& collection, const json& documents) {
-    std::cout << "MongoDB insertMany in collection: " << collection << std::endl;
-    return json::object();
+    if (!documents.is_array())
+        throw std::invalid_argument("insertMany expects a JSON array");
+    json stored = documents;
+    for (auto& document : stored) {
+        if (!document.is_object())
+            throw std::invalid_argument("insertMany expects an array of JSON objects");
+        if (!document.contains("_id"))
+            document["_id"] = Bson::object_id();
+    }
+    json result = with_connection([&](MongoConnection& conn) {
+        return conn.write(database(), "insert", {{"insert", collection}, {"ordered", true}}, "documents", stored);
+    });
+    // Ordered inserts stop at the first error, so everything before it went in.
+    std::size_t inserted = stored.size();
+    if (!result["writeErrors"].empty())
+        inserted = result["writeErrors"][0].value("index", std::size_t(0));
+    json ids = json::array();
+    for (std::size_t i = 0; i < inserted; ++i)
+        ids.push_back(stored[i]["_id"]);
+    json reply = {{"acknowledged", true}, {"insertedCount", result["n"]}, {"insertedIds", std::move(ids)}};
+    if (!result["writeErrors"].empty())
+        reply["writeErrors"] = result["writeErrors"];
+    return reply;
 }
 
 json MongoPrimitives::updateOne(const std::string& collection, const json& filter, const json& update) {
-    std::cout << "MongoDB updateOne in collection: " << collection << std::endl;
-    return json::object();
+    json result = single_write("update", collection, "updates", {{"q", object_or_empty(filter)}, {"u", update}, {"multi", false}});
+    return {{"acknowledged", true}, {"matchedCount", result["n"]}, {"modifiedCount", result["nModified"]}};
 }
 
 json MongoPrimitives::updateMany(const std::string& collection, const json& filter, const json& update) {
-    std::cout << "MongoDB updateMany in collection: " << collection << std::endl;
-    return json::object();
+    json result = single_write("update", collection, "updates", {{"q", object_or_empty(filter)}, {"u", update}, {"multi", true}});
+    return {{"acknowledged", true}, {"matchedCount", result["n"]}, {"modifiedCount", result["nModified"]}};
 }
 
 json MongoPrimitives::deleteOne(const std::string& collection, const json& filter) {
-    std::cout << "MongoDB deleteOne in collection: " << collection << std::endl;
-    return json::object();
+    json result = single_write("delete", collection, "deletes", {{"q", object_or_empty(filter)}, {"limit", 1}});
+    return {{"acknowledged", true}, {"deletedCount", result["n"]}};
 }
 
 json MongoPrimitives::deleteMany(const std::string& collection, const json& filter) {
-    std::cout << "MongoDB deleteMany in collection: " << collection << std::endl;
-    return json::object();
+    json result = single_write("delete", collection, "deletes", {{"q", object_or_empty(filter)}, {"limit", 0}});
+    return {{"acknowledged", true}, {"deletedCount", result["n"]}};
 }
 
 json MongoPrimitives::aggregate(const std::string& collection, const json& pipeline) {
-    std::cout << "MongoDB aggregate in collection: " << collection << std::endl;
-    return json::object();
+    json command = aggregate_command(collection, pipeline, 0);
+    return with_connection([&](MongoConnection& conn) { return drain(conn, "aggregate", command, 0); });
+}
+
+struct MongoCursor::State {
+    Pool::Lease conn;
+};
+
+MongoCursor::MongoCursor(std::unique_ptr<State> state) : state(std::move(state)) {}
+MongoCursor::MongoCursor(MongoCursor&&) noexcept = default;
+MongoCursor& MongoCursor::operator=(MongoCursor&&) noexcept = default;
+
+// An abandoned cursor is killed so the connection can go back to the pool.
+MongoCursor::~MongoCursor() {
+    if (!state || !state->conn)
+        return;
+    try {
+        state->conn->close_cursor();
+    } catch (...) {
+    }
+    if (state->conn->is_broken())
+        state->conn.mark_broken();
+}
+
+bool MongoCursor::next(json& documents) {
+    documents = json::array();
+    return next([&](const char* data, std::size_t size) { documents.push_back(Bson::decode(data, size)); });
+}
+
+bool MongoCursor::next(const std::function<void(const char* data, std::size_t size)>& each) {
+    if (!state || !state->conn)
+        return false;
+    try {
+        if (state->conn->fetch(each))
+            return true;
+    } catch (...) {
+        // The batch was received whole, so an exception from `each` leaves the
+        // session usable; close_cursor() kills the server side.
+        try {
+            state->conn->close_cursor();
+        } catch (...) {
+        }
+        if (state->conn->is_broken())
+            state->conn.mark_broken();
+        state->conn.reset();
+        throw;
+    }
+    state->conn.reset();
+    return false;
+}
+
+MongoCursor MongoPrimitives::openCursor(const std::string& name, const json& command, std::size_t batch_size) {
+    auto state = std::make_unique<MongoCursor::State>();
+    state->conn = checkout();
+    try {
+        state->conn->open_cursor(database(), name, command, batch_size);
+    } catch (...) {
+        if (state->conn->is_broken())
+            state->conn.mark_broken();
+        throw;
+    }
+    return MongoCursor(std::move(state));
+}
+
+MongoCursor MongoPrimitives::findCursor(const std::string& collection, const json& filter, const json& options) {
+    json command = find_command(collection, filter, options);
+    if (!command.contains("batchSize"))
+        command["batchSize"] = 1000;
+    std::size_t batch_size = command.value("batchSize", std::size_t(0));
+    return openCursor("find", command, batch_size);
+}
+
+MongoCursor MongoPrimitives::aggregateCursor(const std::string& collection, const json& pipeline, std::size_t batch_size) {
+    return openCursor("aggregate", aggregate_command(collection, pipeline, batch_size), batch_size);
+}
+
+Response MongoPrimitives::streamFind(const std::string& collection, const json& filter, const json& options,
+                                     const std::string& content_type) {
+    return stream_cursor(findCursor(collection, filter, options), content_type);
+}
+
+Response MongoPrimitives::streamAggregate(const std::string& collection, const json& pipeline, std::size_t batch_size,
+                                          const std::string& content_type) {
+    return stream_cursor(aggregateCursor(collection, pipeline, batch_size), content_type);
 }
 
 bool MongoPrimitives::createIndex(const std::string& collection, const json& keys) {
-    std::cout << "MongoDB createIndex in collection: " << collection << std::endl;
+    json command = {{"createIndexes", collection}, {"indexes", json::array({{{"key", key_spec(keys)}, {"name", index_name(keys)}}})}};
+    with_connection([&](MongoConnection& conn) { return conn.command(database(), "createIndexes", command); });
     return true;
 }
 
 json MongoPrimitives::getConnectionInfo() {
-    return json::object();
+    json info = {{"backend", "mongodb"}, {"host", active_config.db_host}, {"port", active_config.db_port}, {"database", active_config.db_name}};
+    info["pool"] = pool ? pool->stats().to_json() : json(nullptr);
+    if (insert_stats && active_config.db_insert_batch_window_us > 0)
+        info["insert_batching"] = insert_stats->to_json();
+    return info;
 }
 
 bool MongoPrimitives::isConnected() {
-    return true;
+    return pool && pool->isHealthy();
+}
+
+bool MongoPrimitives::warmUp(std::chrono::steady_clock::time_point deadline) {
+    if (!pool)
+        return false;
+    return pool->warm_up(deadline);
+}
+
+bool MongoPrimitives::isReady() {
+    return pool && pool->ready();
 }
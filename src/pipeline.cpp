@@ -0,0 +1,67 @@
+#include "../include/pipeline.hpp"
+
+PipelineResult run_pipeline(const Router& app, Request&& req, const std::string& body,
+                            std::chrono::steady_clock::time_point start) {
+    PipelineResult result;
+    size_t route = Router::npos;
+
+    auto record = [&]() {
+        Metrics* metrics = app.metrics();
+        if (!metrics)
+            return;
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        metrics->record(route, result.status, body.size(), result.body.size(),
+                        static_cast<std::uint64_t>(elapsed.count()));
+    };
+
+    if (!body.empty()) {
+        try {
+            req.json_body = json::parse(body);
+        } catch (...) {
+            result.status = 400;
+            result.content_type = "application/json";
+            result.body = "{\"error\":\"Invalid JSON\"}";
+            record();
+            return result;
+        }
+    }
+    FASTAPI_TIMING_MARK(Parse);
+
+    Response res = app.handle_request(std::move(req), &route);
+    result.status = res.status_code;
+    result.headers = std::move(res.headers);
+    result.content_type = std::move(res.content_type);
+    if (res.body_stream) {
+        result.stream = [stream = std::move(res.body_stream), metrics = app.metrics(), route, status = result.status,
+                         request_bytes = body.size(), start](const Response::BodyWriter& write) {
+            std::size_t sent = 0;
+            auto record = [&]() {
+                if (!metrics)
+                    return;
+                auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+                metrics->record(route, status, request_bytes, sent, static_cast<std::uint64_t>(elapsed.count()));
+            };
+            try {
+                stream([&](const char* data, std::size_t size) {
+                    sent += size;
+                    return write(data, size);
+                });
+            } catch (...) {
+                record();
+                throw;
+            }
+            record();
+        };
+        return result;
+    }
+    result.body = std::move(res).dump();
+    FASTAPI_TIMING_MARK(Dump);
+#if FASTAPI_CPP_ENABLE_TIMING
+    if (app.server_timing()) {
+        if (RequestTiming* timing = RequestTiming::current())
+            result.headers["Server-Timing"] = timing->server_timing_header();
+    }
+#endif
+    record();
+    return result;
+}
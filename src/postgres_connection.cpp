@@ -0,0 +1,1263 @@
+#include "../include/postgres_connection.hpp"
+#include "../include/crypto.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
+namespace {
+
+const std::int32_t protocol_version = 196608;  // 3.0
+
+enum TypeOid : std::uint32_t {
+    BoolOid = 16,
+    ByteaOid = 17,
+    NameOid = 19,
+    Int8Oid = 20,
+    Int2Oid = 21,
+    Int4Oid = 23,
+    TextOid = 25,
+    OidOid = 26,
+    JsonOid = 114,
+    Float4Oid = 700,
+    Float8Oid = 701,
+    BpcharOid = 1042,
+    VarcharOid = 1043,
+    DateOid = 1082,
+    TimestampOid = 1114,
+    TimestamptzOid = 1184,
+    NumericOid = 1700,
+    UuidOid = 2950,
+    JsonbOid = 3802,
+};
+
+// Days between 1970-01-01 and the PostgreSQL epoch, 2000-01-01.
+const std::int64_t pg_epoch_days = 10957;
+
+void append_be(std::string& out, std::uint64_t value, int bytes) {
+    for (int shift = 8 * (bytes - 1); shift >= 0; shift -= 8)
+        out += static_cast<char>((value >> shift) & 0xff);
+}
+
+std::int64_t days_from_civil(std::int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const std::int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<std::int64_t>(doe) - 719468;
+}
+
+std::string text_of(const json& value) {
+    return value.is_string() ? value.get<std::string>() : value.dump();
+}
+
+std::int64_t integer_of(const json& value) {
+    if (value.is_number_integer())
+        return value.get<std::int64_t>();
+    if (value.is_number_float())
+        return static_cast<std::int64_t>(value.get<double>());
+    if (value.is_boolean())
+        return value.get<bool>();
+    return std::stoll(text_of(value));
+}
+
+double float_of(const json& value) {
+    return value.is_number() ? value.get<double>() : std::stod(text_of(value));
+}
+
+// NUMERIC as a JSON number only when no digit is lost: an integer that fits
+// 64 bits, or at most 15 significant digits, which a double holds exactly.
+// Anything wider, e.g. 12345678901234567890.12, and NaN stay strings.
+json decode_numeric(const char* data, std::size_t size) {
+    json parsed = json::parse(data, data + size, nullptr, false);
+    if (parsed.is_number_integer())
+        return parsed;
+    if (!parsed.is_number_float())
+        return std::string(data, size);
+    int digits = 0;
+    bool leading = true;
+    for (std::size_t i = 0; i < size; ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(data[i])))
+            continue;
+        leading = leading && data[i] == '0';
+        if (!leading)
+            ++digits;
+    }
+    if (digits > 15)
+        return std::string(data, size);
+    return parsed;
+}
+
+// ISO 8601 date or date-time; fills microseconds since 1970-01-01 UTC.
+// Without an explicit offset the time is taken as given.
+std::int64_t parse_timestamp_us(const std::string& text) {
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0, consumed = 0;
+    if (std::sscanf(text.c_str(), "%d-%d-%d%n", &year, &month, &day, &consumed) != 3)
+        throw std::runtime_error("Invalid date/time value: " + text);
+    std::size_t pos = static_cast<std::size_t>(consumed);
+    std::int64_t micros = 0;
+    if (pos < text.size() && (text[pos] == 'T' || text[pos] == ' ')) {
+        if (std::sscanf(text.c_str() + pos + 1, "%d:%d:%d%n", &hour, &minute, &second, &consumed) != 3)
+            throw std::runtime_error("Invalid date/time value: " + text);
+        pos += 1 + static_cast<std::size_t>(consumed);
+        if (pos < text.size() && text[pos] == '.') {
+            std::int64_t scale = 100000;
+            for (++pos; pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos])); ++pos) {
+                micros += (text[pos] - '0') * scale;
+                scale /= 10;
+            }
+        }
+    }
+    std::int64_t offset_s = 0;
+    if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+        int oh = 0, om = 0;
+        std::sscanf(text.c_str() + pos + 1, "%d:%d", &oh, &om);
+        if (text.size() - pos - 1 == 4 && text.find(':', pos) == std::string::npos) {
+            om = oh % 100;
+            oh /= 100;
+        }
+        offset_s = (text[pos] == '-' ? -1 : 1) * (oh * 3600 + om * 60);
+    }
+    std::int64_t days = days_from_civil(year, static_cast<unsigned>(month), static_cast<unsigned>(day));
+    std::int64_t seconds = days * 86400 + hour * 3600 + minute * 60 + second - offset_s;
+    return seconds * 1000000 + micros;
+}
+
+// PostgreSQL's binary numeric: base-10000 digits with a weight and scale.
+void append_numeric(std::string& out, const std::string& text) {
+    std::string s = text;
+    std::int16_t sign = 0;
+    if (!s.empty() && (s[0] == '-' || s[0] == '+')) {
+        sign = s[0] == '-' ? 0x4000 : 0;
+        s.erase(0, 1);
+    }
+    if (s == "NaN") {
+        append_be(out, 0, 2);
+        append_be(out, 0, 2);
+        append_be(out, 0xC000, 2);
+        append_be(out, 0, 2);
+        return;
+    }
+    int exponent = 0;
+    auto e = s.find_first_of("eE");
+    if (e != std::string::npos) {
+        exponent = std::stoi(s.substr(e + 1));
+        s.erase(e);
+    }
+    auto dot = s.find('.');
+    std::string int_part = s.substr(0, dot);
+    std::string frac_part = dot == std::string::npos ? "" : s.substr(dot + 1);
+    if ((int_part + frac_part).find_first_not_of("0123456789") != std::string::npos || int_part.size() + frac_part.size() == 0)
+        throw std::runtime_error("Invalid numeric value: " + text);
+    // Apply the exponent by moving digits across the decimal point.
+    for (; exponent > 0; --exponent) {
+        int_part += frac_part.empty() ? '0' : frac_part[0];
+        if (!frac_part.empty())
+            frac_part.erase(0, 1);
+    }
+    for (; exponent < 0; ++exponent) {
+        frac_part.insert(frac_part.begin(), int_part.empty() ? '0' : int_part.back());
+        if (!int_part.empty())
+            int_part.pop_back();
+    }
+    std::int16_t dscale = static_cast<std::int16_t>(frac_part.size());
+    int_part.insert(0, (4 - int_part.size() % 4) % 4, '0');
+    frac_part.append((4 - frac_part.size() % 4) % 4, '0');
+
+    std::vector<std::int16_t> digits;
+    std::string all = int_part + frac_part;
+    for (std::size_t i = 0; i < all.size(); i += 4)
+        digits.push_back(static_cast<std::int16_t>(std::stoi(all.substr(i, 4))));
+    int weight = static_cast<int>(int_part.size() / 4) - 1;
+    std::size_t first = 0;
+    while (first < digits.size() && digits[first] == 0) {
+        ++first;
+        --weight;
+    }
+    std::size_t last = digits.size();
+    while (last > first && digits[last - 1] == 0)
+        --last;
+    if (first == last)
+        weight = 0;
+    append_be(out, last - first, 2);
+    append_be(out, static_cast<std::uint16_t>(weight), 2);
+    append_be(out, static_cast<std::uint16_t>(sign), 2);
+    append_be(out, static_cast<std::uint16_t>(dscale), 2);
+    for (std::size_t i = first; i < last; ++i)
+        append_be(out, static_cast<std::uint16_t>(digits[i]), 2);
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+std::string unhex(const std::string& text, std::size_t from) {
+    std::string out;
+    int high = -1;
+    for (std::size_t i = from; i < text.size(); ++i) {
+        int v = hex_value(text[i]);
+        if (v < 0) {
+            if (text[i] == '-')
+                continue;
+            throw std::runtime_error("Invalid hex value: " + text);
+        }
+        if (high < 0) {
+            high = v;
+        } else {
+            out += static_cast<char>(high << 4 | v);
+            high = -1;
+        }
+    }
+    return out;
+}
+
+// Appends `value` in the binary send format of the column's type.
+void append_copy_value(std::string& out, std::uint32_t type_oid, const json& value, const std::string& column) {
+    switch (type_oid) {
+    case BoolOid:
+        out += static_cast<char>(value.is_boolean() ? value.get<bool>()
+                                                    : text_of(value) == "t" || text_of(value) == "true");
+        break;
+    case Int2Oid:
+        append_be(out, static_cast<std::uint16_t>(integer_of(value)), 2);
+        break;
+    case Int4Oid:
+    case OidOid:
+        append_be(out, static_cast<std::uint32_t>(integer_of(value)), 4);
+        break;
+    case Int8Oid:
+        append_be(out, static_cast<std::uint64_t>(integer_of(value)), 8);
+        break;
+    case Float4Oid: {
+        float f = static_cast<float>(float_of(value));
+        std::uint32_t bits;
+        std::memcpy(&bits, &f, 4);
+        append_be(out, bits, 4);
+        break;
+    }
+    case Float8Oid: {
+        double d = float_of(value);
+        std::uint64_t bits;
+        std::memcpy(&bits, &d, 8);
+        append_be(out, bits, 8);
+        break;
+    }
+    case NumericOid:
+        append_numeric(out, text_of(value));
+        break;
+    case TextOid:
+    case VarcharOid:
+    case BpcharOid:
+    case NameOid:
+        out += text_of(value);
+        break;
+    case JsonOid:
+        out += value.dump();
+        break;
+    case JsonbOid:
+        out += '\1';
+        out += value.dump();
+        break;
+    case ByteaOid: {
+        std::string bytes = text_of(value);
+        out += bytes.compare(0, 2, "\\x") == 0 ? unhex(bytes, 2) : bytes;
+        break;
+    }
+    case UuidOid: {
+        std::string bytes = unhex(text_of(value), 0);
+        if (bytes.size() != 16)
+            throw std::runtime_error("Invalid uuid for column " + column + ": " + text_of(value));
+        out += bytes;
+        break;
+    }
+    case DateOid: {
+        std::int64_t micros = parse_timestamp_us(text_of(value));
+        std::int64_t days = micros / 86400000000LL - (micros < 0 && micros % 86400000000LL ? 1 : 0);
+        append_be(out, static_cast<std::uint32_t>(days - pg_epoch_days), 4);
+        break;
+    }
+    case TimestampOid:
+    case TimestamptzOid:
+        append_be(out, static_cast<std::uint64_t>(parse_timestamp_us(text_of(value)) - pg_epoch_days * 86400000000LL), 8);
+        break;
+    default:
+        throw std::runtime_error("COPY does not support the type (oid " + std::to_string(type_oid) + ") of column " +
+                                 column);
+    }
+}
+
+// Appends one COPY binary field: an int32 length (-1 for NULL) and the value.
+void append_copy_field(std::string& out, std::uint32_t type_oid, const json& value, const std::string& column) {
+    if (value.is_null()) {
+        append_be(out, 0xffffffffu, 4);
+        return;
+    }
+    std::size_t length_at = out.size();
+    out.append(4, '\0');
+    try {
+        append_copy_value(out, type_oid, value, column);
+    } catch (const std::logic_error&) {
+        throw std::runtime_error("Invalid value for column " + column + ": " + value.dump());
+    } catch (const json::exception&) {
+        throw std::runtime_error("Invalid value for column " + column + ": " + value.dump());
+    }
+    std::uint32_t length = static_cast<std::uint32_t>(out.size() - length_at - 4);
+    for (int i = 0; i < 4; ++i)
+        out[length_at + i] = static_cast<char>((length >> (24 - 8 * i)) & 0xff);
+}
+
+std::string quote_identifier(const std::string& name) {
+    std::string quoted = "\"";
+    for (char c : name) {
+        if (c == '"')
+            quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// Cursor over a received message body.
+struct Reader {
+    const char* p;
+    const char* end;
+
+    std::int32_t int32() {
+        check(4);
+        std::uint32_t v = std::uint32_t(static_cast<unsigned char>(p[0])) << 24 |
+                          std::uint32_t(static_cast<unsigned char>(p[1])) << 16 |
+                          std::uint32_t(static_cast<unsigned char>(p[2])) << 8 | static_cast<unsigned char>(p[3]);
+        p += 4;
+        return static_cast<std::int32_t>(v);
+    }
+
+    std::int16_t int16() {
+        check(2);
+        std::uint16_t v = static_cast<std::uint16_t>(static_cast<unsigned char>(p[0]) << 8 | static_cast<unsigned char>(p[1]));
+        p += 2;
+        return static_cast<std::int16_t>(v);
+    }
+
+    std::string cstring() {
+        const char* nul = static_cast<const char*>(std::memchr(p, '\0', static_cast<std::size_t>(end - p)));
+        if (!nul)
+            throw std::runtime_error("Malformed PostgreSQL message");
+        std::string s(p, nul);
+        p = nul + 1;
+        return s;
+    }
+
+    void check(std::size_t n) const {
+        if (static_cast<std::size_t>(end - p) < n)
+            throw std::runtime_error("Truncated PostgreSQL message");
+    }
+};
+
+// Fills `state` and `message` from an ErrorResponse body.
+void parse_error(Reader& r, std::string& state, std::string& message) {
+    while (r.p < r.end && *r.p) {
+        char field = *r.p++;
+        std::string value = r.cstring();
+        if (field == 'C')
+            state = value;
+        else if (field == 'M')
+            message = value;
+    }
+    if (message.empty())
+        message = "PostgreSQL error " + state;
+}
+
+std::string scram_attribute(const std::string& message, char name) {
+    std::size_t pos = 0;
+    while (pos < message.size()) {
+        std::size_t comma = message.find(',', pos);
+        if (comma == std::string::npos)
+            comma = message.size();
+        if (comma - pos >= 2 && message[pos] == name && message[pos + 1] == '=')
+            return message.substr(pos + 2, comma - pos - 2);
+        pos = comma + 1;
+    }
+    throw std::runtime_error(std::string("SCRAM message is missing attribute ") + name);
+}
+
+std::string xor_bytes(const std::string& a, const std::string& b) {
+    std::string out = a;
+    for (std::size_t i = 0; i < out.size() && i < b.size(); ++i)
+        out[i] = static_cast<char>(out[i] ^ b[i]);
+    return out;
+}
+
+}
+
+PostgresConnection::Options PostgresConnection::Options::from(const DBConfig& config) {
+    Options options;
+    options.host = config.db_host.empty() ? "127.0.0.1" : config.db_host;
+    options.port = config.db_port > 0 ? config.db_port : 5432;
+    options.user = config.db_user;
+    options.password = config.db_password;
+    options.database = config.db_name.empty() ? config.db_user : config.db_name;
+    options.connect_timeout = std::chrono::milliseconds(config.db_connect_timeout_ms);
+    options.io_timeout = std::chrono::milliseconds(config.db_query_timeout_ms);
+    options.statement_cache_size = static_cast<std::size_t>(std::max(0, config.db_statement_cache_size));
+    return options;
+}
+
+PostgresConnection::PostgresConnection(const Options& options)
+    : statement_cache_size_(options.statement_cache_size),
+      statement_stats_(options.statement_stats ? options.statement_stats : std::make_shared<StatementCacheStats>()) {
+    socket_ = Socket::connect(options.host, options.port, options.connect_timeout);
+    socket_.set_timeout(options.io_timeout);
+    try {
+        startup(options);
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+}
+
+PostgresConnection::~PostgresConnection() {
+    if (broken_ || !socket_.is_open())
+        return;
+    try {
+        socket_.set_timeout(std::chrono::milliseconds(100));
+        begin_message('X');
+        end_message();
+        flush();
+    } catch (...) {
+    }
+}
+
+void PostgresConnection::startup(const Options& options) {
+    // The startup packet has no type byte, only a length.
+    out_.append(4, '\0');
+    put_int32(protocol_version);
+    put_cstring("user");
+    put_cstring(options.user);
+    put_cstring("database");
+    put_cstring(options.database);
+    put_cstring("client_encoding");
+    put_cstring("UTF8");
+    put_cstring("application_name");
+    put_cstring("fastapi-cpp");
+    out_ += '\0';
+    std::uint32_t length = static_cast<std::uint32_t>(out_.size());
+    for (int i = 0; i < 4; ++i)
+        out_[i] = static_cast<char>((length >> (24 - 8 * i)) & 0xff);
+    flush();
+
+    while (true) {
+        Message msg = next_message();
+        Reader r{msg.data, msg.data + msg.size};
+        switch (msg.type) {
+        case 'R': {
+            std::int32_t code = r.int32();
+            if (code == 0)
+                break;
+            if (code == 3) {
+                begin_message('p');
+                put_cstring(options.password);
+                end_message();
+                flush();
+            } else if (code == 5) {
+                std::string salt(r.p, 4);
+                std::string inner = Crypto::hex(Crypto::md5(options.password + options.user));
+                begin_message('p');
+                put_cstring("md5" + Crypto::hex(Crypto::md5(inner + salt)));
+                end_message();
+                flush();
+            } else if (code == 10) {
+                authenticate_sasl(msg, options);
+            } else {
+                fail("Unsupported PostgreSQL authentication method " + std::to_string(code));
+            }
+            break;
+        }
+        case 'K':
+            break;
+        case 'E': {
+            std::string state, message;
+            parse_error(r, state, message);
+            throw PostgresError(state, message);
+        }
+        case 'Z':
+            transaction_status_ = msg.size ? msg.data[0] : 'I';
+            return;
+        default:
+            fail(std::string("Unexpected message during startup: ") + msg.type);
+        }
+    }
+}
+
+void PostgresConnection::authenticate_sasl(const Message& request, const Options& options) {
+    Reader r{request.data + 4, request.data + request.size};
+    bool supported = false;
+    while (r.p < r.end && *r.p) {
+        if (r.cstring() == "SCRAM-SHA-256")
+            supported = true;
+    }
+    if (!supported)
+        fail("Server offered no supported SASL mechanism");
+
+    std::string client_nonce = Crypto::base64_encode(Crypto::random_bytes(18));
+    std::string client_first_bare = "n=,r=" + client_nonce;
+    std::string client_first = "n,," + client_first_bare;
+    begin_message('p');
+    put_cstring("SCRAM-SHA-256");
+    put_int32(static_cast<std::int32_t>(client_first.size()));
+    out_ += client_first;
+    end_message();
+    flush();
+
+    Message cont = next_message();
+    Reader cr{cont.data, cont.data + cont.size};
+    if (cont.type == 'E') {
+        std::string state, message;
+        parse_error(cr, state, message);
+        throw PostgresError(state, message);
+    }
+    if (cont.type != 'R' || cr.int32() != 11)
+        fail("Unexpected message during SCRAM authentication");
+    std::string server_first(cr.p, cr.end);
+    std::string nonce = scram_attribute(server_first, 'r');
+    if (nonce.compare(0, client_nonce.size(), client_nonce) != 0)
+        fail("SCRAM server nonce does not extend the client nonce");
+    std::string salt = Crypto::base64_decode(scram_attribute(server_first, 's'));
+    int iterations = std::atoi(scram_attribute(server_first, 'i').c_str());
+
+    std::string salted = Crypto::pbkdf2_hmac_sha256(options.password, salt, iterations);
+    std::string client_key = Crypto::hmac_sha256(salted, "Client Key");
+    std::string stored_key = Crypto::sha256(client_key);
+    std::string final_without_proof = "c=biws,r=" + nonce;
+    std::string auth_message = client_first_bare + "," + server_first + "," + final_without_proof;
+    std::string proof = xor_bytes(client_key, Crypto::hmac_sha256(stored_key, auth_message));
+
+    begin_message('p');
+    out_ += final_without_proof + ",p=" + Crypto::base64_encode(proof);
+    end_message();
+    flush();
+
+    Message final = next_message();
+    Reader fr{final.data, final.data + final.size};
+    if (final.type == 'E') {
+        std::string state, message;
+        parse_error(fr, state, message);
+        throw PostgresError(state, message);
+    }
+    if (final.type != 'R' || fr.int32() != 12)
+        fail("Unexpected message during SCRAM authentication");
+    std::string server_final(fr.p, fr.end);
+    std::string expected = Crypto::hmac_sha256(Crypto::hmac_sha256(salted, "Server Key"), auth_message);
+    if (Crypto::base64_decode(scram_attribute(server_final, 'v')) != expected)
+        fail("SCRAM server signature mismatch");
+}
+
+json PostgresConnection::query(const std::string& sql, const json& params) {
+    check_no_cursor();
+    try {
+        return run_query(sql, params, true);
+    } catch (const PostgresError&) {
+        throw;
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+}
+
+json PostgresConnection::run_query(const std::string& sql, const json& params, bool retry) {
+    write_pending_closes();
+    Pending pending = write_statement(sql, params);
+    write_sync();
+    flush();
+
+    std::string state, message;
+    json result = read_statement(pending, state, message);
+    read_until_ready();
+    retired_statements_.clear();
+    if (message.empty())
+        return result;
+    if (settle_failure(pending, state) && retry && transaction_status_ == 'I')
+        return run_query(sql, params, false);
+    throw PostgresError(state, message);
+}
+
+json PostgresConnection::transaction(const std::vector<std::pair<std::string, json>>& statements) {
+    check_no_cursor();
+    try {
+        return run_transaction(statements, true);
+    } catch (const PostgresError&) {
+        throw;
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+}
+
+json PostgresConnection::run_transaction(const std::vector<std::pair<std::string, json>>& statements, bool retry) {
+    write_pending_closes();
+    std::vector<Pending> pending;
+    pending.reserve(statements.size() + 2);
+    pending.push_back(write_statement("BEGIN", nullptr));
+    for (const auto& [sql, params] : statements)
+        pending.push_back(write_statement(sql, params));
+    pending.push_back(write_statement("COMMIT", nullptr));
+    write_sync();
+    flush();
+
+    // After an error the server sends nothing more until ReadyForQuery.
+    json results = json::array();
+    std::string state, message;
+    std::size_t failed = pending.size();
+    for (std::size_t i = 0; i < pending.size(); ++i) {
+        json result = read_statement(pending[i], state, message);
+        if (!message.empty()) {
+            failed = i;
+            break;
+        }
+        if (i > 0 && i + 1 < pending.size())
+            results.push_back(std::move(result));
+    }
+    read_until_ready();
+    bool invalidated = false;
+    if (failed < pending.size()) {
+        invalidated = settle_failure(pending[failed], state);
+        for (std::size_t j = failed + 1; j < pending.size(); ++j)
+            settle_skipped(pending[j]);
+    }
+    retired_statements_.clear();
+
+    if (failed == pending.size())
+        return results;
+    if (transaction_status_ != 'I') {
+        try {
+            run_query("ROLLBACK", nullptr, false);
+        } catch (const PostgresError&) {
+        }
+    }
+    if (invalidated && retry && transaction_status_ == 'I')
+        return run_transaction(statements, false);
+    throw PostgresError(state, message);
+}
+
+json PostgresConnection::copy_in(const std::string& table, std::vector<std::string> columns, const RowSource& next_row) {
+    check_no_cursor();
+    auto started = std::chrono::steady_clock::now();
+    auto cached = copy_tables_.find(table);
+    if (cached == copy_tables_.end()) {
+        // regclass::text quotes each part of the name as needed, so the
+        // caller's spelling never reaches the COPY statement itself.
+        json described = query("SELECT $1::regclass::text AS relname, attname, atttypid::int8 AS atttypid "
+                               "FROM pg_attribute "
+                               "WHERE attrelid = $1::regclass AND attnum > 0 AND NOT attisdropped ORDER BY attnum",
+                               json::array({table}));
+        CopyTable target;
+        for (const auto& row : described["rows"]) {
+            target.name = row["relname"].get<std::string>();
+            target.columns.emplace_back(row["attname"].get<std::string>(),
+                                        static_cast<std::uint32_t>(integer_of(row["atttypid"])));
+        }
+        if (target.columns.empty())
+            throw PostgresError("42P01", "relation \"" + table + "\" does not exist");
+        cached = copy_tables_.emplace(table, std::move(target)).first;
+    }
+    const std::string relation = cached->second.name;
+    const auto& table_columns = cached->second.columns;
+    if (columns.empty()) {
+        for (const auto& column : table_columns)
+            columns.push_back(column.first);
+    }
+    std::vector<std::uint32_t> types;
+    std::string column_list;
+    for (const auto& column : columns) {
+        auto it = std::find_if(table_columns.begin(), table_columns.end(),
+                               [&](const auto& known) { return known.first == column; });
+        if (it == table_columns.end()) {
+            copy_tables_.erase(cached);
+            throw PostgresError("42703", "column \"" + column + "\" of relation \"" + table + "\" does not exist");
+        }
+        types.push_back(it->second);
+        column_list += (column_list.empty() ? "" : ", ") + quote_identifier(column);
+    }
+
+    std::string encode_error;
+    json result;
+    std::uint64_t rows = 0;
+    std::uint64_t bytes = 0;
+    try {
+        begin_message('Q');
+        put_cstring("COPY " + relation + " (" + column_list + ") FROM STDIN (FORMAT binary)");
+        end_message();
+        ++pending_syncs_;
+        flush();
+        Message response = next_message();
+        if (response.type == 'E') {
+            std::string state, message;
+            Reader r{response.data, response.data + response.size};
+            parse_error(r, state, message);
+            read_until_ready();
+            copy_tables_.erase(table);
+            throw PostgresError(state, message);
+        }
+        if (response.type != 'G')
+            fail(std::string("Unexpected response to COPY: ") + response.type);
+
+        // Each chunk keeps five bytes in front for its CopyData header.
+        std::string chunk(5, '\0');
+        chunk.reserve(copy_chunk_size + 5);
+        chunk.append("PGCOPY\n\xff\r\n\0", 11);
+        append_be(chunk, 0, 4);
+        append_be(chunk, 0, 4);
+        json row;
+        try {
+            while (next_row(row)) {
+                append_be(chunk, columns.size(), 2);
+                for (std::size_t i = 0; i < columns.size(); ++i) {
+                    if (row.is_array())
+                        append_copy_field(chunk, types[i], i < row.size() ? row[i] : json(), columns[i]);
+                    else if (row.is_object())
+                        append_copy_field(chunk, types[i], row.contains(columns[i]) ? row[columns[i]] : json(), columns[i]);
+                    else
+                        throw std::runtime_error("COPY rows must be objects or arrays");
+                }
+                ++rows;
+                if (chunk.size() >= copy_chunk_size) {
+                    bytes += chunk.size() - 5;
+                    write_copy_chunk(chunk);
+                }
+            }
+            append_be(chunk, 0xffff, 2);
+        } catch (const SocketError&) {
+            throw;
+        } catch (const std::exception& e) {
+            encode_error = e.what();
+        }
+
+        if (encode_error.empty()) {
+            bytes += chunk.size() - 5;
+            write_copy_chunk(chunk);
+            begin_message('c');
+            end_message();
+        } else {
+            begin_message('f');
+            put_cstring(encode_error);
+            end_message();
+        }
+        flush();
+
+        std::string state, message;
+        result = read_result(state, message);
+        read_until_ready();
+        if (!message.empty() || !encode_error.empty())
+            copy_tables_.erase(table);
+        if (!message.empty() && encode_error.empty())
+            throw PostgresError(state, message);
+    } catch (const PostgresError&) {
+        throw;
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+    if (!encode_error.empty())
+        throw std::runtime_error(encode_error);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return {{"command", result["command"]},
+            {"rows", rows},
+            {"bytes", bytes},
+            {"seconds", seconds},
+            {"rows_per_second", seconds > 0 ? static_cast<double>(rows) / seconds : 0.0}};
+}
+
+// The portal stays open between Executes only until Sync ends the implicit
+// transaction, so batches are requested with Flush and Sync is sent once the
+// result is complete (or the cursor is abandoned).
+void PostgresConnection::open_cursor(const std::string& sql, const json& params, std::size_t batch_size) {
+    check_no_cursor();
+    try {
+        write_pending_closes();
+        cursor_batch_size_ = static_cast<std::int32_t>(std::clamp<std::size_t>(batch_size, 1, 1 << 30));
+        cursor_ = write_statement(sql, params, cursor_batch_size_);
+        write_flush();
+        flush();
+        cursor_open_ = true;
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+}
+
+bool PostgresConnection::fetch(json& rows) {
+    rows = json::array();
+    if (!cursor_open_)
+        return false;
+    try {
+        std::string state, message;
+        json result = read_statement(cursor_, state, message);
+        if (message.empty() && portal_suspended_) {
+            write_execute("", cursor_batch_size_);
+            write_flush();
+            flush();
+            rows = std::move(result["rows"]);
+            return true;
+        }
+        cursor_open_ = false;
+        write_sync();
+        flush();
+        read_until_ready();
+        if (!message.empty()) {
+            settle_failure(cursor_, state);
+            retired_statements_.clear();
+            throw PostgresError(state, message);
+        }
+        retired_statements_.clear();
+        rows = std::move(result["rows"]);
+        return !rows.empty();
+    } catch (const PostgresError&) {
+        throw;
+    } catch (...) {
+        cursor_open_ = false;
+        broken_ = true;
+        throw;
+    }
+}
+
+void PostgresConnection::close_cursor() {
+    if (!cursor_open_)
+        return;
+    cursor_open_ = false;
+    try {
+        write_sync();
+        flush();
+        read_until_ready();
+        retired_statements_.clear();
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+}
+
+void PostgresConnection::check_no_cursor() const {
+    if (cursor_open_)
+        throw std::logic_error("A cursor is open on this PostgreSQL connection");
+}
+
+PostgresConnection::Pending PostgresConnection::write_statement(const std::string& sql, const json& params,
+                                                                std::int32_t max_rows) {
+    Pending pending;
+    if (statement_cache_size_ == 0) {
+        write_parse("", sql);
+        write_bind("", "", params);
+        write_describe('P', "");
+        write_execute("", max_rows);
+        return pending;
+    }
+    // A miss prepares and describes the statement in the same flight as its
+    // first execution, so it costs no extra round trip.
+    pending.statement = lookup_statement(sql);
+    if (!pending.statement) {
+        pending.statement = &add_statement(sql, pending.evicted);
+        pending.prepared_now = true;
+        write_parse(pending.statement->name, sql);
+        write_describe('S', pending.statement->name);
+    }
+    write_bind("", pending.statement->name, params);
+    write_execute("", max_rows);
+    return pending;
+}
+
+json PostgresConnection::read_statement(const Pending& pending, std::string& error_state, std::string& error_message) {
+    if (!pending.statement)
+        return read_result(error_state, error_message);
+    // Hits decode with the cached description; a miss fills it in.
+    columns_.swap(pending.statement->columns);
+    json result = read_result(error_state, error_message);
+    pending.statement->columns.swap(columns_);
+    return result;
+}
+
+bool PostgresConnection::settle_failure(const Pending& pending, const std::string& error_state) {
+    if (!pending.statement)
+        return false;
+    // The statement may or may not exist server-side now; closing a missing
+    // one is not an error, so drop it on the next flight either way.
+    if (pending.prepared_now) {
+        pending_closes_.push_back(pending.statement->name);
+        forget_statement(pending.statement->sql);
+        return false;
+    }
+    if (error_state == "0A000" || error_state == "26000") {
+        // Schema changed under a cached plan, or the session lost it.
+        statement_stats_->invalidations.fetch_add(1, std::memory_order_relaxed);
+        pending_closes_.push_back(pending.statement->name);
+        forget_statement(pending.statement->sql);
+        return true;
+    }
+    return false;
+}
+
+void PostgresConnection::settle_skipped(const Pending& pending) {
+    if (!pending.evicted.empty())
+        pending_closes_.push_back(pending.evicted);
+    if (!pending.prepared_now)
+        return;
+    // Never parsed; a later entry for the same SQL may have replaced it.
+    auto it = statements_.find(pending.statement->sql);
+    if (it != statements_.end() && &*it->second == pending.statement)
+        forget_statement(pending.statement->sql);
+}
+
+void PostgresConnection::write_pending_closes() {
+    for (const auto& name : pending_closes_)
+        write_close('S', name);
+    pending_closes_.clear();
+}
+
+PostgresConnection::Statement* PostgresConnection::lookup_statement(const std::string& sql) {
+    auto it = statements_.find(sql);
+    if (it == statements_.end()) {
+        statement_stats_->misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    statement_stats_->hits.fetch_add(1, std::memory_order_relaxed);
+    statement_lru_.splice(statement_lru_.begin(), statement_lru_, it->second);
+    return &*it->second;
+}
+
+PostgresConnection::Statement& PostgresConnection::add_statement(const std::string& sql, std::string& evicted) {
+    if (statements_.size() >= statement_cache_size_) {
+        Statement& victim = statement_lru_.back();
+        write_close('S', victim.name);
+        evicted = victim.name;
+        statements_.erase(victim.sql);
+        retired_statements_.splice(retired_statements_.end(), statement_lru_, std::prev(statement_lru_.end()));
+        statement_stats_->evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    statement_lru_.push_front({sql, "fastapi_s" + std::to_string(next_statement_id_++), {}});
+    statements_.emplace(statement_lru_.front().sql, statement_lru_.begin());
+    return statement_lru_.front();
+}
+
+void PostgresConnection::forget_statement(const std::string& sql) {
+    auto it = statements_.find(sql);
+    if (it == statements_.end())
+        return;
+    auto entry = it->second;
+    statements_.erase(it);
+    retired_statements_.splice(retired_statements_.end(), statement_lru_, entry);
+}
+
+bool PostgresConnection::ping() {
+    if (broken_)
+        return false;
+    try {
+        write_sync();
+        flush();
+        read_until_ready();
+        return true;
+    } catch (...) {
+        broken_ = true;
+        return false;
+    }
+}
+
+std::string PostgresConnection::server_parameter(const std::string& name) const {
+    auto it = parameters_.find(name);
+    return it != parameters_.end() ? it->second : "";
+}
+
+bool PostgresConnection::encode_param(const json& value, std::string& out) {
+    switch (value.type()) {
+    case json::value_t::null:
+        return false;
+    case json::value_t::string:
+        out = value.get_ref<const std::string&>();
+        return true;
+    case json::value_t::boolean:
+        out = value.get<bool>() ? "true" : "false";
+        return true;
+    default:
+        out = value.dump();
+        return true;
+    }
+}
+
+json PostgresConnection::decode_value(std::uint32_t type_oid, const char* data, std::size_t size) {
+    switch (type_oid) {
+    case BoolOid:
+        return size > 0 && data[0] == 't';
+    case Int2Oid:
+    case Int4Oid:
+    case Int8Oid:
+    case OidOid:
+        return std::strtoll(std::string(data, size).c_str(), nullptr, 10);
+    case NumericOid:
+        return decode_numeric(data, size);
+    case Float4Oid:
+    case Float8Oid:
+    case JsonOid:
+    case JsonbOid: {
+        // NaN and Infinity are not JSON numbers; they stay strings.
+        json parsed = json::parse(data, data + size, nullptr, false);
+        if (!parsed.is_discarded())
+            return parsed;
+        break;
+    }
+    default:
+        break;
+    }
+    return std::string(data, size);
+}
+
+void PostgresConnection::begin_message(char type) {
+    out_ += type;
+    message_start_ = out_.size();
+    out_.append(4, '\0');
+}
+
+void PostgresConnection::end_message() {
+    std::uint32_t length = static_cast<std::uint32_t>(out_.size() - message_start_);
+    for (int i = 0; i < 4; ++i)
+        out_[message_start_ + i] = static_cast<char>((length >> (24 - 8 * i)) & 0xff);
+}
+
+void PostgresConnection::put_int16(std::int16_t value) {
+    out_ += static_cast<char>((value >> 8) & 0xff);
+    out_ += static_cast<char>(value & 0xff);
+}
+
+void PostgresConnection::put_int32(std::int32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out_ += static_cast<char>((static_cast<std::uint32_t>(value) >> shift) & 0xff);
+}
+
+void PostgresConnection::put_cstring(const std::string& value) {
+    out_ += value;
+    out_ += '\0';
+}
+
+void PostgresConnection::write_parse(const std::string& statement, const std::string& sql) {
+    begin_message('P');
+    put_cstring(statement);
+    put_cstring(sql);
+    put_int16(0);
+    end_message();
+}
+
+void PostgresConnection::write_bind(const std::string& portal, const std::string& statement, const json& params) {
+    begin_message('B');
+    put_cstring(portal);
+    put_cstring(statement);
+    put_int16(0);
+    std::string text;
+    auto put_param = [&](const json& value) {
+        if (encode_param(value, text)) {
+            put_int32(static_cast<std::int32_t>(text.size()));
+            out_ += text;
+        } else {
+            put_int32(-1);
+        }
+    };
+    if (params.is_array()) {
+        put_int16(static_cast<std::int16_t>(params.size()));
+        for (const auto& value : params)
+            put_param(value);
+    } else if (params.is_null()) {
+        put_int16(0);
+    } else {
+        put_int16(1);
+        put_param(params);
+    }
+    put_int16(0);
+    end_message();
+}
+
+void PostgresConnection::write_describe(char kind, const std::string& name) {
+    begin_message('D');
+    out_ += kind;
+    put_cstring(name);
+    end_message();
+}
+
+void PostgresConnection::write_execute(const std::string& portal, std::int32_t max_rows) {
+    begin_message('E');
+    put_cstring(portal);
+    put_int32(max_rows);
+    end_message();
+}
+
+void PostgresConnection::write_sync() {
+    begin_message('S');
+    end_message();
+    ++pending_syncs_;
+}
+
+// Asks the server to send what it has without ending the implicit transaction.
+void PostgresConnection::write_flush() {
+    begin_message('H');
+    end_message();
+}
+
+void PostgresConnection::write_copy_chunk(std::string& chunk) {
+    std::uint32_t length = static_cast<std::uint32_t>(chunk.size() - 1);
+    chunk[0] = 'd';
+    for (int i = 0; i < 4; ++i)
+        chunk[1 + i] = static_cast<char>((length >> (24 - 8 * i)) & 0xff);
+    flush();
+    socket_.write_all(chunk);
+    bytes_sent_ += chunk.size();
+    chunk.resize(5);
+}
+
+void PostgresConnection::write_close(char kind, const std::string& name) {
+    begin_message('C');
+    out_ += kind;
+    put_cstring(name);
+    end_message();
+}
+
+void PostgresConnection::flush() {
+    if (out_.empty())
+        return;
+    socket_.write_all(out_);
+    bytes_sent_ += out_.size();
+    ++round_trips_;
+    out_.clear();
+}
+
+void PostgresConnection::ensure_buffered(std::size_t size) {
+    constexpr std::size_t chunk = 64 * 1024;
+    while (in_.size() - in_pos_ < size) {
+        if (in_pos_ > 0) {
+            in_.erase(0, in_pos_);
+            in_pos_ = 0;
+        }
+        std::size_t old_size = in_.size();
+        in_.resize(old_size + chunk);
+        std::size_t got = 0;
+        try {
+            got = socket_.read_some(&in_[old_size], chunk);
+        } catch (...) {
+            in_.resize(old_size);
+            broken_ = true;
+            throw;
+        }
+        in_.resize(old_size + got);
+        bytes_received_ += got;
+    }
+}
+
+PostgresConnection::Message PostgresConnection::next_message() {
+    while (true) {
+        ensure_buffered(5);
+        Reader header{in_.data() + in_pos_ + 1, in_.data() + in_pos_ + 5};
+        std::int32_t length = header.int32();
+        if (length < 4)
+            fail("Invalid PostgreSQL message length");
+        ensure_buffered(1 + static_cast<std::size_t>(length));
+        Message msg{in_[in_pos_], in_.data() + in_pos_ + 5, static_cast<std::size_t>(length) - 4};
+        in_pos_ += 1 + static_cast<std::size_t>(length);
+
+        // Asynchronous messages can arrive at any point.
+        if (msg.type == 'S') {
+            Reader r{msg.data, msg.data + msg.size};
+            std::string name = r.cstring();
+            parameters_[name] = r.cstring();
+            continue;
+        }
+        if (msg.type == 'N' || msg.type == 'A')
+            continue;
+        if (msg.type == 'Z') {
+            transaction_status_ = msg.size ? msg.data[0] : 'I';
+            if (pending_syncs_ > 0)
+                --pending_syncs_;
+        }
+        return msg;
+    }
+}
+
+json PostgresConnection::read_result(std::string& error_state, std::string& error_message) {
+    json result = {{"command", ""}, {"rows_affected", 0}, {"rows", json::array()}};
+    portal_suspended_ = false;
+    json& rows = result["rows"];
+    while (true) {
+        Message msg = next_message();
+        Reader r{msg.data, msg.data + msg.size};
+        switch (msg.type) {
+        case '1':
+        case '2':
+        case '3':
+        case 't':
+            break;
+        case 'n':
+            columns_.clear();
+            break;
+        case 'T': {
+            columns_.resize(static_cast<std::size_t>(r.int16()));
+            for (auto& column : columns_) {
+                column.name = r.cstring();
+                r.int32();
+                r.int16();
+                column.type_oid = static_cast<std::uint32_t>(r.int32());
+                r.int16();
+                r.int32();
+                r.int16();
+            }
+            break;
+        }
+        case 'D': {
+            json row = json::object();
+            std::size_t count = static_cast<std::size_t>(r.int16());
+            for (std::size_t i = 0; i < count && i < columns_.size(); ++i) {
+                std::int32_t length = r.int32();
+                if (length < 0) {
+                    row[columns_[i].name] = nullptr;
+                    continue;
+                }
+                r.check(static_cast<std::size_t>(length));
+                row[columns_[i].name] = decode_value(columns_[i].type_oid, r.p, static_cast<std::size_t>(length));
+                r.p += length;
+            }
+            rows.push_back(std::move(row));
+            break;
+        }
+        case 'C': {
+            std::string tag = r.cstring();
+            auto space = tag.rfind(' ');
+            result["command"] = tag;
+            if (space != std::string::npos && space + 1 < tag.size() &&
+                std::isdigit(static_cast<unsigned char>(tag[space + 1])))
+                result["rows_affected"] = std::strtoll(tag.c_str() + space + 1, nullptr, 10);
+            return result;
+        }
+        case 's':
+            portal_suspended_ = true;
+            return result;
+        case 'I':
+            return result;
+        case 'E':
+            parse_error(r, error_state, error_message);
+            return result;
+        case 'Z':
+            return result;
+        default:
+            fail(std::string("Unexpected PostgreSQL message '") + msg.type + "'");
+        }
+    }
+}
+
+void PostgresConnection::read_until_ready() {
+    while (pending_syncs_ > 0)
+        next_message();
+}
+
+void PostgresConnection::fail(const std::string& what) {
+    broken_ = true;
+    throw std::runtime_error(what);
+}
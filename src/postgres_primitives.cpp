@@ -1,34 +1,421 @@
 #include "../include/postgres_primitives.hpp"
+#include "../include/connection_pool.hpp"
+#include "../include/postgres_connection.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+using Pool = ConnectionPool<PostgresConnection>;
+
+using Clock = std::chrono::steady_clock;
+
+std::unique_ptr<Pool> pool;
+std::shared_ptr<PostgresConnection::StatementCacheStats> statement_stats;
+DBConfig active_config;
+
+// Zero while the replica is caught up; otherwise the age of the last replayed
+// transaction, which is only meaningful while WAL is still arriving.
+const char* const replica_lag_sql =
+    "SELECT CASE WHEN NOT pg_is_in_recovery() OR pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 "
+    "ELSE (EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()) * 1000)::int8 END AS lag_ms";
+
+struct Replica {
+    std::string host;
+    int port = 0;
+    std::unique_ptr<Pool> pool;
+    std::atomic<int> outstanding{0};
+    // Exponentially weighted query latency; 0 until the first query.
+    std::atomic<double> latency_us{0.0};
+    std::atomic<std::int64_t> lag_ms{0};
+    std::atomic<int> consecutive_errors{0};
+    std::atomic<Clock::rep> ejected_until{0};
+    std::atomic<std::uint64_t> queries{0};
+    std::atomic<std::uint64_t> errors{0};
+    std::atomic<std::uint64_t> ejections{0};
+
+    bool available(Clock::time_point now) const {
+        return now.time_since_epoch().count() >= ejected_until.load(std::memory_order_relaxed);
+    }
+
+    void eject() {
+        auto until = Clock::now() + std::chrono::milliseconds(active_config.db_replica_eject_ms);
+        ejected_until.store(until.time_since_epoch().count(), std::memory_order_relaxed);
+        consecutive_errors.store(0, std::memory_order_relaxed);
+        ejections.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_success(Clock::duration elapsed) {
+        double us = std::chrono::duration<double, std::micro>(elapsed).count();
+        double previous = latency_us.load(std::memory_order_relaxed);
+        latency_us.store(previous == 0.0 ? us : previous * 0.8 + us * 0.2, std::memory_order_relaxed);
+        consecutive_errors.store(0, std::memory_order_relaxed);
+    }
+
+    void record_failure() {
+        errors.fetch_add(1, std::memory_order_relaxed);
+        if (consecutive_errors.fetch_add(1, std::memory_order_relaxed) + 1 >= active_config.db_replica_error_threshold)
+            eject();
+    }
+
+    json to_json(Clock::time_point now) const {
+        return {{"host", host},
+                {"port", port},
+                {"available", available(now)},
+                {"outstanding", outstanding.load(std::memory_order_relaxed)},
+                {"latency_us", latency_us.load(std::memory_order_relaxed)},
+                {"lag_ms", lag_ms.load(std::memory_order_relaxed)},
+                {"queries", queries.load(std::memory_order_relaxed)},
+                {"errors", errors.load(std::memory_order_relaxed)},
+                {"ejections", ejections.load(std::memory_order_relaxed)},
+                {"pool", pool->stats().to_json()}};
+    }
+};
+
+std::vector<std::unique_ptr<Replica>> replicas;
+std::atomic<std::size_t> replica_cursor{0};
+
+// Least outstanding requests, or that count weighted by each replica's
+// recent latency. Ties rotate so idle replicas share the load.
+Replica* choose_replica() {
+    if (replicas.empty())
+        return nullptr;
+    auto now = Clock::now();
+    std::size_t start = replica_cursor.fetch_add(1, std::memory_order_relaxed);
+    Replica* best = nullptr;
+    double best_score = 0.0;
+    for (std::size_t i = 0; i < replicas.size(); ++i) {
+        Replica* replica = replicas[(start + i) % replicas.size()].get();
+        if (!replica->available(now))
+            continue;
+        double score = replica->outstanding.load(std::memory_order_relaxed);
+        if (active_config.db_replica_selection == DBConfig::LatencyWeighted)
+            score = (score + 1.0) * replica->latency_us.load(std::memory_order_relaxed);
+        if (!best || score < best_score) {
+            best = replica;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+// Conservative: anything that might write, lock rows or create a table
+// stays on the primary.
+bool is_read_only(const std::string& sql) {
+    std::string upper;
+    upper.reserve(sql.size() + 2);
+    upper += ' ';
+    for (char c : sql) {
+        bool separator = std::isspace(static_cast<unsigned char>(c)) || c == '(' || c == ')' || c == ',' || c == ';';
+        upper += separator ? ' ' : static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    upper += ' ';
+    std::size_t begin = upper.find_first_not_of(' ');
+    if (begin == std::string::npos)
+        return false;
+    std::string word = upper.substr(begin, upper.find(' ', begin) - begin);
+    if (word != "SELECT" && word != "WITH" && word != "SHOW" && word != "VALUES" && word != "TABLE")
+        return false;
+    for (const char* writer : {" INSERT ", " UPDATE ", " DELETE ", " MERGE ", " INTO ", " FOR SHARE", " FOR KEY SHARE",
+                               " FOR NO KEY UPDATE", " NEXTVAL ", " SETVAL "}) {
+        if (upper.find(writer) != std::string::npos)
+            return false;
+    }
+    return true;
+}
+
+std::pair<std::string, int> parse_replica(const std::string& address, int default_port) {
+    std::string host = address;
+    int port = default_port;
+    if (!address.empty() && address[0] == '[') {
+        auto close = address.find(']');
+        host = address.substr(1, close - 1);
+        if (close + 1 < address.size() && address[close + 1] == ':')
+            port = std::stoi(address.substr(close + 2));
+    } else if (std::count(address.begin(), address.end(), ':') == 1) {
+        auto colon = address.find(':');
+        host = address.substr(0, colon);
+        port = std::stoi(address.substr(colon + 1));
+    }
+    return {host, port};
+}
+
+Pool::Lease checkout() {
+    if (!pool)
+        throw std::runtime_error("PostgreSQL primitives are not initialized");
+    return pool->lease();
+}
+
+// Runs `fn` on a pooled connection; a session left in an unknown state by a
+// transport or protocol error is closed instead of going back to the pool.
+template <typename Fn>
+json with_connection(Fn&& fn) {
+    Pool::Lease conn = checkout();
+    try {
+        return fn(*conn);
+    } catch (...) {
+        if (conn->is_broken())
+            conn.mark_broken();
+        throw;
+    }
+}
+
+std::string quote_identifier(const std::string& name) {
+    std::string quoted = "\"";
+    for (char c : name) {
+        if (c == '"')
+            quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+}
 
 bool PostgresPrimitives::initialize(const DBConfig& config) {
+    active_config = config;
+    if (config.auto_create_db && !config.db_name.empty())
+        ensureDatabase(config.db_name);
+    auto options = PostgresConnection::Options::from(config);
+    statement_stats = std::make_shared<PostgresConnection::StatementCacheStats>();
+    options.statement_stats = statement_stats;
+    pool = std::make_unique<Pool>(
+        config, [options] { return std::make_shared<PostgresConnection>(options); },
+        [](PostgresConnection& conn) { return conn.ping(); });
+
+    // Replica health checks also sample replay lag, ejecting replicas that
+    // fall too far behind.
+    replicas.clear();
+    for (const auto& address : config.db_replicas) {
+        auto replica = std::make_unique<Replica>();
+        std::tie(replica->host, replica->port) = parse_replica(address, options.port);
+        auto replica_options = options;
+        replica_options.host = replica->host;
+        replica_options.port = replica->port;
+        Replica* r = replica.get();
+        replica->pool = std::make_unique<Pool>(
+            config, [replica_options] { return std::make_shared<PostgresConnection>(replica_options); },
+            [r](PostgresConnection& conn) {
+                try {
+                    json result = conn.query(replica_lag_sql);
+                    std::int64_t lag = result["rows"].at(0)["lag_ms"].get<std::int64_t>();
+                    r->lag_ms.store(lag, std::memory_order_relaxed);
+                    if (active_config.db_replica_max_lag_ms > 0 && lag > active_config.db_replica_max_lag_ms)
+                        r->eject();
+                    return true;
+                } catch (const PostgresError&) {
+                    return !conn.is_broken();
+                } catch (...) {
+                    return false;
+                }
+            });
+        replicas.push_back(std::move(replica));
+    }
     std::cout << "PostgreSQL primitives initialized" << std::endl;
     return true;
 }
 
+// Connects to the maintenance database, since `dbName` may not exist yet.
 bool PostgresPrimitives::ensureDatabase(const std::string& dbName) {
-    std::cout << "Ensuring PostgreSQL database: " << dbName << std::endl;
-    return true;
+    auto options = PostgresConnection::Options::from(active_config);
+    options.database = "postgres";
+    try {
+        options.statement_cache_size = 0;
+        PostgresConnection conn(options);
+        json found = conn.query("SELECT 1 FROM pg_database WHERE datname = $1", json::array({dbName}));
+        if (found["rows"].empty())
+            conn.query("CREATE DATABASE " + quote_identifier(dbName));
+        return true;
+    } catch (const std::exception& e) {
+        std::cout << "Could not ensure PostgreSQL database " << dbName << ": " << e.what() << std::endl;
+        return false;
+    }
 }
 
 void PostgresPrimitives::shutdown() {
+    replicas.clear();
+    pool.reset();
     std::cout << "PostgreSQL primitives shutdown" << std::endl;
 }
 
+// A replica that fails at the transport level, or cancels the query on a
+// recovery conflict, hands the (read-only, so safely repeatable) query to the
+// primary; other SQL errors are the caller's.
 json PostgresPrimitives::executeQuery(const std::string& sql, const json& params) {
-    std::cout << "Executing PostgreSQL query: " << sql << std::endl;
-    return json::object();
+    Replica* replica = is_read_only(sql) ? choose_replica() : nullptr;
+    if (!replica)
+        return executeOnPrimary(sql, params);
+
+    replica->outstanding.fetch_add(1, std::memory_order_relaxed);
+    replica->queries.fetch_add(1, std::memory_order_relaxed);
+    auto started = Clock::now();
+    try {
+        Pool::Lease conn = replica->pool->lease();
+        try {
+            json result = conn->query(sql, params);
+            replica->outstanding.fetch_sub(1, std::memory_order_relaxed);
+            replica->record_success(Clock::now() - started);
+            return result;
+        } catch (...) {
+            if (conn->is_broken())
+                conn.mark_broken();
+            throw;
+        }
+    } catch (const PostgresError& e) {
+        replica->outstanding.fetch_sub(1, std::memory_order_relaxed);
+        if (e.sqlstate() != "40001")
+            throw;
+        replica->errors.fetch_add(1, std::memory_order_relaxed);
+    } catch (const std::exception&) {
+        replica->outstanding.fetch_sub(1, std::memory_order_relaxed);
+        replica->record_failure();
+    }
+    return executeOnPrimary(sql, params);
 }
 
+json PostgresPrimitives::executeOnPrimary(const std::string& sql, const json& params) {
+    return with_connection([&](PostgresConnection& conn) { return conn.query(sql, params); });
+}
+
+// The whole batch is pipelined behind one Sync, so it costs one round trip;
+// the first failure rolls the transaction back and is rethrown.
 json PostgresPrimitives::executeTransaction(const std::vector<std::pair<std::string, json>>& queries) {
-    std::cout << "Executing PostgreSQL transaction with " << queries.size() << " queries" << std::endl;
-    return json::object();
+    return with_connection([&](PostgresConnection& conn) { return conn.transaction(queries); });
+}
+
+json PostgresPrimitives::copyRows(const std::string& table, const json& rows, const std::vector<std::string>& columns) {
+    if (!rows.is_array())
+        throw std::invalid_argument("copyRows expects an array of rows");
+    auto it = rows.begin();
+    return copyRows(table, [&](json& row) {
+        if (it == rows.end())
+            return false;
+        row = *it++;
+        return true;
+    }, columns);
+}
+
+json PostgresPrimitives::copyRows(const std::string& table, const std::function<bool(json& row)>& next_row,
+                                  const std::vector<std::string>& columns) {
+    return with_connection([&](PostgresConnection& conn) { return conn.copy_in(table, columns, next_row); });
+}
+
+struct PostgresCursor::State {
+    Pool::Lease conn;
+};
+
+PostgresCursor::PostgresCursor(std::unique_ptr<State> state) : state(std::move(state)) {}
+PostgresCursor::PostgresCursor(PostgresCursor&&) noexcept = default;
+PostgresCursor& PostgresCursor::operator=(PostgresCursor&&) noexcept = default;
+
+// An abandoned cursor drains its in-flight batch so the connection can go back to the pool.
+PostgresCursor::~PostgresCursor() {
+    if (!state || !state->conn)
+        return;
+    try {
+        state->conn->close_cursor();
+    } catch (...) {
+    }
+    if (state->conn->is_broken())
+        state->conn.mark_broken();
+}
+
+bool PostgresCursor::next(json& rows) {
+    if (!state || !state->conn) {
+        rows = json::array();
+        return false;
+    }
+    try {
+        if (state->conn->fetch(rows))
+            return true;
+    } catch (...) {
+        if (state->conn->is_broken())
+            state->conn.mark_broken();
+        state->conn.reset();
+        throw;
+    }
+    state->conn.reset();
+    return false;
+}
+
+PostgresCursor PostgresPrimitives::openCursor(const std::string& sql, const json& params, std::size_t batch_size) {
+    auto state = std::make_unique<PostgresCursor::State>();
+    state->conn = checkout();
+    try {
+        state->conn->open_cursor(sql, params, batch_size);
+    } catch (...) {
+        if (state->conn->is_broken())
+            state->conn.mark_broken();
+        throw;
+    }
+    return PostgresCursor(std::move(state));
+}
+
+Response PostgresPrimitives::streamQuery(const std::string& sql, const json& params, std::size_t batch_size,
+                                         const std::string& content_type) {
+    auto cursor = std::make_shared<PostgresCursor>(openCursor(sql, params, batch_size));
+    auto first = std::make_shared<json>();
+    bool more = cursor->next(*first);
+    bool ndjson = content_type == "application/x-ndjson";
+    return Response::stream([cursor, first, more, ndjson](const Response::BodyWriter& write) {
+        std::string chunk = ndjson ? "" : "[";
+        bool first_row = true;
+        bool has_more = more;
+        json rows = std::move(*first);
+        while (has_more) {
+            for (const auto& row : rows) {
+                if (!ndjson && !first_row)
+                    chunk += ',';
+                chunk += row.dump();
+                if (ndjson)
+                    chunk += '\n';
+                first_row = false;
+            }
+            if (!write(chunk.data(), chunk.size()))
+                return;
+            chunk.clear();
+            has_more = cursor->next(rows);
+        }
+        if (!ndjson)
+            chunk += ']';
+        if (!chunk.empty())
+            write(chunk.data(), chunk.size());
+    }, content_type);
 }
 
 json PostgresPrimitives::getConnectionInfo() {
-    return json::object();
+    json info = {{"backend", "postgresql"}, {"host", active_config.db_host}, {"port", active_config.db_port}, {"database", active_config.db_name}};
+    info["pool"] = pool ? pool->stats().to_json() : json(nullptr);
+    info["statement_cache"] = statement_stats ? statement_stats->to_json() : json(nullptr);
+    if (!replicas.empty()) {
+        auto now = Clock::now();
+        info["replicas"] = json::array();
+        for (const auto& replica : replicas)
+            info["replicas"].push_back(replica->to_json(now));
+    }
+    return info;
 }
 
 bool PostgresPrimitives::isConnected() {
-    return true;
+    return pool && pool->isHealthy();
+}
+
+bool PostgresPrimitives::warmUp(std::chrono::steady_clock::time_point deadline) {
+    if (!pool)
+        return false;
+    // Replicas are optional capacity: their warm-up starts in the background
+    // and does not hold up readiness.
+    for (const auto& replica : replicas)
+        replica->pool->warm_up(Clock::now());
+    return pool->warm_up(deadline);
+}
+
+bool PostgresPrimitives::isReady() {
+    return pool && pool->ready();
 }
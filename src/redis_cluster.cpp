@@ -0,0 +1,411 @@
+#include "../include/redis_cluster.hpp"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const std::chrono::milliseconds refresh_interval{1000};
+const std::chrono::milliseconds tryagain_delay{10};
+
+// CRC16-CCITT (XMODEM): polynomial 0x1021, initial value 0, as the cluster
+// specification defines it.
+struct Crc16Table {
+    std::uint16_t entries[256];
+
+    Crc16Table() {
+        for (int i = 0; i < 256; ++i) {
+            std::uint16_t crc = static_cast<std::uint16_t>(i << 8);
+            for (int bit = 0; bit < 8; ++bit)
+                crc = static_cast<std::uint16_t>(crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1);
+            entries[i] = crc;
+        }
+    }
+};
+
+std::uint16_t crc16(const char* data, std::size_t size) {
+    static const Crc16Table table;
+    std::uint16_t crc = 0;
+    for (std::size_t i = 0; i < size; ++i)
+        crc = static_cast<std::uint16_t>((crc << 8) ^ table.entries[((crc >> 8) ^ static_cast<unsigned char>(data[i])) & 0xff]);
+    return crc;
+}
+
+std::pair<std::string, int> parse_address(const std::string& address, int default_port) {
+    std::string host = address;
+    int port = default_port;
+    if (!address.empty() && address[0] == '[') {
+        auto close = address.find(']');
+        host = address.substr(1, close - 1);
+        if (close + 1 < address.size() && address[close + 1] == ':')
+            port = std::stoi(address.substr(close + 2));
+    } else if (std::count(address.begin(), address.end(), ':') == 1) {
+        auto colon = address.find(':');
+        host = address.substr(0, colon);
+        port = std::stoi(address.substr(colon + 1));
+    }
+    return {host, port};
+}
+
+bool starts_with(const std::string& text, const char* prefix) {
+    return text.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+// "MOVED <slot> <host>:<port>" or "ASK <slot> <host>:<port>". The host may be
+// empty when the node does not know its own, meaning the one that replied.
+struct Redirect {
+    bool ask = false;
+    int slot = 0;
+    std::string host;
+    int port = 0;
+
+    static bool parse(const std::string& error, const std::string& replied_host, Redirect& redirect) {
+        redirect.ask = starts_with(error, "ASK ");
+        if (!redirect.ask && !starts_with(error, "MOVED "))
+            return false;
+        auto space = error.find(' ', error.find(' ') + 1);
+        auto colon = error.rfind(':');
+        if (space == std::string::npos || colon == std::string::npos || colon < space)
+            return false;
+        try {
+            redirect.slot = std::stoi(error.substr(error.find(' ') + 1));
+            redirect.port = std::stoi(error.substr(colon + 1));
+        } catch (const std::exception&) {
+            return false;
+        }
+        redirect.host = error.substr(space + 1, colon - space - 1);
+        if (redirect.host.size() > 2 && redirect.host.front() == '[')
+            redirect.host = redirect.host.substr(1, redirect.host.size() - 2);
+        if (redirect.host.empty())
+            redirect.host = replied_host;
+        return redirect.slot >= 0 && redirect.slot < RedisCluster::slot_count;
+    }
+};
+
+}  // namespace
+
+RedisCluster::RedisCluster(const DBConfig& config, const std::vector<std::string>& seeds, NodeListener on_node)
+    : config_(config), base_(RedisConnection::Options::from(config)), on_node_(std::move(on_node)) {
+    // Cluster nodes only have database 0.
+    base_.database = 0;
+    for (const auto& seed : seeds)
+        seeds_.push_back(parse_address(seed, config.cache_port));
+    if (seeds_.empty())
+        seeds_.emplace_back(config.cache_host, config.cache_port);
+    for (auto& slot : slots_)
+        slot.store(nullptr, std::memory_order_relaxed);
+}
+
+RedisCluster::~RedisCluster() = default;
+
+int RedisCluster::hash_slot(const std::string& key) {
+    const char* data = key.data();
+    std::size_t size = key.size();
+    auto open = key.find('{');
+    if (open != std::string::npos) {
+        auto close = key.find('}', open + 1);
+        if (close != std::string::npos && close > open + 1) {
+            data += open + 1;
+            size = close - open - 1;
+        }
+    }
+    return crc16(data, size) & (slot_count - 1);
+}
+
+int RedisCluster::command_slot(const std::vector<std::string>& args) {
+    return args.size() < 2 ? -1 : hash_slot(args[1]);
+}
+
+RedisReply RedisCluster::call(const std::vector<std::string>& args) {
+    std::vector<RedisReply> replies = call_many({args});
+    if (replies[0].is_error())
+        throw RedisError(replies[0].str);
+    return std::move(replies[0]);
+}
+
+std::vector<RedisReply> RedisCluster::call_many(const std::vector<std::vector<std::string>>& commands) {
+    refresh_if_needed();
+    std::vector<RedisReply> replies(commands.size());
+    std::vector<RedisNode*> targets(commands.size());
+    std::vector<bool> asking(commands.size(), false);
+    std::vector<std::size_t> pending(commands.size());
+    for (std::size_t i = 0; i < commands.size(); ++i) {
+        pending[i] = i;
+        targets[i] = &node_for(command_slot(commands[i]));
+    }
+    for (int hop = 0; !pending.empty(); ++hop) {
+        // One batch per node, in order of first appearance, all sent before
+        // any reply is read.
+        std::vector<std::pair<RedisNode*, std::vector<std::size_t>>> groups;
+        for (std::size_t i : pending) {
+            auto group = std::find_if(groups.begin(), groups.end(), [&](const auto& g) { return g.first == targets[i]; });
+            if (group == groups.end())
+                group = groups.insert(groups.end(), {targets[i], {}});
+            group->second.push_back(i);
+        }
+        std::vector<RedisNode::Ticket> tickets;
+        tickets.reserve(groups.size());
+        try {
+            for (const auto& group : groups) {
+                std::vector<std::vector<std::string>> batch;
+                for (std::size_t i : group.second) {
+                    if (asking[i])
+                        batch.push_back({"ASKING"});
+                    batch.push_back(commands[i]);
+                }
+                tickets.push_back(group.first->send(batch));
+            }
+            for (std::size_t g = 0; g < groups.size(); ++g) {
+                std::vector<RedisReply> answers = tickets[g].wait();
+                std::size_t next = 0;
+                for (std::size_t i : groups[g].second) {
+                    if (asking[i])
+                        ++next;
+                    replies[i] = std::move(answers[next++]);
+                }
+            }
+        } catch (...) {
+            // A node may have failed over; have the map checked.
+            stale_ = true;
+            throw;
+        }
+        if (hop == max_redirects)
+            break;
+
+        std::vector<std::size_t> redirected;
+        bool pause = false;
+        for (std::size_t i : pending) {
+            const RedisReply& reply = replies[i];
+            if (!reply.is_error())
+                continue;
+            asking[i] = false;
+            Redirect redirect;
+            if (Redirect::parse(reply.str, targets[i]->options().host, redirect)) {
+                RedisNode& node = node_at(redirect.host, redirect.port);
+                if (redirect.ask) {
+                    asking[i] = true;
+                    ++asked_;
+                } else {
+                    slots_[redirect.slot].store(&node, std::memory_order_release);
+                    stale_ = true;
+                    ++moved_;
+                }
+                targets[i] = &node;
+            } else if (starts_with(reply.str, "TRYAGAIN")) {
+                pause = true;
+                ++retried_;
+            } else {
+                continue;
+            }
+            redirected.push_back(i);
+        }
+        if (pause)
+            std::this_thread::sleep_for(tryagain_delay);
+        pending = std::move(redirected);
+    }
+    return replies;
+}
+
+std::vector<RedisReply> RedisCluster::call_slot(int slot, const std::vector<std::vector<std::string>>& commands) {
+    refresh_if_needed();
+    RedisNode* node = &node_for(slot);
+    for (int hop = 0;; ++hop) {
+        std::vector<RedisReply> replies;
+        try {
+            replies = node->call_many(commands);
+        } catch (...) {
+            stale_ = true;
+            throw;
+        }
+        if (hop == max_redirects)
+            return replies;
+        bool again = false;
+        for (const RedisReply& reply : replies) {
+            Redirect redirect;
+            if (!reply.is_error())
+                continue;
+            // ASK is left to the caller: the importing node only takes the
+            // command right after ASKING, which cannot precede a whole batch.
+            if (Redirect::parse(reply.str, node->options().host, redirect) && !redirect.ask) {
+                node = &node_at(redirect.host, redirect.port);
+                slots_[redirect.slot].store(node, std::memory_order_release);
+                stale_ = true;
+                ++moved_;
+                again = true;
+                break;
+            }
+            if (starts_with(reply.str, "TRYAGAIN")) {
+                std::this_thread::sleep_for(tryagain_delay);
+                ++retried_;
+                again = true;
+                break;
+            }
+        }
+        if (!again)
+            return replies;
+    }
+}
+
+void RedisCluster::call_all(const std::vector<std::string>& args) {
+    refresh_if_needed();
+    for (RedisNode* node : masters())
+        node->call(args);
+}
+
+void RedisCluster::refresh() {
+    std::lock_guard<std::mutex> lock(refresh_mutex_);
+    load_slots();
+}
+
+// The first caller loads the map, everyone else waiting for it. Later
+// reloads are left to whoever gets there first, at most once per interval,
+// while the others carry on with the current map.
+void RedisCluster::refresh_if_needed() {
+    if (!stale_.load(std::memory_order_acquire))
+        return;
+    if (!loaded_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(refresh_mutex_);
+        if (!loaded_)
+            load_slots();
+        return;
+    }
+    std::unique_lock<std::mutex> lock(refresh_mutex_, std::try_to_lock);
+    if (!lock.owns_lock() || !stale_ || Clock::now() < next_refresh_)
+        return;
+    try {
+        load_slots();
+    } catch (const std::exception& e) {
+        std::cout << "Redis cluster slot refresh failed: " << e.what() << std::endl;
+    }
+}
+
+void RedisCluster::load_slots() {
+    next_refresh_ = Clock::now() + refresh_interval;
+    // Cleared first, so a MOVED seen meanwhile asks for another reload.
+    stale_ = false;
+    std::vector<std::pair<std::string, int>> candidates;
+    for (RedisNode* node : masters())
+        candidates.emplace_back(node->options().host, node->options().port);
+    candidates.insert(candidates.end(), seeds_.begin(), seeds_.end());
+    std::exception_ptr error;
+    for (const auto& candidate : candidates) {
+        RedisReply reply;
+        try {
+            reply = node_at(candidate.first, candidate.second).call({"CLUSTER", "SLOTS"});
+        } catch (...) {
+            error = std::current_exception();
+            continue;
+        }
+        // Each range: start, end, then the master and its replicas as
+        // [host, port, id, ...]. "?" is a node with no known endpoint.
+        std::vector<RedisNode*> owners;
+        for (const auto& range : reply.elements) {
+            if (range.elements.size() < 3 || range.elements[2].elements.size() < 2)
+                continue;
+            const RedisReply& master = range.elements[2];
+            std::string host = master.elements[0].str;
+            if (host == "?")
+                continue;
+            if (host.empty())
+                host = candidate.first;
+            RedisNode& node = node_at(host, static_cast<int>(master.elements[1].integer));
+            owners.push_back(&node);
+            auto first = std::max<std::int64_t>(0, range.elements[0].integer);
+            auto last = std::min<std::int64_t>(slot_count - 1, range.elements[1].integer);
+            for (auto slot = first; slot <= last; ++slot)
+                slots_[static_cast<std::size_t>(slot)].store(&node, std::memory_order_release);
+        }
+        ++refreshes_;
+        loaded_ = true;
+        if (on_node_) {
+            std::lock_guard<std::mutex> lock(nodes_mutex_);
+            for (RedisNode* owner : owners) {
+                if (announced_.insert(owner).second)
+                    on_node_(owner->options());
+            }
+        }
+        return;
+    }
+    stale_ = true;
+    std::rethrow_exception(error);
+}
+
+RedisNode& RedisCluster::node_for(int slot) {
+    if (RedisNode* node = slots_[static_cast<std::size_t>(std::max(slot, 0))].load(std::memory_order_acquire))
+        return *node;
+    // Not covered by the map (yet): any node will answer with MOVED.
+    return node_at(seeds_[0].first, seeds_[0].second);
+}
+
+RedisNode& RedisCluster::node_at(const std::string& host, int port) {
+    std::string address = host + ":" + std::to_string(port);
+    std::lock_guard<std::mutex> lock(nodes_mutex_);
+    auto found = nodes_.find(address);
+    if (found != nodes_.end())
+        return *found->second;
+    RedisConnection::Options options = base_;
+    options.host = host;
+    options.port = port;
+    auto node = std::make_unique<RedisNode>(options, config_);
+    RedisNode& added = *node;
+    nodes_.emplace(address, std::move(node));
+    return added;
+}
+
+std::vector<RedisNode*> RedisCluster::masters() {
+    std::vector<RedisNode*> nodes;
+    std::unordered_set<RedisNode*> seen;
+    for (const auto& slot : slots_) {
+        RedisNode* node = slot.load(std::memory_order_acquire);
+        if (node && seen.insert(node).second)
+            nodes.push_back(node);
+    }
+    return nodes;
+}
+
+bool RedisCluster::warm_up(std::chrono::steady_clock::time_point deadline) {
+    try {
+        refresh_if_needed();
+    } catch (const std::exception&) {
+        return false;
+    }
+    for (RedisNode* node : masters())
+        node->warm_up(deadline);
+    return ready();
+}
+
+bool RedisCluster::connected() {
+    std::vector<RedisNode*> nodes = masters();
+    return !nodes.empty() && std::all_of(nodes.begin(), nodes.end(), [](RedisNode* node) { return node->connected(); });
+}
+
+bool RedisCluster::ready() {
+    std::vector<RedisNode*> nodes = masters();
+    return loaded_ && !nodes.empty() && std::all_of(nodes.begin(), nodes.end(), [](RedisNode* node) { return node->ready(); });
+}
+
+nlohmann::json RedisCluster::stats() {
+    std::unordered_map<RedisNode*, int> owned;
+    for (const auto& slot : slots_) {
+        if (RedisNode* node = slot.load(std::memory_order_acquire))
+            ++owned[node];
+    }
+    nlohmann::json nodes = nlohmann::json::array();
+    {
+        std::lock_guard<std::mutex> lock(nodes_mutex_);
+        for (const auto& entry : nodes_) {
+            nlohmann::json node = {{"address", entry.first}, {"slots", owned[entry.second.get()]}};
+            node.update(entry.second->stats());
+            nodes.push_back(std::move(node));
+        }
+    }
+    return {{"nodes", std::move(nodes)},
+            {"refreshes", refreshes_.load()},
+            {"moved", moved_.load()},
+            {"ask", asked_.load()},
+            {"tryagain", retried_.load()}};
+}
@@ -0,0 +1,303 @@
+#include "../include/redis_connection.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Nesting limit for aggregate replies, so a hostile server cannot exhaust the stack.
+const int max_depth = 64;
+
+bool to_int64(const std::string& text, std::int64_t& value) {
+    if (text.empty())
+        return false;
+    errno = 0;
+    char* end = nullptr;
+    long long parsed = std::strtoll(text.c_str(), &end, 10);
+    if (errno != 0 || end != text.c_str() + text.size())
+        return false;
+    value = parsed;
+    return true;
+}
+
+}  // namespace
+
+std::string RedisError::code() const {
+    const char* message = what();
+    const char* space = std::strchr(message, ' ');
+    return space ? std::string(message, space) : std::string(message);
+}
+
+RedisConnection::Options RedisConnection::Options::from(const DBConfig& config) {
+    Options options;
+    options.host = config.cache_host.empty() ? "127.0.0.1" : config.cache_host;
+    options.port = config.cache_port > 0 ? config.cache_port : 6379;
+    options.password = config.cache_password;
+    options.database = config.cache_db;
+    options.connect_timeout = std::chrono::milliseconds(config.db_connect_timeout_ms);
+    options.io_timeout = std::chrono::milliseconds(config.db_query_timeout_ms);
+    return options;
+}
+
+RedisConnection::RedisConnection(const Options& options) {
+    socket_ = Socket::connect(options.host, options.port, options.connect_timeout);
+    socket_.set_timeout(options.io_timeout);
+    try {
+        handshake(options);
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+}
+
+void RedisConnection::handshake(const Options& options) {
+    std::string user = options.user.empty() ? "default" : options.user;
+    bool hello = false;
+    if (options.protocol >= 3) {
+        std::vector<std::string> args = {"HELLO", "3"};
+        if (!options.password.empty())
+            args.insert(args.end(), {"AUTH", user, options.password});
+        args.insert(args.end(), {"SETNAME", "fastapi-cpp"});
+        try {
+            command(args);
+            protocol_ = 3;
+            hello = true;
+        } catch (const RedisError& e) {
+            // Redis before 6 has no HELLO; anything else (bad credentials) is final.
+            std::string code = e.code();
+            if (code != "NOPROTO" && std::string(e.what()).find("unknown command") == std::string::npos)
+                throw;
+        }
+    }
+    if (!hello && !options.password.empty()) {
+        if (options.user.empty())
+            command({"AUTH", options.password});
+        else
+            command({"AUTH", options.user, options.password});
+    }
+    if (options.database != 0)
+        command({"SELECT", std::to_string(options.database)});
+}
+
+RedisReply RedisConnection::command(const std::vector<std::string>& args) {
+    std::string out;
+    encode(args, out);
+    write(out);
+    RedisReply reply = read_reply();
+    if (reply.is_error())
+        throw RedisError(reply.str);
+    return reply;
+}
+
+std::vector<RedisReply> RedisConnection::pipeline(const std::vector<std::vector<std::string>>& commands) {
+    std::string out;
+    for (const auto& args : commands)
+        encode(args, out);
+    write(out);
+    std::vector<RedisReply> replies;
+    replies.reserve(commands.size());
+    for (std::size_t i = 0; i < commands.size(); ++i)
+        replies.push_back(read_reply());
+    return replies;
+}
+
+void RedisConnection::encode(const std::vector<std::string>& args, std::string& out) {
+    out += '*';
+    out += std::to_string(args.size());
+    out += "\r\n";
+    for (const auto& arg : args) {
+        out += '$';
+        out += std::to_string(arg.size());
+        out += "\r\n";
+        out += arg;
+        out += "\r\n";
+    }
+}
+
+void RedisConnection::write(const std::string& data) {
+    if (broken_)
+        throw SocketError("Redis connection is broken");
+    try {
+        socket_.write_all(data);
+    } catch (...) {
+        broken_ = true;
+        throw;
+    }
+    bytes_sent_.fetch_add(data.size(), std::memory_order_relaxed);
+    round_trips_.fetch_add(1, std::memory_order_relaxed);
+}
+
+RedisReply RedisConnection::read_reply() {
+    while (true) {
+        RedisReply reply = parse(0);
+        if (reply.type != RedisReply::Push)
+            return reply;
+    }
+}
+
+RedisReply RedisConnection::read_message() {
+    return parse(0);
+}
+
+bool RedisConnection::wait_readable(std::chrono::milliseconds timeout) {
+    return in_pos_ < in_.size() || socket_.wait_readable(timeout);
+}
+
+bool RedisConnection::ping() {
+    if (broken_)
+        return false;
+    try {
+        return command({"PING"}).type == RedisReply::Status;
+    } catch (...) {
+        broken_ = true;
+        return false;
+    }
+}
+
+void RedisConnection::abort() {
+    broken_ = true;
+    socket_.shutdown();
+}
+
+RedisReply RedisConnection::parse(int depth) {
+    if (depth > max_depth)
+        fail("Redis reply nested too deeply");
+    std::string line = read_line();
+    if (line.empty())
+        fail("Empty Redis reply line");
+    char kind = line[0];
+    std::string rest = line.substr(1);
+    RedisReply reply;
+    std::int64_t length = 0;
+    auto length_of = [&] {
+        if (!to_int64(rest, length) || length < -1)
+            fail("Invalid Redis length " + rest);
+        return length;
+    };
+    switch (kind) {
+    case '+':
+        reply.type = RedisReply::Status;
+        reply.str = std::move(rest);
+        break;
+    case '-':
+        reply.type = RedisReply::Error;
+        reply.str = std::move(rest);
+        break;
+    case ':':
+        reply.type = RedisReply::Integer;
+        if (!to_int64(rest, reply.integer))
+            fail("Invalid Redis integer " + rest);
+        break;
+    case '$':
+    case '!':
+    case '=':
+        if (length_of() < 0)
+            break;
+        reply.type = kind == '!' ? RedisReply::Error : RedisReply::String;
+        reply.str = read_bytes(static_cast<std::size_t>(length));
+        // Verbatim strings start with a three-letter format and a colon.
+        if (kind == '=' && reply.str.size() >= 4)
+            reply.str.erase(0, 4);
+        break;
+    case '*':
+    case '~':
+    case '>':
+    case '%': {
+        if (length_of() < 0)
+            break;
+        reply.type = kind == '*' ? RedisReply::Array : kind == '~' ? RedisReply::Set : kind == '>' ? RedisReply::Push : RedisReply::Map;
+        std::size_t count = static_cast<std::size_t>(length) * (kind == '%' ? 2 : 1);
+        reply.elements.reserve(std::min<std::size_t>(count, 1024));
+        for (std::size_t i = 0; i < count; ++i)
+            reply.elements.push_back(parse(depth + 1));
+        break;
+    }
+    case '|': {
+        // Attributes describe the reply that follows; nothing here uses them.
+        std::size_t count = static_cast<std::size_t>(std::max<std::int64_t>(0, length_of())) * 2;
+        for (std::size_t i = 0; i < count; ++i)
+            parse(depth + 1);
+        return parse(depth);
+    }
+    case '_':
+        break;
+    case ',':
+        reply.type = RedisReply::Double;
+        if (rest == "inf")
+            reply.number = std::numeric_limits<double>::infinity();
+        else if (rest == "-inf")
+            reply.number = -std::numeric_limits<double>::infinity();
+        else if (rest == "nan")
+            reply.number = std::numeric_limits<double>::quiet_NaN();
+        else
+            reply.number = std::strtod(rest.c_str(), nullptr);
+        break;
+    case '#':
+        reply.type = RedisReply::Boolean;
+        reply.integer = rest == "t";
+        break;
+    case '(':
+        reply.type = RedisReply::BigNumber;
+        reply.str = std::move(rest);
+        break;
+    default:
+        fail(std::string("Unknown Redis reply type '") + kind + "'");
+    }
+    return reply;
+}
+
+std::string RedisConnection::read_line() {
+    std::size_t searched = in_pos_;
+    while (true) {
+        std::size_t end = in_.find("\r\n", searched);
+        if (end != std::string::npos) {
+            std::string line = in_.substr(in_pos_, end - in_pos_);
+            in_pos_ = end + 2;
+            return line;
+        }
+        searched = in_.size() > in_pos_ ? in_.size() - 1 : in_pos_;
+        std::size_t offset = searched - in_pos_;
+        fill(in_.size() - in_pos_ + 1);
+        searched = in_pos_ + offset;
+    }
+}
+
+std::string RedisConnection::read_bytes(std::size_t size) {
+    fill(size + 2);
+    if (in_.compare(in_pos_ + size, 2, "\r\n") != 0)
+        fail("Redis bulk string without its terminator");
+    std::string bytes = in_.substr(in_pos_, size);
+    in_pos_ += size + 2;
+    return bytes;
+}
+
+// Reads until at least `wanted` unconsumed bytes are buffered.
+void RedisConnection::fill(std::size_t wanted) {
+    constexpr std::size_t chunk = 64 * 1024;
+    while (in_.size() - in_pos_ < wanted) {
+        if (in_pos_ > 0) {
+            in_.erase(0, in_pos_);
+            in_pos_ = 0;
+        }
+        std::size_t old_size = in_.size();
+        in_.resize(old_size + std::max(chunk, wanted - old_size));
+        std::size_t got = 0;
+        try {
+            got = socket_.read_some(&in_[old_size], in_.size() - old_size);
+        } catch (...) {
+            in_.resize(old_size);
+            broken_ = true;
+            throw;
+        }
+        in_.resize(old_size + got);
+        bytes_received_.fetch_add(got, std::memory_order_relaxed);
+    }
+}
+
+void RedisConnection::fail(const std::string& what) {
+    broken_ = true;
+    throw std::runtime_error(what);
+}
@@ -0,0 +1,220 @@
+#include "../include/redis_multiplexer.hpp"
+#include <stdexcept>
+
+namespace {
+
+const int max_writes_in_flight = 2;
+
+}  // namespace
+
+RedisMultiplexer::RedisMultiplexer(Factory factory) : factory_(std::move(factory)) {}
+
+RedisReply RedisMultiplexer::call(const std::vector<std::string>& args) {
+    Waiter me;
+    submit(me, {args});
+    RedisReply& reply = me.replies.front();
+    if (reply.is_error())
+        throw RedisError(reply.str);
+    return std::move(reply);
+}
+
+std::vector<RedisReply> RedisMultiplexer::call_many(const std::vector<std::vector<std::string>>& commands) {
+    Waiter me;
+    if (commands.empty())
+        return {};
+    submit(me, commands);
+    return std::move(me.replies);
+}
+
+RedisMultiplexer::Ticket::Ticket(RedisMultiplexer* owner, std::unique_ptr<Waiter> waiter)
+    : owner_(owner), waiter_(std::move(waiter)) {}
+
+RedisMultiplexer::Ticket::Ticket(Ticket&& other) noexcept : owner_(other.owner_), waiter_(std::move(other.waiter_)) {}
+
+RedisMultiplexer::Ticket::~Ticket() {
+    if (!waiter_)
+        return;
+    try {
+        owner_->finish(*waiter_);
+    } catch (...) {
+    }
+}
+
+RedisMultiplexer::Ticket RedisMultiplexer::send(const std::vector<std::vector<std::string>>& commands) {
+    auto waiter = std::make_unique<Waiter>();
+    if (!commands.empty())
+        enqueue(*waiter, commands);
+    else
+        waiter->done = true;
+    return Ticket(this, std::move(waiter));
+}
+
+std::vector<RedisReply> RedisMultiplexer::Ticket::wait() {
+    if (!waiter_)
+        throw std::logic_error("Redis multiplexer ticket has already been waited for");
+    std::unique_ptr<Waiter> waiter = std::move(waiter_);
+    owner_->finish(*waiter);
+    return std::move(waiter->replies);
+}
+
+void RedisMultiplexer::submit(Waiter& me, const std::vector<std::vector<std::string>>& commands) {
+    enqueue(me, commands);
+    finish(me);
+}
+
+void RedisMultiplexer::enqueue(Waiter& me, const std::vector<std::vector<std::string>>& commands) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    connect_if_needed();
+    for (const auto& args : commands)
+        RedisConnection::encode(args, out_);
+    me.expected = commands.size();
+    me.replies.reserve(commands.size());
+    waiting_.push_back(&me);
+    calls_.fetch_add(commands.size(), std::memory_order_relaxed);
+    if (!writing_ && writes_in_flight_ < max_writes_in_flight)
+        write_pending(lock);
+}
+
+void RedisMultiplexer::finish(Waiter& me) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    read_until_done(me, lock);
+    lock.unlock();
+    if (me.error)
+        std::rethrow_exception(me.error);
+}
+
+bool RedisMultiplexer::ping() {
+    try {
+        return call({"PING"}).type == RedisReply::Status;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool RedisMultiplexer::connected() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return conn_ != nullptr;
+}
+
+nlohmann::json RedisMultiplexer::stats() const {
+    std::uint64_t calls = calls_.load(std::memory_order_relaxed);
+    std::uint64_t writes = writes_.load(std::memory_order_relaxed);
+    int protocol = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (conn_)
+            protocol = conn_->protocol();
+    }
+    return {{"calls", calls},
+            {"writes", writes},
+            {"commands_per_write", writes ? static_cast<double>(calls) / static_cast<double>(writes) : 0.0},
+            {"connects", connects_.load(std::memory_order_relaxed)},
+            {"protocol", protocol}};
+}
+
+// Called with mutex_ held, so concurrent first callers share one new
+// connection instead of each opening their own.
+void RedisMultiplexer::connect_if_needed() {
+    if (!conn_) {
+        conn_ = std::shared_ptr<RedisConnection>(factory_());
+        connects_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void RedisMultiplexer::write_pending(std::unique_lock<std::mutex>& lock) {
+    writing_ = true;
+    while (!out_.empty()) {
+        std::string batch;
+        batch.swap(out_);
+        waiting_.back()->ends_write = true;
+        ++writes_in_flight_;
+        std::shared_ptr<RedisConnection> conn = conn_;
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            conn->write(batch);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        // Commands buffered meanwhile for a replacement connection still go out.
+        if (error)
+            fail_all(conn, error);
+        else
+            writes_.fetch_add(1, std::memory_order_relaxed);
+    }
+    writing_ = false;
+}
+
+void RedisMultiplexer::read_until_done(Waiter& me, std::unique_lock<std::mutex>& lock) {
+    while (!me.done) {
+        if (reading_) {
+            me.parked = true;
+            me.cv.wait(lock);
+            me.parked = false;
+            continue;
+        }
+        reading_ = true;
+        while (!me.done) {
+            if (!writing_ && !out_.empty() && writes_in_flight_ < max_writes_in_flight)
+                write_pending(lock);
+            if (me.done)
+                break;
+            std::shared_ptr<RedisConnection> conn = conn_;
+            lock.unlock();
+            RedisReply reply;
+            std::exception_ptr error;
+            try {
+                reply = conn->read_reply();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            if (!error && conn == conn_ && waiting_.empty())
+                error = std::make_exception_ptr(std::runtime_error("Redis sent a reply nobody asked for"));
+            if (error) {
+                fail_all(conn, error);
+                break;
+            }
+            // A reply from a connection already given up on; its callers have failed.
+            if (conn != conn_)
+                continue;
+            Waiter* waiter = waiting_.front();
+            waiter->replies.push_back(std::move(reply));
+            if (waiter->replies.size() < waiter->expected)
+                continue;
+            waiting_.pop_front();
+            if (waiter->ends_write)
+                --writes_in_flight_;
+            waiter->done = true;
+            if (waiter != &me)
+                waiter->cv.notify_one();
+        }
+        reading_ = false;
+        // The next reader is the first caller actually waiting; one still
+        // busy between send() and wait() takes over when it gets here.
+        for (Waiter* waiter : waiting_) {
+            if (waiter->parked) {
+                waiter->cv.notify_one();
+                break;
+            }
+        }
+    }
+}
+
+// Fails every caller in flight on `conn` and drops it, so the next call
+// reconnects. A second failure report for the same connection is ignored.
+void RedisMultiplexer::fail_all(const std::shared_ptr<RedisConnection>& conn, std::exception_ptr error) {
+    if (conn != conn_)
+        return;
+    conn->abort();
+    conn_.reset();
+    out_.clear();
+    writes_in_flight_ = 0;
+    for (Waiter* waiter : waiting_) {
+        waiter->error = error;
+        waiter->done = true;
+        waiter->cv.notify_one();
+    }
+    waiting_.clear();
+}
@@ -0,0 +1,130 @@
+#include "../include/redis_node.hpp"
+#include "../include/connection_pool.hpp"
+#include "../include/redis_multiplexer.hpp"
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+
+using Pool = ConnectionPool<RedisConnection>;
+
+// Either a multiplexer's ticket, or a pooled connection with `expected`
+// replies still to read; one left unread is not reused.
+struct RedisNode::Ticket::State {
+    std::optional<RedisMultiplexer::Ticket> multiplexed;
+    Pool::Lease lease;
+    std::size_t expected = 0;
+
+    ~State() {
+        if (lease && expected > 0)
+            lease.mark_broken();
+    }
+};
+
+RedisNode::Ticket::Ticket(std::unique_ptr<State> state) : state_(std::move(state)) {}
+RedisNode::Ticket::Ticket(Ticket&& other) noexcept = default;
+RedisNode::Ticket::~Ticket() = default;
+
+RedisNode::RedisNode(const RedisConnection::Options& options, const DBConfig& config)
+    : options_(options) {
+    auto factory = [options] { return std::make_unique<RedisConnection>(options); };
+    if (config.cache_pipeline_connections > 0) {
+        for (int i = 0; i < config.cache_pipeline_connections; ++i)
+            multiplexers_.push_back(std::make_unique<RedisMultiplexer>(factory));
+    } else {
+        pool_ = std::make_unique<Pool>(config, [factory]() -> Pool::Connection { return factory(); },
+                                       [](RedisConnection& conn) { return conn.ping(); });
+    }
+}
+
+RedisNode::~RedisNode() = default;
+
+// A pooled session left in an unknown state is closed rather than reused.
+RedisReply RedisNode::call(const std::vector<std::string>& args) {
+    if (!multiplexers_.empty())
+        return multiplexers_[next_.fetch_add(1, std::memory_order_relaxed) % multiplexers_.size()]->call(args);
+    Pool::Lease conn = pool_->lease();
+    try {
+        return conn->command(args);
+    } catch (...) {
+        if (conn->is_broken())
+            conn.mark_broken();
+        throw;
+    }
+}
+
+std::vector<RedisReply> RedisNode::call_many(const std::vector<std::vector<std::string>>& commands) {
+    if (!multiplexers_.empty())
+        return multiplexers_[next_.fetch_add(1, std::memory_order_relaxed) % multiplexers_.size()]->call_many(commands);
+    Pool::Lease conn = pool_->lease();
+    try {
+        return conn->pipeline(commands);
+    } catch (...) {
+        if (conn->is_broken())
+            conn.mark_broken();
+        throw;
+    }
+}
+
+RedisNode::Ticket RedisNode::send(const std::vector<std::vector<std::string>>& commands) {
+    auto state = std::make_unique<Ticket::State>();
+    if (!multiplexers_.empty()) {
+        state->multiplexed.emplace(multiplexers_[next_.fetch_add(1, std::memory_order_relaxed) % multiplexers_.size()]->send(commands));
+        return Ticket(std::move(state));
+    }
+    state->lease = pool_->lease();
+    std::string out;
+    for (const auto& args : commands)
+        RedisConnection::encode(args, out);
+    state->expected = commands.size();
+    state->lease->write(out);
+    return Ticket(std::move(state));
+}
+
+std::vector<RedisReply> RedisNode::Ticket::wait() {
+    if (!state_)
+        throw std::logic_error("Redis node ticket has already been waited for");
+    std::unique_ptr<State> state = std::move(state_);
+    if (state->multiplexed)
+        return state->multiplexed->wait();
+    std::vector<RedisReply> replies;
+    replies.reserve(state->expected);
+    while (replies.size() < state->expected)
+        replies.push_back(state->lease->read_reply());
+    state->expected = 0;
+    return replies;
+}
+
+bool RedisNode::warm_up(std::chrono::steady_clock::time_point deadline) {
+    if (!multiplexers_.empty()) {
+        bool all = true;
+        for (const auto& multiplexer : multiplexers_)
+            all = multiplexer->ping() && all;
+        if (all)
+            warmed_ = true;
+        return ready();
+    }
+    return pool_->warm_up(deadline);
+}
+
+bool RedisNode::connected() const {
+    if (!multiplexers_.empty())
+        return std::any_of(multiplexers_.begin(), multiplexers_.end(), [](const auto& m) { return m->connected(); });
+    return pool_->isHealthy();
+}
+
+bool RedisNode::ready() {
+    if (!multiplexers_.empty())
+        return warmed_ && connected();
+    return pool_->ready();
+}
+
+nlohmann::json RedisNode::stats() const {
+    nlohmann::json stats;
+    stats["pool"] = pool_ ? pool_->stats().to_json() : nlohmann::json(nullptr);
+    if (!multiplexers_.empty()) {
+        stats["pipelining"] = nlohmann::json::array();
+        for (const auto& multiplexer : multiplexers_)
+            stats["pipelining"].push_back(multiplexer->stats());
+    }
+    return stats;
+}
@@ -1,55 +1,762 @@
 #include "../include/redis_primitives.hpp"
+#include "../include/json_codec.hpp"
+#include "../include/local_cache.hpp"
+#include "../include/redis_cluster.hpp"
+#include "../include/redis_connection.hpp"
+#include "../include/redis_node.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// One of the two is set: a single server, or a cluster.
+std::unique_ptr<RedisNode> node;
+std::unique_ptr<RedisCluster> cluster;
+DBConfig active_config;
+std::unique_ptr<LocalCache> local_cache;
+JsonCodec::Options codec;
+
+RedisReply run(const std::vector<std::string>& args) {
+    if (cluster)
+        return cluster->call(args);
+    if (!node)
+        throw std::runtime_error("Redis primitives are not initialized");
+    return node->call(args);
+}
+
+// Runs `commands` back to back, in one write per node, returning error
+// replies in place rather than throwing.
+std::vector<RedisReply> run_many(const std::vector<std::vector<std::string>>& commands) {
+    if (cluster)
+        return cluster->call_many(commands);
+    if (!node)
+        throw std::runtime_error("Redis primitives are not initialized");
+    return node->call_many(commands);
+}
+
+// Like run_many, with nothing from other callers in between: on the node
+// owning `slot` when clustered.
+std::vector<RedisReply> run_together(int slot, const std::vector<std::vector<std::string>>& commands) {
+    if (cluster)
+        return cluster->call_slot(slot, commands);
+    return run_many(commands);
+}
+
+// Indexes into `keys`, grouped by hash slot in order of first appearance;
+// a single group when not clustered.
+std::vector<std::vector<std::size_t>> partition(const std::vector<std::string>& keys) {
+    std::vector<std::vector<std::size_t>> groups;
+    if (!cluster) {
+        groups.emplace_back(keys.size());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            groups[0][i] = i;
+        return groups;
+    }
+    std::unordered_map<int, std::size_t> group_of;
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        auto inserted = group_of.emplace(RedisCluster::hash_slot(keys[i]), groups.size());
+        if (inserted.second)
+            groups.emplace_back();
+        groups[inserted.first->second].push_back(i);
+    }
+    return groups;
+}
+
+void write_sample(std::ostream& out, const char* name, const char* type, const char* help, const json& value) {
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " " << type << "\n"
+        << name << " " << value << "\n";
+}
+
+void throw_if_error(const RedisReply& reply) {
+    if (reply.is_error())
+        throw RedisError(reply.str);
+}
+
+// Evicts local entries as Redis reports writes to their keys, from any
+// client: a connection of its own with CLIENT TRACKING ON BCAST receives an
+// invalidation push per write. Reconnecting drops the whole local cache,
+// since invalidations may have been missed meanwhile. A server without
+// tracking (before Redis 6) leaves expiry to the entries' TTL.
+class InvalidationListener {
+public:
+    InvalidationListener(RedisConnection::Options options, std::vector<std::string> prefixes, LocalCache& cache)
+        : options_(std::move(options)), prefixes_(std::move(prefixes)), cache_(cache) {
+        options_.protocol = 3;
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~InvalidationListener() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+            if (conn_)
+                conn_->abort();
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    bool listening() const { return listening_; }
+
+private:
+    static constexpr std::chrono::milliseconds ping_interval{5000};
+    static constexpr std::chrono::milliseconds retry_delay{1000};
+
+    void run() {
+        while (true) {
+            try {
+                auto conn = std::make_shared<RedisConnection>(options_);
+                if (conn->protocol() != 3) {
+                    std::cout << "Redis client tracking needs RESP3; local cache entries expire by TTL only" << std::endl;
+                    return;
+                }
+                std::vector<std::string> args = {"CLIENT", "TRACKING", "ON", "BCAST"};
+                for (const auto& prefix : prefixes_)
+                    args.insert(args.end(), {"PREFIX", prefix});
+                conn->command(args);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (stopped_)
+                        return;
+                    conn_ = conn;
+                }
+                cache_.clear();
+                listening_ = true;
+                listen(*conn);
+            } catch (const RedisError& e) {
+                std::cout << "Redis client tracking unavailable (" << e.what() << "); local cache entries expire by TTL only"
+                          << std::endl;
+                listening_ = false;
+                return;
+            } catch (const std::exception&) {
+            }
+            listening_ = false;
+            std::unique_lock<std::mutex> lock(mutex_);
+            conn_.reset();
+            if (cv_.wait_for(lock, retry_delay, [this] { return stopped_; }))
+                return;
+        }
+    }
+
+    // Until the connection fails. A PING after each quiet interval detects a
+    // server that went away without closing the socket.
+    void listen(RedisConnection& conn) {
+        bool awaiting_pong = false;
+        while (true) {
+            if (!conn.wait_readable(ping_interval)) {
+                if (awaiting_pong)
+                    throw SocketError("Redis tracking connection stopped responding");
+                std::string ping;
+                RedisConnection::encode({"PING"}, ping);
+                conn.write(ping);
+                awaiting_pong = true;
+                continue;
+            }
+            RedisReply message = conn.read_message();
+            awaiting_pong = false;
+            if (message.type != RedisReply::Push || message.elements.size() < 2 || message.elements[0].str != "invalidate")
+                continue;
+            // A nil key list means FLUSHDB or FLUSHALL.
+            if (message.elements[1].is_nil())
+                cache_.clear();
+            for (const auto& key : message.elements[1].elements)
+                cache_.invalidate(key.str);
+        }
+    }
+
+    RedisConnection::Options options_;
+    std::vector<std::string> prefixes_;
+    LocalCache& cache_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopped_ = false;
+    std::shared_ptr<RedisConnection> conn_;
+    std::atomic<bool> listening_{false};
+    std::thread thread_;
+};
+
+// One per server; a cluster adds one for each master as it finds them.
+std::mutex listeners_mutex;
+std::vector<std::unique_ptr<InvalidationListener>> invalidation_listeners;
+
+void listen_for_invalidations(const RedisConnection::Options& options) {
+    std::lock_guard<std::mutex> lock(listeners_mutex);
+    invalidation_listeners.push_back(
+        std::make_unique<InvalidationListener>(options, active_config.cache_local_tracking_prefixes, *local_cache));
+}
+
+void stop_listening() {
+    std::lock_guard<std::mutex> lock(listeners_mutex);
+    invalidation_listeners.clear();
+}
+
+bool tracking() {
+    std::lock_guard<std::mutex> lock(listeners_mutex);
+    return !invalidation_listeners.empty() &&
+           std::all_of(invalidation_listeners.begin(), invalidation_listeners.end(), [](const auto& l) { return l->listening(); });
+}
+
+// After a write through this process, so a concurrent read does not cache
+// the value it replaced.
+void forget(const std::string& key) {
+    if (local_cache)
+        local_cache->invalidate(key);
+}
+
+// How long a value fetched along with the PTTL reply `pttl` may stay in the
+// local cache; zero for a key that has already gone.
+std::chrono::milliseconds local_ttl(const RedisReply& pttl) {
+    std::chrono::milliseconds limit(active_config.cache_local_ttl_ms);
+    if (pttl.type != RedisReply::Integer || pttl.integer == -1)
+        return limit;
+    return std::min(limit, std::chrono::milliseconds(std::max<std::int64_t>(0, pttl.integer)));
+}
+
+// MGET per shard, plus a PTTL per key when `pttls` is given, all in one
+// round trip.
+std::vector<std::optional<std::string>> fetch_many(const std::vector<std::string>& keys, std::vector<RedisReply>* pttls) {
+    std::vector<std::optional<std::string>> values(keys.size());
+    if (keys.empty())
+        return values;
+    std::vector<std::vector<std::size_t>> groups = partition(keys);
+    std::vector<std::vector<std::string>> commands;
+    for (const auto& group : groups) {
+        std::vector<std::string> args = {"MGET"};
+        for (std::size_t i : group)
+            args.push_back(keys[i]);
+        commands.push_back(std::move(args));
+    }
+    if (pttls) {
+        for (const auto& key : keys)
+            commands.push_back({"PTTL", key});
+    }
+    std::vector<RedisReply> replies = run_many(commands);
+    for (std::size_t g = 0; g < groups.size(); ++g) {
+        throw_if_error(replies[g]);
+        if (replies[g].elements.size() != groups[g].size())
+            throw std::runtime_error("MGET returned " + std::to_string(replies[g].elements.size()) + " values for " +
+                                     std::to_string(groups[g].size()) + " keys");
+        for (std::size_t j = 0; j < groups[g].size(); ++j) {
+            RedisReply& value = replies[g].elements[j];
+            if (!value.is_nil())
+                values[groups[g][j]] = std::move(value.str);
+        }
+    }
+    if (pttls)
+        pttls->assign(std::make_move_iterator(replies.begin() + static_cast<std::ptrdiff_t>(groups.size())),
+                      std::make_move_iterator(replies.end()));
+    return values;
+}
+
+std::vector<std::string> with_ttl(std::vector<std::string> args, int ttl) {
+    if (ttl > 0)
+        args.insert(args.end(), {"EX", std::to_string(ttl)});
+    return args;
+}
+
+// A load in progress for getOrLoadJson, shared by every caller in this
+// process that needs the key meanwhile.
+struct Flight {
+    std::promise<json> promise;
+    std::shared_future<json> result = promise.get_future().share();
+};
+
+std::mutex flights_mutex;
+std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+
+struct CacheAsideCounters {
+    std::atomic<std::uint64_t> hits{0};
+    std::atomic<std::uint64_t> stale{0};
+    std::atomic<std::uint64_t> early{0};
+    std::atomic<std::uint64_t> loads{0};
+    std::atomic<std::uint64_t> coalesced{0};
+    std::atomic<std::uint64_t> errors{0};
+} cache_aside;
+
+// The key's flight, and whether this caller started it (and must land it).
+std::pair<std::shared_ptr<Flight>, bool> join_flight(const std::string& key) {
+    std::lock_guard<std::mutex> lock(flights_mutex);
+    auto inserted = flights.emplace(key, nullptr);
+    if (!inserted.second)
+        return {inserted.first->second, false};
+    inserted.first->second = std::make_shared<Flight>();
+    return {inserted.first->second, true};
+}
+
+std::int64_t unix_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// XFetch (Vattani et al., "Optimal Probabilistic Cache Stampede
+// Prevention"): reload before `expires_ms` with a probability that rises
+// as it nears, sooner for values that take longer (`delta_ms`) to load.
+bool refresh_early(std::int64_t now_ms, std::int64_t delta_ms, std::int64_t expires_ms) {
+    double beta = active_config.cache_xfetch_beta;
+    if (beta <= 0)
+        return false;
+    thread_local std::mt19937_64 random(std::random_device{}());
+    double u = 1.0 - std::uniform_real_distribution<double>(0.0, 1.0)(random);
+    return static_cast<double>(now_ms) - static_cast<double>(delta_ms) * beta * std::log(u) >= static_cast<double>(expires_ms);
+}
+
+// Runs `loader` as the key's flight and caches the value with the time
+// the load took, kept in Redis cache_stale_ttl beyond its own expiry.
+json load(const std::string& key, const std::function<json()>& loader, int ttl, Flight& flight) {
+    auto finish = [&key] {
+        std::lock_guard<std::mutex> lock(flights_mutex);
+        flights.erase(key);
+    };
+    json value;
+    try {
+        auto start = std::chrono::steady_clock::now();
+        cache_aside.loads++;
+        value = loader();
+        auto took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        json entry = {{"value", value}, {"delta_ms", std::max<std::int64_t>(1, took)}, {"expires_ms", unix_ms() + ttl * 1000LL}};
+        try {
+            RedisPrimitives::setJson(key, entry, ttl + std::max(0, active_config.cache_stale_ttl));
+        } catch (const std::exception&) {
+            cache_aside.errors++;
+        }
+    } catch (...) {
+        finish();
+        flight.promise.set_exception(std::current_exception());
+        throw;
+    }
+    finish();
+    flight.promise.set_value(value);
+    return value;
+}
+
+}
 
 bool RedisPrimitives::initialize(const DBConfig& config) {
+    stop_listening();
+    cluster.reset();
+    node.reset();
+    local_cache.reset();
+    active_config = config;
+    codec = JsonCodec::Options::from(config);
+    for (auto* counter : {&cache_aside.hits, &cache_aside.stale, &cache_aside.early, &cache_aside.loads, &cache_aside.coalesced,
+                          &cache_aside.errors})
+        counter->store(0);
+    bool tracked = config.cache_local_max_bytes > 0 && config.cache_local_tracking;
+    if (config.cache_local_max_bytes > 0)
+        local_cache = std::make_unique<LocalCache>(config.cache_local_max_bytes);
+    if (config.cache_cluster) {
+        RedisCluster::NodeListener on_node;
+        if (tracked)
+            on_node = listen_for_invalidations;
+        cluster = std::make_unique<RedisCluster>(config, config.cache_cluster_nodes, on_node);
+    } else {
+        RedisConnection::Options options = RedisConnection::Options::from(config);
+        node = std::make_unique<RedisNode>(options, config);
+        if (tracked)
+            listen_for_invalidations(options);
+    }
     std::cout << "Redis primitives initialized" << std::endl;
     return true;
 }
 
 void RedisPrimitives::shutdown() {
+    stop_listening();
+    cluster.reset();
+    node.reset();
+    local_cache.reset();
     std::cout << "Redis primitives shutdown" << std::endl;
 }
 
 bool RedisPrimitives::set(const std::string& key, const std::string& value, int ttl) {
-    std::cout << "Redis set key: " << key << std::endl;
-    return true;
+    bool ok = run(with_ttl({"SET", key, value}, ttl)).is_ok();
+    forget(key);
+    return ok;
 }
 
 std::optional<std::string> RedisPrimitives::get(const std::string& key) {
-    std::cout << "Redis get key: " << key << std::endl;
-    return std::nullopt;
+    RedisReply reply = run({"GET", key});
+    if (reply.is_nil())
+        return std::nullopt;
+    return std::move(reply.str);
 }
 
 bool RedisPrimitives::del(const std::string& key) {
-    std::cout << "Redis del key: " << key << std::endl;
-    return true;
+    bool deleted = run({"DEL", key}).integer > 0;
+    forget(key);
+    return deleted;
 }
 
 bool RedisPrimitives::exists(const std::string& key) {
-    std::cout << "Redis exists key: " << key << std::endl;
-    return false;
+    return run({"EXISTS", key}).integer > 0;
 }
 
 bool RedisPrimitives::setJson(const std::string& key, const json& value, int ttl) {
-    std::cout << "Redis setJson key: " << key << std::endl;
-    return true;
+    return set(key, JsonCodec::encode(value, codec), ttl);
 }
 
+// From the local cache when enabled. A miss fetches the key's PTTL along
+// with the value, so the local copy never outlives the key in Redis.
 std::optional<json> RedisPrimitives::getJson(const std::string& key) {
-    std::cout << "Redis getJson key: " << key << std::endl;
-    return std::nullopt;
+    if (!local_cache) {
+        std::optional<std::string> text = get(key);
+        if (!text)
+            return std::nullopt;
+        return JsonCodec::decode(*text);
+    }
+    if (LocalCache::Value cached = local_cache->get(key))
+        return json(*cached);
+    std::uint64_t epoch = local_cache->epoch(key);
+    std::vector<RedisReply> replies = run_many({{"GET", key}, {"PTTL", key}});
+    throw_if_error(replies[0]);
+    if (replies[0].is_nil())
+        return std::nullopt;
+    auto value = std::make_shared<const json>(JsonCodec::decode(replies[0].str));
+    std::chrono::milliseconds ttl = local_ttl(replies[1]);
+    if (ttl.count() > 0)
+        local_cache->put(key, value, ttl, epoch);
+    return json(*value);
+}
+
+// A fresh entry is returned as it is, unless XFetch picks this call to
+// reload it early. Past its expiry, within cache_stale_ttl, the first
+// caller reloads it and everyone else gets the stale value meanwhile (as
+// does that caller, should the load fail). Without an entry, the first
+// caller loads and the others wait for its result. Either way this
+// process runs one load per key at a time. A Redis failure counts as a
+// miss, so the backend still answers.
+json RedisPrimitives::getOrLoadJson(const std::string& key, const std::function<json()>& loader, int ttl) {
+    if (ttl <= 0)
+        ttl = active_config.cache_ttl;
+    std::optional<json> entry;
+    try {
+        entry = getJson(key);
+    } catch (const std::exception&) {
+        cache_aside.errors++;
+    }
+    if (entry && entry->is_object() && entry->contains("value") && entry->contains("expires_ms")) {
+        json& value = (*entry)["value"];
+        std::int64_t now = unix_ms();
+        std::int64_t expires = entry->value("expires_ms", std::int64_t(0));
+        bool expired = now >= expires;
+        if (!expired && !refresh_early(now, entry->value("delta_ms", std::int64_t(0)), expires)) {
+            cache_aside.hits++;
+            return std::move(value);
+        }
+        auto flight = join_flight(key);
+        if (!flight.second) {
+            (expired ? cache_aside.stale : cache_aside.hits)++;
+            return std::move(value);
+        }
+        (expired ? cache_aside.stale : cache_aside.early)++;
+        try {
+            return load(key, loader, ttl, *flight.first);
+        } catch (const std::exception&) {
+            cache_aside.errors++;
+            return std::move(value);
+        }
+    }
+    auto flight = join_flight(key);
+    if (!flight.second) {
+        cache_aside.coalesced++;
+        return flight.first->result.get();
+    }
+    return load(key, loader, ttl, *flight.first);
+}
+
+std::vector<std::optional<std::string>> RedisPrimitives::mget(const std::vector<std::string>& keys) {
+    return fetch_many(keys, nullptr);
+}
+
+std::vector<std::optional<json>> RedisPrimitives::mgetJson(const std::vector<std::string>& keys) {
+    std::vector<std::optional<json>> values(keys.size());
+    if (!local_cache) {
+        std::vector<std::optional<std::string>> texts = mget(keys);
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            if (texts[i])
+                values[i] = JsonCodec::decode(*texts[i]);
+        }
+        return values;
+    }
+    std::vector<std::size_t> missing;
+    std::vector<std::string> missing_keys;
+    std::vector<std::uint64_t> epochs;
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        if (LocalCache::Value cached = local_cache->get(keys[i])) {
+            values[i] = *cached;
+            continue;
+        }
+        missing.push_back(i);
+        missing_keys.push_back(keys[i]);
+        epochs.push_back(local_cache->epoch(keys[i]));
+    }
+    std::vector<RedisReply> pttls;
+    std::vector<std::optional<std::string>> texts = fetch_many(missing_keys, &pttls);
+    for (std::size_t m = 0; m < missing.size(); ++m) {
+        if (!texts[m])
+            continue;
+        auto value = std::make_shared<const json>(JsonCodec::decode(*texts[m]));
+        std::chrono::milliseconds ttl = local_ttl(pttls[m]);
+        if (ttl.count() > 0)
+            local_cache->put(missing_keys[m], value, ttl, epochs[m]);
+        values[missing[m]] = *value;
+    }
+    return values;
+}
+
+bool RedisPrimitives::mset(const std::vector<std::pair<std::string, std::string>>& entries, int ttl) {
+    if (entries.empty())
+        return true;
+    std::vector<std::vector<std::string>> commands;
+    if (ttl > 0) {
+        for (const auto& entry : entries)
+            commands.push_back(with_ttl({"SET", entry.first, entry.second}, ttl));
+    } else {
+        std::vector<std::string> keys;
+        for (const auto& entry : entries)
+            keys.push_back(entry.first);
+        for (const auto& group : partition(keys)) {
+            std::vector<std::string> args = {"MSET"};
+            for (std::size_t i : group)
+                args.insert(args.end(), {entries[i].first, entries[i].second});
+            commands.push_back(std::move(args));
+        }
+    }
+    std::vector<RedisReply> replies = run_many(commands);
+    for (const auto& entry : entries)
+        forget(entry.first);
+    bool ok = true;
+    for (const RedisReply& reply : replies) {
+        throw_if_error(reply);
+        ok = reply.is_ok() && ok;
+    }
+    return ok;
+}
+
+RedisPipeline RedisPrimitives::pipeline() {
+    return RedisPipeline(false);
+}
+
+RedisPipeline RedisPrimitives::transaction() {
+    return RedisPipeline(true);
+}
+
+template <typename T>
+RedisResult<T> RedisPipeline::add(std::vector<std::string> args, std::function<T(RedisReply&)> convert) {
+    if (executed_)
+        throw std::logic_error("Redis pipeline has already been executed");
+    RedisResult<T> result;
+    auto slot = result.slot_;
+    commands_.push_back(std::move(args));
+    pending_.push_back({[slot, convert](RedisReply& reply) {
+                            try {
+                                throw_if_error(reply);
+                                slot->value = convert(reply);
+                            } catch (...) {
+                                slot->error = std::current_exception();
+                            }
+                        },
+                        [slot](std::exception_ptr error) { slot->error = error; }});
+    return result;
+}
+
+RedisResult<bool> RedisPipeline::set(const std::string& key, const std::string& value, int ttl) {
+    written_.push_back(key);
+    return add<bool>(with_ttl({"SET", key, value}, ttl), [](RedisReply& reply) { return reply.is_ok(); });
+}
+
+RedisResult<std::optional<std::string>> RedisPipeline::get(const std::string& key) {
+    return add<std::optional<std::string>>({"GET", key}, [](RedisReply& reply) -> std::optional<std::string> {
+        if (reply.is_nil())
+            return std::nullopt;
+        return std::move(reply.str);
+    });
+}
+
+RedisResult<bool> RedisPipeline::del(const std::string& key) {
+    written_.push_back(key);
+    return add<bool>({"DEL", key}, [](RedisReply& reply) { return reply.integer > 0; });
+}
+
+RedisResult<bool> RedisPipeline::exists(const std::string& key) {
+    return add<bool>({"EXISTS", key}, [](RedisReply& reply) { return reply.integer > 0; });
+}
+
+RedisResult<bool> RedisPipeline::expire(const std::string& key, int ttl) {
+    written_.push_back(key);
+    return add<bool>({"EXPIRE", key, std::to_string(ttl)}, [](RedisReply& reply) { return reply.integer == 1; });
+}
+
+RedisResult<std::int64_t> RedisPipeline::incr(const std::string& key) {
+    written_.push_back(key);
+    return add<std::int64_t>({"INCR", key}, [](RedisReply& reply) { return reply.integer; });
+}
+
+RedisResult<bool> RedisPipeline::setJson(const std::string& key, const json& value, int ttl) {
+    return set(key, JsonCodec::encode(value, codec), ttl);
+}
+
+RedisResult<std::optional<json>> RedisPipeline::getJson(const std::string& key) {
+    return add<std::optional<json>>({"GET", key}, [](RedisReply& reply) -> std::optional<json> {
+        if (reply.is_nil())
+            return std::nullopt;
+        return JsonCodec::decode(reply.str);
+    });
+}
+
+RedisResult<RedisReply> RedisPipeline::command(std::vector<std::string> args) {
+    return add<RedisReply>(std::move(args), [](RedisReply& reply) { return std::move(reply); });
+}
+
+void RedisPipeline::execute() {
+    if (executed_)
+        throw std::logic_error("Redis pipeline has already been executed");
+    executed_ = true;
+    if (commands_.empty())
+        return;
+    // Whatever the outcome, the writes may have been applied.
+    auto send = [this](int slot, const std::vector<std::vector<std::string>>& commands) {
+        try {
+            std::vector<RedisReply> replies = transaction_ ? run_together(slot, commands) : run_many(commands);
+            for (const auto& key : written_)
+                forget(key);
+            return replies;
+        } catch (...) {
+            for (const auto& key : written_)
+                forget(key);
+            throw;
+        }
+    };
+    auto fail = [this](std::exception_ptr error) {
+        for (auto& pending : pending_)
+            pending.fail(error);
+    };
+    try {
+        if (!transaction_) {
+            std::vector<RedisReply> replies = send(-1, commands_);
+            for (std::size_t i = 0; i < replies.size(); ++i)
+                pending_[i].deliver(replies[i]);
+            return;
+        }
+        // A cluster runs a transaction on one node, so every key must hash
+        // to one slot (use a {hash tag}).
+        int slot = -1;
+        for (const auto& args : commands_) {
+            int key_slot = RedisCluster::command_slot(args);
+            if (cluster && slot >= 0 && key_slot >= 0 && key_slot != slot)
+                throw RedisError("CROSSSLOT Keys in request don't hash to the same slot");
+            if (slot < 0)
+                slot = key_slot;
+        }
+        // MULTI, then QUEUED (or a syntax error) per command, then EXEC with
+        // the replies of them all.
+        std::vector<std::vector<std::string>> commands;
+        commands.reserve(commands_.size() + 2);
+        commands.push_back({"MULTI"});
+        commands.insert(commands.end(), commands_.begin(), commands_.end());
+        commands.push_back({"EXEC"});
+        std::vector<RedisReply> replies = send(slot, commands);
+        throw_if_error(replies.front());
+        RedisReply& exec = replies.back();
+        if (exec.is_error()) {
+            // Name the command that got the transaction discarded.
+            for (std::size_t i = 0; i < commands_.size(); ++i) {
+                if (replies[i + 1].is_error())
+                    throw RedisError(exec.str + " (" + commands_[i][0] + ": " + replies[i + 1].str + ")");
+            }
+            throw RedisError(exec.str);
+        }
+        if (exec.is_nil())
+            throw RedisError("EXECABORT Transaction aborted");
+        if (exec.elements.size() != commands_.size())
+            throw std::runtime_error("EXEC returned " + std::to_string(exec.elements.size()) + " replies for " +
+                                     std::to_string(commands_.size()) + " commands");
+        for (std::size_t i = 0; i < commands_.size(); ++i)
+            pending_[i].deliver(exec.elements[i]);
+    } catch (...) {
+        fail(std::current_exception());
+        throw;
+    }
 }
 
 bool RedisPrimitives::expire(const std::string& key, int ttl) {
-    std::cout << "Redis expire key: " << key << std::endl;
-    return true;
+    bool set = run({"EXPIRE", key, std::to_string(ttl)}).integer == 1;
+    forget(key);
+    return set;
 }
 
 bool RedisPrimitives::flushDb() {
-    std::cout << "Redis flushDb" << std::endl;
-    return true;
+    bool ok = true;
+    if (cluster)
+        cluster->call_all({"FLUSHDB"});
+    else
+        ok = run({"FLUSHDB"}).is_ok();
+    if (local_cache)
+        local_cache->clear();
+    return ok;
+}
+
+void RedisPrimitives::writeMetrics(std::ostream& out) {
+    if (!local_cache)
+        return;
+    json stats = local_cache->stats();
+    write_sample(out, "fastapi_redis_local_cache_hits_total", "counter", "Local cache lookups served in process.",
+                 stats["hits"]);
+    write_sample(out, "fastapi_redis_local_cache_misses_total", "counter", "Local cache lookups that went to Redis.",
+                 stats["misses"]);
+    write_sample(out, "fastapi_redis_local_cache_evictions_total", "counter",
+                 "Local cache entries evicted to stay within max bytes.", stats["evictions"]);
+    write_sample(out, "fastapi_redis_local_cache_bytes", "gauge", "Estimated size of the local cache entries.",
+                 stats["bytes"]);
+    write_sample(out, "fastapi_redis_local_cache_max_bytes", "gauge", "Local cache size limit.", stats["max_bytes"]);
+}
+
+json RedisPrimitives::getConnectionInfo() {
+    json info = {{"backend", "redis"},
+                 {"host", active_config.cache_host},
+                 {"port", active_config.cache_port},
+                 {"database", cluster ? 0 : active_config.cache_db}};
+    if (cluster)
+        info["cluster"] = cluster->stats();
+    else if (node)
+        info.update(node->stats());
+    if (local_cache) {
+        info["local_cache"] = local_cache->stats();
+        info["local_cache"]["tracking"] = tracking();
+    }
+    info["cache_aside"] = {{"hits", cache_aside.hits.load()},
+                           {"stale_served", cache_aside.stale.load()},
+                           {"early_refreshes", cache_aside.early.load()},
+                           {"loads", cache_aside.loads.load()},
+                           {"coalesced", cache_aside.coalesced.load()},
+                           {"errors", cache_aside.errors.load()}};
+    return info;
 }
 
 bool RedisPrimitives::isConnected() {
-    return true;
+    if (cluster)
+        return cluster->connected();
+    return node && node->connected();
+}
+
+bool RedisPrimitives::warmUp(std::chrono::steady_clock::time_point deadline) {
+    if (cluster)
+        return cluster->warm_up(deadline);
+    return node && node->warm_up(deadline);
+}
+
+bool RedisPrimitives::isReady() {
+    if (cluster)
+        return cluster->ready();
+    return node && node->ready();
 }
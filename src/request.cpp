@@ -1,14 +1,31 @@
 #include "../include/request.hpp"
+#include <algorithm>
+#include <cctype>
 
-Request::Request(const std::string& method, const std::string& path, const std::optional<json>& body)
-    : method(method), path(path), json_body(body) {}
+bool CaseInsensitiveLess::operator()(const std::string& a, const std::string& b) const {
+    return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](unsigned char x, unsigned char y) {
+        return std::tolower(x) < std::tolower(y);
+    });
+}
+
+Request::Request(const std::string& method, const std::string& path, std::optional<json>&& body)
+    : method(method), path(path), json_body(std::move(body)) {}
 
 std::string Request::get_header(const std::string& name) const {
+    if (transport.header) {
+        if (const std::string* value = transport.header(transport.request, name))
+            return *value;
+    }
     auto it = headers.find(name);
     return it != headers.end() ? it->second : "";
 }
 
 std::string Request::get_query_param(const std::string& name) const {
+    if (transport.query_params) {
+        auto it = transport.query_params->find(name);
+        if (it != transport.query_params->end())
+            return it->second;
+    }
     auto it = query_params.find(name);
     return it != query_params.end() ? it->second : "";
 }
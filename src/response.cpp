@@ -3,18 +3,36 @@
 Response::Response(const std::string& body, const std::string& type, int status)
     : status_code(status), content_type(type), raw_body(body) {}
 
+Response::Response(std::string&& body, const std::string& type, int status)
+    : status_code(status), content_type(type), raw_body(std::move(body)) {}
+
 Response::Response(const char* body, const std::string& type, int status)
     : status_code(status), content_type(type), raw_body(body) {}
 
 Response::Response(const json& j, const std::string& type, int status)
     : status_code(status), content_type(type), json_body(j) {}
 
-std::string Response::dump() const {
+Response::Response(json&& j, const std::string& type, int status)
+    : status_code(status), content_type(type), json_body(std::move(j)) {}
+
+Response Response::stream(BodyStream body, const std::string& type, int status) {
+    Response res("", type, status);
+    res.body_stream = std::move(body);
+    return res;
+}
+
+std::string Response::dump() const& {
     if (json_body.has_value())
         return json_body->dump();
     return raw_body;
 }
 
+std::string Response::dump() && {
+    if (json_body.has_value())
+        return json_body->dump();
+    return std::move(raw_body);
+}
+
 void Response::set_header(const std::string& name, const std::string& value) {
     headers[name] = value;
 }
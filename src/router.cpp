@@ -1,18 +1,55 @@
 #include "../include/router.hpp"
+#include "../include/startup.hpp"
 
 void Router::add_route(const std::string& method, const std::string& template_path, Handler handler) {
-    routes.push_back({method, template_path, handler});
+    if (metrics_)
+        metrics_->set_route_label(routes.size(), method, template_path);
+    routes.push_back({method, template_path, std::move(handler)});
 }
 
-Response Router::handle_request(const std::string& method, const std::string& path, const std::optional<json>& body) const {
-    for (const auto& route : routes) {
+Response Router::handle_request(const std::string& method, const std::string& path, std::optional<json>&& body,
+                                size_t* matched_route) const {
+    return handle_request(Request{method, path, std::move(body)}, matched_route);
+}
+
+Response Router::handle_request(Request&& req, size_t* matched_route) const {
+    for (size_t i = 0; i < routes.size(); ++i) {
+        const auto& route = routes[i];
         Values values;
-        if (route.method == method && match_and_extract(route.template_path, path, values)) {
-            Request req{method, path, body};
-            return route.handler(req, values);
+        if (route.method == req.method && match_and_extract(route.template_path, req.path, values)) {
+            FASTAPI_TIMING_MARK(Match);
+            if (matched_route)
+                *matched_route = i;
+            Response res = route.handler(req, values);
+            FASTAPI_TIMING_MARK(Handler);
+            return res;
         }
     }
-    return Response("404 Not Found", "text/plain");
+    FASTAPI_TIMING_MARK(Match);
+    if (matched_route)
+        *matched_route = npos;
+    return Response("404 Not Found", "text/plain", 404);
+}
+
+void Router::enable_metrics(const std::string& path) {
+    if (metrics_)
+        return;
+    metrics_ = std::make_unique<Metrics>(path);
+    for (size_t i = 0; i < routes.size(); ++i)
+        metrics_->set_route_label(i, routes[i].method, routes[i].template_path);
+    metrics_->add_collector(Startup::writeMetrics);
+    Metrics* metrics = metrics_.get();
+    add_route("GET", path, [metrics](Request&, const Values&) {
+        return Response(metrics->render(), "text/plain; version=0.0.4");
+    });
+}
+
+void Router::enable_health(const std::string& path) {
+    add_route("GET", path, [](Request&, const Values&) {
+        json status = Startup::status();
+        int code = status["status"] == "ready" ? 200 : 503;
+        return Response(std::move(status), "application/json", code);
+    });
 }
 
 bool Router::match_and_extract(const std::string& tpl, const std::string& path, Values& out_params) const {
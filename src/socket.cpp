@@ -0,0 +1,203 @@
+#include "../include/socket.hpp"
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef _WIN32
+using ssize_t = long long;
+const int send_flags = 0;
+
+int last_error() { return WSAGetLastError(); }
+bool would_block(int err) { return err == WSAEWOULDBLOCK || err == WSAEINPROGRESS; }
+int poll_fds(pollfd* fds, unsigned long count, int timeout_ms) { return WSAPoll(fds, count, timeout_ms); }
+void close_fd(int fd) { closesocket(static_cast<SOCKET>(fd)); }
+
+bool set_non_blocking(int fd) {
+    u_long mode = 1;
+    return ioctlsocket(static_cast<SOCKET>(fd), FIONBIO, &mode) == 0;
+}
+
+struct WinsockInit {
+    WinsockInit() {
+        WSADATA data;
+        WSAStartup(MAKEWORD(2, 2), &data);
+    }
+} winsock_init;
+#else
+const int send_flags = MSG_NOSIGNAL;
+
+int last_error() { return errno; }
+bool would_block(int err) { return err == EAGAIN || err == EWOULDBLOCK || err == EINPROGRESS; }
+int poll_fds(pollfd* fds, nfds_t count, int timeout_ms) { return ::poll(fds, count, timeout_ms); }
+void close_fd(int fd) { ::close(fd); }
+
+bool set_non_blocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+#endif
+
+int remaining_ms(Socket::Clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Socket::Clock::now()).count();
+    if (left <= 0)
+        return 0;
+    return left > 1000000 ? 1000000 : static_cast<int>(left);
+}
+
+}
+
+Socket::Socket(int fd) : fd_(fd) {
+    if (fd_ >= 0) {
+        set_non_blocking(fd_);
+        int one = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&one), sizeof(one));
+    }
+}
+
+Socket::~Socket() { close(); }
+
+Socket::Socket(Socket&& other) noexcept : fd_(other.fd_), timeout_(other.timeout_) { other.fd_ = -1; }
+
+Socket& Socket::operator=(Socket&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd_ = other.fd_;
+        timeout_ = other.timeout_;
+        other.fd_ = -1;
+    }
+    return *this;
+}
+
+void Socket::close() {
+    if (fd_ >= 0) {
+        close_fd(fd_);
+        fd_ = -1;
+    }
+}
+
+void Socket::shutdown() {
+    if (fd_ >= 0) {
+#ifdef _WIN32
+        ::shutdown(static_cast<SOCKET>(fd_), SD_BOTH);
+#else
+        ::shutdown(fd_, SHUT_RDWR);
+#endif
+    }
+}
+
+Socket Socket::connect(const std::string& host, int port, std::chrono::milliseconds timeout) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    std::string service = std::to_string(port);
+    if (int rc = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses); rc != 0)
+        throw SocketError("Cannot resolve " + host + ": " + gai_strerror(rc));
+
+    auto deadline = Clock::now() + timeout;
+    std::string error = "no addresses";
+    for (addrinfo* ai = addresses; ai; ai = ai->ai_next) {
+        int fd = static_cast<int>(::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol));
+        if (fd < 0)
+            continue;
+        Socket socket(fd);
+        if (::connect(fd, ai->ai_addr, static_cast<socklen_t>(ai->ai_addrlen)) != 0) {
+            int err = last_error();
+            if (!would_block(err)) {
+                error = std::strerror(err);
+                continue;
+            }
+            if (!socket.wait(POLLOUT, deadline)) {
+                error = "connect timed out";
+                continue;
+            }
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&so_error), &len);
+            if (so_error != 0) {
+                error = std::strerror(so_error);
+                continue;
+            }
+        }
+        freeaddrinfo(addresses);
+        return socket;
+    }
+    freeaddrinfo(addresses);
+    throw SocketError("Cannot connect to " + host + ":" + service + ": " + error);
+}
+
+bool Socket::wait(short events, Clock::time_point deadline) {
+    while (true) {
+        pollfd pfd{};
+        pfd.fd = fd_;
+        pfd.events = events;
+        int rc = poll_fds(&pfd, 1, remaining_ms(deadline));
+        if (rc > 0)
+            return true;
+        if (rc == 0)
+            return false;
+        if (last_error() != EINTR)
+            throw SocketError(std::string("poll failed: ") + std::strerror(last_error()));
+    }
+}
+
+bool Socket::wait_readable(std::chrono::milliseconds timeout) {
+    return wait(POLLIN, Clock::now() + timeout);
+}
+
+void Socket::write_all(const char* data, std::size_t size) {
+    if (fd_ < 0)
+        throw SocketError("Socket is closed");
+    auto deadline = Clock::now() + timeout_;
+    while (size > 0) {
+        ssize_t n = ::send(fd_, data, size, send_flags);
+        if (n > 0) {
+            data += n;
+            size -= static_cast<std::size_t>(n);
+            continue;
+        }
+        int err = last_error();
+        if (n < 0 && err == EINTR)
+            continue;
+        if (n < 0 && would_block(err)) {
+            if (!wait(POLLOUT, deadline))
+                throw SocketError("Write timed out");
+            continue;
+        }
+        throw SocketError(std::string("Write failed: ") + std::strerror(err));
+    }
+}
+
+std::size_t Socket::read_some(char* buffer, std::size_t size) {
+    if (fd_ < 0)
+        throw SocketError("Socket is closed");
+    auto deadline = Clock::now() + timeout_;
+    while (true) {
+        ssize_t n = ::recv(fd_, buffer, size, 0);
+        if (n > 0)
+            return static_cast<std::size_t>(n);
+        if (n == 0)
+            throw SocketError("Connection closed by peer");
+        int err = last_error();
+        if (err == EINTR)
+            continue;
+        if (!would_block(err))
+            throw SocketError(std::string("Read failed: ") + std::strerror(err));
+        if (!wait(POLLIN, deadline))
+            throw SocketError("Read timed out");
+    }
+}
@@ -0,0 +1,139 @@
+#include "../include/startup.hpp"
+#include "../include/mongo_primitives.hpp"
+#include "../include/postgres_primitives.hpp"
+#include "../include/redis_primitives.hpp"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Backend {
+    const char* name;
+    bool (*initialize)(const DBConfig&);
+    bool (*warm_up)(std::chrono::steady_clock::time_point);
+    bool (*is_ready)();
+    void (*shutdown)();
+    void (*write_metrics)(std::ostream&);
+};
+
+const Backend postgres{"postgresql", PostgresPrimitives::initialize, PostgresPrimitives::warmUp,
+                       PostgresPrimitives::isReady, PostgresPrimitives::shutdown, nullptr};
+const Backend mongo{"mongodb", MongoPrimitives::initialize, MongoPrimitives::warmUp, MongoPrimitives::isReady,
+                    MongoPrimitives::shutdown, nullptr};
+const Backend redis{"redis", RedisPrimitives::initialize, RedisPrimitives::warmUp, RedisPrimitives::isReady,
+                    RedisPrimitives::shutdown, RedisPrimitives::writeMetrics};
+
+// Replaced whole, never modified in place, so the health route can read it
+// on server threads while initialize() or shutdown() publish the next one.
+// Null until initialize() runs: with no backends to wait for, the
+// application is ready.
+struct State {
+    std::vector<const Backend*> backends;
+    bool started = false;
+    bool stopped = false;
+};
+
+std::shared_ptr<const State> state;
+
+std::shared_ptr<const State> current() { return std::atomic_load(&state); }
+
+void publish(std::vector<const Backend*> backends, bool started, bool stopped = false) {
+    auto next = std::make_shared<State>();
+    next->backends = std::move(backends);
+    next->started = started;
+    next->stopped = stopped;
+    std::atomic_store(&state, std::shared_ptr<const State>(std::move(next)));
+}
+
+bool backends_ready(const State* s) {
+    if (!s)
+        return true;
+    if (!s->started)
+        return false;
+    for (const Backend* backend : s->backends) {
+        if (!backend->is_ready())
+            return false;
+    }
+    return true;
+}
+
+}
+
+bool Startup::initialize(const DBConfig& config) {
+    std::vector<const Backend*> configured;
+    if (config.db_type == DBConfig::PostgreSQL)
+        configured.push_back(&postgres);
+    else if (config.db_type == DBConfig::MongoDB)
+        configured.push_back(&mongo);
+    if (config.cache_type == DBConfig::Redis)
+        configured.push_back(&redis);
+    publish(configured, false);
+
+    auto begin = std::chrono::steady_clock::now();
+    auto deadline = begin + std::chrono::milliseconds(config.startup_timeout_ms);
+    std::vector<char> ready(configured.size(), 0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < configured.size(); ++i) {
+        threads.emplace_back([&, i] {
+            try {
+                const Backend& backend = *configured[i];
+                ready[i] = backend.initialize(config) && backend.warm_up(deadline);
+            } catch (const std::exception& e) {
+                std::cout << "Startup: " << configured[i]->name << " failed: " << e.what() << std::endl;
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    publish(configured, true);
+
+    bool all_ready = true;
+    for (size_t i = 0; i < configured.size(); ++i) {
+        if (!ready[i]) {
+            all_ready = false;
+            std::cout << "Startup: " << configured[i]->name << " not warm after " << config.startup_timeout_ms
+                      << " ms" << std::endl;
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    std::cout << "Startup finished in " << elapsed.count() << " ms" << std::endl;
+    return all_ready;
+}
+
+void Startup::shutdown() {
+    std::shared_ptr<const State> s = current();
+    publish({}, false, true);
+    if (s) {
+        for (const Backend* backend : s->backends)
+            backend->shutdown();
+    }
+}
+
+bool Startup::isReady() {
+    return backends_ready(current().get());
+}
+
+void Startup::writeMetrics(std::ostream& out) {
+    std::shared_ptr<const State> s = current();
+    if (!s || !s->started)
+        return;
+    for (const Backend* backend : s->backends) {
+        if (backend->write_metrics)
+            backend->write_metrics(out);
+    }
+}
+
+json Startup::status() {
+    std::shared_ptr<const State> s = current();
+    json backends = json::object();
+    if (!s)
+        return {{"status", "ready"}, {"backends", backends}};
+    for (const Backend* backend : s->backends)
+        backends[backend->name] = {{"ready", s->started && backend->is_ready()}};
+    const char* status = s->stopped ? "stopped" : backends_ready(s.get()) ? "ready" : "starting";
+    return {{"status", status}, {"backends", backends}};
+}
@@ -0,0 +1,95 @@
+#include "../include/test_client.hpp"
+
+namespace {
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+std::string url_decode(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '+') {
+            out += ' ';
+        } else if (s[i] == '%' && i + 2 < s.size() && hex_value(s[i + 1]) >= 0 && hex_value(s[i + 2]) >= 0) {
+            out += static_cast<char>(hex_value(s[i + 1]) * 16 + hex_value(s[i + 2]));
+            i += 2;
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+void parse_query(const std::string& query, Request::Params& out) {
+    size_t pos = 0;
+    while (pos <= query.size()) {
+        size_t amp = query.find('&', pos);
+        if (amp == std::string::npos)
+            amp = query.size();
+        std::string pair = query.substr(pos, amp - pos);
+        if (!pair.empty()) {
+            size_t eq = pair.find('=');
+            if (eq == std::string::npos)
+                out.emplace(url_decode(pair), "");
+            else
+                out.emplace(url_decode(pair.substr(0, eq)), url_decode(pair.substr(eq + 1)));
+        }
+        pos = amp + 1;
+    }
+}
+
+}
+
+std::string TestClient::Result::get_header(const std::string& name) const {
+    auto it = headers.find(name);
+    return it != headers.end() ? it->second : "";
+}
+
+TestClient::Result TestClient::request(const std::string& method, const std::string& path, const std::string& body,
+                                       const Headers& headers) const {
+    auto start = std::chrono::steady_clock::now();
+#if FASTAPI_CPP_ENABLE_TIMING
+    RequestTiming::begin(start);
+#endif
+    size_t question = path.find('?');
+    Request req{method, path.substr(0, question)};
+    req.headers.insert(headers.begin(), headers.end());
+    if (question != std::string::npos)
+        parse_query(path.substr(question + 1), req.query_params);
+
+    PipelineResult res = run_pipeline(app, std::move(req), body, start);
+    std::size_t chunks = 0;
+    if (res.stream) {
+        res.stream([&](const char* data, std::size_t size) {
+            res.body.append(data, size);
+            ++chunks;
+            return true;
+        });
+    }
+#if FASTAPI_CPP_ENABLE_TIMING
+    if (Metrics* metrics = app.metrics())
+        metrics->record_phases(*RequestTiming::current());
+    RequestTiming::end();
+#endif
+    return Result{res.status, std::move(res.headers), std::move(res.content_type), std::move(res.body), chunks};
+}
+
+TestClient::Result TestClient::post(const std::string& path, const json& body, const Headers& headers) const {
+    return request("POST", path, body.dump(), headers);
+}
+
+TestClient::Result TestClient::put(const std::string& path, const json& body, const Headers& headers) const {
+    return request("PUT", path, body.dump(), headers);
+}
+
+TestClient::Result TestClient::patch(const std::string& path, const json& body, const Headers& headers) const {
+    return request("PATCH", path, body.dump(), headers);
+}